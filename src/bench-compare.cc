@@ -0,0 +1,198 @@
+// softcompute_bench_compare: compares softcompute_bench JSON results against
+// a baseline and fails on significant slowdowns.
+//
+// A case is a regression when its median time grew by more than --threshold
+// and a one-sided Mann-Whitney U test over the repetitions says the current
+// samples are larger with p < --alpha. Requiring both keeps noisy cases from
+// failing on a lucky median and tiny but consistent shifts from failing at
+// all. Exits with 1 on regressions and 2 on bad input.
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench-stats.h"
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#endif
+
+#include "OptionParser.h"
+
+#include "nlohmann/json.hpp"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+namespace {
+
+// Samples of one case, keyed by e.g. "ao size=1024 threads=8".
+typedef std::map<std::string, std::vector<double>> Cases;
+
+bool LoadJSON(const std::string &filename, nlohmann::json *json) {
+  std::ifstream ifs(filename);
+  if (!ifs) {
+    std::cerr << "Failed to open " << filename << std::endl;
+    return false;
+  }
+
+  *json = nlohmann::json::parse(ifs, nullptr, /* allow_exceptions */ false);
+  if (json->is_discarded() || !json->contains("results")) {
+    std::cerr << filename << " is not a softcompute_bench result." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Dispatch results have one sample list per case, compile results one per
+// stage. Throws nlohmann::json::exception on results of the wrong shape.
+Cases GetCases(const nlohmann::json &report) {
+  Cases cases;
+
+  const nlohmann::json &results = report.at("results");
+  for (size_t i = 0; i < results.size(); i++) {
+    const nlohmann::json &result = results.at(i);
+
+    if (result.contains("kernel")) {
+      std::stringstream ss;
+      ss << result.at("kernel").get<std::string>()
+         << " size=" << result.at("size").get<int>()
+         << " threads=" << result.at("threads").get<int>();
+      cases[ss.str()] = result.at("samples_ms").get<std::vector<double>>();
+    } else if (result.contains("shader")) {
+      const nlohmann::json &stages = result.at("samples_ms");
+      for (auto it = stages.begin(); it != stages.end(); ++it) {
+        cases[result.at("shader").get<std::string>() + " " + it.key()] =
+            it.value().get<std::vector<double>>();
+      }
+    }
+  }
+
+  return cases;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  using optparse::OptionParser;
+  using softcompute::MannWhitneyGreater;
+  using softcompute::Median;
+
+  OptionParser parser =
+      OptionParser()
+          .usage("%prog [options] baseline.json current.json")
+          .description(
+              "Compares softcompute_bench results against a baseline.");
+
+  parser.add_option("--threshold")
+      .set_default("5")
+      .help("Median slowdown in percent to flag. Default 5.");
+  parser.add_option("--alpha")
+      .set_default("0.01")
+      .help("Significance level of the Mann-Whitney U test. Default 0.01.");
+  parser.add_option("--min-ms")
+      .set_default("0.05")
+      .help("Ignore cases whose baseline median is below this many ms.");
+
+  optparse::Values options = parser.parse_args(argc, argv);
+  std::vector<std::string> args = parser.args();
+
+  if (args.size() != 2) {
+    parser.print_help();
+    return 2;
+  }
+
+  const double threshold = atof(options["threshold"].c_str()) / 100.0;
+  const double alpha = atof(options["alpha"].c_str());
+  const double min_ms = atof(options["min_ms"].c_str());
+
+  nlohmann::json baseline_report;
+  nlohmann::json current_report;
+  if (!LoadJSON(args[0], &baseline_report) ||
+      !LoadJSON(args[1], &current_report)) {
+    return 2;
+  }
+
+  if (baseline_report.value("engine", "") !=
+      current_report.value("engine", "")) {
+    std::cerr << "Warning: comparing engine "
+              << current_report.value("engine", "?") << " against "
+              << baseline_report.value("engine", "?") << std::endl;
+  }
+
+  Cases baseline;
+  Cases current;
+  try {
+    baseline = GetCases(baseline_report);
+    current = GetCases(current_report);
+  } catch (const nlohmann::json::exception &e) {
+    std::cerr << "Invalid softcompute_bench result: " << e.what()
+              << std::endl;
+    return 2;
+  }
+
+  printf("%-48s %12s %12s %9s %9s  %s\n", "case", "base [ms]", "now [ms]",
+         "change", "p", "");
+
+  int num_regressions = 0;
+  int num_improvements = 0;
+  for (Cases::const_iterator it = current.begin(); it != current.end(); ++it) {
+    Cases::const_iterator base = baseline.find(it->first);
+    if (it->second.empty() ||
+        ((base != baseline.end()) && base->second.empty())) {
+      printf("%-48s %12s %12s %9s %9s  no samples\n", it->first.c_str(), "-",
+             "-", "", "");
+      continue;
+    }
+    if (base == baseline.end()) {
+      printf("%-48s %12s %12.3f %9s %9s  new\n", it->first.c_str(), "-",
+             Median(it->second), "", "");
+      continue;
+    }
+
+    const double base_median = Median(base->second);
+    const double median = Median(it->second);
+    if (base_median < min_ms) {
+      continue;
+    }
+
+    const double change = median / base_median - 1.0;
+    const double p_slower = MannWhitneyGreater(base->second, it->second);
+    const double p_faster = MannWhitneyGreater(it->second, base->second);
+
+    const char *status = "";
+    double p = p_slower;
+    if ((change > threshold) && (p_slower < alpha)) {
+      status = "REGRESSION";
+      num_regressions++;
+    } else if ((change < -threshold) && (p_faster < alpha)) {
+      status = "faster";
+      p = p_faster;
+      num_improvements++;
+    }
+
+    printf("%-48s %12.3f %12.3f %+8.1f%% %9.2g  %s\n", it->first.c_str(),
+           base_median, median, change * 100.0, p, status);
+  }
+
+  for (Cases::const_iterator it = baseline.begin(); it != baseline.end();
+       ++it) {
+    if ((current.find(it->first) == current.end()) && !it->second.empty()) {
+      printf("%-48s %12.3f %12s %9s %9s  missing\n", it->first.c_str(),
+             Median(it->second), "-", "", "");
+    }
+  }
+
+  printf("\n%d regression(s), %d improvement(s) (threshold %.1f%%, alpha %g)\n",
+         num_regressions, num_improvements, threshold * 100.0, alpha);
+
+  return (num_regressions > 0) ? 1 : 0;
+}
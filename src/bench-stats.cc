@@ -0,0 +1,62 @@
+#include "bench-stats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <utility>
+
+namespace softcompute {
+
+double Median(std::vector<double> v) {
+  assert(!v.empty());
+  std::sort(v.begin(), v.end());
+  const size_t n = v.size();
+  return (n % 2) ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+double MannWhitneyGreater(const std::vector<double> &a,
+                          const std::vector<double> &b) {
+  const size_t n1 = a.size();
+  const size_t n2 = b.size();
+  if ((n1 == 0) || (n2 == 0)) {
+    return 1.0;
+  }
+
+  // (value, from b)
+  std::vector<std::pair<double, bool>> all;
+  for (size_t i = 0; i < n1; i++) all.push_back(std::make_pair(a[i], false));
+  for (size_t i = 0; i < n2; i++) all.push_back(std::make_pair(b[i], true));
+  std::sort(all.begin(), all.end());
+
+  // Rank sum of b, averaging ranks of ties.
+  const double n = static_cast<double>(n1 + n2);
+  double rank_sum = 0.0;
+  double tie_term = 0.0;  // sum of t^3 - t over groups of t ties
+  for (size_t i = 0; i < all.size();) {
+    size_t j = i;
+    while ((j < all.size()) && (all[j].first == all[i].first)) j++;
+
+    const double t = static_cast<double>(j - i);
+    const double rank = 0.5 * (static_cast<double>(i + 1) + static_cast<double>(j));
+    for (size_t k = i; k < j; k++) {
+      if (all[k].second) rank_sum += rank;
+    }
+    tie_term += t * t * t - t;
+    i = j;
+  }
+
+  const double m1 = static_cast<double>(n1);
+  const double m2 = static_cast<double>(n2);
+  const double u = rank_sum - m2 * (m2 + 1.0) / 2.0;
+  const double mean = m1 * m2 / 2.0;
+  const double variance =
+      m1 * m2 / 12.0 * ((n + 1.0) - tie_term / (n * (n - 1.0)));
+  if (variance <= 0.0) {
+    return 1.0;  // All samples equal
+  }
+
+  const double z = (u - mean - 0.5) / std::sqrt(variance);
+  return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+}  // namespace softcompute
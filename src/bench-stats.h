@@ -0,0 +1,22 @@
+#ifndef SOFTCOMPUTE_BENCH_STATS_H_
+#define SOFTCOMPUTE_BENCH_STATS_H_
+
+#include <vector>
+
+namespace softcompute {
+
+// Statistics of benchmark samples for softcompute_bench_compare.
+
+// Median of `v`, which must not be empty.
+double Median(std::vector<double> v);
+
+// p-value of the one-sided Mann-Whitney U test that samples of `b` tend to
+// be larger than samples of `a`. Uses the normal approximation with tie and
+// continuity correction, which is reasonable from about 5 samples each.
+// 1 when either is empty or all samples are equal.
+double MannWhitneyGreater(const std::vector<double> &a,
+                          const std::vector<double> &b);
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_BENCH_STATS_H_
@@ -0,0 +1,494 @@
+// softcompute_bench: times the bundled compute shaders over a matrix of
+// problem sizes and worker thread counts.
+//
+// Each case is run `--warmup` times untimed, then `--reps` times, each
+// repetition being one glDispatchCompute() followed by glFinish(). The shader
+// engine is fixed at build time (-DWITH_JIT=On or not), so comparing the DLL
+// and JIT engines means running the benchmark from both builds; the engine
+// name is recorded in the output.
+//
+// With --compile it instead builds shaders repeatedly and reports how long
+// each compile stage took (see ProgramCompileStats).
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#endif
+
+#include "OptionParser.h"
+
+#include "nlohmann/json.hpp"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include "bench-stats.h"
+#include "softgl.h"
+
+using namespace softgl;
+
+namespace {
+
+struct Kernel {
+  const char *name;
+  const char *filename;  // Relative to --shader-dir
+};
+
+const Kernel kKernels[] = {
+    {"ao", "shaders/ao.comp"},
+    {"twice", "shaders/twice.comp"},
+    {"dnn_tanh_activation", "sandbox/dnn_tanh_activation.comp"},
+    {"dnn_fully_connected_layer", "sandbox/dnn_fully_connected_layer.comp"},
+};
+
+// Buffers and dispatch size of one benchmark case.
+struct Workload {
+  std::vector<GLuint> buffers;  // Bound to binding 0, 1, ...
+  GLuint num_groups_x;
+  GLuint num_groups_y;
+  GLuint64 bytes;  // Bytes read and written per dispatch
+  GLuint64 items;  // Work items per dispatch, for throughput
+};
+
+std::vector<int> ParseIntList(const std::string &s) {
+  std::vector<int> values;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) {
+      values.push_back(atoi(item.c_str()));
+    }
+  }
+  return values;
+}
+
+bool ReadFile(const std::string &filename, std::string *data) {
+  std::ifstream ifs(filename, std::ios::binary);
+  if (!ifs) {
+    std::cerr << "Failed to open shader: " << filename << std::endl;
+    return false;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  *data = ss.str();
+  return true;
+}
+
+// Builds a program from GLSL source, or SPIR-V when the file ends in .spv.
+bool LoadProgram(const std::string &filename, GLuint *program) {
+  std::string data;
+  if (!ReadFile(filename, &data)) {
+    return false;
+  }
+
+  GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+  const bool spirv = (filename.size() > 4) &&
+                     (filename.compare(filename.size() - 4, 4, ".spv") == 0);
+  if (spirv) {
+    glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V_ARB, data.data(),
+                   static_cast<GLsizei>(data.size()));
+  } else {
+    const GLchar *src = data.c_str();
+    glShaderSource(shader, 1, &src, nullptr);
+    glCompileShader(shader);
+
+    GLint status = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+      char log[4096];
+      GLsizei len = 0;
+      glGetShaderInfoLog(shader, sizeof(log), &len, log);
+      std::cerr << "Failed to compile " << filename << ":\n"
+                << log << std::endl;
+      glDeleteShader(shader);
+      return false;
+    }
+  }
+
+  *program = glCreateProgram();
+  glAttachShader(*program, shader);
+  glLinkProgram(*program);
+  glDeleteShader(shader);
+
+  GLint status = 0;
+  glGetProgramiv(*program, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    std::cerr << "Failed to link " << filename << std::endl;
+    glDeleteProgram(*program);
+    return false;
+  }
+
+  return true;
+}
+
+GLuint CreateBuffer(const void *data, size_t size) {
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(size), data,
+               GL_DYNAMIC_DRAW);
+  return buffer;
+}
+
+// `size` is the image width for ao (rounded up to the 16x16 workgroup) and
+// the number of elements otherwise. The fully connected layer has `size`
+// inputs and outputs.
+Workload CreateWorkload(const std::string &kernel, int size) {
+  Workload w;
+  w.num_groups_x = static_cast<GLuint>(size);
+  w.num_groups_y = 1;
+
+  const size_t n = static_cast<size_t>(size);
+  if (kernel == "ao") {
+    w.num_groups_x = static_cast<GLuint>((size + 15) / 16);
+    w.num_groups_y = w.num_groups_x;
+    const size_t width = size_t(w.num_groups_x) * 16;
+    std::vector<float> dst(width * width * 4, 0.0f);
+    w.buffers.push_back(CreateBuffer(dst.data(), dst.size() * sizeof(float)));
+    w.bytes = dst.size() * sizeof(float);
+    w.items = width * width;
+  } else if (kernel == "twice") {
+    std::vector<float> data(n * 4, 1.0f);
+    w.buffers.push_back(CreateBuffer(data.data(), data.size() * sizeof(float)));
+    w.buffers.push_back(CreateBuffer(data.data(), data.size() * sizeof(float)));
+    w.bytes = 2 * data.size() * sizeof(float);
+    w.items = n;
+  } else if (kernel == "dnn_tanh_activation") {
+    std::vector<float> data(n, 0.5f);
+    w.buffers.push_back(CreateBuffer(data.data(), data.size() * sizeof(float)));
+    w.buffers.push_back(CreateBuffer(data.data(), data.size() * sizeof(float)));
+    w.bytes = 2 * data.size() * sizeof(float);
+    w.items = n;
+  } else {
+    std::vector<float> data(n, 0.5f);
+    std::vector<float> weights(n, 0.25f);
+    struct {
+      float in_b;
+      int in_size;
+    } param = {1.0f, size};
+    w.buffers.push_back(CreateBuffer(data.data(), data.size() * sizeof(float)));
+    w.buffers.push_back(CreateBuffer(data.data(), data.size() * sizeof(float)));
+    w.buffers.push_back(
+        CreateBuffer(weights.data(), weights.size() * sizeof(float)));
+    w.buffers.push_back(CreateBuffer(&param, sizeof(param)));
+    // Every invocation reads all inputs and weights.
+    w.bytes = (2 * n * n + n) * sizeof(float);
+    w.items = n * n;
+  }
+
+  return w;
+}
+
+// Nearest-rank percentile of sorted samples.
+double Percentile(const std::vector<double> &sorted, double p) {
+  const size_t rank = static_cast<size_t>(
+      std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+  return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+const Kernel *FindKernel(const std::string &name) {
+  for (size_t i = 0; i < sizeof(kKernels) / sizeof(kKernels[0]); i++) {
+    if (name == kKernels[i].name) {
+      return &kKernels[i];
+    }
+  }
+  return nullptr;
+}
+
+struct BenchOptions {
+  std::vector<std::string> kernels;
+  std::vector<int> sizes;
+  std::vector<int> thread_counts;
+  int warmup;
+  int reps;
+  std::string shader_dir;
+  std::string compiler_options;
+};
+
+// Times dispatches of each kernel, size and thread count.
+bool RunDispatchBenchmark(const BenchOptions &bench, nlohmann::json *results) {
+  bool ok = true;
+
+  printf("%-28s %8s %7s %12s %12s %12s %14s\n", "kernel", "size", "threads",
+         "median [ms]", "p99 [ms]", "mean [ms]", "items/s");
+
+  for (size_t t = 0; t < bench.thread_counts.size(); t++) {
+    SoftGLConfig config;
+    config.num_threads = bench.thread_counts[t];
+    InitSoftGL(config);
+    SetJITCompilerOptions(bench.compiler_options.c_str());
+
+    const GLint num_threads = GetNumWorkerThreads();
+
+    for (size_t k = 0; k < bench.kernels.size(); k++) {
+      const Kernel *kernel = FindKernel(bench.kernels[k]);
+      if (!kernel) {
+        std::cerr << "Unknown kernel: " << bench.kernels[k] << std::endl;
+        ok = false;
+        continue;
+      }
+
+      GLuint program = 0;
+      if (!LoadProgram(bench.shader_dir + "/" + kernel->filename, &program)) {
+        ok = false;
+        continue;
+      }
+      glUseProgram(program);
+
+      for (size_t s = 0; s < bench.sizes.size(); s++) {
+        const int size = bench.sizes[s];
+        if (size <= 0) continue;
+
+        Workload w = CreateWorkload(kernel->name, size);
+        for (size_t b = 0; b < w.buffers.size(); b++) {
+          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(b),
+                           w.buffers[b]);
+        }
+
+        for (int i = 0; i < bench.warmup; i++) {
+          glDispatchCompute(w.num_groups_x, w.num_groups_y, 1);
+          glFinish();
+        }
+
+        std::vector<double> samples;  // [ms]
+        for (int i = 0; i < bench.reps; i++) {
+          auto start = std::chrono::steady_clock::now();
+          glDispatchCompute(w.num_groups_x, w.num_groups_y, 1);
+          glFinish();
+          auto end = std::chrono::steady_clock::now();
+          samples.push_back(
+              std::chrono::duration<double, std::milli>(end - start).count());
+        }
+
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        const double median = softcompute::Median(sorted);
+        const double p99 = Percentile(sorted, 99.0);
+        double mean = 0.0;
+        for (size_t i = 0; i < samples.size(); i++) {
+          mean += samples[i];
+        }
+        mean /= static_cast<double>(samples.size());
+        const double items_per_sec =
+            median > 0.0 ? static_cast<double>(w.items) / (median * 1.0e-3)
+                         : 0.0;
+
+        printf("%-28s %8d %7d %12.3f %12.3f %12.3f %14.4g\n", kernel->name,
+               size, num_threads, median, p99, mean, items_per_sec);
+
+        nlohmann::json result;
+        result["kernel"] = kernel->name;
+        result["size"] = size;
+        result["threads"] = num_threads;
+        result["warmup"] = bench.warmup;
+        result["reps"] = bench.reps;
+        result["median_ms"] = median;
+        result["p99_ms"] = p99;
+        result["mean_ms"] = mean;
+        result["min_ms"] = sorted.front();
+        result["max_ms"] = sorted.back();
+        result["items"] = w.items;
+        result["items_per_sec"] = items_per_sec;
+        result["bytes"] = w.bytes;
+        result["bytes_per_sec"] =
+            median > 0.0 ? static_cast<double>(w.bytes) / (median * 1.0e-3)
+                         : 0.0;
+        result["samples_ms"] = samples;
+        results->push_back(result);
+
+        glDeleteBuffers(static_cast<GLsizei>(w.buffers.size()),
+                        w.buffers.data());
+      }
+
+      glDeleteProgram(program);
+    }
+
+    ReleaseSoftGL();
+  }
+
+  return ok;
+}
+
+// Builds each shader `reps` times in one process and reports the time of
+// each compile stage. The first build of a shader is reported as cold: it
+// pays for first use of glslang and the compiler, and for reading headers
+// and shaders from disk. The median of the others is reported as warm.
+bool RunCompileBenchmark(const BenchOptions &bench,
+                         const std::vector<std::string> &filenames,
+                         nlohmann::json *results) {
+  static const char *kStageNames[] = {"glsl_to_spirv", "spirv_to_cpp",
+                                      "cpp_to_ir",     "codegen",
+                                      "load",          "link"};
+  const size_t kNumStages = sizeof(kStageNames) / sizeof(kStageNames[0]);
+
+  bool ok = true;
+
+  InitSoftGL();
+  SetJITCompilerOptions(bench.compiler_options.c_str());
+
+  printf("%-40s %5s %10s %10s %10s %10s %10s %10s\n", "shader [ms]", "",
+         "glslang", "spv->cpp", "cpp->ir", "codegen", "load", "link");
+
+  for (size_t f = 0; f < filenames.size(); f++) {
+    // [stage][rep], in ms
+    std::vector<std::vector<double>> samples(kNumStages);
+
+    for (int r = 0; r < bench.reps; r++) {
+      GLuint program = 0;
+      if (!LoadProgram(filenames[f], &program)) {
+        ok = false;
+        break;
+      }
+
+      ProgramCompileStats stats;
+      GetProgramCompileStats(program, &stats);
+      const GLuint64 ns[] = {stats.glsl_to_spirv_ns, stats.spirv_to_cpp_ns,
+                             stats.cpp_to_ir_ns,     stats.codegen_ns,
+                             stats.load_ns,          stats.link_ns};
+      for (size_t i = 0; i < kNumStages; i++) {
+        samples[i].push_back(static_cast<double>(ns[i]) / 1.0e6);
+      }
+
+      glDeleteProgram(program);
+    }
+
+    if (samples[0].empty()) continue;
+
+    nlohmann::json result;
+    result["shader"] = filenames[f];
+    result["reps"] = samples[0].size();
+
+    double cold[kNumStages];
+    double warm[kNumStages];
+    for (size_t i = 0; i < kNumStages; i++) {
+      cold[i] = samples[i][0];
+      warm[i] = cold[i];
+      if (samples[i].size() > 1) {
+        warm[i] = softcompute::Median(std::vector<double>(samples[i].begin() + 1,
+                                             samples[i].end()));
+      }
+
+      result["cold_ms"][kStageNames[i]] = cold[i];
+      result["warm_median_ms"][kStageNames[i]] = warm[i];
+      result["samples_ms"][kStageNames[i]] = samples[i];
+    }
+    results->push_back(result);
+
+    printf("%-40s %5s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+           filenames[f].c_str(), "cold", cold[0], cold[1], cold[2], cold[3],
+           cold[4], cold[5]);
+    printf("%-40s %5s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", "",
+           "warm", warm[0], warm[1], warm[2], warm[3], warm[4], warm[5]);
+  }
+
+  ReleaseSoftGL();
+
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  using optparse::OptionParser;
+
+  OptionParser parser =
+      OptionParser()
+          .usage("%prog [options] [shader.comp|shader.spv ...]")
+          .description(
+              "Benchmarks dispatches of the bundled compute shaders, or with "
+              "--compile, building the given shaders.");
+
+  parser.add_option("-k", "--kernels")
+      .help("Comma separated kernels to run. Default all.");
+  parser.add_option("-s", "--sizes")
+      .set_default("256,1024")
+      .help("Comma separated problem sizes.");
+  parser.add_option("-t", "--threads")
+      .set_default("1,0")
+      .help("Comma separated worker thread counts. 0 uses all hardware "
+            "threads.");
+  parser.add_option("-w", "--warmup")
+      .set_default("2")
+      .help("Untimed runs before measuring.");
+  parser.add_option("-r", "--reps").set_default("10").help("Timed runs.");
+  parser.add_option("-c", "--compile")
+      .action("store_true")
+      .set_default("false")
+      .help("Time compile stages instead of dispatches. Builds each shader "
+            "given, or each kernel, --reps times.");
+  parser.add_option("-d", "--shader-dir")
+      .set_default(".")
+      .help("Directory containing shaders/ and sandbox/.");
+  parser.add_option("-o", "--output").help("Write results as JSON to FILE.");
+  parser.add_option("--options").help("Compiler options. e.g. \"-O2\"");
+
+  optparse::Values options = parser.parse_args(argc, argv);
+
+  BenchOptions bench;
+  if (options.is_set("kernels")) {
+    std::stringstream ss(options["kernels"]);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+      bench.kernels.push_back(item);
+    }
+  } else {
+    for (size_t i = 0; i < sizeof(kKernels) / sizeof(kKernels[0]); i++) {
+      bench.kernels.push_back(kKernels[i].name);
+    }
+  }
+
+  bench.sizes = ParseIntList(options["sizes"]);
+  bench.thread_counts = ParseIntList(options["threads"]);
+  bench.warmup = std::max(0, atoi(options["warmup"].c_str()));
+  bench.reps = std::max(1, atoi(options["reps"].c_str()));
+  bench.shader_dir = options["shader_dir"];
+  bench.compiler_options = options["options"];
+
+  const bool compile = options.get("compile");
+
+  nlohmann::json results = nlohmann::json::array();
+  bool ok = true;
+  if (compile) {
+    std::vector<std::string> filenames = parser.args();
+    if (filenames.empty()) {
+      for (size_t k = 0; k < bench.kernels.size(); k++) {
+        const Kernel *kernel = FindKernel(bench.kernels[k]);
+        if (kernel) {
+          filenames.push_back(bench.shader_dir + "/" + kernel->filename);
+        }
+      }
+    }
+    ok = RunCompileBenchmark(bench, filenames, &results);
+  } else {
+    ok = RunDispatchBenchmark(bench, &results);
+  }
+
+  if (options.is_set("output")) {
+    nlohmann::json report;
+    report["mode"] = compile ? "compile" : "dispatch";
+    report["engine"] = GetShaderEngineName();
+    report["compiler_options"] = bench.compiler_options;
+    report["results"] = results;
+
+    std::ofstream ofs(options["output"]);
+    if (!ofs) {
+      std::cerr << "Failed to open " << options["output"] << std::endl;
+      return EXIT_FAILURE;
+    }
+    ofs << report.dump(2) << std::endl;
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,224 @@
+#include "buffer-pool.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace softcompute {
+
+const size_t BufferPool::kAlignment;
+const size_t BufferPool::kPageSize;
+const size_t BufferPool::kHugePageSize;
+const size_t BufferPool::kNumaMinBytes;
+
+namespace {
+
+#if !defined(_WIN32)
+
+size_t GetMappingSize(size_t capacity) {
+  return (capacity + BufferPool::kHugePageSize - 1) /
+         BufferPool::kHugePageSize * BufferPool::kHugePageSize;
+}
+
+// Maps `size` bytes on huge pages. Returns nullptr when neither kind is
+// available.
+void *MapHugePages(size_t size, BufferPool::PageMode *page_mode) {
+#if defined(MAP_HUGETLB)
+  // Only succeeds when huge pages were reserved, e.g. with
+  // vm.nr_hugepages.
+  void *huge = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (huge != MAP_FAILED) {
+    *page_mode = BufferPool::kHugeTLBPages;
+    return huge;
+  }
+#endif
+
+#if defined(MADV_HUGEPAGE)
+  // Over-map to start on a huge page boundary, then trim.
+  const size_t padded = size + BufferPool::kHugePageSize;
+  void *base = mmap(nullptr, padded, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    return nullptr;
+  }
+
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(base);
+  const uintptr_t aligned = (begin + BufferPool::kHugePageSize - 1) &
+                            ~uintptr_t(BufferPool::kHugePageSize - 1);
+  if (aligned > begin) {
+    munmap(base, aligned - begin);
+  }
+  const uintptr_t end = begin + padded;
+  if (end > aligned + size) {
+    munmap(reinterpret_cast<void *>(aligned + size), end - (aligned + size));
+  }
+
+  void *ptr = reinterpret_cast<void *>(aligned);
+  *page_mode = (madvise(ptr, size, MADV_HUGEPAGE) == 0)
+                   ? BufferPool::kTransparentHugePages
+                   : BufferPool::kSmallPages;
+  return ptr;
+#else
+  (void)size;
+  (void)page_mode;
+  return nullptr;
+#endif
+}
+
+#endif
+
+}  // namespace
+
+BufferPool::BufferPool(size_t max_cached_bytes)
+    : cached_bytes_(0),
+      max_cached_bytes_(max_cached_bytes),
+      huge_page_threshold_(0),
+      topology_(nullptr),
+      placement_(kNumaFirstTouch) {}
+
+BufferPool::~BufferPool() { Trim(); }
+
+void BufferPool::SetHugePageThreshold(size_t threshold) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  huge_page_threshold_ = threshold;
+}
+
+void BufferPool::SetNumaPlacement(const NumaTopology *topology,
+                                  NumaPlacement placement) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  topology_ = topology;
+  placement_ = placement;
+}
+
+size_t BufferPool::GetSizeClass(size_t size) {
+  if (size <= kAlignment) {
+    return kAlignment;
+  }
+
+  size_t power = kAlignment;
+  while ((power << 1) <= size) {
+    power <<= 1;
+  }
+  if (power == size) {
+    return size;
+  }
+
+  const size_t step = (power >= 1024) ? (power / 4) : power;
+  return (size + step - 1) / step * step;
+}
+
+BufferPool::Block BufferPool::AllocateBlock(size_t capacity,
+                                            size_t huge_page_threshold) {
+  Block block;
+  block.capacity = capacity;
+
+#if !defined(_WIN32)
+  if ((huge_page_threshold > 0) && (capacity >= huge_page_threshold)) {
+    block.data = MapHugePages(GetMappingSize(capacity), &block.page_mode);
+    if (block.data) {
+      block.mapped = true;
+      return block;
+    }
+  }
+#else
+  (void)huge_page_threshold;
+#endif
+
+  const size_t alignment = (capacity >= kPageSize) ? kPageSize : kAlignment;
+
+#if defined(_WIN32)
+  block.data = _aligned_malloc(capacity, alignment);
+#else
+  if (posix_memalign(&block.data, alignment, capacity) != 0) {
+    block.data = nullptr;
+  }
+#endif
+
+  return block;
+}
+
+void BufferPool::FreeBlock(const Block &block) {
+  if (!block.data) {
+    return;
+  }
+
+#if defined(_WIN32)
+  _aligned_free(block.data);
+#else
+  if (block.mapped) {
+    munmap(block.data, GetMappingSize(block.capacity));
+  } else {
+    free(block.data);
+  }
+#endif
+}
+
+BufferPool::Block BufferPool::Allocate(size_t size) {
+  const size_t size_class = GetSizeClass(size);
+
+  size_t huge_page_threshold = 0;
+  const NumaTopology *topology = nullptr;
+  NumaPlacement placement = kNumaFirstTouch;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    huge_page_threshold = huge_page_threshold_;
+    topology = topology_;
+    placement = placement_;
+
+    std::unordered_map<size_t, std::vector<Block>>::iterator it =
+        free_blocks_.find(size_class);
+    if ((it != free_blocks_.end()) && !it->second.empty()) {
+      const Block block = it->second.back();
+      it->second.pop_back();
+      cached_bytes_ -= size_class;
+      return block;
+    }
+  }
+
+  const Block block = AllocateBlock(size_class, huge_page_threshold);
+
+  // Reused blocks keep the placement they got here.
+  if (topology && (size_class >= kNumaMinBytes)) {
+    topology->Place(block.data, size_class, placement);
+  }
+
+  return block;
+}
+
+void BufferPool::Free(const Block &block) {
+  if (!block.data) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cached_bytes_ + block.capacity <= max_cached_bytes_) {
+      free_blocks_[block.capacity].push_back(block);
+      cached_bytes_ += block.capacity;
+      return;
+    }
+  }
+
+  FreeBlock(block);
+}
+
+void BufferPool::Trim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::unordered_map<size_t, std::vector<Block>>::iterator it =
+           free_blocks_.begin();
+       it != free_blocks_.end(); ++it) {
+    for (size_t i = 0; i < it->second.size(); i++) {
+      FreeBlock(it->second[i]);
+    }
+  }
+  free_blocks_.clear();
+  cached_bytes_ = 0;
+}
+
+}  // namespace softcompute
@@ -0,0 +1,97 @@
+#ifndef SOFTCOMPUTE_BUFFER_POOL_H_
+#define SOFTCOMPUTE_BUFFER_POOL_H_
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "numa-topology.h"
+
+namespace softcompute {
+
+// Recycles aligned heap blocks by size class, so that buffers re-specified
+// with the same sizes every frame neither go back to the system allocator
+// nor get zero-filled. Blocks are uninitialized. Thread-safe.
+//
+// Blocks of at least the huge page threshold are mapped on 2 MB pages, from
+// the reserved hugetlbfs pool when there is one and as transparent huge
+// pages otherwise, to cut TLB misses of kernels scattering over them.
+//
+// On NUMA systems, new blocks of at least kNumaMinBytes are spread over the
+// nodes as set with SetNumaPlacement().
+class BufferPool {
+ public:
+  // Blocks start on a cache line, and blocks of a page or more on a page so
+  // that they do not share pages with other data.
+  static const size_t kAlignment = 64;
+  static const size_t kPageSize = 4096;
+  static const size_t kHugePageSize = 2 << 20;
+  static const size_t kNumaMinBytes = 1 << 20;
+
+  enum PageMode {
+    kSmallPages = 0,
+    kTransparentHugePages,  // madvise(MADV_HUGEPAGE), a hint to the kernel
+    kHugeTLBPages,          // MAP_HUGETLB
+  };
+
+  struct Block {
+    void *data;
+    size_t capacity;
+    PageMode page_mode;
+    bool mapped;  // Mapped with mmap() rather than allocated from the heap
+    char pad[3];
+
+    Block()
+        : data(nullptr), capacity(0), page_mode(kSmallPages), mapped(false) {
+      pad[0] = pad[1] = pad[2] = 0;
+    }
+  };
+
+  // Keeps at most `max_cached_bytes` of freed blocks for reuse.
+  explicit BufferPool(size_t max_cached_bytes);
+  ~BufferPool();
+
+  // Blocks of at least `threshold` bytes are allocated on huge pages from
+  // now on. 0 turns huge pages off.
+  void SetHugePageThreshold(size_t threshold);
+
+  // New blocks are placed on the nodes of `topology`, which must outlive the
+  // pool, according to `placement`. nullptr leaves them to first touch.
+  void SetNumaPlacement(const NumaTopology *topology, NumaPlacement placement);
+
+  // Returns a block of at least `size` bytes. Its data is nullptr when out
+  // of memory.
+  Block Allocate(size_t size);
+
+  // Returns a block from Allocate().
+  void Free(const Block &block);
+
+  // Frees the cached blocks.
+  void Trim();
+
+  // Size of the block serving `size` bytes: powers of two up to 1 KB, then
+  // four classes per power of two, so at most a quarter is wasted.
+  static size_t GetSizeClass(size_t size);
+
+  // Allocation without pooling, for callers without a pool. Huge pages are
+  // used when `capacity` is at least `huge_page_threshold` (if not 0).
+  static Block AllocateBlock(size_t capacity, size_t huge_page_threshold);
+  static void FreeBlock(const Block &block);
+
+ private:
+  BufferPool(const BufferPool &);
+  BufferPool &operator=(const BufferPool &);
+
+  std::mutex mutex_;
+  std::unordered_map<size_t, std::vector<Block>> free_blocks_;  // By class
+  size_t cached_bytes_;
+  size_t max_cached_bytes_;
+  size_t huge_page_threshold_;
+  const NumaTopology *topology_;
+  NumaPlacement placement_;
+};
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_BUFFER_POOL_H_
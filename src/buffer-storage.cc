@@ -0,0 +1,201 @@
+#include "buffer-storage.h"
+
+#include <iostream>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace softcompute {
+
+BufferStorage::BufferStorage() : BufferStorage(nullptr) {}
+
+BufferStorage::BufferStorage(BufferPool *pool)
+    : pool_(pool),
+      map_base_(nullptr),
+      map_size_(0),
+      data_(nullptr),
+      size_(0),
+      hint_(kAccessNormal),
+      mapped_(false),
+      writable_(true) {
+  pad_[0] = pad_[1] = 0;
+}
+
+BufferStorage::~BufferStorage() { Release(); }
+
+BufferStorage::BufferStorage(BufferStorage &&rhs) : BufferStorage() {
+  *this = std::move(rhs);
+}
+
+BufferStorage &BufferStorage::operator=(BufferStorage &&rhs) {
+  if (this != &rhs) {
+    Release();
+
+    pool_ = rhs.pool_;
+    block_ = rhs.block_;
+    map_base_ = rhs.map_base_;
+    map_size_ = rhs.map_size_;
+    data_ = rhs.data_;
+    size_ = rhs.size_;
+    hint_ = rhs.hint_;
+    mapped_ = rhs.mapped_;
+    writable_ = rhs.writable_;
+
+    rhs.block_ = BufferPool::Block();
+    rhs.map_base_ = nullptr;
+    rhs.map_size_ = 0;
+    rhs.data_ = nullptr;
+    rhs.size_ = 0;
+    rhs.hint_ = kAccessNormal;
+    rhs.mapped_ = false;
+    rhs.writable_ = true;
+  }
+  return *this;
+}
+
+void BufferStorage::Allocate(size_t size) {
+  if (block_.data && (BufferPool::GetSizeClass(size) == block_.capacity)) {
+    size_ = size;
+    return;
+  }
+
+  Release();
+
+  if (size == 0) {
+    return;
+  }
+
+  block_ = pool_ ? pool_->Allocate(size)
+                 : BufferPool::AllocateBlock(BufferPool::GetSizeClass(size), 0);
+  if (!block_.data) {
+    std::cerr << "[SoftGL] Failed to allocate " << size << " bytes."
+              << std::endl;
+    block_ = BufferPool::Block();
+    return;
+  }
+
+  data_ = static_cast<uint8_t *>(block_.data);
+  size_ = size;
+}
+
+void BufferStorage::Release() {
+#if !defined(_WIN32)
+  if (map_base_) {
+    munmap(map_base_, map_size_);
+  }
+#endif
+
+  if (pool_) {
+    pool_->Free(block_);
+  } else {
+    BufferPool::FreeBlock(block_);
+  }
+
+  block_ = BufferPool::Block();
+  map_base_ = nullptr;
+  map_size_ = 0;
+  data_ = nullptr;
+  size_ = 0;
+  hint_ = kAccessNormal;
+  mapped_ = false;
+  writable_ = true;
+}
+
+#if !defined(_WIN32)
+
+bool BufferStorage::MapFile(const std::string &filename, size_t offset,
+                            size_t size, MapMode mode) {
+  const int fd = open(filename.c_str(),
+                      (mode == kMapShared) ? (O_RDWR | O_CREAT) : O_RDONLY,
+                      0644);
+  if (fd < 0) {
+    std::cerr << "[SoftGL] Failed to open " << filename << std::endl;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  const size_t file_size = static_cast<size_t>(st.st_size);
+  if ((size == 0) && (offset < file_size)) {
+    size = file_size - offset;
+  }
+
+  if (offset + size > file_size) {
+    if ((mode != kMapShared) ||
+        (ftruncate(fd, static_cast<off_t>(offset + size)) != 0)) {
+      std::cerr << "[SoftGL] " << filename << " is shorter than "
+                << offset + size << " bytes." << std::endl;
+      close(fd);
+      return false;
+    }
+  }
+
+  // Mapped from the start of the file, since offsets into it need not be
+  // page aligned.
+  void *ptr = nullptr;
+  if (size > 0) {
+    ptr = mmap(nullptr, offset + size,
+               (mode == kMapReadOnly) ? PROT_READ : (PROT_READ | PROT_WRITE),
+               (mode == kMapPrivate) ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+  }
+
+  // The mapping keeps the file open.
+  close(fd);
+
+  if (ptr == MAP_FAILED) {
+    std::cerr << "[SoftGL] Failed to map " << filename << std::endl;
+    return false;
+  }
+
+  Release();
+  map_base_ = static_cast<uint8_t *>(ptr);
+  map_size_ = ptr ? (offset + size) : 0;
+  data_ = ptr ? (map_base_ + offset) : nullptr;
+  size_ = size;
+  mapped_ = (ptr != nullptr);
+  writable_ = (mode != kMapReadOnly);
+
+  return true;
+}
+
+void BufferStorage::Advise(AccessHint hint) {
+  if (!mapped_ || (hint == hint_)) {
+    return;
+  }
+
+  // Only hints, so failures are ignored. MADV_WILLNEED starts reading ahead
+  // but does not undo MADV_SEQUENTIAL.
+  madvise(map_base_, map_size_,
+          (hint == kAccessSequential) ? MADV_SEQUENTIAL : MADV_NORMAL);
+  if (hint == kAccessWillNeed) {
+    madvise(map_base_, map_size_, MADV_WILLNEED);
+  }
+  hint_ = hint;
+}
+
+#else
+
+bool BufferStorage::MapFile(const std::string &filename, size_t offset,
+                            size_t size, MapMode mode) {
+  (void)offset;
+  (void)size;
+  (void)mode;
+  std::cerr << "[SoftGL] Mapping " << filename
+            << " is not supported on this platform." << std::endl;
+  return false;
+}
+
+void BufferStorage::Advise(AccessHint hint) { (void)hint; }
+
+#endif
+
+}  // namespace softcompute
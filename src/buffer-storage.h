@@ -0,0 +1,93 @@
+#ifndef SOFTCOMPUTE_BUFFER_STORAGE_H_
+#define SOFTCOMPUTE_BUFFER_STORAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "buffer-pool.h"
+
+namespace softcompute {
+
+// Memory behind a buffer object: a heap allocation, or a mapping of a file.
+// File mappings are paged in on demand, so shaders can start on multi-GB
+// inputs right away, and shared writable ones write through to the file, so
+// outputs land there without a separate write pass.
+class BufferStorage {
+ public:
+  enum MapMode {
+    kMapReadOnly = 0,
+    kMapShared,   // Stores are written to the file
+    kMapPrivate,  // Stores are kept in memory, copy-on-write
+  };
+
+  // How the next dispatches access the storage, for paging hints.
+  enum AccessHint {
+    kAccessNormal = 0,
+    kAccessSequential,  // Each invocation touches its own elements once
+    kAccessWillNeed,    // Read as a whole, e.g. by every invocation
+  };
+
+  BufferStorage();
+
+  // Heap allocations come from `pool` and go back to it.
+  explicit BufferStorage(BufferPool *pool);
+
+  ~BufferStorage();
+
+  BufferStorage(BufferStorage &&rhs);
+  BufferStorage &operator=(BufferStorage &&rhs);
+
+  // Replaces the storage with `size` uninitialized bytes on the heap,
+  // aligned to BufferPool::kAlignment. The current block is reused when it
+  // is a heap block of the same size class.
+  void Allocate(size_t size);
+
+  // Replaces the storage with a mapping of `size` bytes of `filename` from
+  // `offset`, or the rest of the file when `size` is 0. Fails when the file
+  // is shorter, except that kMapShared creates the file and grows it as
+  // needed. Returns false and keeps the old storage on failure. Only
+  // available on POSIX systems.
+  bool MapFile(const std::string &filename, size_t offset, size_t size,
+               MapMode mode);
+
+  // Frees the memory or unmaps the file.
+  void Release();
+
+  uint8_t *data() { return data_; }
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+
+  BufferPool *pool() const { return pool_; }
+
+  // Pages backing heap storage. File mappings use small pages.
+  BufferPool::PageMode page_mode() const { return block_.page_mode; }
+
+  bool IsMapped() const { return mapped_; }
+
+  // False for read-only file mappings. Stores to them fault.
+  bool IsWritable() const { return writable_; }
+
+  // Passes `hint` to madvise() for file mappings. Cheap when the hint did
+  // not change since the last call.
+  void Advise(AccessHint hint);
+
+ private:
+  BufferStorage(const BufferStorage &);
+  BufferStorage &operator=(const BufferStorage &);
+
+  BufferPool *pool_;
+  BufferPool::Block block_;  // Heap storage
+  uint8_t *map_base_;  // From the start of the file
+  size_t map_size_;
+  uint8_t *data_;
+  size_t size_;
+  AccessHint hint_;
+  bool mapped_;
+  bool writable_;
+  char pad_[2];
+};
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_BUFFER_STORAGE_H_
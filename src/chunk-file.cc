@@ -0,0 +1,152 @@
+#include "chunk-file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace softcompute {
+
+ChunkFile::ChunkFile() : size_(0), fd_(-1), pad_(0) {}
+
+ChunkFile::~ChunkFile() { Close(); }
+
+#if !defined(_WIN32)
+
+bool ChunkFile::OpenForRead(const std::string &filename) {
+  Close();
+
+  fd_ = open(filename.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    std::cerr << "[SoftGL] Failed to open " << filename << std::endl;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd_, &st) != 0) {
+    Close();
+    return false;
+  }
+  size_ = static_cast<uint64_t>(st.st_size);
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+  // Larger readahead. Only a hint.
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  return true;
+}
+
+bool ChunkFile::OpenForWrite(const std::string &filename, uint64_t size) {
+  Close();
+
+  fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    std::cerr << "[SoftGL] Failed to create " << filename << std::endl;
+    return false;
+  }
+
+  if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+    std::cerr << "[SoftGL] Failed to resize " << filename << std::endl;
+    Close();
+    return false;
+  }
+  size_ = size;
+
+  return true;
+}
+
+void ChunkFile::Close() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  fd_ = -1;
+  size_ = 0;
+}
+
+bool ChunkFile::Read(uint64_t offset, size_t size, void *dst) const {
+  uint8_t *p = static_cast<uint8_t *>(dst);
+
+  // Past the end reads as zero.
+  size_t valid = 0;
+  if (offset < size_) {
+    valid = static_cast<size_t>(
+        std::min(uint64_t(size), size_ - offset));
+  }
+  memset(p + valid, 0, size - valid);
+
+  size_t done = 0;
+  while (done < valid) {
+    const ssize_t n = pread(fd_, p + done, valid - done,
+                            static_cast<off_t>(offset + done));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n == 0) {
+      // Truncated while reading.
+      memset(p + done, 0, valid - done);
+      break;
+    }
+    done += static_cast<size_t>(n);
+  }
+
+  return true;
+}
+
+bool ChunkFile::Write(uint64_t offset, size_t size, const void *src) const {
+  const uint8_t *p = static_cast<const uint8_t *>(src);
+
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t n = pwrite(fd_, p + done, size - done,
+                             static_cast<off_t>(offset + done));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    done += static_cast<size_t>(n);
+  }
+
+  return true;
+}
+
+#else
+
+bool ChunkFile::OpenForRead(const std::string &filename) {
+  std::cerr << "[SoftGL] Streaming " << filename
+            << " is not supported on this platform." << std::endl;
+  return false;
+}
+
+bool ChunkFile::OpenForWrite(const std::string &filename, uint64_t size) {
+  (void)size;
+  return OpenForRead(filename);
+}
+
+void ChunkFile::Close() {}
+
+bool ChunkFile::Read(uint64_t offset, size_t size, void *dst) const {
+  (void)offset;
+  (void)size;
+  (void)dst;
+  return false;
+}
+
+bool ChunkFile::Write(uint64_t offset, size_t size, const void *src) const {
+  (void)offset;
+  (void)size;
+  (void)src;
+  return false;
+}
+
+#endif
+
+}  // namespace softcompute
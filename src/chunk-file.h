@@ -0,0 +1,45 @@
+#ifndef SOFTCOMPUTE_CHUNK_FILE_H_
+#define SOFTCOMPUTE_CHUNK_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace softcompute {
+
+// File read or written in chunks at explicit offsets with pread()/pwrite(),
+// so that several threads can work on different chunks of it. POSIX only.
+class ChunkFile {
+ public:
+  ChunkFile();
+  ~ChunkFile();
+
+  // Opens an input for sequential chunked reading.
+  bool OpenForRead(const std::string &filename);
+
+  // Creates or truncates an output and sizes it to `size` bytes.
+  bool OpenForWrite(const std::string &filename, uint64_t size);
+
+  void Close();
+
+  uint64_t size() const { return size_; }
+
+  // Reads `size` bytes at `offset`. Bytes past the end of the file read as
+  // zero. Returns false on I/O errors.
+  bool Read(uint64_t offset, size_t size, void *dst) const;
+
+  // Writes `size` bytes at `offset`. Returns false on I/O errors.
+  bool Write(uint64_t offset, size_t size, const void *src) const;
+
+ private:
+  ChunkFile(const ChunkFile &);
+  ChunkFile &operator=(const ChunkFile &);
+
+  uint64_t size_;
+  int fd_;
+  int pad_;
+};
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_CHUNK_FILE_H_
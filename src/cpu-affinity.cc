@@ -0,0 +1,167 @@
+#include "cpu-affinity.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace softcompute {
+
+namespace {
+
+// Largest number of CPUs Linux can be built for (NR_CPUS). Lists naming
+// CPUs beyond it are malformed, which also bounds the ranges expanded.
+const int kMaxCpus = 8192;
+
+// CPU number of a string of digits, or -1 when it is kMaxCpus or more.
+int ParseCpu(const std::string &str) {
+  const size_t first = std::min(str.find_first_not_of('0'), str.size() - 1);
+  if (str.size() - first > 4) {
+    return -1;
+  }
+
+  const int cpu = std::atoi(str.c_str() + first);
+  return (cpu < kMaxCpus) ? cpu : -1;
+}
+
+}  // namespace
+
+bool ParseCpuList(const std::string &list, std::vector<int> *cpus) {
+  cpus->clear();
+
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    // Trailing newline or spaces
+    range.erase(range.find_last_not_of(" \t\r\n") + 1);
+    if (range.empty()) {
+      continue;
+    }
+
+    const size_t dash = range.find('-');
+    const std::string first_str = range.substr(0, dash);
+    const std::string last_str =
+        (dash == std::string::npos) ? first_str : range.substr(dash + 1);
+    if (first_str.empty() || last_str.empty() ||
+        (first_str.find_first_not_of("0123456789") != std::string::npos) ||
+        (last_str.find_first_not_of("0123456789") != std::string::npos)) {
+      return false;
+    }
+
+    const int first = ParseCpu(first_str);
+    const int last = ParseCpu(last_str);
+    if ((first < 0) || (last < first)) {
+      return false;
+    }
+    for (int i = first; i <= last; i++) {
+      cpus->push_back(i);
+    }
+  }
+
+  std::sort(cpus->begin(), cpus->end());
+  cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+  return true;
+}
+
+std::vector<int> ReadCpuListFile(const std::string &filename) {
+  std::vector<int> cpus;
+
+  std::ifstream ifs(filename.c_str());
+  std::string line;
+  if (!std::getline(ifs, line) || !ParseCpuList(line, &cpus)) {
+    cpus.clear();
+  }
+
+  return cpus;
+}
+
+std::vector<int> GetIsolatedCpus() {
+  return ReadCpuListFile("/sys/devices/system/cpu/isolated");
+}
+
+std::vector<int> RemoveSmtSiblings(const std::vector<int> &cpus) {
+  return RemoveSmtSiblings(cpus, [](int cpu) {
+    return ReadCpuListFile("/sys/devices/system/cpu/cpu" +
+                           std::to_string(cpu) +
+                           "/topology/thread_siblings_list");
+  });
+}
+
+std::vector<int> RemoveSmtSiblings(
+    const std::vector<int> &cpus,
+    const std::function<std::vector<int>(int)> &get_siblings) {
+  std::vector<int> first_threads;
+  std::vector<int> seen;
+  for (size_t i = 0; i < cpus.size(); i++) {
+    if (std::binary_search(seen.begin(), seen.end(), cpus[i])) {
+      continue;
+    }
+    first_threads.push_back(cpus[i]);
+
+    const std::vector<int> siblings = get_siblings(cpus[i]);
+    std::vector<int> merged;
+    std::set_union(seen.begin(), seen.end(), siblings.begin(), siblings.end(),
+                   std::back_inserter(merged));
+    seen.swap(merged);
+  }
+
+  return first_threads;
+}
+
+std::vector<int> IntersectCpus(const std::vector<int> &a,
+                               const std::vector<int> &b) {
+  std::vector<int> common;
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(common));
+  return common;
+}
+
+#ifdef __linux__
+
+std::vector<int> GetAllowedCpus() {
+  std::vector<int> cpus;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(size_t(i), &set)) {
+        cpus.push_back(i);
+      }
+    }
+  }
+
+  return cpus;
+}
+
+bool BindThreadToCpus(const std::vector<int> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  bool any = false;
+  for (size_t i = 0; i < cpus.size(); i++) {
+    if ((cpus[i] >= 0) && (cpus[i] < CPU_SETSIZE)) {
+      CPU_SET(size_t(cpus[i]), &set);
+      any = true;
+    }
+  }
+
+  return any && (sched_setaffinity(0, sizeof(set), &set) == 0);
+}
+
+#else
+
+std::vector<int> GetAllowedCpus() { return std::vector<int>(); }
+
+bool BindThreadToCpus(const std::vector<int> &cpus) {
+  (void)cpus;
+  return false;
+}
+
+#endif
+
+}  // namespace softcompute
@@ -0,0 +1,52 @@
+#ifndef SOFTCOMPUTE_CPU_AFFINITY_H_
+#define SOFTCOMPUTE_CPU_AFFINITY_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace softcompute {
+
+// How worker threads are bound to CPUs.
+enum ThreadAffinity {
+  kAffinityNone = 0,  // Not bound; the OS schedules them
+  kAffinityNode,      // Bound to the CPUs of their NUMA node
+  kAffinityCore,      // Each bound to a single CPU
+};
+
+// CPU numbers of a list such as "0-3,8-11", in ascending order without
+// duplicates. Returns false when `list` is malformed, including reversed
+// ranges such as "8-2" and CPU numbers beyond what Linux supports.
+bool ParseCpuList(const std::string &list, std::vector<int> *cpus);
+
+// Same as ParseCpuList() on the first line of a sysfs file. Returns an empty
+// list when it cannot be read.
+std::vector<int> ReadCpuListFile(const std::string &filename);
+
+// CPUs the calling thread may run on. Empty when not known.
+std::vector<int> GetAllowedCpus();
+
+// CPUs isolated from the scheduler with the isolcpus= kernel parameter.
+std::vector<int> GetIsolatedCpus();
+
+// Keeps the first CPU of each physical core in `cpus`, dropping the other
+// SMT (hyper-)threads of the core.
+std::vector<int> RemoveSmtSiblings(const std::vector<int> &cpus);
+
+// Same, with the sorted SMT siblings of a CPU (itself included) returned by
+// `get_siblings` instead of read from sysfs.
+std::vector<int> RemoveSmtSiblings(
+    const std::vector<int> &cpus,
+    const std::function<std::vector<int>(int)> &get_siblings);
+
+// Elements of `a` which are also in `b`. Both must be sorted.
+std::vector<int> IntersectCpus(const std::vector<int> &a,
+                               const std::vector<int> &b);
+
+// Restricts the calling thread to `cpus`. Returns false when `cpus` is empty
+// or the OS refuses it. Linux only.
+bool BindThreadToCpus(const std::vector<int> &cpus);
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_CPU_AFFINITY_H_
@@ -15,7 +15,6 @@
 #include <cassert>
 #include <cstdio>
 #include <iostream>
-#include <map>
 #include <vector>
 
 #ifdef _WIN32
@@ -27,6 +26,7 @@
 #endif
 
 #include "dll-engine.h"
+#include "trace.h"
 
 static std::string GetFileExtension(const std::string &FileName)
 {
@@ -121,6 +121,8 @@ bool ShaderInstance::Impl::Compile(const std::string &type, const std::vector<st
     (void)type;
     (void)paths;
 
+    CompileStageScope trace(kCompileLoad, "dlopen");
+
     std::string ext = GetFileExtension(filename);
 
     std::string abspath = filename; // @fixme
@@ -294,6 +296,10 @@ ShaderEngine::ShaderEngine(bool abortOnFailure)
 
 ShaderEngine::~ShaderEngine()
 {
+    for (size_t i = 0; i < shaderInstances_.size(); i++)
+    {
+        delete shaderInstances_[i];
+    }
     delete impl;
 }
 
@@ -307,19 +313,21 @@ ShaderInstance *ShaderEngine::Compile(const std::string &type, unsigned int shad
     assert(impl);
     assert(shaderID != static_cast<unsigned int>(-1));
 
-    if (shaderInstanceMap_.find(shaderID) != shaderInstanceMap_.end())
+    if (shaderID >= shaderInstances_.size())
     {
-        printf("[ShaderEngine] Err: Duplicate shader ID.\n");
-        ShaderInstance *instance = shaderInstanceMap_[shaderID];
-        if (instance)
-        {
-            delete instance;
-        }
+        shaderInstances_.resize(shaderID + 1, nullptr);
+    }
+
+    if (shaderInstances_[shaderID])
+    {
+        // Recompiling replaces the previous instance.
+        delete shaderInstances_[shaderID];
+        shaderInstances_[shaderID] = nullptr;
     }
 
     ShaderInstance *shaderInstance = impl->Compile(type, shaderID, paths, filename);
 
-    shaderInstanceMap_[shaderID] = shaderInstance;
+    shaderInstances_[shaderID] = shaderInstance;
 
     return shaderInstance;
 }
@@ -15,7 +15,6 @@
 #ifndef DLL_ENGINE_H_
 #define DLL_ENGINE_H_
 
-#include <map>
 #include <string>
 #include <vector>
 
@@ -49,12 +48,12 @@ public:
     ShaderInstance *Compile(const std::string &type, unsigned int shaderID, const std::vector<std::string> &paths,
                             const std::string &options, const std::string &filename);
 
+    // Shader IDs index an array, so keep them small and dense.
     ShaderInstance *GetShaderInstance(uint32_t shaderID)
     {
-        // @todo { use array for faster lookup. }
-        if (shaderInstanceMap_.find(shaderID) != shaderInstanceMap_.end())
+        if (shaderID < shaderInstances_.size())
         {
-            return shaderInstanceMap_[shaderID];
+            return shaderInstances_[shaderID];
         }
         else
         {
@@ -66,7 +65,7 @@ private:
     class Impl;
     Impl *impl;
 
-    std::map<unsigned int, ShaderInstance *> shaderInstanceMap_;
+    std::vector<ShaderInstance *> shaderInstances_; // Indexed by shader ID
 };
 }
 
@@ -0,0 +1,82 @@
+#include "heatmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "image-file.h"
+
+namespace softcompute {
+
+namespace {
+
+// Scale the image up to about this many pixels on its longer side.
+const uint32_t kMinImageSize = 512;
+
+// Black -> purple -> orange -> yellow, roughly the "inferno" color map.
+// Stops are display values; `rgb` gets them linear, as WriteImage() takes.
+void ColorMap(float t, float rgb[3]) {
+  static const float kStops[5][3] = {{0.0f, 0.0f, 0.02f},
+                                     {0.34f, 0.06f, 0.43f},
+                                     {0.73f, 0.21f, 0.33f},
+                                     {0.98f, 0.55f, 0.04f},
+                                     {0.99f, 1.0f, 0.64f}};
+
+  const float x = std::min(std::max(t, 0.0f), 1.0f) * 4.0f;
+  const int i = std::min(static_cast<int>(x), 3);
+  const float f = x - static_cast<float>(i);
+
+  for (int c = 0; c < 3; c++) {
+    const float v = kStops[i][c] + (kStops[i + 1][c] - kStops[i][c]) * f;
+    rgb[c] = std::pow(v, 2.2f);
+  }
+}
+
+}  // namespace
+
+bool WriteHeatmap(const std::string &basename, const std::vector<uint64_t> &costs,
+                  uint32_t width, uint32_t height) {
+  if ((width == 0) || (height == 0) ||
+      (costs.size() != size_t(width) * size_t(height))) {
+    return false;
+  }
+
+  {
+    std::ofstream ofs(basename + ".csv");
+    if (!ofs) {
+      return false;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+      for (uint32_t x = 0; x < width; x++) {
+        if (x > 0) ofs << ",";
+        ofs << costs[size_t(y) * width + x];
+      }
+      ofs << "\n";
+    }
+  }
+
+  const uint64_t min_cost = *std::min_element(costs.begin(), costs.end());
+  const uint64_t max_cost = *std::max_element(costs.begin(), costs.end());
+  const float range = static_cast<float>(std::max(max_cost - min_cost, uint64_t(1)));
+
+  const uint32_t scale =
+      std::max(uint32_t(1), kMinImageSize / std::max(width, height));
+  const uint32_t image_width = width * scale;
+  const uint32_t image_height = height * scale;
+
+  // Bottom row first, so that grid row 0 ends up at the top.
+  std::vector<float> image(size_t(image_width) * image_height * 3);
+  for (uint32_t y = 0; y < image_height; y++) {
+    float *row = &image[size_t(image_height - y - 1) * image_width * 3];
+    for (uint32_t x = 0; x < image_width; x++) {
+      const uint64_t cost = costs[size_t(y / scale) * width + (x / scale)];
+      ColorMap(static_cast<float>(cost - min_cost) / range, &row[x * 3]);
+    }
+  }
+
+  return WriteImage(basename + ".png", image.data(), image_width,
+                    image_height, 3, nullptr);
+}
+
+}  // namespace softcompute
@@ -0,0 +1,40 @@
+#ifndef SOFTCOMPUTE_HEATMAP_H_
+#define SOFTCOMPUTE_HEATMAP_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+namespace softcompute {
+
+// Cheap timestamp for measuring short intervals. CPU reference cycles where
+// the TSC is available, nanoseconds otherwise.
+inline uint64_t ReadCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+#endif
+}
+
+// Writes a width x height grid of costs (row-major) to `basename`.csv and as
+// a false-color image, cheap workgroups dark and expensive ones bright, to
+// `basename`.png. Small grids are scaled up so that cells stay visible.
+// Returns false when a file cannot be written.
+bool WriteHeatmap(const std::string &basename, const std::vector<uint64_t> &costs,
+                  uint32_t width, uint32_t height);
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_HEATMAP_H_
@@ -0,0 +1,327 @@
+#include "image-file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "tensor-file.h"
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wconversion"
+#endif
+
+// Static so that it does not clash with the application's copy.
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace softcompute {
+
+namespace {
+
+// Entries of the gamma table over [0, 1]. 16 bits keep the steep start of
+// the curve within one step of std::pow().
+const uint32_t kGammaLutSize = 1 << 16;
+
+// Below this many pixels per piece, handing rows to workers costs more than
+// it saves.
+const uint64_t kMinPixelsPerPiece = 1 << 16;
+
+// Rows of float formats converted per write, so that memory stays bounded.
+const uint64_t kMaxBytesPerWrite = 64 << 20;
+
+struct GammaLut {
+  uint8_t values[kGammaLutSize];
+
+  GammaLut() {
+    for (uint32_t i = 0; i < kGammaLutSize; i++) {
+      const float x = static_cast<float>(i) / float(kGammaLutSize - 1);
+      const int v = static_cast<int>(std::pow(x, 1.0f / 2.2f) * 256.0f);
+      values[i] = static_cast<uint8_t>(std::min(v, 255));
+    }
+  }
+};
+
+const GammaLut &GetGammaLut() {
+  static const GammaLut lut;
+  return lut;
+}
+
+bool EndsWith(const std::string &s, const std::string &suffix) {
+  return (s.size() >= suffix.size()) &&
+         (s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+// Calls `fn(begin, end)` for bands of rows [0, height) on the workers of
+// `pool`.
+void ParallelRows(uint32_t width, uint32_t height, WorkerPool *pool,
+                  const std::function<void(uint32_t, uint32_t)> &fn) {
+  uint64_t n = pool ? uint64_t(std::max(pool->GetNumThreads(), 1)) : 1;
+  n = std::min(n, std::max(uint64_t(width) * height / kMinPixelsPerPiece,
+                           uint64_t(1)));
+  n = std::min(n, uint64_t(std::max(height, 1u)));
+
+  ParallelFor(pool, size_t(n), [&](size_t i) {
+    fn(static_cast<uint32_t>(height * i / n),
+       static_cast<uint32_t>(height * (i + 1) / n));
+  });
+}
+
+// Converts rows [0, height) into `band_rows` rows at a time with
+// `pack(y, row)`, and writes them in order. `pack` fills `row_size` bytes.
+bool WriteRows(std::ofstream &ofs, uint32_t width, uint32_t height,
+               size_t row_size, WorkerPool *pool,
+               const std::function<void(uint32_t, void *)> &pack) {
+  const uint32_t band_rows = static_cast<uint32_t>(std::max(
+      std::min(kMaxBytesPerWrite / std::max(row_size, size_t(1)),
+               uint64_t(height)),
+      uint64_t(1)));
+  std::vector<uint8_t> band(size_t(band_rows) * row_size);
+
+  for (uint32_t y0 = 0; y0 < height; y0 += band_rows) {
+    const uint32_t rows = std::min(band_rows, height - y0);
+    ParallelRows(width, rows, pool, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t y = begin; y < end; y++) {
+        pack(y0 + y, &band[size_t(y) * row_size]);
+      }
+    });
+    ofs.write(reinterpret_cast<const char *>(band.data()),
+              static_cast<std::streamsize>(size_t(rows) * row_size));
+  }
+
+  return bool(ofs);
+}
+
+// Bottom-to-top RGB or grayscale, little-endian: the row order of GL.
+bool WritePFM(const std::string &filename, const float *pixels,
+              uint32_t width, uint32_t height, uint32_t channels,
+              WorkerPool *pool) {
+  std::ofstream ofs(filename, std::ios::binary);
+  if (!ofs) {
+    return false;
+  }
+
+  // Gray-alpha becomes grayscale and RGBA RGB.
+  const uint32_t out_channels = (channels <= 2) ? 1 : 3;
+  ofs << ((out_channels == 1) ? "Pf" : "PF") << "\n"
+      << width << " " << height << "\n-1.0\n";
+
+  const size_t row_size = size_t(width) * out_channels * sizeof(float);
+  return WriteRows(
+      ofs, width, height, row_size, pool,
+      [&](uint32_t y, void *row) {
+        const float *src = pixels + size_t(y) * width * channels;
+        float *dst = static_cast<float *>(row);
+        for (uint32_t x = 0; x < width; x++) {
+          for (uint32_t c = 0; c < out_channels; c++) {
+            dst[x * out_channels + c] =
+                (c < channels) ? src[x * channels + c] : 0.0f;
+          }
+        }
+      });
+}
+
+void Append(std::vector<uint8_t> *s, const void *p, size_t size) {
+  const uint8_t *b = static_cast<const uint8_t *>(p);
+  s->insert(s->end(), b, b + size);
+}
+
+void AppendString(std::vector<uint8_t> *s, const char *str) {
+  Append(s, str, strlen(str) + 1);
+}
+
+void AppendInt(std::vector<uint8_t> *s, int32_t v) { Append(s, &v, 4); }
+
+void AppendFloat(std::vector<uint8_t> *s, float v) { Append(s, &v, 4); }
+
+void AppendAttribute(std::vector<uint8_t> *s, const char *name,
+                     const char *type, int32_t size) {
+  AppendString(s, name);
+  AppendString(s, type);
+  AppendInt(s, size);
+}
+
+// Single-part scanline OpenEXR, uncompressed, one line per block, FLOAT
+// channels. The first line of the file is the top of the image.
+bool WriteEXR(const std::string &filename, const float *pixels,
+              uint32_t width, uint32_t height, uint32_t channels,
+              WorkerPool *pool) {
+  // Channels are stored in alphabetical order of their names.
+  static const char *const kNames[4][4] = {{"Y"},
+                                           {"A", "Y"},
+                                           {"B", "G", "R"},
+                                           {"A", "B", "G", "R"}};
+  static const uint32_t kSource[4][4] = {
+      {0}, {1, 0}, {2, 1, 0}, {3, 2, 1, 0}};
+  const char *const *names = kNames[channels - 1];
+  const uint32_t *source = kSource[channels - 1];
+
+  std::vector<uint8_t> header;
+  const uint8_t magic[4] = {0x76, 0x2f, 0x31, 0x01};
+  Append(&header, magic, 4);
+  AppendInt(&header, 2);  // Version 2, scanline, short names
+
+  int32_t chlist_size = 1;
+  for (uint32_t c = 0; c < channels; c++) {
+    chlist_size += static_cast<int32_t>(strlen(names[c])) + 1 + 16;
+  }
+  AppendAttribute(&header, "channels", "chlist", chlist_size);
+  for (uint32_t c = 0; c < channels; c++) {
+    AppendString(&header, names[c]);
+    AppendInt(&header, 2);  // FLOAT
+    AppendInt(&header, 0);  // pLinear and reserved
+    AppendInt(&header, 1);  // x sampling
+    AppendInt(&header, 1);  // y sampling
+  }
+  header.push_back(0);
+
+  AppendAttribute(&header, "compression", "compression", 1);
+  header.push_back(0);  // NO_COMPRESSION
+
+  for (int i = 0; i < 2; i++) {
+    AppendAttribute(&header, (i == 0) ? "dataWindow" : "displayWindow",
+                    "box2i", 16);
+    AppendInt(&header, 0);
+    AppendInt(&header, 0);
+    AppendInt(&header, static_cast<int32_t>(width) - 1);
+    AppendInt(&header, static_cast<int32_t>(height) - 1);
+  }
+
+  AppendAttribute(&header, "lineOrder", "lineOrder", 1);
+  header.push_back(0);  // INCREASING_Y
+
+  AppendAttribute(&header, "pixelAspectRatio", "float", 4);
+  AppendFloat(&header, 1.0f);
+
+  AppendAttribute(&header, "screenWindowCenter", "v2f", 8);
+  AppendFloat(&header, 0.0f);
+  AppendFloat(&header, 0.0f);
+
+  AppendAttribute(&header, "screenWindowWidth", "float", 4);
+  AppendFloat(&header, 1.0f);
+
+  header.push_back(0);  // End of header
+
+  // Each line block is its y, its data size and the data.
+  const size_t data_size = size_t(width) * channels * sizeof(float);
+  const size_t block_size = 8 + data_size;
+  const uint64_t first_block = header.size() + uint64_t(height) * 8;
+  for (uint32_t y = 0; y < height; y++) {
+    const uint64_t offset = first_block + uint64_t(y) * block_size;
+    Append(&header, &offset, 8);
+  }
+
+  std::ofstream ofs(filename, std::ios::binary);
+  if (!ofs) {
+    return false;
+  }
+  ofs.write(reinterpret_cast<const char *>(header.data()),
+            static_cast<std::streamsize>(header.size()));
+
+  return WriteRows(
+      ofs, width, height, block_size, pool,
+      [&](uint32_t y, void *block) {
+        const int32_t line = static_cast<int32_t>(y);
+        const int32_t size = static_cast<int32_t>(data_size);
+        memcpy(block, &line, 4);
+        memcpy(static_cast<uint8_t *>(block) + 4, &size, 4);
+
+        // Flip Y
+        const float *src = pixels + size_t(height - y - 1) * width * channels;
+        float *dst = static_cast<float *>(block) + 2;
+        for (uint32_t c = 0; c < channels; c++) {
+          for (uint32_t x = 0; x < width; x++) {
+            dst[c * width + x] = src[x * channels + source[c]];
+          }
+        }
+      });
+}
+
+}  // namespace
+
+void QuantizeImage(const float *src, uint32_t width, uint32_t height,
+                   uint32_t channels, uint32_t dst_channels, WorkerPool *pool,
+                   uint8_t *dst) {
+  const uint8_t *lut = GetGammaLut().values;
+  const float scale = float(kGammaLutSize - 1);
+
+  // The last of 2 or 4 channels is alpha, which is not gamma encoded.
+  const uint32_t alpha =
+      ((channels == 2) || (channels == 4)) ? channels - 1 : channels;
+
+  ParallelRows(width, height, pool, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t y = begin; y < end; y++) {
+      // Flip Y
+      const float *s = src + size_t(y) * width * channels;
+      uint8_t *d = dst + size_t(height - y - 1) * width * dst_channels;
+      for (uint32_t x = 0; x < width; x++) {
+        for (uint32_t c = 0; c < dst_channels; c++) {
+          // Also maps NaN to 0.
+          float v = s[x * channels + c];
+          v = (v > 0.0f) ? v : 0.0f;
+          v = (v < 1.0f) ? v : 1.0f;
+          d[x * dst_channels + c] =
+              (c == alpha) ? static_cast<uint8_t>(v * 255.0f + 0.5f)
+                           : lut[static_cast<uint32_t>(v * scale)];
+        }
+      }
+    }
+  });
+}
+
+bool WriteImage(const std::string &filename, const float *pixels,
+                uint32_t width, uint32_t height, uint32_t channels,
+                WorkerPool *pool) {
+  if ((channels < 1) || (channels > 4) || (width == 0) || (height == 0)) {
+    std::cerr << "[SoftGL] Invalid image size for " << filename << std::endl;
+    return false;
+  }
+
+  bool ok = false;
+  if (EndsWith(filename, ".png")) {
+    // Gray-alpha and RGBA keep their alpha channel.
+    std::vector<uint8_t> ldr(size_t(width) * height * channels);
+    QuantizeImage(pixels, width, height, channels, channels, pool,
+                  ldr.data());
+    ok = stbi_write_png(filename.c_str(), static_cast<int>(width),
+                        static_cast<int>(height), static_cast<int>(channels),
+                        ldr.data(), static_cast<int>(width * channels)) != 0;
+  } else if (EndsWith(filename, ".pfm")) {
+    ok = WritePFM(filename, pixels, width, height, channels, pool);
+  } else if (EndsWith(filename, ".exr")) {
+    ok = WriteEXR(filename, pixels, width, height, channels, pool);
+  } else if (EndsWith(filename, ".npy")) {
+    std::vector<uint64_t> shape;
+    shape.push_back(height);
+    shape.push_back(width);
+    shape.push_back(channels);
+    ok = WriteTensorFile(filename, "<f4", shape, pixels,
+                         size_t(width) * height * channels * sizeof(float));
+  } else {
+    std::cerr << "[SoftGL] Unknown image format: " << filename << std::endl;
+    return false;
+  }
+
+  if (!ok) {
+    std::cerr << "[SoftGL] Failed to write " << filename << std::endl;
+  }
+
+  return ok;
+}
+
+}  // namespace softcompute
@@ -0,0 +1,38 @@
+#ifndef SOFTCOMPUTE_IMAGE_FILE_H_
+#define SOFTCOMPUTE_IMAGE_FILE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "worker-pool.h"
+
+namespace softcompute {
+
+// Converts linear float pixels with `channels` (1 to 4) channels to 8 bits
+// with gamma 1/2.2 through a lookup table, clamping to [0, 1]. The last of 2
+// (gray-alpha) or 4 (RGBA) channels is alpha, which is scaled linearly
+// instead. `dst` gets the first `dst_channels` channels. The first row of `src` is the bottom of the
+// image, as rendered by GL, and becomes the last row of `dst`. Rows are split
+// over the workers of `pool` (nullptr: the calling thread only).
+void QuantizeImage(const float *src, uint32_t width, uint32_t height,
+                   uint32_t channels, uint32_t dst_channels, WorkerPool *pool,
+                   uint8_t *dst);
+
+// Writes linear float pixels laid out as for QuantizeImage(), choosing the
+// format from the extension of `filename`:
+//
+//   .png  8 bits through QuantizeImage(), with linear alpha
+//   .pfm  Portable float map, RGB or grayscale (alpha is dropped)
+//   .exr  OpenEXR, uncompressed 32-bit float scanlines
+//   .npy  NumPy array of shape (height, width, channels)
+//
+// Float formats keep the values as they are; .npy keeps the rows in buffer
+// order. Returns false for other extensions and when the file cannot be
+// written.
+bool WriteImage(const std::string &filename, const float *pixels,
+                uint32_t width, uint32_t height, uint32_t channels,
+                WorkerPool *pool);
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_IMAGE_FILE_H_
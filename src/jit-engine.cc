@@ -23,11 +23,14 @@
 #endif
 
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
 #include <sstream>
-#include <map>
 #include <vector>
 
+#include <unistd.h>
+
 #include "clang/Basic/DiagnosticOptions.h"
 #include "clang/CodeGen/CodeGenAction.h"
 #include "clang/Driver/Compilation.h"
@@ -41,6 +44,7 @@
 #include "llvm/ADT/SmallString.h"
 
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
 #include "llvm/ExecutionEngine/ObjectCache.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
@@ -51,6 +55,8 @@
 
 #include "llvm/IRReader/IRReader.h"
 
+#include "llvm/Object/SymbolSize.h"
+
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/ManagedStatic.h"
@@ -68,6 +74,7 @@ using namespace clang::driver;
 using namespace llvm;
 
 #include "jit-engine.h"
+#include "trace.h"
 
 namespace softcompute {
 
@@ -115,6 +122,101 @@ void *ShaderJITMemoryManager::getPointerToNamedFunction(const std::string &Name,
   return pfn;
 }
 
+#if (LLVM_VERSION_MAJOR >= 8)
+// Appends the functions of each emitted object to /tmp/perf-<pid>.map, which
+// `perf report` reads to name JIT code without `perf inject`.
+class PerfMapListener : public llvm::JITEventListener {
+ public:
+  PerfMapListener() : file_(nullptr) {}
+
+  void notifyObjectLoaded(ObjectKey K, const object::ObjectFile &Obj,
+                          const RuntimeDyld::LoadedObjectInfo &L) override {
+    (void)K;
+
+    // Symbol addresses of the debug object are load addresses.
+    object::OwningBinary<object::ObjectFile> DebugObjOwner =
+        L.getObjectForDebug(Obj);
+    const object::ObjectFile *DebugObj = DebugObjOwner.getBinary();
+    if (!DebugObj) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!file_) {
+      char filename[64];
+      snprintf(filename, sizeof(filename), "/tmp/perf-%d.map",
+               static_cast<int>(getpid()));
+      file_ = fopen(filename, "a");
+      if (!file_) {
+        return;
+      }
+    }
+
+    for (const std::pair<object::SymbolRef, uint64_t> &P :
+         object::computeSymbolSizes(*DebugObj)) {
+      const object::SymbolRef &Sym = P.first;
+
+      Expected<object::SymbolRef::Type> Type = Sym.getType();
+      if (!Type) {
+        consumeError(Type.takeError());
+        continue;
+      }
+      if (*Type != object::SymbolRef::ST_Function) {
+        continue;
+      }
+
+      Expected<StringRef> Name = Sym.getName();
+      Expected<uint64_t> Address = Sym.getAddress();
+      if (!Name || !Address) {
+        if (!Name) consumeError(Name.takeError());
+        if (!Address) consumeError(Address.takeError());
+        continue;
+      }
+
+      fprintf(file_, "%llx %llx %s\n",
+              static_cast<unsigned long long>(*Address),
+              static_cast<unsigned long long>(P.second),
+              Name->str().c_str());
+    }
+
+    fflush(file_);
+  }
+
+ private:
+  std::mutex mutex_;
+  FILE *file_;
+};
+#endif
+
+// Makes JIT-compiled shaders visible to debuggers and profilers. GDB is
+// always told about emitted objects. With SOFTCOMPUTE_PERF set, functions
+// are also written to /tmp/perf-<pid>.map and, when LLVM is built with
+// LLVM_USE_PERF, to a jitdump file for `perf inject --jit`. Compile with
+// `-g` to get source lines of the generated C++.
+static void RegisterJITEventListeners(llvm::ExecutionEngine *EE) {
+  EE->RegisterJITEventListener(
+      llvm::JITEventListener::createGDBRegistrationListener());
+
+  const char *perf = getenv("SOFTCOMPUTE_PERF");
+  if (!perf || !perf[0] || (perf[0] == '0')) {
+    return;
+  }
+
+#if (LLVM_VERSION_MAJOR >= 8)
+  // Shared by all engines. Never freed since engines are not either.
+  static PerfMapListener *perf_map = new PerfMapListener();
+  EE->RegisterJITEventListener(perf_map);
+
+  // nullptr unless LLVM is built with LLVM_USE_PERF.
+  llvm::JITEventListener *jitdump =
+      llvm::JITEventListener::createPerfJITEventListener();
+  if (jitdump) {
+    EE->RegisterJITEventListener(jitdump);
+  }
+#endif
+}
+
 static std::string GetExecutablePath(const char *Argv0) {
   // This just needs to be some symbol in the binary; C++ doesn't
   // allow taking the address of ::main however.
@@ -165,6 +267,8 @@ bool ShaderInstance::Impl::Compile(const std::string &type,
                                    const std::string &options,
                                    const std::string &filename) {
   (void)type;
+  TraceScope trace("compile", "JIT compile");
+
   std::string ext = GetFileExtension(filename);
 
   std::string abspath = filename;  // @fixme
@@ -402,9 +506,12 @@ bool ShaderInstance::Impl::Compile(const std::string &type,
 
   // Create and execute the frontend to generate an LLVM bitcode module.
   Act = new EmitLLVMOnlyAction();
-  if (!Clang->ExecuteAction(*Act)) {
-    fprintf(stderr, "[ShaderEngine] ExecuteAction failed.\n");
-    return false;
+  {
+    CompileStageScope frontend_trace(kCompileCppToIR, "clang frontend");
+    if (!Clang->ExecuteAction(*Act)) {
+      fprintf(stderr, "[ShaderEngine] ExecuteAction failed.\n");
+      return false;
+    }
   }
 
   // Explicitly free Clang
@@ -426,30 +533,41 @@ bool ShaderInstance::Impl::Compile(const std::string &type,
     return false;
   }
 
-  std::string Error;
-  EE = llvm::EngineBuilder(std::move(Module))
-           .setMCJITMemoryManager(llvm::make_unique<ShaderJITMemoryManager>())
-           .create();
-  if (!EE) {
-    llvm::errs() << "unable to make execution engine: " << Error << "\n";
-    return false;
-  }
+  {
+    CompileStageScope backend_trace(kCompileCodegen, "LLVM backend");
 
-  // Disable symbol search using dlsym for security(e.g. disable system() call
-  // from the shader)
-  // EE->DisableSymbolSearching(); // @todo { Turn on this feature to increase
-  // security. }
+    std::string Error;
+    EE = llvm::EngineBuilder(std::move(Module))
+             .setMCJITMemoryManager(llvm::make_unique<ShaderJITMemoryManager>())
+             .create();
+    if (!EE) {
+      llvm::errs() << "unable to make execution engine: " << Error << "\n";
+      return false;
+    }
 
-  EE->DisableLazyCompilation(true);
+    // Disable symbol search using dlsym for security(e.g. disable system()
+    // call from the shader)
+    // EE->DisableSymbolSearching(); // @todo { Turn on this feature to
+    // increase security. }
 
-  // Install unknown symbol resolver
-  // EE->InstallLazyFunctionCreator(CustomSymbolResolver);
+    EE->DisableLazyCompilation(true);
 
-  EntryPoint = EE->getPointerToFunction(EntryFn);
-  assert(EntryPoint);
+    // Before code is emitted by getPointerToFunction().
+    RegisterJITEventListeners(EE);
 
-  // Need to call finalizeObject to ensure module is usable.
-  EE->finalizeObject();
+    // Install unknown symbol resolver
+    // EE->InstallLazyFunctionCreator(CustomSymbolResolver);
+
+    EntryPoint = EE->getPointerToFunction(EntryFn);
+    assert(EntryPoint);
+  }
+
+  {
+    CompileStageScope load_trace(kCompileLoad, "finalize");
+
+    // Need to call finalizeObject to ensure module is usable.
+    EE->finalizeObject();
+  }
 
   printf("[JITEngine] Shader [ %s ] compile OK.\n", filename.c_str());
 
@@ -544,7 +662,12 @@ ShaderEngine::Impl::~Impl() {}
 ShaderEngine::ShaderEngine(bool abortOnFailure)
     : impl(new Impl(abortOnFailure)) {}
 
-ShaderEngine::~ShaderEngine() { delete impl; }
+ShaderEngine::~ShaderEngine() {
+  for (size_t i = 0; i < shaderInstances_.size(); i++) {
+    delete shaderInstances_[i];
+  }
+  delete impl;
+}
 
 ShaderInstance *ShaderEngine::Compile(const std::string &type,
                                       unsigned int shaderID,
@@ -554,18 +677,20 @@ ShaderInstance *ShaderEngine::Compile(const std::string &type,
   assert(impl);
   assert(shaderID != (unsigned int)(-1));
 
-  if (shaderInstanceMap_.find(shaderID) != shaderInstanceMap_.end()) {
-    printf("[ShaderEngine] Err: Duplicate shader ID.\n");
-    ShaderInstance *instance = shaderInstanceMap_[shaderID];
-    if (instance) {
-      delete instance;
-    }
+  if (shaderID >= shaderInstances_.size()) {
+    shaderInstances_.resize(shaderID + 1, nullptr);
+  }
+
+  if (shaderInstances_[shaderID]) {
+    // Recompiling replaces the previous instance.
+    delete shaderInstances_[shaderID];
+    shaderInstances_[shaderID] = nullptr;
   }
 
   ShaderInstance *shaderInstance =
       impl->Compile(type, shaderID, paths, options, filename);
 
-  shaderInstanceMap_[shaderID] = shaderInstance;
+  shaderInstances_[shaderID] = shaderInstance;
 
   return shaderInstance;
 }
@@ -15,7 +15,6 @@
 #ifndef JIT_ENGINE_H_
 #define JIT_ENGINE_H_
 
-#include <map>
 #include <string>
 #include <vector>
 
@@ -51,10 +50,10 @@ class ShaderEngine {
 
   ShaderInstance *GetShaderInterface(uint32_t shaderID);
 
+  // Shader IDs index an array, so keep them small and dense.
   ShaderInstance *GetShaderInstance(unsigned int shaderID) {
-    // @todo { use array for faster lookup. }
-    if (shaderInstanceMap_.find(shaderID) != shaderInstanceMap_.end()) {
-      return shaderInstanceMap_[shaderID];
+    if (shaderID < shaderInstances_.size()) {
+      return shaderInstances_[shaderID];
     } else {
       return nullptr;
     }
@@ -64,7 +63,7 @@ class ShaderEngine {
   class Impl;
   Impl *impl;
 
-  std::map<unsigned int, ShaderInstance *> shaderInstanceMap_;
+  std::vector<ShaderInstance *> shaderInstances_;  // Indexed by shader ID
 };
 }  // namespace softcompute
 
@@ -0,0 +1,561 @@
+#include "job-file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include <stdint.h>
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wreserved-id-macro"
+#pragma clang diagnostic ignored "-Wdocumentation"
+#pragma clang diagnostic ignored "-Wundefined-reinterpret-cast"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wshadow"
+#pragma clang diagnostic ignored "-Wswitch-enum"
+#pragma clang diagnostic ignored "-Wpadded"
+#pragma clang diagnostic ignored "-Wdouble-promotion"
+#pragma clang diagnostic ignored "-Wcast-align"
+#pragma clang diagnostic ignored "-Wimplicit-fallthrough"
+#pragma clang diagnostic ignored "-Wmissing-prototypes"
+#pragma clang diagnostic ignored "-Wdeprecated"
+#pragma clang diagnostic ignored "-Wweak-vtables"
+#ifdef __APPLE__
+#if __clang_major__ >= 8 && __clang_minor__ >= 1
+#pragma clang diagnostic ignored "-Wcomma"
+#endif
+#else  // __APPLE__
+#if (__clang_major__ >= 4) || (__clang_major__ >= 3 && __clang_minor__ > 8)
+#pragma clang diagnostic ignored "-Wcomma"
+#endif
+#endif  // __APPLE__
+#endif
+
+#include "nlohmann/json.hpp"
+
+// ghc filesystem
+#include "ghc/filesystem.hpp"
+
+namespace fs = ghc::filesystem;
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include "tensor-file.h"
+
+using namespace softgl;
+
+namespace softcompute {
+
+bool
+LoadShader(
+  GLenum shaderType,  // GL_VERTEX_SHADER or GL_FRAGMENT_SHADER(or maybe GL_COMPUTE_SHADER)
+  GLuint& shader,
+  const char* shaderSourceFilename)
+{
+  GLint val = 0;
+
+  // free old shader/program
+  if (shader != 0) glDeleteShader(shader);
+
+  std::ifstream ifs(shaderSourceFilename, std::ios::binary);
+  if (!ifs) {
+    fprintf(stderr, "failed to load shader: %s\n", shaderSourceFilename);
+    return false;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  const std::string source = ss.str();
+
+  const GLchar *src = source.c_str();
+
+  shader = glCreateShader(shaderType);
+  glShaderSource(shader, 1, &src, NULL);
+  glCompileShader(shader);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &val);
+  if (val != GL_TRUE) {
+    char log[4096];
+    GLsizei msglen;
+    glGetShaderInfoLog(shader, 4096, &msglen, log);
+    printf("%s\n", log);
+    fprintf(stderr, "failed to compile shader: %s\n", shaderSourceFilename);
+    glDeleteShader(shader);
+    shader = 0;
+    return false;
+  }
+
+  printf("Load shader [ %s ] OK\n", shaderSourceFilename);
+  return true;
+}
+
+bool
+LinkShader(
+  GLuint& prog,
+  GLuint& compShader)
+{
+  GLint val = 0;
+
+  if (prog != 0) {
+    glDeleteProgram(prog);
+  }
+
+  prog = glCreateProgram();
+
+  glAttachShader(prog, compShader);
+  glLinkProgram(prog);
+
+  glGetProgramiv(prog, GL_LINK_STATUS, &val);
+  if (val != GL_TRUE) {
+    fprintf(stderr, "failed to link shader\n");
+    glDeleteProgram(prog);
+    prog = 0;
+    return false;
+  }
+
+  printf("Link shader OK\n");
+
+  return true;
+}
+
+// Buffer of a batch job, bound to `binding` of `target`.
+struct JobBuffer
+{
+    GLuint id;
+    GLenum target;
+    GLuint binding;
+    size_t size;
+    std::string output;  // File to write the contents to after the job
+    std::string dtype;   // NumPy type string of .npy and raw+sidecar outputs
+    std::vector<GLuint64> shape;
+    bool tensor_output;  // Write `output` as .npy or raw with a JSON sidecar
+    std::vector<GLsizei> image;  // Width, height and channels of image outputs
+};
+
+// Buffers of a job, deleted however the job ends, including by an exception
+// for an invalid job file.
+struct JobBuffers
+{
+    std::vector<JobBuffer> buffers;
+
+    JobBuffers() {}
+    ~JobBuffers()
+    {
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            glDeleteBuffers(1, &buffers[i].id);
+        }
+    }
+
+  private:
+    JobBuffers(const JobBuffers &);
+    JobBuffers &operator=(const JobBuffers &);
+};
+
+// NumPy type string of a "type" of the job file.
+static std::string GetDType(const std::string &type)
+{
+    return (type == "int") ? "<i4" : (type == "uint") ? "<u4" : "<f4";
+}
+
+// Reads a file of a job. Relative paths are relative to the job file.
+static bool ReadBinaryFile(const fs::path &path, std::vector<uint8_t> *data)
+{
+    std::ifstream ifs(path.string(), std::ios::binary);
+    if (!ifs)
+    {
+        std::cerr << "Failed to open " << path.string() << std::endl;
+        return false;
+    }
+
+    data->assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Initial contents of a buffer: "data" with a "type" of float (default), int
+// or uint, raw bytes from "file", or "size" zero bytes.
+static bool GetBufferContents(const nlohmann::json &j, const fs::path &base_dir, std::vector<uint8_t> *data)
+{
+    if (j.contains("data"))
+    {
+        const std::string type = j.value("type", "float");
+        const nlohmann::json &values = j["data"];
+        data->resize(values.size() * 4);
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            if (type == "float")
+            {
+                float v = values[i].get<float>();
+                memcpy(&data->at(i * 4), &v, 4);
+            }
+            else if (type == "int")
+            {
+                int32_t v = values[i].get<int32_t>();
+                memcpy(&data->at(i * 4), &v, 4);
+            }
+            else if (type == "uint")
+            {
+                uint32_t v = values[i].get<uint32_t>();
+                memcpy(&data->at(i * 4), &v, 4);
+            }
+            else
+            {
+                std::cerr << "Unknown buffer type: " << type << std::endl;
+                return false;
+            }
+        }
+    }
+    else if (j.contains("file"))
+    {
+        if (!ReadBinaryFile(base_dir / j["file"].get<std::string>(), data))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        data->assign(j.value("size", size_t(0)), 0);
+    }
+
+    if (j.contains("size") && (data->size() < j["size"].get<size_t>()))
+    {
+        data->resize(j["size"].get<size_t>(), 0);
+    }
+
+    return true;
+}
+
+// Sets a uniform from a number or up to 4 numbers, converted to the type the
+// shader declares. {"int": ...} is accepted too, for older job files.
+static bool SetUniform(GLuint prog, const std::string &name, const nlohmann::json &value)
+{
+    GLint location = glGetUniformLocation(prog, name.c_str());
+    if (location < 0)
+    {
+        std::cerr << "Uniform not found: " << name << std::endl;
+        return false;
+    }
+
+    GLint array_size = 0;
+    GLenum type = 0;
+    glGetActiveUniform(prog, GLuint(location), 0, nullptr, &array_size, &type, nullptr);
+
+    // Component type and count of the uniform. Matrices cannot be set.
+    GLenum component = 0;
+    size_t count = 0;
+    switch (type)
+    {
+    case GL_FLOAT: component = GL_FLOAT; count = 1; break;
+    case GL_FLOAT_VEC2: component = GL_FLOAT; count = 2; break;
+    case GL_FLOAT_VEC3: component = GL_FLOAT; count = 3; break;
+    case GL_FLOAT_VEC4: component = GL_FLOAT; count = 4; break;
+    case GL_INT: component = GL_INT; count = 1; break;
+    case GL_INT_VEC2: component = GL_INT; count = 2; break;
+    case GL_INT_VEC3: component = GL_INT; count = 3; break;
+    case GL_INT_VEC4: component = GL_INT; count = 4; break;
+    case GL_UNSIGNED_INT: component = GL_UNSIGNED_INT; count = 1; break;
+    case GL_UNSIGNED_INT_VEC2: component = GL_UNSIGNED_INT; count = 2; break;
+    case GL_UNSIGNED_INT_VEC3: component = GL_UNSIGNED_INT; count = 3; break;
+    case GL_UNSIGNED_INT_VEC4: component = GL_UNSIGNED_INT; count = 4; break;
+    default: std::cerr << "Uniform " << name << " has a type that cannot be set" << std::endl; return false;
+    }
+
+    nlohmann::json v = (value.is_object() && value.contains("int")) ? value["int"] : value;
+    if (!v.is_array())
+    {
+        v = nlohmann::json::array({v});
+    }
+
+    if (v.size() != count)
+    {
+        std::cerr << "Uniform " << name << " needs " << count << " values" << std::endl;
+        return false;
+    }
+
+    double x[4] = {0.0, 0.0, 0.0, 0.0};
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!v[i].is_number())
+        {
+            std::cerr << "Uniform " << name << " needs numbers" << std::endl;
+            return false;
+        }
+        x[i] = v[i].get<double>();
+    }
+
+    if (component == GL_FLOAT)
+    {
+        const GLfloat f[4] = {GLfloat(x[0]), GLfloat(x[1]), GLfloat(x[2]), GLfloat(x[3])};
+        switch (count)
+        {
+        case 1: glUniform1f(location, f[0]); break;
+        case 2: glUniform2f(location, f[0], f[1]); break;
+        case 3: glUniform3f(location, f[0], f[1], f[2]); break;
+        default: glUniform4f(location, f[0], f[1], f[2], f[3]); break;
+        }
+    }
+    else if (component == GL_INT)
+    {
+        const GLint i[4] = {GLint(x[0]), GLint(x[1]), GLint(x[2]), GLint(x[3])};
+        switch (count)
+        {
+        case 1: glUniform1i(location, i[0]); break;
+        case 2: glUniform2i(location, i[0], i[1]); break;
+        case 3: glUniform3i(location, i[0], i[1], i[2]); break;
+        default: glUniform4i(location, i[0], i[1], i[2], i[3]); break;
+        }
+    }
+    else
+    {
+        const GLuint u[4] = {GLuint(x[0]), GLuint(x[1]), GLuint(x[2]), GLuint(x[3])};
+        switch (count)
+        {
+        case 1: glUniform1ui(location, u[0]); break;
+        case 2: glUniform2ui(location, u[0], u[1]); break;
+        case 3: glUniform3ui(location, u[0], u[1], u[2]); break;
+        default: glUniform4ui(location, u[0], u[1], u[2], u[3]); break;
+        }
+    }
+
+    return true;
+}
+
+// Runs one job of a batch file. `programs` caches linked programs by shader
+// path for the following jobs.
+static bool RunJob(const nlohmann::json &job, const fs::path &base_dir, std::map<std::string, GLuint> *programs)
+{
+    const std::string shader = (base_dir / job.at("shader").get<std::string>()).string();
+
+    GLuint prog = 0;
+    std::map<std::string, GLuint>::const_iterator it = programs->find(shader);
+    if (it != programs->end())
+    {
+        prog = it->second;
+    }
+    else
+    {
+        // The program keeps the compiled shader; it is not needed after linking.
+        GLuint shader_id = 0;
+        const bool built = LoadShader(GL_COMPUTE_SHADER, shader_id, shader.c_str()) && LinkShader(prog, shader_id);
+        glDeleteShader(shader_id);
+        if (!built)
+        {
+            return false;
+        }
+        (*programs)[shader] = prog;
+    }
+
+    glUseProgram(prog);
+
+    JobBuffers job_buffers;
+    std::vector<JobBuffer> &buffers = job_buffers.buffers;
+    bool ok = true;
+    if (job.contains("buffers"))
+    {
+        const nlohmann::json &list = job["buffers"];
+        for (size_t i = 0; i < list.size(); i++)
+        {
+            // Added before it is set up, so that it is deleted on any error.
+            buffers.push_back(JobBuffer());
+            JobBuffer &buffer = buffers.back();
+            buffer.target = (list[i].value("target", "storage") == "uniform") ? GL_UNIFORM_BUFFER : GL_SHADER_STORAGE_BUFFER;
+            buffer.binding = list[i].value("binding", GLuint(i));
+            buffer.dtype = GetDType(list[i].value("type", "float"));
+            buffer.tensor_output = false;
+
+            glGenBuffers(1, &buffer.id);
+            glBindBuffer(buffer.target, buffer.id);
+
+            if (list[i].contains("tensor"))
+            {
+                // .npy or raw file with JSON sidecar, mapped instead of read.
+                const std::string tensor = (base_dir / list[i]["tensor"].get<std::string>()).string();
+                softcompute::TensorHeader header;
+                if (!softcompute::ReadTensorHeader(tensor, &header) || !BufferDataFromTensorFile(buffer.target, tensor.c_str()))
+                {
+                    ok = false;
+                    break;
+                }
+                buffer.size = static_cast<size_t>(header.data_size);
+                buffer.dtype = header.dtype;
+                buffer.shape = header.shape;
+            }
+            else
+            {
+                std::vector<uint8_t> data;
+                if (!GetBufferContents(list[i], base_dir, &data))
+                {
+                    ok = false;
+                    break;
+                }
+                buffer.size = data.size();
+                glBufferData(buffer.target, static_cast<GLsizeiptr>(data.size()), data.data(), GL_STATIC_DRAW);
+            }
+
+            if (list[i].contains("output"))
+            {
+                buffer.output = (base_dir / list[i]["output"].get<std::string>()).string();
+                buffer.tensor_output = fs::path(buffer.output).extension() == ".npy";
+            }
+            if (list[i].contains("dtype"))
+            {
+                buffer.dtype = list[i]["dtype"].get<std::string>();
+                buffer.tensor_output = true;
+            }
+            if (list[i].contains("shape"))
+            {
+                buffer.shape = list[i]["shape"].get<std::vector<uint64_t>>();
+            }
+            if (list[i].contains("image"))
+            {
+                buffer.image = list[i]["image"].get<std::vector<GLsizei>>();
+                buffer.image.resize(3, 4);
+            }
+
+            glBindBufferBase(buffer.target, buffer.binding, buffer.id);
+        }
+    }
+
+    if (ok && job.contains("uniforms"))
+    {
+        const nlohmann::json &uniforms = job["uniforms"];
+        for (auto u = uniforms.begin(); ok && (u != uniforms.end()); ++u)
+        {
+            ok = SetUniform(prog, u.key(), u.value());
+        }
+    }
+
+    if (ok)
+    {
+        std::vector<GLuint> groups = job.value("dispatch", std::vector<GLuint>{1, 1, 1});
+        groups.resize(3, 1);
+        const int repeat = job.value("repeat", 1);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeat; r++)
+        {
+            glDispatchCompute(groups[0], groups[1], groups[2]);
+        }
+        glFinish();
+        auto end = std::chrono::steady_clock::now();
+
+        printf("%s: %d dispatch(es) of %u x %u x %u in %.3f ms\n", job.value("name", shader).c_str(), repeat,
+               groups[0], groups[1], groups[2], std::chrono::duration<double, std::milli>(end - start).count());
+
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            if (buffers[i].output.empty())
+            {
+                continue;
+            }
+
+            if (!buffers[i].image.empty())
+            {
+                if (!SaveBufferAsImage(buffers[i].id, buffers[i].output.c_str(), buffers[i].image[0], buffers[i].image[1],
+                                       buffers[i].image[2]))
+                {
+                    std::cerr << "Failed to write " << buffers[i].output << std::endl;
+                    ok = false;
+                }
+                continue;
+            }
+
+            if (buffers[i].tensor_output)
+            {
+                if (!SaveBufferAsTensorFile(buffers[i].id, buffers[i].output.c_str(), buffers[i].dtype.c_str(),
+                                            buffers[i].shape.data(), static_cast<GLsizei>(buffers[i].shape.size())))
+                {
+                    std::cerr << "Failed to write " << buffers[i].output << std::endl;
+                    ok = false;
+                }
+                continue;
+            }
+
+            glBindBuffer(buffers[i].target, buffers[i].id);
+            const void *data = glMapBuffer(buffers[i].target, GL_READ_ONLY);
+
+            std::ofstream ofs(buffers[i].output, std::ios::binary);
+            if (!ofs || !data)
+            {
+                std::cerr << "Failed to write " << buffers[i].output << std::endl;
+                ok = false;
+            }
+            else
+            {
+                ofs.write(static_cast<const char *>(data), static_cast<std::streamsize>(buffers[i].size));
+            }
+            glUnmapBuffer(buffers[i].target);
+        }
+    }
+
+    return ok;
+}
+
+// Runs all jobs of a JSON job file in this process, so that glslang, the
+// compiled programs and the worker threads are set up once. The file is
+//
+//   {"jobs": [{"name": "...", "shader": "twice.comp",
+//              "buffers": [{"binding": 0, "data": [1, 2, 3, 4]},
+//                          {"binding": 2, "tensor": "weights.npy"},
+//                          {"binding": 1, "size": 16, "output": "out.bin"}],
+//              "uniforms": {"scale": 2.0, "count": {"int": 4}},
+//              "dispatch": [1, 1, 1], "repeat": 1}, ...]}
+//
+// Returns the number of failed jobs.
+int RunJobFile(const std::string &filename)
+{
+    std::ifstream ifs(filename);
+    if (!ifs)
+    {
+        std::cerr << "Failed to open job file: " << filename << std::endl;
+        return 1;
+    }
+
+    nlohmann::json jobs = nlohmann::json::parse(ifs, nullptr, /* allow_exceptions */ false);
+    if (jobs.is_discarded() || !jobs.contains("jobs") || !jobs["jobs"].is_array())
+    {
+        std::cerr << "Invalid job file: " << filename << std::endl;
+        return 1;
+    }
+
+    const fs::path base_dir = fs::path(filename).parent_path();
+    std::map<std::string, GLuint> programs;
+
+    int num_failed = 0;
+    for (size_t i = 0; i < jobs["jobs"].size(); i++)
+    {
+        bool ok = false;
+        try
+        {
+            ok = RunJob(jobs["jobs"][i], base_dir, &programs);
+        }
+        catch (const nlohmann::json::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+
+        if (!ok)
+        {
+            std::cerr << "Job " << i << " failed." << std::endl;
+            num_failed++;
+        }
+    }
+
+    for (std::map<std::string, GLuint>::const_iterator it = programs.begin(); it != programs.end(); ++it)
+    {
+        glDeleteProgram(it->second);
+    }
+
+    return num_failed;
+}
+
+}  // namespace softcompute
@@ -0,0 +1,26 @@
+#ifndef SOFTCOMPUTE_JOB_FILE_H_
+#define SOFTCOMPUTE_JOB_FILE_H_
+
+#include <string>
+
+#include "softgl.h"
+
+namespace softcompute {
+
+// Compiles a shader from a file, replacing `shader` if it is not 0. On failure
+// the shader is deleted and `shader` is 0.
+bool LoadShader(softgl::GLenum shaderType, softgl::GLuint &shader,
+                const char *shaderSourceFilename);
+
+// Links `compShader` into a new `prog`, replacing `prog` if it is not 0. On
+// failure the program is deleted and `prog` is 0.
+bool LinkShader(softgl::GLuint &prog, softgl::GLuint &compShader);
+
+// Runs all jobs of a JSON job file in this process. Each job's buffers are
+// deleted when it ends, also when the job file is invalid. Returns the number
+// of failed jobs, or 1 when the file cannot be read or has no "jobs" array.
+int RunJobFile(const std::string &filename);
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_JOB_FILE_H_
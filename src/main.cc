@@ -2,6 +2,8 @@
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <sstream>
 #include <vector>
 
@@ -37,13 +39,8 @@
 #endif  // __APPLE__
 #endif
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
 #include "OptionParser.h"
 
-#include "nlohmann/json.hpp"
-
 // ghc filesystem
 #include "ghc/filesystem.hpp"
 
@@ -53,6 +50,7 @@ namespace fs = ghc::filesystem;
 #pragma clang diagnostic pop
 #endif
 
+#include "job-file.h"
 #include "softgl.h"
 
 using namespace softgl;
@@ -84,40 +82,6 @@ typedef struct spirv_cross_interface *(*spirv_cross_get_interface_fn)();
 
 #define WINDOW_SIZE 1024
 
-inline static unsigned char fclamp(float x)
-{
-    int i = static_cast<int>(std::pow(x, 1.0f / 2.2f) * 256.0f); // simple gamma correction
-    if (i > 255)
-        i = 255;
-    if (i < 0)
-        i = 0;
-
-    return static_cast<unsigned char>(i);
-}
-
-static void SaveImageAsPNG(const char *filename, const float *rgba, int width, int height)
-{
-
-    std::vector<unsigned char> ldr(static_cast<size_t>(width * height * 3));
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            // Flip Y
-            ldr[3 * static_cast<size_t>((height - y - 1) * width + x) + 0] = fclamp(rgba[4 * (y * width + x) + 0]);
-            ldr[3 * static_cast<size_t>((height - y - 1) * width + x) + 1] = fclamp(rgba[4 * (y * width + x) + 1]);
-            ldr[3 * static_cast<size_t>((height - y - 1) * width + x) + 2] = fclamp(rgba[4 * (y * width + x) + 2]);
-        }
-    }
-
-    int len = stbi_write_png(filename, width, height, 3, &ldr.at(0), width * 3);
-    if (len < 1)
-    {
-        printf("Failed to save image\n");
-        exit(-1);
-    }
-}
-
 static bool exec_command(std::vector<std::string> *outputs, const std::string &cmd)
 {
     outputs->clear();
@@ -505,7 +469,7 @@ int main(int argc, char **argv)
     interface()->destruct(shader);
 
     // Save imag
-    SaveImageAsPNG("output.png", &outbuf.at(0), WINDOW_SIZE, WINDOW_SIZE);
+    softcompute::WriteImage("output.png", &outbuf.at(0), WINDOW_SIZE, WINDOW_SIZE, 4, nullptr);
 
     std::cout << "output.png written." << std::endl;
 
@@ -513,70 +477,44 @@ int main(int argc, char **argv)
 }
 #endif
 
-bool
-LoadShader(
-  GLenum shaderType,  // GL_VERTEX_SHADER or GL_FRAGMENT_SHADER(or maybe GL_COMPUTE_SHADER)
-  GLuint& shader,
-  const char* shaderSourceFilename)
+// Prints statistics of the dispatches finished so far.
+static void PrintDispatchStats()
 {
-  GLint val = 0;
-
-  // free old shader/program
-  if (shader != 0) glDeleteShader(shader);
-
-  static GLchar srcbuf[16384];
-  FILE *fp = fopen(shaderSourceFilename, "rb");
-  if (!fp) {
-    fprintf(stderr, "failed to load shader: %s\n", shaderSourceFilename);
-    return false;
-  }
-  fseek(fp, 0, SEEK_END);
-  size_t len = ftell(fp);
-  rewind(fp);
-  len = fread(srcbuf, 1, len, fp);
-  srcbuf[len] = 0;
-  fclose(fp);
-
-  static const GLchar *src = srcbuf;
-
-  shader = glCreateShader(shaderType);
-  glShaderSource(shader, 1, &src, NULL);
-  glCompileShader(shader);
-  glGetShaderiv(shader, GL_COMPILE_STATUS, &val);
-  if (val != GL_TRUE) {
-    char log[4096];
-    GLsizei msglen;
-    glGetShaderInfoLog(shader, 4096, &msglen, log);
-    printf("%s\n", log);
-    assert(val == GL_TRUE && "failed to compile shader");
-  }
-
-  printf("Load shader [ %s ] OK\n", shaderSourceFilename);
-  return true;
-}
-
-bool
-LinkShader(
-  GLuint& prog,
-  GLuint& compShader)
-{
-  GLint val = 0;
-
-  if (prog != 0) {
-    glDeleteProgram(prog);
-  }
-
-  prog = glCreateProgram();
-
-  glAttachShader(prog, compShader);
-  glLinkProgram(prog);
-
-  glGetProgramiv(prog, GL_LINK_STATUS, &val);
-  assert(val == GL_TRUE && "failed to link shader");
-
-  printf("Link shader OK\n");
-
-  return true;
+    softgl::DispatchStats stats[64];
+    GLsizei n = 0;
+    while ((n = softgl::GetDispatchStats(stats, 64)) > 0)
+    {
+        for (GLsizei i = 0; i < n; i++)
+        {
+            const softgl::DispatchStats &s = stats[i];
+            printf("dispatch %llu: %.3f ms, %llu workgroups, %u threads",
+                   static_cast<unsigned long long>(s.sequence),
+                   static_cast<double>(s.wall_time_ns) / 1.0e6,
+                   static_cast<unsigned long long>(s.num_workgroups), s.num_threads);
+
+            // Needs both cycles and instructions.
+            if (((s.counter_mask & 3) == 3) && (s.cycles > 0) && (s.instructions > 0))
+            {
+                printf(", IPC %.2f, %.3f bytes/instruction",
+                       static_cast<double>(s.instructions) / static_cast<double>(s.cycles),
+                       static_cast<double>(s.bytes_bound) / static_cast<double>(s.instructions));
+            }
+            if (s.counter_mask & 4)
+            {
+                printf(", %llu LLC misses", static_cast<unsigned long long>(s.llc_misses));
+            }
+            if (s.counter_mask & 8)
+            {
+                printf(", %llu branch misses", static_cast<unsigned long long>(s.branch_misses));
+            }
+            if (s.bytes_bound_huge_pages > 0)
+            {
+                printf(", %.1f of %.1f MB bound on huge pages", static_cast<double>(s.bytes_bound_huge_pages) / 1.0e6,
+                       static_cast<double>(s.bytes_bound) / 1.0e6);
+            }
+            printf("\n");
+        }
+    }
 }
 
 int main(int argc, char **argv)
@@ -587,11 +525,15 @@ int main(int argc, char **argv)
 
     parser.add_option("-o", "--options").help("Compiler options. e.g. \"-O2\"");
     parser.add_option("-v", "--verbose").action("store_true").set_default("false").help("Verbose mode.");
+    parser.add_option("-t", "--trace").help("Write a Chrome trace of compilation and dispatches to the file.");
+    parser.add_option("--heatmap").help("Write per-workgroup cost of each dispatch to PREFIX-<n>.png/.csv.");
+    parser.add_option("--perf-counters").action("store_true").set_default("false").help("Count CPU cycles, instructions and cache/branch misses per dispatch.");
+    parser.add_option("-j", "--jobs").help("Run the jobs of a JSON job file in this process.");
 
     optparse::Values options = parser.parse_args(argc, argv);
     std::vector<std::string> args = parser.args();
 
-    if (args.empty())
+    if (args.empty() && !options.is_set("jobs"))
     {
         parser.print_help();
         return -1;
@@ -605,35 +547,51 @@ int main(int argc, char **argv)
 
     std::string compiler_options = options["options"];
 
-    std::string filename = args[0];
-
     softgl::InitSoftGL();
 
-    softgl::SetJITCompilerOptions(compiler_options.c_str());
+    if (options.is_set("trace"))
+    {
+        softgl::EnableTracing(options["trace"].c_str());
+    }
 
-    // HACK
+    if (options.is_set("heatmap"))
     {
-      GLuint shader_id = glCreateShader(GL_COMPUTE_SHADER);
-      bool ret = LoadShader(GL_COMPUTE_SHADER, shader_id, filename.c_str());
-      if (!ret) {
-        std::cerr << "Failed to load shader : " << filename << std::endl;
-        return EXIT_FAILURE;
-      }
+        softgl::EnableWorkgroupHeatmap(options["heatmap"].c_str());
+    }
+
+    if (options.get("perf_counters"))
+    {
+        softgl::EnablePerfCounters(GL_TRUE);
+    }
 
-      std::cout << "shader_id = " << shader_id << std::endl;
+    softgl::SetJITCompilerOptions(compiler_options.c_str());
 
-      GLuint prog = 0;
-      ret = LinkShader(prog, shader_id);
-      if (!ret) {
-        std::cerr << "Failed to link shader" << std::endl;
-        return EXIT_FAILURE;
-      }
+    int num_failed = 0;
+    if (options.is_set("jobs"))
+    {
+        num_failed = softcompute::RunJobFile(options["jobs"]);
+    }
+    else
+    {
+        // Compile and link only.
+        std::string filename = args[0];
 
-      GLint idx = glGetUniformBlockIndex(prog, "radius");
-      std::cout << "idx = " << idx << std::endl;
+        GLuint shader_id = 0;
+        GLuint prog = 0;
+        if (!softcompute::LoadShader(GL_COMPUTE_SHADER, shader_id, filename.c_str()) ||
+            !softcompute::LinkShader(prog, shader_id))
+        {
+            std::cerr << "Failed to build shader : " << filename << std::endl;
+            num_failed = 1;
+        }
+        glDeleteShader(shader_id);
+        glDeleteProgram(prog);
     }
 
+    glFinish();
+    PrintDispatchStats();
+
     softgl::ReleaseSoftGL();
 
-    return EXIT_SUCCESS;
+    return (num_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
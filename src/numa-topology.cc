@@ -0,0 +1,263 @@
+#include "numa-topology.h"
+
+#include "cpu-affinity.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string>
+#endif
+
+namespace softcompute {
+
+NumaTopology::NumaTopology() : nodes_(1) { nodes_[0].id = 0; }
+
+NumaTopology::NumaTopology(const std::vector<int> &cpus) : nodes_(1) {
+  nodes_[0].id = 0;
+  nodes_[0].cpus = cpus;
+}
+
+NumaTopology NumaTopology::Restrict(const std::vector<int> &cpus) const {
+  NumaTopology topology;
+  topology.nodes_.clear();
+
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    Node node;
+    node.id = nodes_[i].id;
+    node.cpus = IntersectCpus(nodes_[i].cpus, cpus);
+    if (!node.cpus.empty()) {
+      topology.nodes_.push_back(node);
+    }
+  }
+
+  if (topology.nodes_.empty()) {
+    return NumaTopology(cpus);
+  }
+
+  return topology;
+}
+
+size_t NumaTopology::GetNumCpus() const {
+  size_t num_cpus = 0;
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    num_cpus += nodes_[i].cpus.size();
+  }
+  return num_cpus;
+}
+
+#ifdef __linux__
+
+namespace {
+
+// mbind() modes, from <linux/mempolicy.h>, which is not always installed.
+const int kMpolPreferred = 1;
+const int kMpolBind = 2;
+const int kMpolInterleave = 3;
+const unsigned kMpolMfMove = 1 << 1;
+const unsigned long kMpolFAddr = 1 << 1;
+
+// Nodes get_mempolicy() may report.
+const size_t kMaxNodes = 1024;
+
+const size_t kPageSize = 4096;
+const size_t kHugePageSize = 2 << 20;
+
+long BindMemory(void *data, size_t size, int mode,
+                const std::vector<unsigned long> &mask) {
+  // The kernel reads maxnode - 1 bits.
+  const unsigned long max_node = mask.size() * sizeof(unsigned long) * 8 + 1;
+
+  // Pages the heap already touched are migrated.
+  return syscall(SYS_mbind, data, size, mode, mask.data(), max_node,
+                 kMpolMfMove);
+}
+
+void SetNodeBit(std::vector<unsigned long> *mask, int id) {
+  const size_t bits = sizeof(unsigned long) * 8;
+  const size_t word = size_t(id) / bits;
+  if (word >= mask->size()) {
+    mask->resize(word + 1, 0);
+  }
+  (*mask)[word] |= 1UL << (size_t(id) % bits);
+}
+
+// Index in `nodes` of the node closest to node `id` by the SLIT distances in
+// sysfs, 0 when they cannot be read.
+size_t GetNearestNode(const std::string &root, int id,
+                      const std::vector<NumaTopology::Node> &nodes) {
+  // Distances to the online nodes, in the order of their numbers.
+  const std::vector<int> online = ReadCpuListFile(root + "online");
+  std::ifstream ifs(root + "node" + std::to_string(id) + "/distance");
+  const std::vector<int> distances((std::istream_iterator<int>(ifs)),
+                                   std::istream_iterator<int>());
+
+  size_t nearest = 0;
+  int nearest_distance = -1;
+  for (size_t i = 0; (i < online.size()) && (i < distances.size()); i++) {
+    for (size_t j = 0; j < nodes.size(); j++) {
+      if ((nodes[j].id == online[i]) &&
+          ((nearest_distance < 0) || (distances[i] < nearest_distance))) {
+        nearest = j;
+        nearest_distance = distances[i];
+      }
+    }
+  }
+
+  return nearest;
+}
+
+}  // namespace
+
+NumaTopology NumaTopology::Detect() {
+  const std::string root = "/sys/devices/system/node/";
+
+  NumaTopology topology;
+  topology.nodes_.clear();
+
+  const std::vector<int> ids = ReadCpuListFile(root + "has_memory");
+  for (size_t i = 0; i < ids.size(); i++) {
+    Node node;
+    node.id = ids[i];
+    node.cpus =
+        ReadCpuListFile(root + "node" + std::to_string(ids[i]) + "/cpulist");
+    topology.nodes_.push_back(node);
+  }
+
+  // CPUs of memoryless nodes (e.g. sub-NUMA clusters or CPU-only sockets)
+  // work on the memory closest to them.
+  if (!topology.nodes_.empty()) {
+    const std::vector<int> cpu_ids = ReadCpuListFile(root + "has_cpu");
+    for (size_t i = 0; i < cpu_ids.size(); i++) {
+      if (std::binary_search(ids.begin(), ids.end(), cpu_ids[i])) {
+        continue;
+      }
+
+      const std::vector<int> cpus = ReadCpuListFile(
+          root + "node" + std::to_string(cpu_ids[i]) + "/cpulist");
+      Node &node =
+          topology.nodes_[GetNearestNode(root, cpu_ids[i], topology.nodes_)];
+      std::vector<int> merged;
+      std::set_union(node.cpus.begin(), node.cpus.end(), cpus.begin(),
+                     cpus.end(), std::back_inserter(merged));
+      node.cpus.swap(merged);
+    }
+  }
+
+  // Memory-only nodes (e.g. CXL or HBM expanders) get no workers.
+  topology.nodes_.erase(
+      std::remove_if(topology.nodes_.begin(), topology.nodes_.end(),
+                     [](const Node &node) { return node.cpus.empty(); }),
+      topology.nodes_.end());
+
+  if (topology.nodes_.empty()) {
+    return NumaTopology();
+  }
+
+  return topology;
+}
+
+bool NumaTopology::Place(void *data, size_t size,
+                         NumaPlacement placement) const {
+  if ((nodes_.size() < 2) || (placement == kNumaFirstTouch) || !data ||
+      (size == 0)) {
+    return false;
+  }
+
+  if (placement == kNumaInterleave) {
+    std::vector<unsigned long> mask;
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      SetNodeBit(&mask, nodes_[i].id);
+    }
+    return BindMemory(data, size, kMpolInterleave, mask) == 0;
+  }
+
+  // Slices in proportion to the CPUs of the nodes, like workers, and equal
+  // when CPUs are not known. They end on huge page boundaries when they are
+  // large enough, so that transparent huge pages are not split.
+  const size_t num_nodes = nodes_.size();
+  const size_t num_cpus = GetNumCpus();
+  const size_t granularity =
+      (size / num_nodes >= kHugePageSize) ? kHugePageSize : kPageSize;
+
+  uint8_t *base = static_cast<uint8_t *>(data);
+  size_t begin = 0;
+  size_t cpus_before = 0;
+  bool ok = true;
+  for (size_t i = 0; (i < num_nodes) && (begin < size); i++) {
+    cpus_before += (num_cpus > 0) ? nodes_[i].cpus.size() : 1;
+    const size_t weight = (num_cpus > 0) ? num_cpus : num_nodes;
+    const size_t end =
+        (i + 1 == num_nodes)
+            ? size
+            : std::min(size, (size / weight * cpus_before + granularity - 1) /
+                                 granularity * granularity);
+    if (end <= begin) {
+      continue;
+    }
+
+    std::vector<unsigned long> mask;
+    SetNodeBit(&mask, nodes_[i].id);
+
+    // Preferred rather than bound, so that a full node spills over instead
+    // of failing allocations.
+    if (BindMemory(base + begin, end - begin, kMpolPreferred, mask) != 0) {
+      ok = false;
+    }
+    begin = end;
+  }
+
+  return ok;
+}
+
+int NumaTopology::GetPlacedNode(const void *data) const {
+  if ((nodes_.size() < 2) || !data) {
+    return -1;
+  }
+
+  // The policy of the mapping at `data`, which does not fault the page in.
+  const size_t bits = sizeof(unsigned long) * 8;
+  std::vector<unsigned long> mask(kMaxNodes / bits, 0);
+  int mode = 0;
+  if (syscall(SYS_get_mempolicy, &mode, mask.data(), kMaxNodes,
+              const_cast<void *>(data), kMpolFAddr) != 0) {
+    return -1;
+  }
+  if ((mode != kMpolPreferred) && (mode != kMpolBind)) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    const size_t id = size_t(nodes_[i].id);
+    if ((id < kMaxNodes) && (mask[id / bits] & (1UL << (id % bits)))) {
+      return static_cast<int>(i);
+    }
+  }
+
+  return -1;
+}
+
+#else
+
+NumaTopology NumaTopology::Detect() { return NumaTopology(); }
+
+int NumaTopology::GetPlacedNode(const void *data) const {
+  (void)data;
+  return -1;
+}
+
+bool NumaTopology::Place(void *data, size_t size,
+                         NumaPlacement placement) const {
+  (void)data;
+  (void)size;
+  (void)placement;
+  return false;
+}
+
+#endif
+
+}  // namespace softcompute
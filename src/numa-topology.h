@@ -0,0 +1,63 @@
+#ifndef SOFTCOMPUTE_NUMA_TOPOLOGY_H_
+#define SOFTCOMPUTE_NUMA_TOPOLOGY_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace softcompute {
+
+// How memory is spread over the nodes of a NUMA system.
+enum NumaPlacement {
+  kNumaFirstTouch = 0,  // Wherever the thread first writing a page runs
+  kNumaPartition,       // One contiguous slice per node, in node order
+  kNumaInterleave,      // Pages round-robin over the nodes
+};
+
+// Memory nodes and the CPUs belonging to them, read from
+// /sys/devices/system/node on Linux. Systems without NUMA, and other
+// platforms, have a single node.
+class NumaTopology {
+ public:
+  struct Node {
+    int id;  // Kernel node number. Numbers need not be contiguous.
+    std::vector<int> cpus;
+  };
+
+  // A single node holding `cpus`, or no CPUs in particular.
+  NumaTopology();
+  explicit NumaTopology(const std::vector<int> &cpus);
+
+  // Nodes which have both memory and CPUs. CPUs of nodes without memory are
+  // added to the nearest node with memory.
+  static NumaTopology Detect();
+
+  // Nodes with only the CPUs also in `cpus` (sorted), dropping nodes left
+  // without CPUs. A single node holding `cpus` when none are left.
+  NumaTopology Restrict(const std::vector<int> &cpus) const;
+
+  int GetNumNodes() const { return static_cast<int>(nodes_.size()); }
+  const Node &GetNode(int index) const { return nodes_[size_t(index)]; }
+
+  // Number of CPUs over all nodes. 0 when not known.
+  size_t GetNumCpus() const;
+
+  // Places the pages of [data, data + size) on the nodes according to
+  // `placement`, migrating pages already touched. kNumaPartition gives each
+  // node a slice in proportion to its CPUs. Meant for fresh allocations;
+  // `data` must be page aligned. Only a hint: returns false, leaving the
+  // pages to first touch, when the kernel refuses it or there is a single
+  // node.
+  bool Place(void *data, size_t size, NumaPlacement placement) const;
+
+  // Index of the node the pages at `data` were placed on by kNumaPartition,
+  // e.g. to work on them from there. -1 when they are not bound to one node
+  // (first touch, interleaved, or a single node).
+  int GetPlacedNode(const void *data) const;
+
+ private:
+  std::vector<Node> nodes_;
+};
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_NUMA_TOPOLOGY_H_
@@ -0,0 +1,182 @@
+#include "parallel-copy.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace softcompute {
+
+namespace {
+
+const size_t kMinBytesPerPiece = 2 << 20;
+const size_t kNonTemporalBytes = 8 << 20;
+
+// Fill patterns are 48 bytes, a multiple of every value size and of the
+// 16-byte stores.
+const size_t kPatternSize = 48;
+
+// Ranges are split at multiples of this, so that threads neither share pages
+// nor start in the middle of a pattern.
+const size_t kSplitAlignment = 3 * 4096;
+
+// Calls `fn(begin, end)` for pieces of [0, size) on the workers of `pool`,
+// each preferably on the node its part of `dst` was placed on.
+void ParallelRanges(uint8_t *dst, size_t size, WorkerPool *pool,
+                    const std::function<void(size_t, size_t)> &fn) {
+  size_t n = pool ? size_t(std::max(pool->GetNumThreads(), 1)) : 1;
+  n = std::min(n, std::max(size / kMinBytesPerPiece, size_t(1)));
+
+  std::vector<size_t> ends(n);
+  for (size_t i = 0; i < n; i++) {
+    ends[i] = (i + 1 == n) ? size
+                           : (size / n * (i + 1)) / kSplitAlignment *
+                                 kSplitAlignment;
+  }
+
+  ParallelFor(
+      pool, n,
+      [&](size_t i) { fn((i > 0) ? ends[i - 1] : 0, ends[i]); },
+      [&](size_t i) {
+        return pool->GetTopology().GetPlacedNode(
+            dst + ((i > 0) ? ends[i - 1] : 0));
+      });
+}
+
+// Bytes before the first 16-byte aligned address from `ptr`.
+size_t GetHeadSize(const void *ptr, size_t size) {
+  const uintptr_t misalignment = reinterpret_cast<uintptr_t>(ptr) & 15;
+  return std::min(size, size_t((16 - misalignment) & 15));
+}
+
+void CopyRange(uint8_t *dst, const uint8_t *src, size_t size,
+               bool non_temporal) {
+#if defined(__SSE2__)
+  if (non_temporal) {
+    const size_t head = GetHeadSize(dst, size);
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, dst += 64, src += 64) {
+      const __m128i *s =
+          static_cast<const __m128i *>(static_cast<const void *>(src));
+      __m128i *d = static_cast<__m128i *>(static_cast<void *>(dst));
+      const __m128i v0 = _mm_loadu_si128(s);
+      const __m128i v1 = _mm_loadu_si128(s + 1);
+      const __m128i v2 = _mm_loadu_si128(s + 2);
+      const __m128i v3 = _mm_loadu_si128(s + 3);
+      _mm_stream_si128(d, v0);
+      _mm_stream_si128(d + 1, v1);
+      _mm_stream_si128(d + 2, v2);
+      _mm_stream_si128(d + 3, v3);
+    }
+
+    memcpy(dst, src, size);
+
+    // Streaming stores are weakly ordered; make them visible before the
+    // piece is reported done.
+    _mm_sfence();
+    return;
+  }
+#else
+  (void)non_temporal;
+#endif
+
+  memcpy(dst, src, size);
+}
+
+// `dst` is at the start of a pattern. `pattern` holds it twice, so that
+// any rotation of it can be read from there.
+void FillRange(uint8_t *dst, size_t size, const uint8_t *pattern,
+               bool non_temporal) {
+  // Up to a 16-byte aligned address, which starts `head` bytes into the
+  // pattern.
+  const size_t head = GetHeadSize(dst, size);
+  memcpy(dst, pattern, head);
+  dst += head;
+  size -= head;
+  pattern += head;
+
+#if defined(__SSE2__)
+  const __m128i *p =
+      static_cast<const __m128i *>(static_cast<const void *>(pattern));
+  const __m128i v0 = _mm_loadu_si128(p);
+  const __m128i v1 = _mm_loadu_si128(p + 1);
+  const __m128i v2 = _mm_loadu_si128(p + 2);
+
+  for (; size >= kPatternSize; size -= kPatternSize, dst += kPatternSize) {
+    __m128i *d = static_cast<__m128i *>(static_cast<void *>(dst));
+    if (non_temporal) {
+      _mm_stream_si128(d, v0);
+      _mm_stream_si128(d + 1, v1);
+      _mm_stream_si128(d + 2, v2);
+    } else {
+      _mm_store_si128(d, v0);
+      _mm_store_si128(d + 1, v1);
+      _mm_store_si128(d + 2, v2);
+    }
+  }
+#else
+  (void)non_temporal;
+#endif
+
+  for (; size > 0;) {
+    const size_t n = std::min(size, kPatternSize);
+    memcpy(dst, pattern, n);
+    dst += n;
+    size -= n;
+  }
+
+#if defined(__SSE2__)
+  if (non_temporal) {
+    _mm_sfence();
+  }
+#endif
+}
+
+}  // namespace
+
+void ParallelCopy(void *dst, const void *src, size_t size, WorkerPool *pool) {
+  uint8_t *d = static_cast<uint8_t *>(dst);
+  const uint8_t *s = static_cast<const uint8_t *>(src);
+  const bool non_temporal = (size >= kNonTemporalBytes);
+
+  ParallelRanges(d, size, pool, [&](size_t begin, size_t end) {
+    CopyRange(d + begin, s + begin, end - begin, non_temporal);
+  });
+}
+
+void ParallelFill(void *dst, size_t size, const void *value, size_t value_size,
+                  WorkerPool *pool) {
+  assert((value_size > 0) && (kPatternSize % value_size == 0));
+
+  const uint8_t *v = static_cast<const uint8_t *>(value);
+  uint8_t pattern[kPatternSize * 2];
+  bool uniform = true;
+  for (size_t i = 0; i < sizeof(pattern); i++) {
+    pattern[i] = v[i % value_size];
+    uniform = uniform && (pattern[i] == v[0]);
+  }
+
+  uint8_t *d = static_cast<uint8_t *>(dst);
+  const bool non_temporal = (size >= kNonTemporalBytes);
+
+  ParallelRanges(d, size, pool, [&](size_t begin, size_t end) {
+    // memset() is as fast for single byte values, e.g. clears to 0.
+    if (uniform && !non_temporal) {
+      memset(d + begin, v[0], end - begin);
+    } else {
+      FillRange(d + begin, end - begin, pattern, non_temporal);
+    }
+  });
+}
+
+}  // namespace softcompute
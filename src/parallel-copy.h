@@ -0,0 +1,29 @@
+#ifndef SOFTCOMPUTE_PARALLEL_COPY_H_
+#define SOFTCOMPUTE_PARALLEL_COPY_H_
+
+#include <cstddef>
+
+#include "worker-pool.h"
+
+namespace softcompute {
+
+// Copies and fills at memory bandwidth for large buffer ranges. Ranges of
+// 4 MB or more are split over the workers of `pool` (nullptr: the calling
+// thread only), each piece run on the NUMA node its part of `dst` was placed
+// on with kNumaPartition. Ranges of 8 MB or more are written with non-temporal
+// (streaming) stores on x86: they would not stay in cache until read anyway,
+// and streaming them neither reads the destination in first nor evicts the
+// working set of running dispatches.
+
+// memcpy() of non-overlapping ranges.
+void ParallelCopy(void *dst, const void *src, size_t size, WorkerPool *pool);
+
+// Fills `size` bytes with copies of the `value_size` bytes at `value`.
+// `value_size` must divide 48 (1, 2, 3, 4, 6, 8, 12 or 16); `size` need not
+// be a multiple of it.
+void ParallelFill(void *dst, size_t size, const void *value, size_t value_size,
+                  WorkerPool *pool);
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_PARALLEL_COPY_H_
@@ -0,0 +1,103 @@
+#include "perf-counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+namespace softcompute {
+
+#ifdef __linux__
+
+namespace {
+
+int OpenCounter(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;  // Allowed with perf_event_paranoid <= 2
+  attr.exclude_hv = 1;
+
+  // pid 0, cpu -1: the calling thread on any CPU.
+  return static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+}  // namespace
+
+PerfCounters::PerfCounters() : open_mask_(0) {
+  for (int i = 0; i < kNumCounters; i++) {
+    fds_[i] = -1;
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int i = 0; i < kNumCounters; i++) {
+    if (fds_[i] >= 0) {
+      close(fds_[i]);
+    }
+  }
+}
+
+bool PerfCounters::Open() {
+  const uint64_t llc_misses =
+      uint64_t(PERF_COUNT_HW_CACHE_LL) |
+      (uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8) |
+      (uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+
+  fds_[kCycles] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  fds_[kInstructions] =
+      OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  fds_[kLLCMisses] = OpenCounter(PERF_TYPE_HW_CACHE, llc_misses);
+  fds_[kBranchMisses] =
+      OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+  open_mask_ = 0;
+  for (int i = 0; i < kNumCounters; i++) {
+    if (fds_[i] >= 0) {
+      open_mask_ |= 1u << i;
+    }
+  }
+
+  return open_mask_ != 0;
+}
+
+void PerfCounters::Read(uint64_t values[kNumCounters]) const {
+  for (int i = 0; i < kNumCounters; i++) {
+    values[i] = 0;
+    if (fds_[i] >= 0) {
+      uint64_t value = 0;
+      if (read(fds_[i], &value, sizeof(value)) ==
+          static_cast<ssize_t>(sizeof(value))) {
+        values[i] = value;
+      }
+    }
+  }
+}
+
+#else
+
+PerfCounters::PerfCounters() : open_mask_(0) {
+  for (int i = 0; i < kNumCounters; i++) {
+    fds_[i] = -1;
+  }
+}
+
+PerfCounters::~PerfCounters() {}
+
+bool PerfCounters::Open() { return false; }
+
+void PerfCounters::Read(uint64_t values[kNumCounters]) const {
+  for (int i = 0; i < kNumCounters; i++) {
+    values[i] = 0;
+  }
+}
+
+#endif
+
+}  // namespace softcompute
@@ -0,0 +1,45 @@
+#ifndef SOFTCOMPUTE_PERF_COUNTERS_H_
+#define SOFTCOMPUTE_PERF_COUNTERS_H_
+
+#include <cstdint>
+
+namespace softcompute {
+
+// Hardware performance counters of the thread which opened them, read
+// through Linux perf_event_open(). Counters the CPU, kernel or
+// perf_event_paranoid setting do not allow stay closed and read as 0.
+// Not available on other platforms.
+class PerfCounters {
+ public:
+  enum Counter {
+    kCycles = 0,
+    kInstructions,
+    kLLCMisses,  // Last level cache misses
+    kBranchMisses,
+    kNumCounters
+  };
+
+  PerfCounters();
+  ~PerfCounters();
+
+  // Opens and starts the counters for the calling thread. Returns false when
+  // none could be opened.
+  bool Open();
+
+  // Bit i is set when counter i is open.
+  uint32_t GetOpenMask() const { return open_mask_; }
+
+  // Current counts since Open(). Counters which are not open read as 0.
+  void Read(uint64_t values[kNumCounters]) const;
+
+ private:
+  PerfCounters(const PerfCounters &);
+  PerfCounters &operator=(const PerfCounters &);
+
+  int fds_[kNumCounters];
+  uint32_t open_mask_;
+};
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_PERF_COUNTERS_H_
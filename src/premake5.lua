@@ -1,5 +1,18 @@
 sources = {
    "softgl.cc"
+ , "buffer-pool.cc"
+ , "buffer-storage.cc"
+ , "chunk-file.cc"
+ , "cpu-affinity.cc"
+ , "heatmap.cc"
+ , "image-file.cc"
+ , "numa-topology.cc"
+ , "parallel-copy.cc"
+ , "perf-counters.cc"
+ , "spirv-analysis.cc"
+ , "tensor-file.cc"
+ , "trace.cc"
+ , "worker-pool.cc"
  , "OptionParser.cpp"
  , "loguru-impl.cc"
  -- SPIRV-Cross
@@ -39,6 +52,9 @@ project "SoftCompute"
    includedirs { spirv_cross_path }
    includedirs { spirv_cross_path .. '/include' }
 
+   -- nlohmann/json
+   includedirs { "../third_party/json/include" }
+
    -- Loguru
    includedirs { "../third_party/fmt" }
    includedirs { "../third_party/" }
@@ -184,6 +200,7 @@ project "Console_SoftCompute"
    
    files {
    	"main.cc",
+   	"job-file.cc",
    }
    
    links { "SoftCompute" }
@@ -212,3 +229,65 @@ project "Console_SoftCompute"
          optimize "Speed"
       end
       targetname "softcompute"
+
+project "Bench_SoftCompute"
+
+   kind "ConsoleApp"
+
+   includedirs { "../src", "../third_party/json/include" }
+
+   language "C++"
+
+   flags { "c++11" }
+
+   files {
+   	"bench.cc",
+   	"bench-stats.cc",
+   }
+
+   links { "SoftCompute" }
+
+   if _OPTIONS['asan'] then
+      linkoptions { "-fsanitize=address" }
+   end
+
+   configuration { "linux" }
+      links { "dl", "pthread" }
+
+   configuration "Debug"
+      optimize "Debug"
+      defines { "DEBUG" } -- -DDEBUG
+      symbols "On"
+      targetname "softcompute_bench_d"
+
+   configuration "Release"
+      symbols "On"
+      optimize "Speed"
+      targetname "softcompute_bench"
+
+project "BenchCompare_SoftCompute"
+
+   kind "ConsoleApp"
+
+   includedirs { "../src", "../third_party/json/include" }
+
+   language "C++"
+
+   flags { "c++11" }
+
+   files {
+   	"bench-compare.cc",
+   	"bench-stats.cc",
+   	"OptionParser.cpp",
+   }
+
+   configuration "Debug"
+      optimize "Debug"
+      defines { "DEBUG" } -- -DDEBUG
+      symbols "On"
+      targetname "softcompute_bench_compare_d"
+
+   configuration "Release"
+      symbols "On"
+      optimize "Speed"
+      targetname "softcompute_bench_compare"
@@ -0,0 +1,137 @@
+#ifndef SOFTCOMPUTE_SLOT_MAP_H_
+#define SOFTCOMPUTE_SLOT_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace softcompute {
+
+// Growable table of objects addressed by 32-bit handles, with O(1)
+// allocation, lookup and release.
+//
+// A handle is (generation << kIndexBits) | index. The generation of a slot
+// changes whenever its object is released, so a stale handle is rejected
+// instead of aliasing the object that reuses the slot. Handle 0 is never
+// issued. Released slots are reused in FIFO order to make a generation wrap
+// on one slot as unlikely as possible.
+//
+// Slots live in fixed-size pages, so pointers to objects stay valid while the
+// table grows.
+template <typename T>
+class SlotMap {
+ public:
+  typedef uint32_t Handle;
+
+  static const uint32_t kIndexBits = 20;
+  static const uint32_t kMaxSlots = 1u << kIndexBits;
+  static const uint32_t kIndexMask = kMaxSlots - 1;
+  static const uint32_t kMaxGeneration = (1u << (32 - kIndexBits)) - 1;
+
+  SlotMap() : num_slots_(0), num_live_(0), free_head_(kNone), free_tail_(kNone) {}
+
+  // Default-constructs an object and returns its handle, or 0 when kMaxSlots
+  // objects are live.
+  Handle Allocate() {
+    uint32_t index;
+    if (free_head_ != kNone) {
+      index = free_head_;
+      free_head_ = GetSlot(index).next_free;
+      if (free_head_ == kNone) {
+        free_tail_ = kNone;
+      }
+    } else {
+      if (num_slots_ == kMaxSlots) {
+        return 0;
+      }
+      if ((num_slots_ % kPageSize) == 0) {
+        pages_.push_back(std::unique_ptr<Slot[]>(new Slot[kPageSize]));
+      }
+      index = num_slots_++;
+    }
+
+    Slot &slot = GetSlot(index);
+    slot.live = true;
+    num_live_++;
+
+    return (slot.generation << kIndexBits) | index;
+  }
+
+  // Returns nullptr for 0 and for handles of released objects.
+  T *Get(Handle handle) {
+    const uint32_t index = handle & kIndexMask;
+    if (index >= num_slots_) {
+      return nullptr;
+    }
+
+    Slot &slot = GetSlot(index);
+    if (!slot.live || (slot.generation != (handle >> kIndexBits))) {
+      return nullptr;
+    }
+
+    return &slot.value;
+  }
+
+  const T *Get(Handle handle) const {
+    return const_cast<SlotMap *>(this)->Get(handle);
+  }
+
+  // Destructs the object (by resetting it to T()) and invalidates its handle.
+  // Returns false for invalid handles.
+  bool Release(Handle handle) {
+    if (!Get(handle)) {
+      return false;
+    }
+
+    const uint32_t index = handle & kIndexMask;
+    Slot &slot = GetSlot(index);
+    slot.value = T();
+    slot.live = false;
+    slot.generation = (slot.generation == kMaxGeneration) ? 1 : (slot.generation + 1);
+    slot.next_free = kNone;
+
+    if (free_tail_ == kNone) {
+      free_head_ = index;
+    } else {
+      GetSlot(free_tail_).next_free = index;
+    }
+    free_tail_ = index;
+
+    num_live_--;
+    return true;
+  }
+
+  // Dense index of the handle's slot in [0, kMaxSlots). Unique among live
+  // objects, for tables indexed by object.
+  static uint32_t Index(Handle handle) { return handle & kIndexMask; }
+
+  size_t Size() const { return num_live_; }
+
+ private:
+  static const uint32_t kPageSize = 256;
+  static const uint32_t kNone = 0xFFFFFFFFu;
+
+  struct Slot {
+    T value;
+    uint32_t generation;
+    uint32_t next_free;
+    bool live;
+
+    Slot() : generation(1), next_free(kNone), live(false) {}
+  };
+
+  Slot &GetSlot(uint32_t index) {
+    return pages_[index / kPageSize][index % kPageSize];
+  }
+
+  std::vector<std::unique_ptr<Slot[]>> pages_;
+  uint32_t num_slots_;  // Slots ever allocated
+  uint32_t num_live_;
+  uint32_t free_head_;
+  uint32_t free_tail_;
+};
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_SLOT_MAP_H_
@@ -6,11 +6,21 @@
 #include "softgl.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <sstream>
 
@@ -47,21 +57,36 @@
 #include "dll-engine.h"
 #endif
 
+#include "buffer-pool.h"
+#include "buffer-storage.h"
+#include "chunk-file.h"
+#include "cpu-affinity.h"
+#include "image-file.h"
+#include "tensor-file.h"
+#include "heatmap.h"
+#include "numa-topology.h"
+#include "parallel-copy.h"
+#include "perf-counters.h"
+#include "slot-map.h"
+#include "spirv-analysis.h"
+#include "trace.h"
+#include "worker-pool.h"
+
 namespace softgl {
 
 typedef struct spirv_cross_interface *(*spirv_cross_get_interface_fn)();
 
-const int kMaxUniforms = 64;
-const int kMaxBuffers = 64;
-const int kMaxPrograms = 64;
-const int kMaxShaders = 64;
+const int kMaxBufferBindings = 64;
+
+// Freed buffer blocks kept for reuse by glBufferData().
+const size_t kMaxPooledBufferBytes = size_t(256) << 20;
 
 struct Buffer {
-  std::vector<uint8_t> data;
-  bool deleted;
-  char pad[7];
+  // Heap or a mapped file. Shared with submitted dispatches, which keep the
+  // storage alive when glBufferData() orphans it.
+  std::shared_ptr<softcompute::BufferStorage> storage;
 
-  Buffer() { deleted = true; }
+  Buffer() : storage(std::make_shared<softcompute::BufferStorage>()) {}
 };
 
 struct Accessor {
@@ -84,1097 +109,4094 @@ struct Uniform {
   union {
     float fv[4];
     int iv[4];
+    unsigned int uv[4];
   };
 
   int type;
   int count;
 };
 
+// Place of a uniform in the program's uniform block. The block holds the
+// push constant block (with its declared layout) followed by plain uniforms,
+// each aligned std140-like but laid out as its C++ type in the shader.
+struct UniformSlot {
+  std::string name;
+  uint32_t offset;  // In the uniform block
+  uint32_t size;    // 0 for unused locations
+  uint32_t spirv_location;  // Location decoration of plain uniforms
+  bool push_constant;       // Member of the push constant block
+  char pad[3];
+
+  // Type, checked against the glUniform* call setting it.
+  spirv_cross::SPIRType::BaseType base_type;  // Float, Int or UInt to be set
+  uint32_t vecsize;                           // Components per column
+  uint32_t columns;                           // > 1 for matrices
+  uint32_t array_size;                        // 1 for non-arrays
+
+  UniformSlot()
+      : offset(0),
+        size(0),
+        spirv_location(0),
+        push_constant(false),
+        base_type(spirv_cross::SPIRType::Unknown),
+        vecsize(0),
+        columns(0),
+        array_size(0) {}
+};
+
+// GL_FLOAT, GL_INT or GL_UNSIGNED_INT for the components of `type`, matching
+// Uniform::type. 0 for other types.
+static int GetUniformComponentType(spirv_cross::SPIRType::BaseType type) {
+  switch (type) {
+    case spirv_cross::SPIRType::Float:
+      return GL_FLOAT;
+    case spirv_cross::SPIRType::Int:
+      return GL_INT;
+    case spirv_cross::SPIRType::UInt:
+      return GL_UNSIGNED_INT;
+    default:
+      return 0;
+  }
+}
+
+// Immutable copy of a uniform block used by dispatches.
+typedef std::shared_ptr<const std::vector<uint8_t>> UniformSnapshot;
+
+// Descriptor set/binding of a SSBO or UBO declared in the shader.
+struct ResourceBinding {
+  uint32_t set;
+  uint32_t binding;
+  uint32_t buffer_binding;  // Indexed binding point the buffer is taken from
+  uint32_t data_size;       // Declared size, without a runtime array's elements
+  uint32_t element_stride;  // Array stride when the block is a single array
+  bool is_storage;  // true: shader storage block, false: uniform block
+  bool readable;    // false for `writeonly` blocks
+  bool writable;    // false for `readonly` blocks and uniform blocks
+  bool elementwise;  // Only accessed at [gl_GlobalInvocationID.x]
+};
+
+// Names of a linked program's interface, so introspection never walks the
+// SPIR-V again. Blocks map to their index in Program::resource_bindings.
+// Blocks are registered under both the block and the instance name.
+struct ProgramReflection {
+  std::unordered_map<std::string, GLint> uniforms;  // Name to location
+  std::unordered_map<std::string, GLuint> storage_blocks;
+  std::unordered_map<std::string, GLuint> uniform_blocks;
+};
+
+// Constructed shader object together with the storage its builtins and
+// resources point to. SPIRV-Cross generated shaders keep pointers to these
+// members, so a ShaderContext must not move once constructed.
+struct ShaderContext {
+  const spirv_cross_interface *interface;
+  spirv_cross_shader_t *shader;
+
+  glm::uvec3 num_workgroups;
+  glm::uvec3 work_group_id;
+
+  void *resources[SPIRV_CROSS_NUM_DESCRIPTOR_SETS]
+                 [SPIRV_CROSS_NUM_DESCRIPTOR_BINDINGS];
+
+  // Uniform block the shader currently points to. Held so that the pointers
+  // stay valid after the dispatch that set them.
+  UniformSnapshot uniforms;
+
+  ShaderContext(const spirv_cross_interface *iface,
+                const std::vector<ResourceBinding> &bindings)
+      : interface(iface), num_workgroups(0, 0, 0), work_group_id(0, 0, 0) {
+    memset(resources, 0, sizeof(resources));
+
+    shader = interface->construct();
+
+    spirv_cross_set_builtin(shader, SPIRV_CROSS_BUILTIN_NUM_WORK_GROUPS,
+                            &num_workgroups, sizeof(num_workgroups));
+    spirv_cross_set_builtin(shader, SPIRV_CROSS_BUILTIN_WORK_GROUP_ID,
+                            &work_group_id, sizeof(work_group_id));
+
+    for (size_t i = 0; i < bindings.size(); i++) {
+      spirv_cross_set_resource(
+          shader, bindings[i].set, bindings[i].binding,
+          &resources[bindings[i].set][bindings[i].binding], sizeof(void *));
+    }
+  }
+
+  ~ShaderContext() { interface->destruct(shader); }
+
+  // Points push constants and plain uniforms into `block`. Only done when the
+  // block changes, i.e. after a glUniform* call.
+  void SetUniforms(const UniformSnapshot &block,
+                   const std::vector<UniformSlot> &slots,
+                   uint32_t push_constant_size) {
+    if (block == uniforms) {
+      return;
+    }
+    uniforms = block;
+
+    // The shader only reads through these pointers.
+    uint8_t *base = const_cast<uint8_t *>(block->data());
+
+    if (push_constant_size > 0) {
+      spirv_cross_set_push_constant(shader, base, push_constant_size);
+    }
+
+    for (size_t i = 0; i < slots.size(); i++) {
+      if ((slots[i].size > 0) && !slots[i].push_constant) {
+        spirv_cross_set_uniform_constant(shader, slots[i].spirv_location,
+                                         base + slots[i].offset,
+                                         slots[i].size);
+      }
+    }
+  }
+
+ private:
+  ShaderContext(const ShaderContext &);
+  ShaderContext &operator=(const ShaderContext &);
+};
+
+// Shader objects of a linked program. A shader object holds the builtins of
+// the workgroup being run, so each concurrently running chunk of workgroups
+// takes its own ShaderContext from here.
+class ShaderContextPool {
+ public:
+  ShaderContextPool(const spirv_cross_interface *iface,
+                    const std::vector<ResourceBinding> &bindings)
+      : interface_(iface), bindings_(bindings) {}
+
+  ~ShaderContextPool() {
+    for (size_t i = 0; i < contexts_.size(); i++) {
+      delete contexts_[i];
+    }
+  }
+
+  ShaderContext *Acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        ShaderContext *ctx = free_.back();
+        free_.pop_back();
+        return ctx;
+      }
+    }
+
+    // Construct outside of the lock. Happens at most once per worker.
+    ShaderContext *ctx = new ShaderContext(interface_, bindings_);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    contexts_.push_back(ctx);
+    return ctx;
+  }
+
+  void Release(ShaderContext *ctx) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(ctx);
+  }
+
+ private:
+  ShaderContextPool(const ShaderContextPool &);
+  ShaderContextPool &operator=(const ShaderContextPool &);
+
+  const spirv_cross_interface *interface_;
+  std::vector<ResourceBinding> bindings_;
+
+  std::mutex mutex_;
+  std::vector<ShaderContext *> contexts_;  // All constructed contexts
+  std::vector<ShaderContext *> free_;
+};
+
 struct Program {
   std::vector<uint32_t> shaders;  // List of attached shaders
 
-  bool deleted;
   bool linked;
+  bool synchronizes;  // Uses barriers or shared memory
   char buf[6];
 
+  uint32_t local_size[3];
+  uint32_t link_count;  // Link attempts, to detect stale command lists
+
   std::shared_ptr<spirv_cross::CompilerCPP> cpp;
-  std::shared_ptr<softcompute::ShaderInstance> instance;
-  std::shared_ptr<spirv_cross_shader_t> shader;
+  softcompute::ShaderInstance *instance;  // Owned by SoftGLContext::engine
+  std::shared_ptr<ShaderContextPool> contexts;
 
-  Program() {
-    deleted = true;
+  // SSBOs followed by UBOs referenced by the shader. The index of a block of
+  // either kind is its index in its part. Filled in glLinkProgram.
+  std::vector<ResourceBinding> resource_bindings;
+  uint32_t num_storage_blocks;
+  uint32_t pad2;
+
+  ProgramReflection reflection;
+
+  // Uniforms indexed by location. Filled in glLinkProgram.
+  std::vector<UniformSlot> uniform_slots;
+  uint32_t push_constant_size;  // At the start of the uniform block
+  bool uniforms_dirty;          // uniform_data changed since the snapshot
+  char pad1[3];
+
+  // Written by glUniform*. Dispatches get a snapshot of it, taken again only
+  // when something changed, so setting a uniform costs a store and in-flight
+  // dispatches keep their values.
+  std::vector<uint8_t> uniform_data;
+  UniformSnapshot uniform_snapshot;
+
+  ProgramCompileStats compile_stats;  // Of the last successful link
+
+  Program() : compile_stats() {
     linked = false;
-    //cpp = nullptr;
-    //instance = nullptr;
-    //shader = nullptr;
+    synchronizes = true;
+    local_size[0] = local_size[1] = local_size[2] = 1;
+    link_count = 0;
+    instance = nullptr;
+    num_storage_blocks = 0;
+    pad2 = 0;
+    push_constant_size = 0;
+    uniforms_dirty = false;
   }
 
-  //~Program() {
-    //delete instance;
-    //delete shader;
-  //}
+  // Stores `value` to the uniform at `location`. Returns false when there is
+  // no such uniform, or `value` does not have its component type and count,
+  // as glUniform* requires. Arrays get their first element set.
+  bool WriteUniform(GLint location, const Uniform &value) {
+    if ((location < 0) ||
+        (static_cast<size_t>(location) >= uniform_slots.size())) {
+      return false;
+    }
 
-  bool FindUniformLocation(const char *uniform_name, int *idx) {
-    if (!cpp) {
+    const UniformSlot &slot = uniform_slots[static_cast<size_t>(location)];
+    const size_t size = sizeof(value.fv[0]) * static_cast<size_t>(value.count);
+    if ((slot.size == 0) || (size > slot.size) || (slot.columns != 1) ||
+        (value.count != static_cast<int>(slot.vecsize)) ||
+        (value.type != GetUniformComponentType(slot.base_type))) {
       return false;
     }
 
-    const uint32_t num_ids = cpp->get_current_id_bound();
-    for (uint32_t i = 0; i < num_ids; i++) {
-      const std::string &name = cpp->get_name(i);
-      // LOG_F(INFO, "name[%d] = %s", i, name.c_str());
+    uint8_t *dst = uniform_data.data() + slot.offset;
+    if (memcmp(dst, value.fv, size) != 0) {
+      memcpy(dst, value.fv, size);
+      uniforms_dirty = true;
+    }
+
+    return true;
+  }
 
-      if (name.compare(uniform_name) == 0) {
-        // LOG_F(INFO, "Bingo!");
-        if (idx) {
-          (*idx) = int(i);
-        }
-        return true;
-      }
+  // Snapshot of the current uniform values, or nullptr without uniforms.
+  UniformSnapshot GetUniformSnapshot() {
+    if (uniform_data.empty()) {
+      return UniformSnapshot();
     }
 
-    return false;
+    if (uniforms_dirty || !uniform_snapshot) {
+      uniform_snapshot = std::make_shared<const std::vector<uint8_t>>(uniform_data);
+      uniforms_dirty = false;
+    }
+
+    return uniform_snapshot;
   }
 };
 
 struct Shader {
   std::vector<uint32_t> binary;  // Shader binary input(Assume SPIR-V binary)
   std::string source;            // Shader source input
+  uint64_t glsl_to_spirv_ns;     // Time glCompileShader spent in glslang
 
-  bool deleted;
-  char buf[7];
-
-  Shader() { deleted = true; }
+  Shader() : glsl_to_spirv_ns(0) {}
 };
 
-class SoftGLContext {
- public:
-  SoftGLContext() : error_(GL_NO_ERROR) {
-    // 0th index is reserved.
-    programs.resize(kMaxPrograms + 1);
-    buffers.resize(kMaxBuffers + 1);
-    shaders.resize(kMaxShaders + 1);
-    shader_storage_buffer_accessor.resize(kMaxBuffers + 1);
-    uniform_buffer_accessor.resize(kMaxBuffers + 1);
-
-    uniforms.resize(kMaxUniforms);
+// Buffer bound to a shader resource, resolved from the accessor tables.
+struct BufferBinding {
+  uint32_t set;
+  uint32_t binding;
+  Buffer *buffer;
+  // buffer->storage when submitted. Empty in recorded command lists.
+  std::shared_ptr<softcompute::BufferStorage> storage;
+  size_t offset;
+  size_t size;  // Of the bound range. 0: up to the end of the buffer.
+  uint32_t element_stride;
+  GLuint buffer_name;  // Of `buffer`. 0 for buffers internal to a dispatch.
+  bool readable;
+  bool writable;
+  bool elementwise;
+  char pad[5];
+};
 
-    active_buffer_index = 0;
-    active_program = 0;
+// Everything needed to run a dispatch without touching the context state.
+struct DispatchCommand {
+  Program *program;
+  // Name and Program::link_count of `program`. Command lists resolve
+  // `program` and the binding buffers again from names when called, since
+  // they may have been deleted or relinked since recording.
+  GLuint program_name;
+  uint32_t program_link_count;
+  uint32_t num_groups[3];
+  uint32_t group_offset[3];  // Added to gl_WorkGroupID, for partial dispatches
+  std::vector<BufferBinding> bindings;
+  UniformSnapshot uniforms;  // Uniform values at dispatch time
+
+  DispatchCommand()
+      : program(nullptr), program_name(0), program_link_count(0) {
+    num_groups[0] = num_groups[1] = num_groups[2] = 0;
+    group_offset[0] = group_offset[1] = group_offset[2] = 0;
   }
+};
 
-  ~SoftGLContext() {}
+struct UniformCommand {
+  GLint location;
+  int pad;
+  Uniform value;
+};
 
-  void SetJITCompilerOptions(const std::string &option_string) {
-    jit_compile_options_ = option_string;
-  }
+struct BindCommand {
+  GLenum target;
+  GLuint index;
+  Accessor accessor;
+};
 
-  std::string GetJITCompileOptions() const {
-    return jit_compile_options_;
-  }
+struct Command {
+  enum Type { kUseProgram, kBindBuffer, kUniform, kDispatch, kBarrier };
 
-  void SetGLError(const GLenum error) { error_ = error; }
+  Type type;
+  uint32_t index;  // Index to the array of `type` in CommandList.
+  uint32_t count;  // kDispatch: number of fused dispatches from `index`.
+};
 
-  Program &GetProgram(uint32_t idx) {
-    if (idx == 0) {
-      // ABORT_F("Program index is zero");
-    }
+// Recorded sequence of state changes and dispatches.
+struct CommandList {
+  std::vector<Command> commands;
+
+  std::vector<GLuint> programs;
+  std::vector<BindCommand> binds;
+  std::vector<UniformCommand> uniforms;
+  std::vector<DispatchCommand> dispatches;
+  std::vector<GLbitfield> barriers;
+
+  void Clear() {
+    commands.clear();
+    programs.clear();
+    binds.clear();
+    uniforms.clear();
+    dispatches.clear();
+    barriers.clear();
+  }
+};
 
-    if (idx >= uint32_t(programs.size())) {
-      // ABORT_F("Invalid Program index");
+// Node of the dispatch dependency graph. Barriers and fences are nodes
+// without workgroups.
+struct DispatchNode {
+  // Dispatches run over the same workgroups. More than one when dispatches
+  // are fused, empty for barriers and fences.
+  std::vector<DispatchCommand> stages;
+  std::vector<std::shared_ptr<ShaderContextPool>> contexts;  // Per stage
+
+  std::chrono::steady_clock::time_point start_time;
+  std::chrono::steady_clock::time_point finish_time;  // Set before `done`
+
+  uint64_t sequence;  // Submission order of dispatches, from 1
+  uint64_t bytes_bound;
+  uint64_t bytes_bound_huge_pages;
+  uint64_t num_workgroups;
+  uint64_t chunk_size;  // Workgroups per task
+  uint64_t block_size;  // Workgroups run through all stages at a time
+  std::atomic<uint64_t> remaining_chunks;
+
+  // Cycles spent in each workgroup (all stages), indexed by linear workgroup
+  // index. Empty unless workgroup profiling is on.
+  std::vector<uint64_t> workgroup_costs;
+  std::string heatmap_prefix;
+
+  // Hardware counter deltas summed over chunks, when counting events.
+  bool count_events;
+  char pad1[3];
+  std::atomic<uint32_t> counter_mask;  // PerfCounters::GetOpenMask() of workers
+  std::atomic<uint64_t> counters[softcompute::PerfCounters::kNumCounters];
+
+  // Workers which ran chunks, indexed by worker id.
+  std::unique_ptr<std::atomic<bool>[]> workers_used;
+  int num_workers;
+  int pad0;
+
+  // Guarded by DispatchScheduler::mutex_.
+  std::vector<std::shared_ptr<DispatchNode>> dependents;
+  uint32_t num_dependencies;  // Unfinished nodes this node waits for
+  bool done;
+  char pad[3];
+
+  DispatchNode()
+      : sequence(0),
+        bytes_bound(0),
+        bytes_bound_huge_pages(0),
+        num_workgroups(0),
+        chunk_size(1),
+        block_size(1),
+        remaining_chunks(0),
+        count_events(false),
+        counter_mask(0),
+        num_workers(0),
+        pad0(0),
+        num_dependencies(0),
+        done(false) {
+    for (int i = 0; i < softcompute::PerfCounters::kNumCounters; i++) {
+      counters[i] = 0;
     }
-
-    return programs[idx];
   }
+};
 
-  uint32_t active_buffer_index;
-  uint32_t active_program;
+// Runs dispatches on the worker pool asynchronously to the caller. Each
+// dispatch is split into chunks of workgroups, and starts as soon as the
+// dispatches it depends on have finished. Dependencies come from memory
+// barriers and from read/write hazards on the buffers bound to the dispatch,
+// so independent dispatches run concurrently.
+class DispatchScheduler {
+ public:
+  // Statistics of this many dispatches are kept until TakeStats().
+  static const size_t kMaxStats = 1024;
+
+  explicit DispatchScheduler(softcompute::WorkerPool *pool)
+      : pool_(pool),
+        num_pending_(0),
+        num_dispatches_(0),
+        count_events_(false),
+        worker_counters_(size_t(pool->GetNumThreads())),
+        stats_(kMaxStats),
+        stats_begin_(0),
+        num_stats_(0) {}
+
+  ~DispatchScheduler() { Wait(); }
+
+  // Runs `num_stages` dispatches of the same size as one node. Each block of
+  // workgroups goes through all stages before the next block starts, so the
+  // stages must be fusable (see CanFuse()). Returns the node, e.g. to wait
+  // for it with WaitNode().
+  std::shared_ptr<DispatchNode> Submit(const DispatchCommand *stages,
+                                       size_t num_stages);
+
+  // Dispatches submitted after the barrier wait for all dispatches submitted
+  // before it.
+  void Barrier();
+
+  // Returns a node which finishes once all dispatches submitted so far, and
+  // `after` when given, have finished. Unlike Barrier(), later dispatches do
+  // not wait for it.
+  std::shared_ptr<DispatchNode> Fence(
+      const std::shared_ptr<DispatchNode> &after = nullptr);
+
+  // Blocks until every submitted dispatch has finished.
+  void Wait();
+
+  // Blocks until `node` has finished or `timeout_ns` has passed. Returns
+  // true when the node has finished. GL_TIMEOUT_IGNORED waits forever.
+  bool WaitNode(const std::shared_ptr<DispatchNode> &node, uint64_t timeout_ns);
+
+  // Blocks until submitted dispatches accessing `buffer` have finished.
+  void WaitBuffer(const Buffer *buffer);
+
+  // Blocks until submitted dispatches writing `buffer` have finished, which
+  // is enough before the host reads it.
+  void WaitBufferWriter(const Buffer *buffer);
+
+  // Forgets dispatches accessing `buffer` after its storage was replaced, so
+  // that later dispatches do not wait for them.
+  void OrphanBuffer(const Buffer *buffer);
+
+  // Records the cost of each workgroup of dispatches submitted from now on
+  // and writes it as `<prefix>-<sequence>`.png/.csv from the next Wait()
+  // after they finish, off the path of dependent dispatches. An empty prefix
+  // turns it off.
+  void SetHeatmapPrefix(const std::string &prefix) {
+    heatmap_prefix_ = prefix;
+  }
 
-  std::vector<Accessor> shader_storage_buffer_accessor;
-  std::vector<Accessor> uniform_buffer_accessor;
-  std::vector<Uniform> uniforms;
-  std::vector<Buffer> buffers;
-  std::vector<Program> programs;
-  std::vector<Shader> shaders;
+  // Counts hardware events (see PerfCounters) of dispatches submitted from
+  // now on, for DispatchStats.
+  void SetCountEvents(bool enable) { count_events_ = enable; }
 
+  // Moves statistics of finished dispatches, oldest first, to `stats`.
+  // Returns the number of entries written. When more than kMaxStats
+  // dispatches finish between calls, the oldest entries are lost.
+  size_t TakeStats(DispatchStats *stats, size_t max_count);
 
  private:
-  std::string jit_compile_options_;
+  typedef std::shared_ptr<DispatchNode> NodePtr;
 
-  GLenum error_;
-};
+  struct BufferHazard {
+    NodePtr last_writer;
+    std::vector<NodePtr> readers;  // Readers since the last write
+  };
 
-static SoftGLContext *gCtx = nullptr;
+  // Workgroup costs of a finished dispatch, to be written by Wait().
+  struct PendingHeatmap {
+    std::string filename;
+    std::vector<uint64_t> costs;
+    uint32_t width;
+    uint32_t height;
 
-// --------------------------------------------------------------------------------
-// Simple offline complilation functions.
+    PendingHeatmap() : width(0), height(0) {}
+  };
 
-/// Generate unique filename.
-static std::string GenerateUniqueFilename() {
-  char basename[] = "softcompute_XXXXXX";
+  // Needs mutex_ held.
+  void AddDependency(const NodePtr &node, const NodePtr &dependency);
 
-#if defined(_WIN32)
+  void Launch(const NodePtr &node);
+  void RunChunk(const NodePtr &node, uint64_t begin, uint64_t end,
+                int worker_id);
+  void Finish(const NodePtr &node);
 
-  assert(strlen(basename) < 1023);
+  softcompute::WorkerPool *pool_;
 
-  char buf[1024];
-  strncpy(buf, basename, strlen(basename));
-  buf[strlen(basename)] = '\0';
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t num_pending_;  // Submitted but not finished nodes
 
-  size_t len = strlen(buf) + 1;
-  int err =
-      _mktemp_s(buf, len);  // prefix will be overwritten with actual filename
-  if (err != 0) {
-    std::cerr << "Failed to create unique filename.\n";
-    return std::string();
-  }
+  std::unordered_map<const Buffer *, BufferHazard> hazards_;
+  NodePtr barrier_;                     // Last barrier
+  std::vector<NodePtr> since_barrier_;  // Nodes submitted after barrier_
 
-  printf("DBG: Unique name: %s", buf);
+  uint64_t num_dispatches_;  // Submitted so far
 
-  std::string name = std::string(buf);
+  std::string heatmap_prefix_;
+  std::vector<PendingHeatmap> heatmaps_;  // Guarded by mutex_
 
-#else
-  int fd =
-      mkstemp(basename);  // prefix will be overwritten with actual filename
-  if (fd == -1) {
-    std::cerr << "Failed to create unique filename.\n";
-    return std::string();
-  }
-  close(fd);
-  int ret = unlink(basename);
-  if (ret == -1) {
-    std::cerr << "Failed to delete file: " << basename << std::endl;
-  }
+  bool count_events_;
+  char pad_[7];
 
-  std::string name = std::string(basename);
+  // Indexed by worker id. Each is opened by, and only used on, its worker.
+  std::vector<std::unique_ptr<softcompute::PerfCounters>> worker_counters_;
 
-#endif
+  // Ring buffer of finished dispatches.
+  std::vector<DispatchStats> stats_;
+  size_t stats_begin_;
+  size_t num_stats_;
+};
 
-  return name;
+void DispatchScheduler::AddDependency(const NodePtr &node,
+                                      const NodePtr &dependency) {
+  if (!dependency || dependency->done || (dependency == node)) {
+    return;
+  }
+
+  dependency->dependents.push_back(node);
+  node->num_dependencies++;
 }
 
-#if 0
-static bool exec_command(std::vector<std::string> *outputs,
-                         const std::string &cmd) {
-  outputs->clear();
+DispatchScheduler::NodePtr DispatchScheduler::Submit(
+    const DispatchCommand *stages, size_t num_stages) {
+  // Aim for a few chunks per worker so that uneven workgroups balance out.
+  const uint64_t kChunksPerWorker = 4;
+
+  // Invocations per block of fused stages. Keeps the block's elements of the
+  // intermediate buffers in L2 between stages.
+  const uint64_t kFusedBlockInvocations = 4096;
+
+  assert(num_stages > 0);
+
+  NodePtr node = std::make_shared<DispatchNode>();
+  node->stages.assign(stages, stages + num_stages);
+  for (size_t i = 0; i < num_stages; i++) {
+    node->contexts.push_back(stages[i].program->contexts);
+
+    for (size_t b = 0; b < node->stages[i].bindings.size(); b++) {
+      BufferBinding &binding = node->stages[i].bindings[b];
+      binding.storage = binding.buffer->storage;
+
+      // The buffer may have been respecified smaller since binding.
+      const size_t rest = (binding.offset < binding.storage->size())
+                              ? binding.storage->size() - binding.offset
+                              : 0;
+      const size_t range =
+          (binding.size > 0) ? std::min(binding.size, rest) : rest;
+      node->bytes_bound += range;
+      if (binding.storage->page_mode() !=
+          softcompute::BufferPool::kSmallPages) {
+        node->bytes_bound_huge_pages += range;
+      }
 
-  // This may not be needed, but for the safety.
-  // See popen(3) manual for details why calling fflush(nullptr) here
-  fflush(nullptr);
+      // Page in file-backed buffers the way the shader reads them.
+      softcompute::BufferStorage::AccessHint hint =
+          softcompute::BufferStorage::kAccessNormal;
+      if (binding.elementwise) {
+        hint = softcompute::BufferStorage::kAccessSequential;
+      } else if (binding.readable && !binding.writable) {
+        hint = softcompute::BufferStorage::kAccessWillNeed;
+      }
+      binding.storage->Advise(hint);
+    }
+  }
 
-#if defined(_WIN32)
-  FILE *pfp = _popen(cmd.c_str(), "r");
-#else
-  FILE *pfp = popen(cmd.c_str(), "r");
-#endif
+  node->num_workers = pool_->GetNumThreads();
+  node->workers_used.reset(new std::atomic<bool>[size_t(node->num_workers)]);
+  for (int i = 0; i < node->num_workers; i++) {
+    node->workers_used[size_t(i)] = false;
+  }
 
-  if (!pfp) {
-    std::cerr << "Failed to open pipe." << std::endl;
-    perror("popen");
+  const DispatchCommand &command = stages[0];
+  node->num_workgroups = uint64_t(command.num_groups[0]) *
+                         uint64_t(command.num_groups[1]) *
+                         uint64_t(command.num_groups[2]);
 
-    return false;
+  if (!heatmap_prefix_.empty()) {
+    node->workgroup_costs.assign(size_t(node->num_workgroups), 0);
+    node->heatmap_prefix = heatmap_prefix_;
   }
 
-  char buf[4096];
-  while (fgets(buf, 4095, pfp) != nullptr) {
-    // printf("%s", buf);
-    outputs->push_back(buf);
-  }
+  node->count_events = count_events_;
 
-#if defined(_WIN32)
-  int status = _pclose(pfp);
-  if (status == -1) {
-    fprintf(stderr, "Failed to close pipe.\n");
-    return false;
-  }
-#else
-  int status = pclose(pfp);
-  if (status == -1) {
-    fprintf(stderr, "Failed to close pipe.\n");
-    return false;
+  const uint64_t num_chunks =
+      uint64_t(pool_->GetNumThreads()) * kChunksPerWorker;
+  node->chunk_size =
+      std::max(uint64_t(1), (node->num_workgroups + num_chunks - 1) / num_chunks);
+
+  if (num_stages > 1) {
+    const uint64_t group_size = uint64_t(command.program->local_size[0]) *
+                                uint64_t(command.program->local_size[1]) *
+                                uint64_t(command.program->local_size[2]);
+    node->block_size =
+        std::max(uint64_t(1), kFusedBlockInvocations / std::max(uint64_t(1), group_size));
+  } else {
+    node->block_size = node->chunk_size;
   }
-#endif
 
-  return true;
-}
-#endif
+  bool ready = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
 
-static void PutsIfNonEmpty(const char *str)
-{
-  if (str && str[0]) {
-    puts(str);
-  }
-}
+    num_pending_++;
+    node->sequence = ++num_dispatches_;
 
-// glsl string -> spirv
-static bool compile_glsl_string(const std::string &glsl_input, const std::string &filename, std::vector<uint32_t> *out_spirv) {
+    AddDependency(node, barrier_);
 
-  TBuiltInResource resources = glslang::DefaultTBuiltInResource;
+    // Hazards between stages of the node are resolved by running the stages
+    // in order, so only earlier nodes are depended on.
+    for (size_t s = 0; s < num_stages; s++) {
+      for (size_t i = 0; i < stages[s].bindings.size(); i++) {
+        const BufferBinding &binding = stages[s].bindings[i];
+        BufferHazard &hazard = hazards_[binding.buffer];
 
+        // RAW and WAW
+        AddDependency(node, hazard.last_writer);
 
-  glslang::TProgram &program = *new glslang::TProgram;
-  glslang::TShader *shader = new glslang::TShader(EShLangCompute); // compute shader
+        // WAR
+        if (binding.writable) {
+          for (size_t r = 0; r < hazard.readers.size(); r++) {
+            AddDependency(node, hazard.readers[r]);
+          }
+        }
+      }
+    }
 
-  const char *text[1];
-  const char *filename_list[1];
-  int count = 1;
+    for (size_t s = 0; s < num_stages; s++) {
+      for (size_t i = 0; i < stages[s].bindings.size(); i++) {
+        const BufferBinding &binding = stages[s].bindings[i];
+        BufferHazard &hazard = hazards_[binding.buffer];
+
+        if (binding.writable) {
+          hazard.last_writer = node;
+          hazard.readers.clear();
+        } else {
+          // Drop finished readers so that the list stays short.
+          hazard.readers.erase(
+              std::remove_if(hazard.readers.begin(), hazard.readers.end(),
+                             [](const NodePtr &n) { return n->done; }),
+              hazard.readers.end());
+          if (hazard.last_writer != node) {
+            hazard.readers.push_back(node);
+          }
+        }
+      }
+    }
 
-  text[0] = glsl_input.c_str();
-  filename_list[0] = filename.c_str();
+    // Without barriers the list keeps growing, so drop finished nodes.
+    if (since_barrier_.size() >= 64) {
+      since_barrier_.erase(
+          std::remove_if(since_barrier_.begin(), since_barrier_.end(),
+                         [](const NodePtr &n) { return n->done; }),
+          since_barrier_.end());
+    }
+    since_barrier_.push_back(node);
 
-  shader->setStringsWithLengthsAndNames(text, nullptr, filename_list, count);
+    ready = (node->num_dependencies == 0);
+  }
 
-  //std::vector<std::string> processes; // TODO(LTE)
-  //shader->addProcesses(processes);
+  if (ready) {
+    Launch(node);
+  }
 
-  // SPIR-V settings.
-  shader->setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_0);
+  return node;
+}
 
-  EShMessages messages = EShMsgDefault;
+void DispatchScheduler::Barrier() {
+  NodePtr node = std::make_shared<DispatchNode>();
 
-  // TODO(LTE): Includer, preprocess.
-  bool compile_ok = shader->parse(&resources, /* version */110, false, messages);
+  bool ready = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
 
-  PutsIfNonEmpty(shader->getInfoLog());
-  PutsIfNonEmpty(shader->getInfoDebugLog());
+    num_pending_++;
 
-  if (!compile_ok) {
-    std::cerr << "Compile failed." << std::endl;
-  } else {
-    std::cout << "Compile OK." << std::endl;
-  }
+    AddDependency(node, barrier_);
+    for (size_t i = 0; i < since_barrier_.size(); i++) {
+      AddDependency(node, since_barrier_[i]);
+    }
 
-  program.addShader(shader);
+    // Everything before the barrier is ordered by it. Buffer hazards are
+    // kept for WaitBuffer().
+    since_barrier_.clear();
+    barrier_ = node;
 
-  bool link_ok = program.link(messages);
-  if (!link_ok) {
-    std::cerr << "Link failed." << std::endl;
-  } else {
-    std::cout << "Link OK." << std::endl;
+    ready = (node->num_dependencies == 0);
   }
 
-  bool ok = false;
-
-  if (compile_ok && link_ok) {
+  if (ready) {
+    Launch(node);
+  }
+}
 
-    glslang::SpvOptions spv_options;
-    spv_options.disableOptimizer = false;
-    spv_options.optimizeSize = false;
-    spv::SpvBuildLogger logger;
+std::shared_ptr<DispatchNode> DispatchScheduler::Fence(const NodePtr &after) {
+  NodePtr node = std::make_shared<DispatchNode>();
 
-    std::vector<unsigned int> spirv;
+  bool ready = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
 
-    glslang::GlslangToSpv(*program.getIntermediate(static_cast<EShLanguage>(EShLangCompute)), spirv, &logger, &spv_options);
+    num_pending_++;
 
-    if (spirv.size() > 0) {
-      (*out_spirv) = spirv;
-      ok = true;
+    AddDependency(node, after);
+    AddDependency(node, barrier_);
+    for (size_t i = 0; i < since_barrier_.size(); i++) {
+      AddDependency(node, since_barrier_[i]);
     }
+
+    ready = (node->num_dependencies == 0);
   }
 
-#if 0
-  // From ResourceLimits.cpp in glslang/StandAlone
-  int ret = ShCompile(compiler, &shader_string, 1, nullptr, EShOptNone, &resources, options, /* version */110, false, messages);
+  if (ready) {
+    Launch(node);
+  }
 
-  free(shader_string);
-#endif
+  return node;
+}
 
-  delete &program;
-  delete shader;
+void DispatchScheduler::Wait() {
+  std::vector<PendingHeatmap> heatmaps;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return num_pending_ == 0; });
 
-  return true;
-}
+    // Release finished nodes.
+    hazards_.clear();
+    since_barrier_.clear();
+    barrier_.reset();
 
+    heatmaps.swap(heatmaps_);
+  }
 
-#if 0
-// glsl -> spirv
-static bool compile_glsl(const std::string &output_filename, bool verbose,
-                         const std::string &glsl_filename) {
-  //
-  // Invoke `glslangValidator`
-  //
-  std::string binary = "glslangValidator";
-  char *binary_path = getenv("GLSLANG_VALIDADOR");
-  if (binary_path) {
-    binary = binary_path;
-    if (verbose) {
-      printf("glslangValidator = %s\n", binary.c_str());
+  for (size_t i = 0; i < heatmaps.size(); i++) {
+    if (!softcompute::WriteHeatmap(heatmaps[i].filename, heatmaps[i].costs,
+                                   heatmaps[i].width, heatmaps[i].height)) {
+      std::cerr << "[SoftGL] Failed to write heatmap: "
+                << heatmaps[i].filename << std::endl;
     }
   }
+}
 
-  std::stringstream ss;
-  ss << binary;
-  ss << " -V";
-  ss << " -o " << output_filename.c_str();
-  ss << " " << glsl_filename;
+bool DispatchScheduler::WaitNode(const NodePtr &node, uint64_t timeout_ns) {
+  std::unique_lock<std::mutex> lock(mutex_);
 
-  std::string cmd;
-  cmd = ss.str();
-  if (verbose) {
-    std::cout << cmd << std::endl;
+  if (timeout_ns == 0) {
+    return node->done;
   }
 
-  std::vector<std::string> outputs;
-  bool ret = exec_command(&outputs, cmd);
-  if (ret) {
-    //
-    // Check if compiled cpp code exists.
-    //
-    std::ifstream ifile(output_filename);
-    if (!ifile) {
-      std::cerr << "Failed to translate GLSL to SPIR-V" << std::endl;
-      return false;
-    }
+  if (timeout_ns == GL_TIMEOUT_IGNORED) {
+    cv_.wait(lock, [&node] { return node->done; });
+    return true;
   }
 
-  return true;
+  return cv_.wait_for(lock, std::chrono::nanoseconds(timeout_ns),
+                      [&node] { return node->done; });
 }
 
-// spirv file -> c++
-static bool compile_spirv(const std::string &output_filename, bool verbose, const std::string &spirv_filename)
-{
-    //
-    // Invoke `spirv-cross`
-    //
-    std::string spirv_cross = "spirv-cross";
-    char *spirv_cross_path = getenv("SPIRV_CROSS");
-    if (spirv_cross_path)
-    {
-        spirv_cross = spirv_cross_path;
-        if (verbose)
-        {
-            printf("spirv-cross = %s\n", spirv_cross.c_str());
-        }
+void DispatchScheduler::WaitBuffer(const Buffer *buffer) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  std::unordered_map<const Buffer *, BufferHazard>::const_iterator it =
+      hazards_.find(buffer);
+  if (it == hazards_.end()) {
+    return;
+  }
+
+  // Readers all depend on the last writer, but a writer may still be running
+  // with no readers after it.
+  std::vector<NodePtr> nodes = it->second.readers;
+  if (it->second.last_writer) {
+    nodes.push_back(it->second.last_writer);
+  }
+
+  cv_.wait(lock, [&nodes] {
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (!nodes[i]->done) return false;
     }
+    return true;
+  });
+}
 
-    std::stringstream ss;
-    ss << spirv_cross;
-    ss << " --output " << output_filename.c_str();
-    ss << " --cpp";
-    ss << " " << spirv_filename;
-    ss << " --dump-resources";
-    ss << " 2>&1"; // spirv-cross dumps info to stderr. redirect stderr to stdout to catch dump info.
+void DispatchScheduler::WaitBufferWriter(const Buffer *buffer) {
+  std::unique_lock<std::mutex> lock(mutex_);
 
-    std::string cmd;
-    cmd = ss.str();
-    if (verbose)
-    {
-        std::cout << cmd << std::endl;
+  std::unordered_map<const Buffer *, BufferHazard>::const_iterator it =
+      hazards_.find(buffer);
+  if ((it == hazards_.end()) || !it->second.last_writer) {
+    return;
+  }
+
+  const NodePtr writer = it->second.last_writer;
+  cv_.wait(lock, [&writer] { return writer->done; });
+}
+
+void DispatchScheduler::OrphanBuffer(const Buffer *buffer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  hazards_.erase(buffer);
+}
+
+void DispatchScheduler::Launch(const NodePtr &node) {
+  node->start_time = std::chrono::steady_clock::now();
+
+  if (node->num_workgroups == 0) {
+    Finish(node);
+    return;
+  }
+
+  // On NUMA systems the workgroups are split into one contiguous range per
+  // node, in proportion to its workers like kNumaPartition places buffers,
+  // and the chunks of each range are queued for the workers of that node.
+  // Chunks do not straddle ranges.
+  const uint64_t num_nodes = uint64_t(pool_->GetNumNodes());
+  std::vector<uint64_t> node_begin(size_t(num_nodes) + 1);
+  uint64_t num_chunks = 0;
+  for (uint64_t n = 0; n <= num_nodes; n++) {
+    node_begin[size_t(n)] = uint64_t(pool_->GetFirstWorker(int(n))) *
+                            node->num_workgroups /
+                            uint64_t(pool_->GetNumThreads());
+    if (n > 0) {
+      num_chunks += (node_begin[size_t(n)] - node_begin[size_t(n - 1)] +
+                     node->chunk_size - 1) /
+                    node->chunk_size;
+    }
+  }
+  node->remaining_chunks = num_chunks;
+
+  for (uint64_t n = 0; n < num_nodes; n++) {
+    const uint64_t range_end = node_begin[size_t(n + 1)];
+    for (uint64_t begin = node_begin[size_t(n)]; begin < range_end;
+         begin += node->chunk_size) {
+      const uint64_t end = std::min(begin + node->chunk_size, range_end);
+      const softcompute::WorkerPool::Task task =
+          [this, node, begin, end](int worker_id) {
+            RunChunk(node, begin, end, worker_id);
+          };
+      if (num_nodes > 1) {
+        pool_->Submit(task, int(n));
+      } else {
+        pool_->Submit(task);
+      }
     }
+  }
+}
 
-    std::vector<std::string> outputs;
-    bool ret = exec_command(&outputs, cmd);
-    if (ret)
-    {
-        //
-        // Check if compiled cpp code exists.
-        //
-        std::ifstream ifile(output_filename);
-        if (!ifile)
-        {
-            LOG_F(ERROR, "Failed to translate SPIR-V to C++");
-            return false;
-        }
-        return true;
+// Runs workgroups [begin, end) in linear order. Adds the cycles each
+// workgroup takes to `costs` (indexed by linear workgroup index) unless it is
+// nullptr.
+static void RunWorkgroups(ShaderContext *ctx, const DispatchCommand &command,
+                          uint64_t begin, uint64_t end, uint64_t *costs) {
+  const uint32_t *num_groups = command.num_groups;
+  const glm::uvec3 offset(command.group_offset[0], command.group_offset[1],
+                          command.group_offset[2]);
+
+  // Linear workgroup index -> (x, y, z)
+  const uint64_t slice = uint64_t(num_groups[0]) * uint64_t(num_groups[1]);
+  uint32_t x = uint32_t(begin % num_groups[0]);
+  uint32_t y = uint32_t((begin / num_groups[0]) % num_groups[1]);
+  uint32_t z = uint32_t(begin / slice);
+
+  for (uint64_t i = begin; i < end; i++) {
+    ctx->work_group_id = glm::uvec3(x, y, z) + offset;
+
+    if (costs) {
+      const uint64_t start = softcompute::ReadCycleCounter();
+      ctx->interface->invoke(ctx->shader);
+      costs[i] += softcompute::ReadCycleCounter() - start;
+    } else {
+      ctx->interface->invoke(ctx->shader);
     }
 
-    return false;
+    if (++x == num_groups[0]) {
+      x = 0;
+      if (++y == num_groups[1]) {
+        y = 0;
+        z++;
+      }
+    }
+  }
 }
-#else
-// spirv binary file -> c++
-static bool compile_spirv_binary(const std::string &output_filename,
-                                 bool verbose,
-                                 const std::vector<uint32_t> &spirv_binary) {
-  std::unique_ptr<spirv_cross::CompilerGLSL> compiler =
-      std::unique_ptr<spirv_cross::CompilerGLSL>(
-          new spirv_cross::CompilerCPP(spirv_binary));
 
-  std::string code = compiler->compile();
+void DispatchScheduler::RunChunk(const NodePtr &node, uint64_t begin,
+                                 uint64_t end, int worker_id) {
+  softcompute::TraceScope trace("dispatch", "workgroups", "dispatch",
+                                node->sequence);
 
-  std::ofstream ofs(output_filename);
-  if (!ofs) {
-    // LOG_F(ERROR, "Failed to open file for wtire : %s",
-    // output_filename.c_str());
-    return false;
+  const std::vector<DispatchCommand> &stages = node->stages;
+
+  if ((worker_id >= 0) && (worker_id < node->num_workers)) {
+    node->workers_used[size_t(worker_id)].store(true,
+                                                std::memory_order_relaxed);
   }
 
-  ofs << code;
+  softcompute::PerfCounters *counters = nullptr;
+  uint64_t counts_begin[softcompute::PerfCounters::kNumCounters];
+  if (node->count_events && (worker_id >= 0) &&
+      (size_t(worker_id) < worker_counters_.size())) {
+    std::unique_ptr<softcompute::PerfCounters> &slot =
+        worker_counters_[size_t(worker_id)];
+    if (!slot) {
+      // Stays closed when unavailable, so opening is tried once.
+      slot.reset(new softcompute::PerfCounters());
+      slot->Open();
+    }
+    if (slot->GetOpenMask() != 0) {
+      counters = slot.get();
+      counters->Read(counts_begin);
+    }
+  }
 
-  (void)verbose;
+  std::vector<ShaderContext *> contexts(stages.size());
+  for (size_t s = 0; s < stages.size(); s++) {
+    const DispatchCommand &command = stages[s];
+    ShaderContext *ctx = node->contexts[s]->Acquire();
+
+    // Unbound resources read as nullptr rather than the previous dispatch's.
+    memset(ctx->resources, 0, sizeof(ctx->resources));
+    for (size_t i = 0; i < command.bindings.size(); i++) {
+      const BufferBinding &binding = command.bindings[i];
+      ctx->resources[binding.set][binding.binding] =
+          binding.storage->data() + binding.offset;
+    }
 
-  return true;
-}
-#endif
+    ctx->num_workgroups = glm::uvec3(
+        command.num_groups[0], command.num_groups[1], command.num_groups[2]);
 
-#if 0
-// c++ -> dll
-static bool compile_cpp(const std::string &output_filename,
-                        const std::string &options, bool verbose,
-                        const std::string &cpp_filename) {
-  //
-  // Invoke C++ compiler
-  //
-  std::string cpp = "g++";
-  char *cpp_env = getenv("CXX");
-  if (cpp_env) {
-    cpp = cpp_env;
-    if (verbose) {
-      printf("cpp = %s\n", cpp.c_str());
+    if (command.uniforms) {
+      ctx->SetUniforms(command.uniforms, command.program->uniform_slots,
+                       command.program->push_constant_size);
     }
+
+    contexts[s] = ctx;
   }
 
-  // Assume gcc or clang. Assume mingw on windows.
-  std::stringstream ss;
-  ss << cpp;
-  ss << " -std=c++11";
-  ss << " -I./third_party/glm";  // TODO(syoyo): User-supplied path to glm
-  ss << " -I./third_party/SPIRV-Cross/include";  // TODO(syoyo): User-supplied
-                                                 // path to SPIRV-Cross/include.
-  ss << " -o " << output_filename;
-#ifdef __APPLE__
-  ss << " -flat_namespace";
-  ss << " -bundle";
-  ss << " -undefined suppress";
-#else
-  ss << " -shared";
-  ss << " -g";
-#endif
-#ifdef __linux__
-  ss << " -fPIC";
-#endif
-  ss << " " << options;
-  ss << " " << cpp_filename;
+  // Chunks cover disjoint workgroups, so they write disjoint costs.
+  uint64_t *costs =
+      node->workgroup_costs.empty() ? nullptr : node->workgroup_costs.data();
 
-  std::string cmd;
-  cmd = ss.str();
-  if (verbose) std::cout << cmd << std::endl;
+  // Fused stages run block by block, so a stage reads what the previous
+  // stage wrote while it is still in cache.
+  for (uint64_t block = begin; block < end; block += node->block_size) {
+    const uint64_t block_end = std::min(block + node->block_size, end);
+    for (size_t s = 0; s < stages.size(); s++) {
+      RunWorkgroups(contexts[s], stages[s], block, block_end, costs);
+    }
+  }
 
-  std::vector<std::string> outputs;
-  bool ret = exec_command(&outputs, cmd);
-  if (ret) {
-    //
-    // Check if compiled dll file exists.
-    //
-    std::ifstream ifile(output_filename);
-    if (!ifile) {
-      std::cerr << "Failed to compile C++" << std::endl;
-      return false;
+  for (size_t s = 0; s < stages.size(); s++) {
+    node->contexts[s]->Release(contexts[s]);
+  }
+
+  if (counters) {
+    uint64_t counts_end[softcompute::PerfCounters::kNumCounters];
+    counters->Read(counts_end);
+    for (int i = 0; i < softcompute::PerfCounters::kNumCounters; i++) {
+      node->counters[i].fetch_add(counts_end[i] - counts_begin[i],
+                                  std::memory_order_relaxed);
     }
+    node->counter_mask.fetch_or(counters->GetOpenMask(),
+                                std::memory_order_relaxed);
   }
 
-  return true;
+  if (node->remaining_chunks.fetch_sub(1) == 1) {
+    Finish(node);
+  }
 }
-#endif
 
-// -------------------------------------------------------------------
+void DispatchScheduler::Finish(const NodePtr &node) {
+  node->finish_time = std::chrono::steady_clock::now();
+
+  // One event over the whole dispatch, next to the chunks of the workers.
+  if (softcompute::IsTracing() && !node->stages.empty()) {
+    softcompute::AddTraceEvent(
+        "dispatch", "dispatch",
+        static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                node->start_time.time_since_epoch())
+                .count()),
+        static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                node->finish_time.time_since_epoch())
+                .count()),
+        "dispatch", node->sequence);
+  }
 
-void InitSoftGL() {
-  // Pass dummy argc/argv;
-  int argc = 1;
-  const char *argv[] = {"softgl", nullptr};
-  (void)argc;
-  (void)argv;
+  // Written by Wait(), rather than here before dependents may start.
+  PendingHeatmap heatmap;
+  if (!node->workgroup_costs.empty()) {
+    // z slices are stacked vertically.
+    const uint32_t *num_groups = node->stages[0].num_groups;
+    std::stringstream ss;
+    ss << node->heatmap_prefix << "-" << node->sequence;
+    heatmap.filename = ss.str();
+    heatmap.costs.swap(node->workgroup_costs);
+    heatmap.width = num_groups[0];
+    heatmap.height = num_groups[1] * num_groups[2];
+  }
 
-  // loguru::init(argc, const_cast<char **>(argv));
-  // LOG_F(INFO, "Initialize SoftGL context");
-  gCtx = new SoftGLContext();
+  // Orphaned storage goes back to the pool once its last dispatch is done.
+  for (size_t s = 0; s < node->stages.size(); s++) {
+    for (size_t b = 0; b < node->stages[s].bindings.size(); b++) {
+      node->stages[s].bindings[b].storage.reset();
+    }
+  }
+
+  std::vector<NodePtr> ready;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!node->stages.empty()) {
+      DispatchStats stats;
+      stats.sequence = node->sequence;
+      stats.wall_time_ns = static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              node->finish_time - node->start_time)
+              .count());
+      stats.num_workgroups = node->num_workgroups;
+      stats.bytes_bound = node->bytes_bound;
+      stats.bytes_bound_huge_pages = node->bytes_bound_huge_pages;
+      stats.num_threads = 0;
+      for (int i = 0; i < node->num_workers; i++) {
+        if (node->workers_used[size_t(i)].load(std::memory_order_relaxed)) {
+          stats.num_threads++;
+        }
+      }
+      stats.num_dispatches = static_cast<uint32_t>(node->stages.size());
+
+      // The last chunk's fetch_sub orders the counter updates before this.
+      stats.cycles = node->counters[softcompute::PerfCounters::kCycles];
+      stats.instructions =
+          node->counters[softcompute::PerfCounters::kInstructions];
+      stats.llc_misses = node->counters[softcompute::PerfCounters::kLLCMisses];
+      stats.branch_misses =
+          node->counters[softcompute::PerfCounters::kBranchMisses];
+      stats.counter_mask = node->counter_mask;
+      stats.pad = 0;
+
+      // Overwrites the oldest entry when full.
+      stats_[(stats_begin_ + num_stats_) % kMaxStats] = stats;
+      if (num_stats_ < kMaxStats) {
+        num_stats_++;
+      } else {
+        stats_begin_ = (stats_begin_ + 1) % kMaxStats;
+      }
+    }
+
+    // The worker task holding the last reference to `node` may only drop it
+    // after Wait() returned, when the program can already be deleted and its
+    // module unloaded. Its shader contexts are destructed here instead.
+    node->contexts.clear();
+    for (size_t s = 0; s < node->stages.size(); s++) {
+      node->stages[s].program = nullptr;
+    }
+
+    node->done = true;
+
+    if (!heatmap.costs.empty()) {
+      heatmaps_.push_back(std::move(heatmap));
+    }
+
+    for (size_t i = 0; i < node->dependents.size(); i++) {
+      if (--node->dependents[i]->num_dependencies == 0) {
+        ready.push_back(node->dependents[i]);
+      }
+    }
+    node->dependents.clear();
+
+    num_pending_--;
+
+    // Wakes up Wait(), WaitNode() and WaitBuffer(). Notified under the lock
+    // since the scheduler may be destroyed as soon as Wait() returns.
+    cv_.notify_all();
+  }
+
+  for (size_t i = 0; i < ready.size(); i++) {
+    Launch(ready[i]);
+  }
 }
 
-void ReleaseSoftGL() {
-  // LOG_F(INFO, "Relese SoftGL context");
-  delete gCtx;
-  gCtx = nullptr;
+size_t DispatchScheduler::TakeStats(DispatchStats *stats, size_t max_count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const size_t count = std::min(max_count, num_stats_);
+  for (size_t i = 0; i < count; i++) {
+    stats[i] = stats_[(stats_begin_ + i) % kMaxStats];
+  }
+
+  if (count > 0) {
+    stats_begin_ = (stats_begin_ + count) % kMaxStats;
+    num_stats_ -= count;
+  }
+
+  return count;
 }
 
-static void InitializeGLContext() {
-  if (gCtx == nullptr) {
-    InitSoftGL();
+// GLsync points to this.
+struct SyncObject {
+  std::shared_ptr<DispatchNode> fence;
+};
+
+// Timer query. Its times are the finish times of fence nodes.
+struct Query {
+  GLenum target;  // 0 until first used
+  uint32_t pad;
+
+  std::shared_ptr<DispatchNode> begin;  // GL_TIME_ELAPSED only
+  std::shared_ptr<DispatchNode> end;
+
+  Query() : target(0), pad(0) {}
+};
+
+// CPUs workers run on as set by `config`, grouped by NUMA node unless NUMA
+// awareness is off.
+static softcompute::NumaTopology GetWorkerTopology(const SoftGLConfig &config) {
+  std::vector<int> cpus = softcompute::GetAllowedCpus();
+
+  // Listed CPUs are not restricted to the allowed ones, which usually
+  // exclude isolated CPUs.
+  if (config.cpu_list && (config.cpu_list[0] != '\0')) {
+    std::vector<int> listed;
+    if (strcmp(config.cpu_list, "isolated") == 0) {
+      listed = softcompute::GetIsolatedCpus();
+    } else if (!softcompute::ParseCpuList(config.cpu_list, &listed)) {
+      listed.clear();
+    }
+
+    if (listed.empty()) {
+      std::cerr << "[SoftGL] No CPUs in \"" << config.cpu_list
+                << "\", using all CPUs." << std::endl;
+    } else {
+      cpus = listed;
+    }
+  }
+
+  if (config.avoid_smt) {
+    cpus = softcompute::RemoveSmtSiblings(cpus);
+  }
+
+  if (config.numa_placement == SoftGLConfig::kNumaOff) {
+    return softcompute::NumaTopology(cpus);
   }
+  return softcompute::NumaTopology::Detect().Restrict(cpus);
 }
 
-static void SetGLError(GLenum error) {
-  if (gCtx) {
-    gCtx->SetGLError(error);
+static softcompute::ThreadAffinity GetWorkerAffinity(
+    const SoftGLConfig &config, const softcompute::NumaTopology &topology) {
+  switch (config.thread_affinity) {
+    case SoftGLConfig::kAffinityCore:
+      return softcompute::kAffinityCore;
+    case SoftGLConfig::kAffinityNode:
+      // Binding to all CPUs the process may run on would only keep workers
+      // from following later affinity changes of the process.
+      if ((topology.GetNumNodes() > 1) ||
+          (config.cpu_list && (config.cpu_list[0] != '\0')) ||
+          config.avoid_smt) {
+        return softcompute::kAffinityNode;
+      }
+      return softcompute::kAffinityNone;
+    case SoftGLConfig::kAffinityNone:
+      break;
   }
+  return softcompute::kAffinityNone;
 }
 
-void SetJITCompilerOptions(const char *option_string) {
-  InitializeGLContext();
+class SoftGLContext {
+ public:
+  explicit SoftGLContext(const SoftGLConfig &config)
+      : numa(GetWorkerTopology(config)),
+        buffer_pool(kMaxPooledBufferBytes),
+        pool(config.num_threads, numa, GetWorkerAffinity(config, numa)),
+        scheduler(&pool),
+        error_(GL_NO_ERROR) {
+    buffer_pool.SetHugePageThreshold(static_cast<size_t>(
+        std::max(config.huge_page_threshold, GLsizeiptr(0))));
+    if (config.numa_placement != SoftGLConfig::kNumaOff) {
+      buffer_pool.SetNumaPlacement(
+          &numa, (config.numa_placement == SoftGLConfig::kNumaInterleave)
+                     ? softcompute::kNumaInterleave
+                     : softcompute::kNumaPartition);
+    }
+    shader_storage_buffer_accessor.resize(kMaxBufferBindings + 1);
+    uniform_buffer_accessor.resize(kMaxBufferBindings + 1);
+
+    active_buffer_index = 0;
+    copy_read_buffer_index = 0;
+    copy_write_buffer_index = 0;
+    active_program = 0;
+    recording_list = 0;
+    active_time_query = 0;
+  }
+
+  ~SoftGLContext() {
+    // Finish in-flight dispatches before buffers and programs go away.
+    scheduler.Wait();
+  }
+
+  void SetJITCompilerOptions(const std::string &option_string) {
+    jit_compile_options_ = option_string;
+  }
+
+  std::string GetJITCompileOptions() const {
+    return jit_compile_options_;
+  }
+
+  void SetGLError(const GLenum error) { error_ = error; }
+
+  // Memory nodes and their CPUs. Declared before everything placing memory
+  // or threads on them.
+  softcompute::NumaTopology numa;
+
+  // Heap blocks of buffers. Declared before the rest so that buffers, including ones
+  // held by dispatches, return their blocks before it goes away.
+  softcompute::BufferPool buffer_pool;
+
+  // Owns compiled shader modules. Shader ID is the slot index of the program
+  // (SlotMap::Index()).
+  // Declared before programs so that they release their shaders before it.
+  softcompute::ShaderEngine engine;
+
+  softcompute::WorkerPool pool;
+  DispatchScheduler scheduler;
+
+  uint32_t active_buffer_index;  // GL_SHADER_STORAGE_BUFFER and GL_UNIFORM_BUFFER
+  uint32_t copy_read_buffer_index;
+  uint32_t copy_write_buffer_index;
+  uint32_t active_program;
+  uint32_t recording_list;  // Non-zero while recording a command list.
+  uint32_t active_time_query;  // Active GL_TIME_ELAPSED query
+
+  std::vector<Accessor> shader_storage_buffer_accessor;
+  std::vector<Accessor> uniform_buffer_accessor;
+
+  // Object names are SlotMap handles. Objects do not move, so dispatches
+  // refer to buffers and programs by pointer.
+  softcompute::SlotMap<Buffer> buffers;
+  softcompute::SlotMap<Program> programs;
+  softcompute::SlotMap<Shader> shaders;
+  softcompute::SlotMap<CommandList> command_lists;
+  softcompute::SlotMap<Query> queries;
+
+  // GLsync objects are pointers rather than names. Deleted ones are removed,
+  // so that they are not mistaken for live ones.
+  std::unordered_map<const SyncObject *, std::unique_ptr<SyncObject>> syncs;
+
+ private:
+  std::string jit_compile_options_;
+
+  GLenum error_;
+};
+
+static SoftGLContext *gCtx = nullptr;
+
+// --------------------------------------------------------------------------------
+// Simple offline complilation functions.
+
+/// Generate unique filename.
+static std::string GenerateUniqueFilename() {
+  char basename[] = "softcompute_XXXXXX";
+
+#if defined(_WIN32)
+
+  assert(strlen(basename) < 1023);
+
+  char buf[1024];
+  strncpy(buf, basename, strlen(basename));
+  buf[strlen(basename)] = '\0';
+
+  size_t len = strlen(buf) + 1;
+  int err =
+      _mktemp_s(buf, len);  // prefix will be overwritten with actual filename
+  if (err != 0) {
+    std::cerr << "Failed to create unique filename.\n";
+    return std::string();
+  }
+
+  printf("DBG: Unique name: %s", buf);
+
+  std::string name = std::string(buf);
+
+#else
+  int fd =
+      mkstemp(basename);  // prefix will be overwritten with actual filename
+  if (fd == -1) {
+    std::cerr << "Failed to create unique filename.\n";
+    return std::string();
+  }
+  close(fd);
+  int ret = unlink(basename);
+  if (ret == -1) {
+    std::cerr << "Failed to delete file: " << basename << std::endl;
+  }
+
+  std::string name = std::string(basename);
+
+#endif
+
+  return name;
+}
+
+#ifndef SOFTCOMPUTE_ENABLE_JIT
+// Runs `cmd` and collects its stdout. Returns false when it cannot be run or
+// exits with an error.
+static bool exec_command(std::vector<std::string> *outputs,
+                         const std::string &cmd) {
+  outputs->clear();
+
+  // This may not be needed, but for the safety.
+  // See popen(3) manual for details why calling fflush(nullptr) here
+  fflush(nullptr);
+
+#if defined(_WIN32)
+  FILE *pfp = _popen(cmd.c_str(), "r");
+#else
+  FILE *pfp = popen(cmd.c_str(), "r");
+#endif
+
+  if (!pfp) {
+    std::cerr << "Failed to open pipe." << std::endl;
+    perror("popen");
+
+    return false;
+  }
+
+  char buf[4096];
+  while (fgets(buf, 4095, pfp) != nullptr) {
+    // printf("%s", buf);
+    outputs->push_back(buf);
+  }
+
+#if defined(_WIN32)
+  int status = _pclose(pfp);
+  if (status == -1) {
+    fprintf(stderr, "Failed to close pipe.\n");
+    return false;
+  }
+#else
+  int status = pclose(pfp);
+  if (status == -1) {
+    fprintf(stderr, "Failed to close pipe.\n");
+    return false;
+  }
+#endif
+
+  return status == 0;
+}
+#endif
+
+static void PutsIfNonEmpty(const char *str)
+{
+  if (str && str[0]) {
+    puts(str);
+  }
+}
+
+// glsl string -> spirv
+static bool compile_glsl_string(const std::string &glsl_input, const std::string &filename, std::vector<uint32_t> *out_spirv) {
+  softcompute::CompileStageScope trace(softcompute::kCompileGlslToSpirv,
+                                      "glslang");
+
+  TBuiltInResource resources = glslang::DefaultTBuiltInResource;
+
+
+  glslang::TProgram &program = *new glslang::TProgram;
+  glslang::TShader *shader = new glslang::TShader(EShLangCompute); // compute shader
+
+  const char *text[1];
+  const char *filename_list[1];
+  int count = 1;
+
+  text[0] = glsl_input.c_str();
+  filename_list[0] = filename.c_str();
+
+  shader->setStringsWithLengthsAndNames(text, nullptr, filename_list, count);
+
+  //std::vector<std::string> processes; // TODO(LTE)
+  //shader->addProcesses(processes);
+
+  // SPIR-V settings.
+  shader->setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_0);
+
+  EShMessages messages = EShMsgDefault;
+
+  // TODO(LTE): Includer, preprocess.
+  bool compile_ok = false;
+  {
+    softcompute::TraceScope parse_trace("compile", "glslang parse");
+    compile_ok = shader->parse(&resources, /* version */110, false, messages);
+  }
+
+  PutsIfNonEmpty(shader->getInfoLog());
+  PutsIfNonEmpty(shader->getInfoDebugLog());
+
+  if (!compile_ok) {
+    std::cerr << "Compile failed." << std::endl;
+  } else {
+    std::cout << "Compile OK." << std::endl;
+  }
+
+  program.addShader(shader);
+
+  bool link_ok = false;
+  {
+    softcompute::TraceScope link_trace("compile", "glslang link");
+    link_ok = program.link(messages);
+  }
+  if (!link_ok) {
+    std::cerr << "Link failed." << std::endl;
+  } else {
+    std::cout << "Link OK." << std::endl;
+  }
+
+  bool ok = false;
+
+  if (compile_ok && link_ok) {
+
+    glslang::SpvOptions spv_options;
+    spv_options.disableOptimizer = false;
+    spv_options.optimizeSize = false;
+    spv::SpvBuildLogger logger;
+
+    std::vector<unsigned int> spirv;
+
+    softcompute::TraceScope spv_trace("compile", "GlslangToSpv");
+    glslang::GlslangToSpv(*program.getIntermediate(static_cast<EShLanguage>(EShLangCompute)), spirv, &logger, &spv_options);
+
+    if (spirv.size() > 0) {
+      (*out_spirv) = spirv;
+      ok = true;
+    }
+  }
+
+#if 0
+  // From ResourceLimits.cpp in glslang/StandAlone
+  int ret = ShCompile(compiler, &shader_string, 1, nullptr, EShOptNone, &resources, options, /* version */110, false, messages);
+
+  free(shader_string);
+#endif
+
+  delete &program;
+  delete shader;
+
+  return true;
+}
+
+
+#if 0
+// glsl -> spirv
+static bool compile_glsl(const std::string &output_filename, bool verbose,
+                         const std::string &glsl_filename) {
+  //
+  // Invoke `glslangValidator`
+  //
+  std::string binary = "glslangValidator";
+  char *binary_path = getenv("GLSLANG_VALIDADOR");
+  if (binary_path) {
+    binary = binary_path;
+    if (verbose) {
+      printf("glslangValidator = %s\n", binary.c_str());
+    }
+  }
+
+  std::stringstream ss;
+  ss << binary;
+  ss << " -V";
+  ss << " -o " << output_filename.c_str();
+  ss << " " << glsl_filename;
+
+  std::string cmd;
+  cmd = ss.str();
+  if (verbose) {
+    std::cout << cmd << std::endl;
+  }
+
+  std::vector<std::string> outputs;
+  bool ret = exec_command(&outputs, cmd);
+  if (ret) {
+    //
+    // Check if compiled cpp code exists.
+    //
+    std::ifstream ifile(output_filename);
+    if (!ifile) {
+      std::cerr << "Failed to translate GLSL to SPIR-V" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// spirv file -> c++
+static bool compile_spirv(const std::string &output_filename, bool verbose, const std::string &spirv_filename)
+{
+    //
+    // Invoke `spirv-cross`
+    //
+    std::string spirv_cross = "spirv-cross";
+    char *spirv_cross_path = getenv("SPIRV_CROSS");
+    if (spirv_cross_path)
+    {
+        spirv_cross = spirv_cross_path;
+        if (verbose)
+        {
+            printf("spirv-cross = %s\n", spirv_cross.c_str());
+        }
+    }
+
+    std::stringstream ss;
+    ss << spirv_cross;
+    ss << " --output " << output_filename.c_str();
+    ss << " --cpp";
+    ss << " " << spirv_filename;
+    ss << " --dump-resources";
+    ss << " 2>&1"; // spirv-cross dumps info to stderr. redirect stderr to stdout to catch dump info.
+
+    std::string cmd;
+    cmd = ss.str();
+    if (verbose)
+    {
+        std::cout << cmd << std::endl;
+    }
+
+    std::vector<std::string> outputs;
+    bool ret = exec_command(&outputs, cmd);
+    if (ret)
+    {
+        //
+        // Check if compiled cpp code exists.
+        //
+        std::ifstream ifile(output_filename);
+        if (!ifile)
+        {
+            LOG_F(ERROR, "Failed to translate SPIR-V to C++");
+            return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+#else
+// spirv binary file -> c++
+static bool compile_spirv_binary(const std::string &output_filename,
+                                 bool verbose,
+                                 const std::vector<uint32_t> &spirv_binary) {
+  softcompute::CompileStageScope trace(softcompute::kCompileSpirvToCpp,
+                                      "SPIRV-Cross codegen");
+
+  std::unique_ptr<spirv_cross::CompilerGLSL> compiler =
+      std::unique_ptr<spirv_cross::CompilerGLSL>(
+          new spirv_cross::CompilerCPP(spirv_binary));
+
+  std::string code = compiler->compile();
+
+  std::ofstream ofs(output_filename);
+  if (!ofs) {
+    // LOG_F(ERROR, "Failed to open file for wtire : %s",
+    // output_filename.c_str());
+    return false;
+  }
+
+  ofs << code;
+
+  (void)verbose;
+
+  return true;
+}
+#endif
+
+#ifndef SOFTCOMPUTE_ENABLE_JIT
+// c++ -> dll
+static bool compile_cpp(const std::string &output_filename,
+                        const std::string &options, bool verbose,
+                        const std::string &cpp_filename) {
+  //
+  // Invoke C++ compiler
+  //
+  std::string cpp = "g++";
+  char *cpp_env = getenv("CXX");
+  if (cpp_env) {
+    cpp = cpp_env;
+    if (verbose) {
+      printf("cpp = %s\n", cpp.c_str());
+    }
+  }
+
+  // Assume gcc or clang. Assume mingw on windows.
+  std::stringstream ss;
+  ss << cpp;
+  ss << " -std=c++11";
+  ss << " -I./third_party/glm";  // TODO(syoyo): User-supplied path to glm
+  ss << " -I./third_party/SPIRV-Cross/include";  // TODO(syoyo): User-supplied
+                                                 // path to SPIRV-Cross/include.
+  ss << " -o " << output_filename;
+#ifdef __APPLE__
+  ss << " -flat_namespace";
+  ss << " -bundle";
+  ss << " -undefined suppress";
+#else
+  ss << " -shared";
+  ss << " -g";
+#endif
+#ifdef __linux__
+  ss << " -fPIC";
+#endif
+  ss << " " << options;
+  ss << " " << cpp_filename;
+
+  std::string cmd;
+  cmd = ss.str();
+  if (verbose) std::cout << cmd << std::endl;
+
+  std::vector<std::string> outputs;
+  bool ret = exec_command(&outputs, cmd);
+  if (!ret) {
+    for (size_t i = 0; i < outputs.size(); i++) {
+      std::cerr << outputs[i];
+    }
+    std::cerr << "Failed to compile C++" << std::endl;
+    return false;
+  }
+
+  //
+  // Check if compiled dll file exists.
+  //
+  std::ifstream ifile(output_filename);
+  if (!ifile) {
+    std::cerr << "Failed to compile C++" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+#endif
+
+// -------------------------------------------------------------------
+
+void InitSoftGL() { InitSoftGL(SoftGLConfig()); }
+
+// Applies SOFTCOMPUTE_AFFINITY, a ':' separated list of "none", "node",
+// "core", "smt", "nosmt" and a CPU list or "isolated", e.g.
+// "core:nosmt:0-15". `cpu_list` keeps the string config->cpu_list points to.
+static void ParseAffinityEnvironment(const char *value, SoftGLConfig *config,
+                                     std::string *cpu_list) {
+  std::stringstream ss(value);
+  std::string token;
+  while (std::getline(ss, token, ':')) {
+    if (token == "none") {
+      config->thread_affinity = SoftGLConfig::kAffinityNone;
+    } else if (token == "node") {
+      config->thread_affinity = SoftGLConfig::kAffinityNode;
+    } else if (token == "core") {
+      config->thread_affinity = SoftGLConfig::kAffinityCore;
+    } else if (token == "smt") {
+      config->avoid_smt = GL_FALSE;
+    } else if (token == "nosmt") {
+      config->avoid_smt = GL_TRUE;
+    } else if ((token == "isolated") ||
+               (!token.empty() && (token[0] >= '0') && (token[0] <= '9'))) {
+      *cpu_list = token;
+      config->cpu_list = cpu_list->c_str();
+    } else if (!token.empty()) {
+      std::cerr << "[SoftGL] Unknown SOFTCOMPUTE_AFFINITY setting \"" << token
+                << "\"" << std::endl;
+    }
+  }
+}
+
+void InitSoftGL(const SoftGLConfig &config) {
+  // Pass dummy argc/argv;
+  int argc = 1;
+  const char *argv[] = {"softgl", nullptr};
+  (void)argc;
+  (void)argv;
+
+  SoftGLConfig env_config = config;
+  std::string cpu_list;
+
+  const char *threads = getenv("SOFTCOMPUTE_THREADS");
+  if (threads && (threads[0] != '\0')) {
+    char *end = nullptr;
+    const long num_threads = strtol(threads, &end, 10);
+    if ((*end == '\0') && (num_threads > 0) &&
+        (num_threads <= std::numeric_limits<GLint>::max())) {
+      env_config.num_threads = static_cast<GLint>(num_threads);
+    } else {
+      std::cerr << "[SoftGL] Invalid SOFTCOMPUTE_THREADS setting \"" << threads
+                << "\"" << std::endl;
+    }
+  }
+
+  const char *affinity = getenv("SOFTCOMPUTE_AFFINITY");
+  if (affinity) {
+    ParseAffinityEnvironment(affinity, &env_config, &cpu_list);
+  }
+
+  // loguru::init(argc, const_cast<char **>(argv));
+  // LOG_F(INFO, "Initialize SoftGL context");
+  gCtx = new SoftGLContext(env_config);
+
+  softcompute::StartTracingFromEnvironment();
+
+  const char *heatmap_prefix = getenv("SOFTCOMPUTE_HEATMAP");
+  if (heatmap_prefix) {
+    gCtx->scheduler.SetHeatmapPrefix(heatmap_prefix);
+  }
+
+  const char *perf_counters = getenv("SOFTCOMPUTE_PERF_COUNTERS");
+  if (perf_counters && (atoi(perf_counters) != 0)) {
+    gCtx->scheduler.SetCountEvents(true);
+  }
+}
+
+void ReleaseSoftGL() {
+  // LOG_F(INFO, "Relese SoftGL context");
+  delete gCtx;
+  gCtx = nullptr;
+
+  // After the context so that in-flight dispatches are recorded.
+  softcompute::StopTracing();
+}
+
+static void InitializeGLContext() {
+  if (gCtx == nullptr) {
+    InitSoftGL();
+  }
+}
+
+static void SetGLError(GLenum error) {
+  if (gCtx) {
+    gCtx->SetGLError(error);
+  }
+}
+
+void SetJITCompilerOptions(const char *option_string) {
+  InitializeGLContext();
+
+  if (option_string) {
+    gCtx->SetJITCompilerOptions(std::string(option_string));
+  }
+}
+
+GLint GetNumWorkerThreads() {
+  InitializeGLContext();
+
+  return gCtx->pool.GetNumThreads();
+}
+
+GLint GetNumNumaNodes() {
+  InitializeGLContext();
+
+  return gCtx->pool.GetNumNodes();
+}
+
+const char *GetShaderEngineName() {
+#ifdef SOFTCOMPUTE_ENABLE_JIT
+  return "jit";
+#else
+  return "dll";
+#endif
+}
+
+void EnableTracing(const char *filename) {
+  if (filename && filename[0]) {
+    softcompute::StartTracing(filename);
+  }
+}
+
+void EnablePerfCounters(GLboolean enable) {
+  InitializeGLContext();
+
+  gCtx->scheduler.SetCountEvents(enable != GL_FALSE);
+}
+
+void EnableWorkgroupHeatmap(const char *prefix) {
+  InitializeGLContext();
+
+  gCtx->scheduler.SetHeatmapPrefix(prefix ? prefix : "");
+}
+
+// Returns the command list being recorded, or nullptr when not recording.
+static CommandList *GetRecordingCommandList() {
+  if (gCtx->recording_list == 0) {
+    return nullptr;
+  }
+
+  return gCtx->command_lists.Get(gCtx->recording_list);
+}
+
+template <typename T>
+static void AppendCommand(CommandList *list, Command::Type type,
+                          std::vector<T> *args, const T &arg) {
+  Command command;
+  command.type = type;
+  command.index = static_cast<uint32_t>(args->size());
+  command.count = 1;
+
+  args->push_back(arg);
+  list->commands.push_back(command);
+}
+
+// Sets a uniform of the active program. Location -1 is silently ignored as
+// in GL.
+static void SetUniform(GLint location, const Uniform &value) {
+  if (location == -1) return;
+
+  Program *prog = gCtx->programs.Get(gCtx->active_program);
+  if (!prog || !prog->linked || !prog->WriteUniform(location, value)) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  CommandList *list = GetRecordingCommandList();
+  if (list) {
+    UniformCommand command;
+    command.location = location;
+    command.value = value;
+    AppendCommand(list, Command::kUniform, &list->uniforms, command);
+  }
+}
+
+void glUniform1f(GLint location, GLfloat v0) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.fv[0] = v0;
+  value.type = GL_FLOAT;
+  value.count = 1;
+
+  SetUniform(location, value);
+}
+
+void glUniform2f(GLint location, GLfloat v0, GLfloat v1) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.fv[0] = v0;
+  value.fv[1] = v1;
+  value.type = GL_FLOAT;
+  value.count = 2;
+
+  SetUniform(location, value);
+}
+
+void glUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.fv[0] = v0;
+  value.fv[1] = v1;
+  value.fv[2] = v2;
+  value.type = GL_FLOAT;
+  value.count = 3;
+
+  SetUniform(location, value);
+}
+
+void glUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2,
+                 GLfloat v3) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.fv[0] = v0;
+  value.fv[1] = v1;
+  value.fv[2] = v2;
+  value.fv[3] = v3;
+  value.type = GL_FLOAT;
+  value.count = 4;
+
+  SetUniform(location, value);
+}
+
+void glUniform1i(GLint location, GLint v0) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.iv[0] = v0;
+  value.type = GL_INT;
+  value.count = 1;
+
+  SetUniform(location, value);
+}
+
+void glUniform2i(GLint location, GLint v0, GLint v1) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.iv[0] = v0;
+  value.iv[1] = v1;
+  value.type = GL_INT;
+  value.count = 2;
+
+  SetUniform(location, value);
+}
+
+void glUniform3i(GLint location, GLint v0, GLint v1, GLint v2) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.iv[0] = v0;
+  value.iv[1] = v1;
+  value.iv[2] = v2;
+  value.type = GL_INT;
+  value.count = 3;
+
+  SetUniform(location, value);
+}
+
+void glUniform4i(GLint location, GLint v0, GLint v1, GLint v2, GLint v3) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.iv[0] = v0;
+  value.iv[1] = v1;
+  value.iv[2] = v2;
+  value.iv[3] = v3;
+  value.type = GL_INT;
+  value.count = 4;
+
+  SetUniform(location, value);
+}
+
+void glUniform1ui(GLint location, GLuint v0) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.uv[0] = v0;
+  value.type = GL_UNSIGNED_INT;
+  value.count = 1;
+
+  SetUniform(location, value);
+}
+
+void glUniform2ui(GLint location, GLuint v0, GLuint v1) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.uv[0] = v0;
+  value.uv[1] = v1;
+  value.type = GL_UNSIGNED_INT;
+  value.count = 2;
+
+  SetUniform(location, value);
+}
+
+void glUniform3ui(GLint location, GLuint v0, GLuint v1, GLuint v2) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.uv[0] = v0;
+  value.uv[1] = v1;
+  value.uv[2] = v2;
+  value.type = GL_UNSIGNED_INT;
+  value.count = 3;
+
+  SetUniform(location, value);
+}
+
+void glUniform4ui(GLint location, GLuint v0, GLuint v1, GLuint v2, GLuint v3) {
+  InitializeGLContext();
+
+  Uniform value;
+  value.uv[0] = v0;
+  value.uv[1] = v1;
+  value.uv[2] = v2;
+  value.uv[3] = v3;
+  value.type = GL_UNSIGNED_INT;
+  value.count = 4;
+
+  SetUniform(location, value);
+}
+
+void glGenBuffers(GLsizei n, GLuint *buffers) {
+  InitializeGLContext();
+
+  if (n < 0) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+  assert(buffers);
+
+  for (GLsizei i = 0; i < n; i++) {
+    buffers[i] = gCtx->buffers.Allocate();
+    if (buffers[i] == 0) {
+      SetGLError(GL_OUT_OF_MEMORY);
+    }
+  }
+}
+
+void glDeleteBuffers(GLsizei n, const GLuint *buffers) {
+  InitializeGLContext();
+
+  if (n < 0) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+  assert(buffers);
+
+  for (GLsizei i = 0; i < n; i++) {
+    Buffer *buffer = gCtx->buffers.Get(buffers[i]);
+    if (!buffer) {
+      // Silently ignores 0 and unused names.
+      continue;
+    }
+
+    // In-flight dispatches may still access the storage.
+    gCtx->scheduler.WaitBuffer(buffer);
+
+    // Deleting a bound buffer unbinds it.
+    for (size_t k = 0; k < gCtx->shader_storage_buffer_accessor.size(); k++) {
+      if (gCtx->shader_storage_buffer_accessor[k].buffer_index == buffers[i]) {
+        gCtx->shader_storage_buffer_accessor[k] = Accessor();
+      }
+    }
+    for (size_t k = 0; k < gCtx->uniform_buffer_accessor.size(); k++) {
+      if (gCtx->uniform_buffer_accessor[k].buffer_index == buffers[i]) {
+        gCtx->uniform_buffer_accessor[k] = Accessor();
+      }
+    }
+    if (gCtx->active_buffer_index == buffers[i]) {
+      gCtx->active_buffer_index = 0;
+    }
+    if (gCtx->copy_read_buffer_index == buffers[i]) {
+      gCtx->copy_read_buffer_index = 0;
+    }
+    if (gCtx->copy_write_buffer_index == buffers[i]) {
+      gCtx->copy_write_buffer_index = 0;
+    }
+
+    gCtx->buffers.Release(buffers[i]);
+  }
+}
+
+GLuint glCreateProgram() {
+  InitializeGLContext();
+
+  return gCtx->programs.Allocate();  // 0 when out of slots
+}
+
+GLuint glCreateShader(GLenum shader_type) {
+  InitializeGLContext();
+  assert(shader_type == GL_COMPUTE_SHADER);
+  (void)shader_type;
+
+  return gCtx->shaders.Allocate();
+}
+
+// Records the component type and shape of `type` in `slot`.
+static void SetUniformType(const spirv_cross::SPIRType &type,
+                           UniformSlot *slot) {
+  slot->base_type = type.basetype;
+  slot->vecsize = type.vecsize;
+  slot->columns = type.columns;
+  slot->array_size = 1;
+  for (size_t i = 0; i < type.array.size(); i++) {
+    slot->array_size *= type.array[i];
+  }
+}
+
+// Size and std140-like alignment of a plain uniform in the uniform block. The
+// size is that of the C++ type the shader reads, e.g. 12 bytes for a vec3.
+// Returns false for types glUniform* cannot set.
+static bool GetUniformLayout(const spirv_cross::SPIRType &type, uint32_t *size,
+                             uint32_t *alignment) {
+  if ((type.basetype != spirv_cross::SPIRType::Float) &&
+      (type.basetype != spirv_cross::SPIRType::Int) &&
+      (type.basetype != spirv_cross::SPIRType::UInt)) {
+    return false;
+  }
+
+  const uint32_t component_size = type.width / 8;
+
+  uint32_t count = type.vecsize * type.columns;
+  for (size_t i = 0; i < type.array.size(); i++) {
+    count *= type.array[i];
+  }
+
+  (*size) = component_size * count;
+
+  if ((type.columns > 1) || !type.array.empty() || (type.vecsize >= 3)) {
+    (*alignment) = 4 * component_size;
+  } else {
+    (*alignment) = type.vecsize * component_size;
+  }
+
+  return (*size) > 0;
+}
+
+// Registers a buffer block under its block name and, for named instances,
+// under its instance name too.
+static void AddBlockNames(const spirv_cross::CompilerCPP &cpp,
+                          const spirv_cross::Resource &block, GLuint index,
+                          std::unordered_map<std::string, GLuint> *names) {
+  const std::string &block_name = cpp.get_name(block.base_type_id);
+  if (!block_name.empty()) {
+    names->insert(std::make_pair(block_name, index));
+  }
+  if (!block.name.empty()) {
+    names->insert(std::make_pair(block.name, index));
+  }
+}
+
+void glLinkProgram(GLuint program) {
+  InitializeGLContext();
+
+  softcompute::TraceScope trace("gl", "glLinkProgram", "program", program);
+
+  Program *program_ptr = gCtx->programs.Get(program);
+  if (!program_ptr) {
+    // LOG_F(ERROR, "[SoftGL] Program %d is not created.", program);
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  Program &prog = *program_ptr;
+
+  if (prog.linked) {
+    // LOG_F(ERROR, "[SoftGL] Program %d is already linked.", program);
+    return;
+  }
+
+  // Linking replaces the shader module of this program index.
+  gCtx->scheduler.Wait();
+  prog.link_count++;
+
+  const uint64_t link_start_ns = softcompute::TraceNow();
+  softcompute::ResetCompileStageTimes();
+
+  // CHECK_F(prog.shaders.size() == 1, "Currently only one shader per program
+  // expected, but got %d", int(prog.shaders.size()));
+
+  const Shader *shader_ptr =
+      prog.shaders.empty() ? nullptr : gCtx->shaders.Get(prog.shaders[0]);
+
+  if (!shader_ptr) {
+    // LOG_F(ERROR, "[SoftGL] Invalid shader attached to the program.");
+    return;
+  }
+
+  const Shader &shader = *shader_ptr;
+
+  if (shader.binary.size() == 0) {
+    // LOG_F(ERROR, "[SoftGL] No shader binary assined.");
+    return;
+  }
+
+  std::string basename = GenerateUniqueFilename();
+  std::string spirv_filename = basename + ".spv";
+  std::string cpp_filename = basename + ".cc";
+
+#ifdef _WIN32
+  std::string dll_filename = basename + ".dll";
+#else
+  std::string dll_filename = basename + ".so";
+#endif
+
+  {
+    // Save CPP compiler context of SPIRV-Cross for later use.
+    prog.cpp = std::make_shared<spirv_cross::CompilerCPP>(shader.binary);
+  }
+
+  {
+    bool ret =
+        compile_spirv_binary(cpp_filename, /* verbose */ true, shader.binary);
+    if (!ret) {
+      // ABORT_F("Failed to translate SPIR-V binary to .cpp");
+      std::cerr << "Failed to translate SPIR-V binary to .cpp" << std::endl;
+    }
+  }
+
+#if 0
+  {
+    std::string cpp_compile_options;  // FIXME(syoyo): Supply compiler options
+
+    // c++ -> dll
+    bool ret = compile_cpp(dll_filename, cpp_compile_options,
+                           /* verbose */ true, cpp_filename);
+    if (!ret) {
+      std::cerr << "Failed to compile C++ into dll module." << std::endl;
+      return;
+    }
+  }
+
+  softcompute::ShaderEngine engine;
+  std::vector<std::string> search_paths;
+  std::string compile_options;
+
+  // LOG_F(INFO, "load dll...");
+  prog.instance = std::make_shared<softcompute::ShaderInstance>(*(engine.Compile("comp", /* id */ 0, search_paths,
+                                 compile_options, dll_filename)));
+
+  // LOG_F(INFO, "loaded dll...");
+  spirv_cross_get_interface_fn interface_fn =
+      reinterpret_cast<spirv_cross_get_interface_fn>(
+          prog.instance->GetInterfaceFuncPtr());
+
+  struct spirv_cross_interface *interface = interface_fn();
+  //fprintf(stderr, "construct: %p\n", interface->construct());
+  prog.shader = std::make_shared<spirv_cross_shader_t>(*(interface->construct()));
+
+  // LOG_F(INFO, "linked...");
+  prog.linked = true;
+#else
+
+  std::vector<std::string> search_paths;
+  std::string compile_options;
+
+  {
+    std::stringstream ss;
+
+    //ss << "-I./third_party/glm ";  // TODO(syoyo): User-supplied path to glm
+    ss << "-I./third_party/SPIRV-Cross/include ";
+
+    ss << gCtx->GetJITCompileOptions() << " ";
+
+    compile_options = ss.str();
+  }
+
+#ifdef SOFTCOMPUTE_ENABLE_JIT
+  const std::string &module_filename = cpp_filename;
+#else
+  // The DLL engine loads a compiled module.
+  {
+    softcompute::CompileStageScope compile_trace(softcompute::kCompileCppToIR,
+                                                 "C++ compiler");
+
+    // Capture compiler errors, which go to stderr.
+    bool ret = compile_cpp(dll_filename, compile_options + " 2>&1",
+                           /* verbose */ false, cpp_filename);
+    if (!ret) {
+      std::cerr << "Failed to compile C++ into dll module." << std::endl;
+      return;
+    }
+  }
+  const std::string &module_filename = dll_filename;
+#endif
+
+  prog.instance = gCtx->engine.Compile(
+      "comp", /* id */ softcompute::SlotMap<Program>::Index(program),
+      search_paths, compile_options, module_filename);
+  if (!prog.instance) {
+    std::cerr << "Failed to compile shader module." << std::endl;
+    return;
+  }
+
+  // LOG_F(INFO, "loaded dll...");
+  spirv_cross_get_interface_fn interface_fn =
+      reinterpret_cast<spirv_cross_get_interface_fn>(
+          prog.instance->GetInterfaceFuncPtr());
+
+  {
+    softcompute::TraceScope reflection_trace("compile", "reflection");
+
+    // Record descriptor set/binding of buffer blocks so that dispatches can
+    // bind them without reflecting the shader again.
+    prog.resource_bindings.clear();
+    prog.reflection = ProgramReflection();
+
+    const spirv_cross::ShaderResources resources =
+        prog.cpp->get_shader_resources();
+
+    // Find SSBOs each invocation accesses only at its own index, for
+    // fusing dispatches in command lists.
+    std::vector<uint32_t> buffer_ids;
+    for (size_t i = 0; i < resources.storage_buffers.size(); i++) {
+      buffer_ids.push_back(resources.storage_buffers[i].id);
+    }
+
+    softcompute::BufferAccessInfo access;
+    if (!softcompute::AnalyzeBufferAccess(shader.binary, buffer_ids,
+                                          &access)) {
+      access.synchronizes = true;
+      access.elementwise_variables.clear();
+    }
+
+    prog.synchronizes = access.synchronizes;
+    for (uint32_t i = 0; i < 3; i++) {
+      prog.local_size[i] = prog.cpp->get_execution_mode_argument(
+          spv::ExecutionModeLocalSize, i);
+    }
+
+    for (size_t i = 0; i < resources.storage_buffers.size(); i++) {
+      const uint32_t id = resources.storage_buffers[i].id;
+      const spirv_cross::Bitset flags = prog.cpp->get_buffer_block_flags(id);
+
+      // Elements can only be matched between shaders for blocks holding just
+      // the array, e.g. `buffer B { vec4 data[]; };`.
+      const spirv_cross::SPIRType &type =
+          prog.cpp->get_type(resources.storage_buffers[i].base_type_id);
+      uint32_t element_stride = 0;
+      if ((type.member_types.size() == 1) &&
+          !prog.cpp->get_type(type.member_types[0]).array.empty()) {
+        element_stride = prog.cpp->type_struct_member_array_stride(type, 0);
+      }
+
+      ResourceBinding binding;
+      binding.set = prog.cpp->get_decoration(id, spv::DecorationDescriptorSet);
+      binding.binding = prog.cpp->get_decoration(id, spv::DecorationBinding);
+      binding.buffer_binding = binding.binding;
+      binding.data_size =
+          static_cast<uint32_t>(prog.cpp->get_declared_struct_size(type));
+      binding.element_stride = element_stride;
+      binding.is_storage = true;
+      binding.readable = !flags.get(spv::DecorationNonReadable);
+      binding.writable = !flags.get(spv::DecorationNonWritable);
+      binding.elementwise =
+          (element_stride > 0) &&
+          (std::find(access.elementwise_variables.begin(),
+                     access.elementwise_variables.end(),
+                     id) != access.elementwise_variables.end());
+      AddBlockNames(*prog.cpp, resources.storage_buffers[i],
+                    static_cast<GLuint>(i), &prog.reflection.storage_blocks);
+      prog.resource_bindings.push_back(binding);
+    }
+
+    prog.num_storage_blocks =
+        static_cast<uint32_t>(prog.resource_bindings.size());
+
+    for (size_t i = 0; i < resources.uniform_buffers.size(); i++) {
+      const spirv_cross::Resource &block = resources.uniform_buffers[i];
+
+      ResourceBinding binding;
+      binding.set =
+          prog.cpp->get_decoration(block.id, spv::DecorationDescriptorSet);
+      binding.binding = prog.cpp->get_decoration(block.id, spv::DecorationBinding);
+      binding.buffer_binding = binding.binding;
+      binding.data_size = static_cast<uint32_t>(
+          prog.cpp->get_declared_struct_size(prog.cpp->get_type(block.base_type_id)));
+      binding.element_stride = 0;
+      binding.is_storage = false;
+      binding.readable = true;
+      binding.writable = false;
+      binding.elementwise = false;
+      AddBlockNames(*prog.cpp, block, static_cast<GLuint>(i),
+                    &prog.reflection.uniform_blocks);
+      prog.resource_bindings.push_back(binding);
+    }
+
+    // Pack the push constant block and plain uniforms into one block. Plain
+    // uniforms keep their Location as GL location. Push constant members,
+    // which GL has no notion of, get the locations after them.
+    prog.uniform_slots.clear();
+    prog.push_constant_size = 0;
+
+    uint32_t block_size = 0;
+    std::vector<UniformSlot> push_constants;
+    if (!resources.push_constant_buffers.empty()) {
+      const spirv_cross::Resource &block = resources.push_constant_buffers[0];
+      const spirv_cross::SPIRType &type =
+          prog.cpp->get_type(block.base_type_id);
+
+      for (uint32_t m = 0; m < static_cast<uint32_t>(type.member_types.size());
+           m++) {
+        UniformSlot slot;
+        slot.name = prog.cpp->get_member_name(block.base_type_id, m);
+        slot.offset = prog.cpp->type_struct_member_offset(type, m);
+        slot.size = static_cast<uint32_t>(
+            prog.cpp->get_declared_struct_member_size(type, m));
+        slot.push_constant = true;
+        SetUniformType(prog.cpp->get_type(type.member_types[m]), &slot);
+        push_constants.push_back(slot);
+      }
+
+      prog.push_constant_size =
+          static_cast<uint32_t>(prog.cpp->get_declared_struct_size(type));
+      block_size = prog.push_constant_size;
+    }
+
+    for (size_t i = 0; i < resources.gl_plain_uniforms.size(); i++) {
+      const spirv_cross::Resource &uniform = resources.gl_plain_uniforms[i];
+
+      uint32_t size = 0;
+      uint32_t alignment = 0;
+      const uint32_t location =
+          prog.cpp->get_decoration(uniform.id, spv::DecorationLocation);
+      const spirv_cross::SPIRType &type = prog.cpp->get_type(uniform.type_id);
+      if (!GetUniformLayout(type, &size, &alignment) ||
+          (location >= SPIRV_CROSS_NUM_UNIFORM_CONSTANTS)) {
+        std::cerr << "[SoftGL] Unsupported uniform: " << uniform.name
+                  << std::endl;
+        return;
+      }
+
+      if (location >= prog.uniform_slots.size()) {
+        prog.uniform_slots.resize(location + 1);
+      }
+
+      UniformSlot &slot = prog.uniform_slots[location];
+      if (slot.size > 0) {
+        std::cerr << "[SoftGL] Uniforms " << slot.name << " and "
+                  << uniform.name << " share location " << location
+                  << std::endl;
+        return;
+      }
+
+      block_size = (block_size + alignment - 1) / alignment * alignment;
+
+      slot.name = uniform.name;
+      slot.offset = block_size;
+      slot.size = size;
+      slot.spirv_location = location;
+      SetUniformType(type, &slot);
+      block_size += size;
+    }
+
+    prog.uniform_slots.insert(prog.uniform_slots.end(), push_constants.begin(),
+                              push_constants.end());
+    for (size_t i = 0; i < prog.uniform_slots.size(); i++) {
+      if (prog.uniform_slots[i].size > 0) {
+        prog.reflection.uniforms[prog.uniform_slots[i].name] =
+            static_cast<GLint>(i);
+      }
+    }
+    prog.uniform_data.assign(block_size, 0);
+    prog.uniforms_dirty = false;
+    prog.uniform_snapshot.reset();
+
+    for (size_t i = 0; i < prog.resource_bindings.size(); i++) {
+      if ((prog.resource_bindings[i].set >= SPIRV_CROSS_NUM_DESCRIPTOR_SETS) ||
+          (prog.resource_bindings[i].binding >=
+           SPIRV_CROSS_NUM_DESCRIPTOR_BINDINGS) ||
+          (prog.resource_bindings[i].binding > kMaxBufferBindings)) {
+        std::cerr << "[SoftGL] Unsupported set/binding: "
+                  << prog.resource_bindings[i].set << "/"
+                  << prog.resource_bindings[i].binding << std::endl;
+        return;
+      }
+    }
+  }
+
+  prog.contexts = std::make_shared<ShaderContextPool>(interface_fn(),
+                                                      prog.resource_bindings);
+
+  {
+    uint64_t stage_ns[softcompute::kNumCompileStages];
+    softcompute::GetCompileStageTimes(stage_ns);
+
+    ProgramCompileStats &stats = prog.compile_stats;
+    stats.glsl_to_spirv_ns = shader.glsl_to_spirv_ns;
+    stats.spirv_to_cpp_ns = stage_ns[softcompute::kCompileSpirvToCpp];
+    stats.cpp_to_ir_ns = stage_ns[softcompute::kCompileCppToIR];
+    stats.codegen_ns = stage_ns[softcompute::kCompileCodegen];
+    stats.load_ns = stage_ns[softcompute::kCompileLoad];
+    stats.link_ns = softcompute::TraceNow() - link_start_ns;
+  }
+
+  // LOG_F(INFO, "linked...");
+  prog.linked = true;
+
+#endif
+}
+
+void glBindBuffer(GLenum target, GLuint buffer) {
+  InitializeGLContext();
+  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER) ||
+         (target == GL_COPY_READ_BUFFER) || (target == GL_COPY_WRITE_BUFFER));
+
+  if (target == GL_COPY_READ_BUFFER) {
+    gCtx->copy_read_buffer_index = buffer;
+  } else if (target == GL_COPY_WRITE_BUFFER) {
+    gCtx->copy_write_buffer_index = buffer;
+  } else {
+    gCtx->active_buffer_index = buffer;
+  }
+}
+
+void glBindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+  InitializeGLContext();
+
+  const Buffer *buf = gCtx->buffers.Get(buffer);
+  if (!buf) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  glBindBufferRange(target, index, buffer, 0,
+                    static_cast<GLsizeiptr>(buf->storage->size()));
+}
+
+void glBindBufferRange(GLenum target, GLuint index, GLuint buffer,
+                       GLintptr offset, GLsizeiptr size) {
+  InitializeGLContext();
+  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER));
+
+  assert(index <= kMaxBufferBindings);
+
+  const Buffer *buf = gCtx->buffers.Get(buffer);
+  if (!buf) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  assert(static_cast<size_t>(offset + size) <= buf->storage->size());
+
+  if (target == GL_SHADER_STORAGE_BUFFER) {
+    gCtx->shader_storage_buffer_accessor[index].assigned = true;
+    gCtx->shader_storage_buffer_accessor[index].buffer_index = buffer;
+    gCtx->shader_storage_buffer_accessor[index].offset =
+        static_cast<size_t>(offset);
+    gCtx->shader_storage_buffer_accessor[index].size =
+        static_cast<size_t>(size);
+  } else if (target == GL_UNIFORM_BUFFER) {
+    gCtx->uniform_buffer_accessor[index].assigned = true;
+    gCtx->uniform_buffer_accessor[index].buffer_index = buffer;
+    gCtx->uniform_buffer_accessor[index].offset = static_cast<size_t>(offset);
+    gCtx->uniform_buffer_accessor[index].size = static_cast<size_t>(size);
+  }
+
+  CommandList *list = GetRecordingCommandList();
+  if (list) {
+    BindCommand command;
+    command.target = target;
+    command.index = index;
+    command.accessor = (target == GL_SHADER_STORAGE_BUFFER)
+                           ? gCtx->shader_storage_buffer_accessor[index]
+                           : gCtx->uniform_buffer_accessor[index];
+    AppendCommand(list, Command::kBindBuffer, &list->binds, command);
+  }
+}
+
+void glBufferData(GLenum target, GLsizeiptr size, const GLvoid *data,
+                  GLenum usage) {
+  InitializeGLContext();
+  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER));
+  (void)target;
+
+  Buffer *buffer = gCtx->buffers.Get(gCtx->active_buffer_index);
+  if (!buffer) return;
+
+  // Orphaning: dispatches still using the storage keep it, and the buffer
+  // gets new storage instead of waiting for them. Otherwise the block is
+  // reused when the size class stays the same.
+  if ((buffer->storage.use_count() > 1) ||
+      (buffer->storage->pool() != &gCtx->buffer_pool)) {
+    buffer->storage =
+        std::make_shared<softcompute::BufferStorage>(&gCtx->buffer_pool);
+    gCtx->scheduler.OrphanBuffer(buffer);
+  }
+
+  // Contents are undefined without `data`, so they are not cleared.
+  buffer->storage->Allocate(static_cast<size_t>(size));
+  if (data) {
+    memcpy(buffer->storage->data(), data, static_cast<size_t>(size));
+  }
+
+  (void)usage;
+}
+
+// Buffer bound to `target`. Storage and uniform buffers share a binding.
+static Buffer *GetBoundBuffer(GLenum target) {
+  if (target == GL_COPY_READ_BUFFER) {
+    return gCtx->buffers.Get(gCtx->copy_read_buffer_index);
+  } else if (target == GL_COPY_WRITE_BUFFER) {
+    return gCtx->buffers.Get(gCtx->copy_write_buffer_index);
+  }
+  return gCtx->buffers.Get(gCtx->active_buffer_index);
+}
+
+static bool IsValidBufferRange(const Buffer *buffer, GLintptr offset,
+                               GLsizeiptr size) {
+  return (offset >= 0) && (size >= 0) &&
+         (size_t(offset) + size_t(size) <= buffer->storage->size());
+}
+
+// Prepares `buffer` for host writes to [offset, offset + size). Waits for
+// in-flight dispatches accessing it, except that heap storage overwritten as
+// a whole is orphaned as by glBufferData. Returns false for read-only
+// storage.
+static bool BeginBufferWrite(Buffer *buffer, size_t offset, size_t size) {
+  if (!buffer->storage->IsWritable()) {
+    return false;
+  }
+
+  if ((offset == 0) && (size > 0) && (size == buffer->storage->size()) &&
+      !buffer->storage->IsMapped() && (buffer->storage.use_count() > 1)) {
+    std::shared_ptr<softcompute::BufferStorage> storage =
+        std::make_shared<softcompute::BufferStorage>(&gCtx->buffer_pool);
+    storage->Allocate(size);
+    if (storage->data()) {
+      buffer->storage = storage;
+      gCtx->scheduler.OrphanBuffer(buffer);
+      return true;
+    }
+  }
+
+  gCtx->scheduler.WaitBuffer(buffer);
+  return true;
+}
+
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size,
+                     const GLvoid *data) {
+  InitializeGLContext();
+
+  Buffer *buffer = GetBoundBuffer(target);
+  if (!buffer) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  if (!IsValidBufferRange(buffer, offset, size) || ((size > 0) && !data)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (size == 0) {
+    return;
+  }
+
+  if (!BeginBufferWrite(buffer, size_t(offset), size_t(size))) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  softcompute::ParallelCopy(buffer->storage->data() + offset, data,
+                            size_t(size), &gCtx->pool);
+}
+
+void glGetBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size,
+                        GLvoid *data) {
+  InitializeGLContext();
+
+  Buffer *buffer = GetBoundBuffer(target);
+  if (!buffer) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  if (!IsValidBufferRange(buffer, offset, size) || ((size > 0) && !data)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (size == 0) {
+    return;
+  }
+
+  // Results of dispatches writing the buffer.
+  gCtx->scheduler.WaitBufferWriter(buffer);
+
+  softcompute::ParallelCopy(data, buffer->storage->data() + offset,
+                            size_t(size), &gCtx->pool);
+}
+
+void glCopyBufferSubData(GLenum readTarget, GLenum writeTarget,
+                         GLintptr readOffset, GLintptr writeOffset,
+                         GLsizeiptr size) {
+  InitializeGLContext();
+
+  Buffer *src = GetBoundBuffer(readTarget);
+  Buffer *dst = GetBoundBuffer(writeTarget);
+  if (!src || !dst) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  if (!IsValidBufferRange(src, readOffset, size) ||
+      !IsValidBufferRange(dst, writeOffset, size)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  // Overlapping ranges of the same buffer.
+  if ((src == dst) && (readOffset < writeOffset + size) &&
+      (writeOffset < readOffset + size)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (size == 0) {
+    return;
+  }
+
+  // Dispatches still reading the source do not conflict with the copy.
+  gCtx->scheduler.WaitBufferWriter(src);
+  if (!BeginBufferWrite(dst, size_t(writeOffset), size_t(size))) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  softcompute::ParallelCopy(dst->storage->data() + writeOffset,
+                            src->storage->data() + readOffset, size_t(size),
+                            &gCtx->pool);
+}
+
+// Layout of a buffer texel format, for glClearBufferSubData.
+struct ClearFormat {
+  GLenum internalformat;
+  GLenum type;  // Type of each component
+  uint32_t components;
+  bool integer;  // Read from *_INTEGER formats
+  char pad[3];
+};
+
+static const ClearFormat kClearFormats[] = {
+    {GL_R8, GL_UNSIGNED_BYTE, 1, false, {}},
+    {GL_R16, GL_UNSIGNED_SHORT, 1, false, {}},
+    {GL_R16F, GL_HALF_FLOAT, 1, false, {}},
+    {GL_R32F, GL_FLOAT, 1, false, {}},
+    {GL_R8I, GL_BYTE, 1, true, {}},
+    {GL_R8UI, GL_UNSIGNED_BYTE, 1, true, {}},
+    {GL_R16I, GL_SHORT, 1, true, {}},
+    {GL_R16UI, GL_UNSIGNED_SHORT, 1, true, {}},
+    {GL_R32I, GL_INT, 1, true, {}},
+    {GL_R32UI, GL_UNSIGNED_INT, 1, true, {}},
+    {GL_RG8, GL_UNSIGNED_BYTE, 2, false, {}},
+    {GL_RG16, GL_UNSIGNED_SHORT, 2, false, {}},
+    {GL_RG16F, GL_HALF_FLOAT, 2, false, {}},
+    {GL_RG32F, GL_FLOAT, 2, false, {}},
+    {GL_RG8I, GL_BYTE, 2, true, {}},
+    {GL_RG8UI, GL_UNSIGNED_BYTE, 2, true, {}},
+    {GL_RG16I, GL_SHORT, 2, true, {}},
+    {GL_RG16UI, GL_UNSIGNED_SHORT, 2, true, {}},
+    {GL_RG32I, GL_INT, 2, true, {}},
+    {GL_RG32UI, GL_UNSIGNED_INT, 2, true, {}},
+    {GL_RGB32F, GL_FLOAT, 3, false, {}},
+    {GL_RGB32I, GL_INT, 3, true, {}},
+    {GL_RGB32UI, GL_UNSIGNED_INT, 3, true, {}},
+    {GL_RGBA8, GL_UNSIGNED_BYTE, 4, false, {}},
+    {GL_RGBA16, GL_UNSIGNED_SHORT, 4, false, {}},
+    {GL_RGBA16F, GL_HALF_FLOAT, 4, false, {}},
+    {GL_RGBA32F, GL_FLOAT, 4, false, {}},
+    {GL_RGBA8I, GL_BYTE, 4, true, {}},
+    {GL_RGBA8UI, GL_UNSIGNED_BYTE, 4, true, {}},
+    {GL_RGBA16I, GL_SHORT, 4, true, {}},
+    {GL_RGBA16UI, GL_UNSIGNED_SHORT, 4, true, {}},
+    {GL_RGBA32I, GL_INT, 4, true, {}},
+    {GL_RGBA32UI, GL_UNSIGNED_INT, 4, true, {}},
+};
+
+// Bytes per texel of `internalformat` given as `format` and `type`. 0 with
+// the GL error set when they do not match.
+static size_t GetClearTexelSize(GLenum internalformat, GLenum format,
+                                GLenum type) {
+  const ClearFormat *clear_format = nullptr;
+  for (size_t i = 0; i < sizeof(kClearFormats) / sizeof(kClearFormats[0]);
+       i++) {
+    if (kClearFormats[i].internalformat == internalformat) {
+      clear_format = &kClearFormats[i];
+    }
+  }
+  if (!clear_format) {
+    SetGLError(GL_INVALID_ENUM);
+    return 0;
+  }
+
+  uint32_t components = 0;
+  bool integer = false;
+  switch (format) {
+    case GL_RED_INTEGER:
+      integer = true;
+      components = 1;
+      break;
+    case GL_RED:
+      components = 1;
+      break;
+    case GL_RG_INTEGER:
+      integer = true;
+      components = 2;
+      break;
+    case GL_RG:
+      components = 2;
+      break;
+    case GL_RGB_INTEGER:
+      integer = true;
+      components = 3;
+      break;
+    case GL_RGB:
+      components = 3;
+      break;
+    case GL_RGBA_INTEGER:
+      integer = true;
+      components = 4;
+      break;
+    case GL_RGBA:
+      components = 4;
+      break;
+    default:
+      SetGLError(GL_INVALID_ENUM);
+      return 0;
+  }
+
+  size_t component_size = 0;
+  switch (type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+      component_size = 1;
+      break;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT:
+      component_size = 2;
+      break;
+    case GL_INT:
+    case GL_UNSIGNED_INT:
+    case GL_FLOAT:
+      component_size = 4;
+      break;
+    default:
+      SetGLError(GL_INVALID_ENUM);
+      return 0;
+  }
+
+  // No conversion: the data must already be in the stored layout.
+  if ((components != clear_format->components) ||
+      (integer != clear_format->integer) || (type != clear_format->type)) {
+    std::cerr << "[SoftGL] glClearBufferSubData: format and type must match "
+                 "the internal format."
+              << std::endl;
+    SetGLError(GL_INVALID_OPERATION);
+    return 0;
+  }
+
+  return components * component_size;
+}
+
+void glClearBufferData(GLenum target, GLenum internalformat, GLenum format,
+                       GLenum type, const void *data) {
+  InitializeGLContext();
+
+  Buffer *buffer = GetBoundBuffer(target);
+  if (!buffer) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  glClearBufferSubData(target, internalformat, 0,
+                       static_cast<GLsizeiptr>(buffer->storage->size()),
+                       format, type, data);
+}
+
+void glClearBufferSubData(GLenum target, GLenum internalformat,
+                          GLintptr offset, GLsizeiptr size, GLenum format,
+                          GLenum type, const void *data) {
+  InitializeGLContext();
+
+  Buffer *buffer = GetBoundBuffer(target);
+  if (!buffer) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  const size_t texel_size = GetClearTexelSize(internalformat, format, type);
+  if (texel_size == 0) {
+    return;
+  }
+
+  if (!IsValidBufferRange(buffer, offset, size) ||
+      (size_t(offset) % texel_size != 0) || (size_t(size) % texel_size != 0)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (size == 0) {
+    return;
+  }
+
+  if (!BeginBufferWrite(buffer, size_t(offset), size_t(size))) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  const uint8_t zeros[16] = {};
+  softcompute::ParallelFill(buffer->storage->data() + offset, size_t(size),
+                            data ? data : zeros, texel_size,
+                            &gCtx->pool);
+}
+
+// Maps `filename` as new storage of `buffer`, see BufferStorage::MapFile().
+// Like glBufferData, dispatches still using the old storage keep it, rather
+// than being waited for. The old storage stays on failure.
+static bool MapBufferStorage(Buffer *buffer, const char *filename,
+                             size_t offset, size_t size,
+                             softcompute::BufferStorage::MapMode mode) {
+  std::shared_ptr<softcompute::BufferStorage> storage =
+      std::make_shared<softcompute::BufferStorage>(&gCtx->buffer_pool);
+  if (!storage->MapFile(filename, offset, size, mode)) {
+    return false;
+  }
+
+  buffer->storage = storage;
+  gCtx->scheduler.OrphanBuffer(buffer);
+  return true;
+}
+
+GLboolean BufferDataFromFile(GLenum target, const char *filename,
+                             GLsizeiptr size, GLenum access) {
+  InitializeGLContext();
+  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER));
+  (void)target;
+
+  if (!filename || (size < 0) ||
+      ((access != GL_READ_ONLY) && (access != GL_READ_WRITE))) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_FALSE;
+  }
+
+  Buffer *buffer = gCtx->buffers.Get(gCtx->active_buffer_index);
+  if (!buffer) {
+    SetGLError(GL_INVALID_OPERATION);
+    return GL_FALSE;
+  }
+
+  if (!MapBufferStorage(buffer, filename, 0, static_cast<size_t>(size),
+                        (access == GL_READ_WRITE)
+                            ? softcompute::BufferStorage::kMapShared
+                            : softcompute::BufferStorage::kMapReadOnly)) {
+    return GL_FALSE;
+  }
+
+  return GL_TRUE;
+}
+
+GLboolean BufferDataFromTensorFile(GLenum target, const char *filename) {
+  InitializeGLContext();
+  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER));
+  (void)target;
+
+  if (!filename) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_FALSE;
+  }
+
+  Buffer *buffer = gCtx->buffers.Get(gCtx->active_buffer_index);
+  if (!buffer) {
+    SetGLError(GL_INVALID_OPERATION);
+    return GL_FALSE;
+  }
+
+  softcompute::TensorHeader header;
+  if (!softcompute::ReadTensorHeader(filename, &header)) {
+    return GL_FALSE;
+  }
+
+  if (header.data_size == 0) {
+    // Empty, as MapFile() would map the rest of the file.
+    buffer->storage =
+        std::make_shared<softcompute::BufferStorage>(&gCtx->buffer_pool);
+    gCtx->scheduler.OrphanBuffer(buffer);
+    return GL_TRUE;
+  }
+
+  if (!MapBufferStorage(buffer, filename, size_t(header.data_offset),
+                        static_cast<size_t>(header.data_size),
+                        softcompute::BufferStorage::kMapPrivate)) {
+    return GL_FALSE;
+  }
+
+  return GL_TRUE;
+}
+
+GLboolean SaveBufferAsTensorFile(GLuint buffer, const char *filename,
+                                 const char *dtype, const GLuint64 *shape,
+                                 GLsizei num_dims) {
+  InitializeGLContext();
+
+  if (!filename || !dtype || (num_dims < 0) || (num_dims && !shape)) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_FALSE;
+  }
+
+  Buffer *buf = gCtx->buffers.Get(buffer);
+  if (!buf) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_FALSE;
+  }
+
+  // Results of dispatches writing the buffer.
+  gCtx->scheduler.WaitBuffer(buf);
+
+  const std::vector<uint64_t> dims(shape, shape + num_dims);
+  if (!softcompute::WriteTensorFile(filename, dtype, dims, buf->storage->data(),
+                                    buf->storage->size())) {
+    return GL_FALSE;
+  }
+
+  return GL_TRUE;
+}
+
+GLboolean SaveBufferAsImage(GLuint buffer, const char *filename,
+                            GLsizei width, GLsizei height, GLint channels) {
+  InitializeGLContext();
+
+  if (!filename || (width <= 0) || (height <= 0) || (channels < 1) ||
+      (channels > 4)) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_FALSE;
+  }
+
+  Buffer *buf = gCtx->buffers.Get(buffer);
+  if (!buf || (buf->storage->size() < size_t(width) * size_t(height) *
+                                         size_t(channels) * sizeof(float))) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_FALSE;
+  }
+
+  // Results of dispatches writing the buffer.
+  gCtx->scheduler.WaitBuffer(buf);
+
+  if (!softcompute::WriteImage(
+          filename,
+          static_cast<const float *>(
+              static_cast<const void *>(buf->storage->data())),
+          static_cast<uint32_t>(width), static_cast<uint32_t>(height),
+          static_cast<uint32_t>(channels), &gCtx->pool)) {
+    return GL_FALSE;
+  }
+
+  return GL_TRUE;
+}
+
+void *glMapBuffer(GLenum target, GLenum access) {
+  InitializeGLContext();
+  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER));
+  (void)target;
+
+  Buffer *buffer = gCtx->buffers.Get(gCtx->active_buffer_index);
+  if (!buffer) return nullptr;
+
+  if ((access != GL_READ_ONLY) && !buffer->storage->IsWritable()) {
+    SetGLError(GL_INVALID_OPERATION);
+    return nullptr;
+  }
+
+  // Make results of dispatches writing the buffer visible, and keep host
+  // writes from racing with dispatches reading it.
+  gCtx->scheduler.WaitBuffer(buffer);
+
+  return buffer->storage->data();
+}
+
+GLboolean glUnmapBuffer(GLenum target) {
+  InitializeGLContext();
+  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER));
+  (void)target;
+
+  return GL_TRUE;
+}
+
+void glUseProgram(GLuint program) {
+  InitializeGLContext();
+  gCtx->active_program = program;
+
+  CommandList *list = GetRecordingCommandList();
+  if (list) {
+    AppendCommand(list, Command::kUseProgram, &list->programs, program);
+  }
+}
+
+void glShaderBinary(GLsizei n, const GLuint *shaders, GLenum binaryformat,
+                    const void *binary, GLsizei length) {
+  InitializeGLContext();
+
+  // TODO(LTE): Support multiple shaders.
+  assert(n == 1);
+  assert(shaders);
+  assert(binary);
+  assert(length > 0);
+  assert(length % 4 ==
+         0);  // Size of SPIR-V binary must be the multiple of 32bit
+  assert(binaryformat == GL_SHADER_BINARY_FORMAT_SPIR_V_ARB);
+  (void)n;
+  (void)binaryformat;
+
+  Shader *shader = gCtx->shaders.Get(shaders[0]);
+  if (!shader) {
+    std::cerr << "[SoftGL] shader " << shaders[0] << " is not initialized."
+              << std::endl;
+    return;
+  }
+
+  shader->binary.resize(static_cast<size_t>(length / 4));
+  memcpy(shader->binary.data(), binary, static_cast<size_t>(length));
+}
+
+void glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string,
+                    const GLint *length) {
+  InitializeGLContext();
+  assert(count > 0);
+  assert(string);
+
+  Shader *s = gCtx->shaders.Get(shader);
+  if (!s) {
+    std::cerr << "[SoftGL] shader " << shader << " is not initialized."
+              << std::endl;
+    return;
+  }
+
+  s->source.clear();
+
+  // Concat
+  for (size_t i = 0; i < static_cast<size_t>(count); i++) {
+    if (length) {
+      s->source += std::string(string[i], static_cast<size_t>(length[i]));
+    } else {
+      // Assume each input string is null terminated.
+      s->source += std::string(string[i]);
+    }
+  }
+}
+
+GLint glGetUniformLocation(GLuint program, const GLchar *name) {
+  InitializeGLContext();
+
+  const Program *prog = gCtx->programs.Get(program);
+  if (!prog) {
+    // LOG_F(ERROR, "Program %d is not created.", program);
+    SetGLError(GL_INVALID_VALUE);
+    return -1;
+  }
+
+  if (!prog->linked || !name) {
+    SetGLError(GL_INVALID_OPERATION);
+    return -1;
+  }
+
+  std::unordered_map<std::string, GLint>::const_iterator it =
+      prog->reflection.uniforms.find(name);
+  if (it == prog->reflection.uniforms.end()) {
+    return -1;
+  }
+
+  return it->second;
+}
+
+// GL type enum of a uniform, e.g. GL_FLOAT_VEC3. 0 when there is none.
+static GLenum GetUniformGLType(const UniformSlot &slot) {
+  static const int kVectorTypes[3][4] = {
+      {GL_FLOAT, GL_FLOAT_VEC2, GL_FLOAT_VEC3, GL_FLOAT_VEC4},
+      {GL_INT, GL_INT_VEC2, GL_INT_VEC3, GL_INT_VEC4},
+      {GL_UNSIGNED_INT, GL_UNSIGNED_INT_VEC2, GL_UNSIGNED_INT_VEC3,
+       GL_UNSIGNED_INT_VEC4}};
+  // Indexed by columns and then rows, from 2.
+  static const int kMatrixTypes[3][3] = {
+      {GL_FLOAT_MAT2, GL_FLOAT_MAT2x3, GL_FLOAT_MAT2x4},
+      {GL_FLOAT_MAT3x2, GL_FLOAT_MAT3, GL_FLOAT_MAT3x4},
+      {GL_FLOAT_MAT4x2, GL_FLOAT_MAT4x3, GL_FLOAT_MAT4}};
+
+  if ((slot.vecsize < 1) || (slot.vecsize > 4) || (slot.columns < 1) ||
+      (slot.columns > 4)) {
+    return 0;
+  }
+
+  if (slot.columns > 1) {
+    return (slot.base_type == spirv_cross::SPIRType::Float) &&
+                   (slot.vecsize > 1)
+               ? GLenum(kMatrixTypes[slot.columns - 2][slot.vecsize - 2])
+               : 0;
+  }
+
+  switch (slot.base_type) {
+    case spirv_cross::SPIRType::Float:
+      return GLenum(kVectorTypes[0][slot.vecsize - 1]);
+    case spirv_cross::SPIRType::Int:
+      return GLenum(kVectorTypes[1][slot.vecsize - 1]);
+    case spirv_cross::SPIRType::UInt:
+      return GLenum(kVectorTypes[2][slot.vecsize - 1]);
+    default:
+      return 0;
+  }
+}
+
+void glGetActiveUniform(GLuint program, GLuint index, GLsizei bufSize,
+                        GLsizei *length, GLint *size, GLenum *type,
+                        GLchar *name) {
+  InitializeGLContext();
+
+  const Program *prog = gCtx->programs.Get(program);
+  if (!prog) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (!prog->linked) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  if ((index >= prog->uniform_slots.size()) ||
+      (prog->uniform_slots[index].size == 0) || (bufSize < 0)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  const UniformSlot &slot = prog->uniform_slots[index];
+  if (size) {
+    (*size) = static_cast<GLint>(slot.array_size);
+  }
+  if (type) {
+    (*type) = GetUniformGLType(slot);
+  }
+
+  // Truncated to fit `bufSize` with the terminating null, as in GL.
+  GLsizei n = 0;
+  if (name && (bufSize > 0)) {
+    n = static_cast<GLsizei>(
+        std::min(slot.name.size(), static_cast<size_t>(bufSize - 1)));
+    memcpy(name, slot.name.c_str(), static_cast<size_t>(n));
+    name[n] = '\0';
+  }
+  if (length) {
+    (*length) = n;
+  }
+}
+
+void glAttachShader(GLuint program, GLuint shader) {
+  InitializeGLContext();
+
+  Program *prog = gCtx->programs.Get(program);
+  if (!prog || !gCtx->shaders.Get(shader)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  prog->shaders.push_back(shader);
+}
+
+void glGetShaderiv(GLuint shader, GLenum pname, GLint *params) {
+  if (shader == 0) {
+    return;
+  }
+
+  InitializeGLContext();
+
+  const Shader *s = gCtx->shaders.Get(shader);
+  if (!s) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (pname == GL_COMPILE_STATUS) {
+    if (s->binary.size() > 0) {
+      if (params) {
+        (*params) = GL_TRUE;
+      }
+    } else {
+      if (params) {
+        (*params) = GL_FALSE;
+      }
+    }
+  } else {
+    // ABORT_F("TODO");
+  }
+
+  return;
+}
+
+void glGetProgramiv(GLuint program, GLenum pname, GLint *params) {
+  InitializeGLContext();
+
+  const Program *prog = gCtx->programs.Get(program);
+  if (!prog) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (pname == GL_LINK_STATUS) {
+    if (prog->linked) {
+      if (params) {
+        (*params) = GL_TRUE;
+      }
+    } else {
+      if (params) {
+        (*params) = GL_FALSE;
+      }
+    }
 
-  if (option_string) {
-    gCtx->SetJITCompilerOptions(std::string(option_string));
+  } else {
+    // ABORT_F("TODO");
   }
+
+  return;
 }
 
+void glGetShaderInfoLog(GLuint shader, GLsizei maxLength, GLsizei *length,
+                        GLchar *infoLog) {
+  (void)shader;
+  (void)maxLength;
+  (void)length;
+  (void)infoLog;
 
-void glUniform1f(GLint location, GLfloat v0) {
-  InitializeGLContext();
-  if (location < 0) return;
-  assert(static_cast<size_t>(location) < gCtx->uniforms.size());
+  // LOG_F(ERROR, "Implement");
 
-  gCtx->uniforms[static_cast<size_t>(location)].fv[0] = v0;
-  gCtx->uniforms[static_cast<size_t>(location)].type = GL_FLOAT;
-  gCtx->uniforms[static_cast<size_t>(location)].count = 1;
+  return;
 }
 
-void glUniform2f(GLint location, GLfloat v0, GLfloat v1) {
+void glDeleteShader(GLuint shader) {
   InitializeGLContext();
-  if (location < 0) return;
-  assert(static_cast<size_t>(location) < gCtx->uniforms.size());
 
-  gCtx->uniforms[static_cast<size_t>(location)].fv[0] = v0;
-  gCtx->uniforms[static_cast<size_t>(location)].fv[1] = v1;
-  gCtx->uniforms[static_cast<size_t>(location)].type = GL_FLOAT;
-  gCtx->uniforms[static_cast<size_t>(location)].count = 2;
+  if (shader == 0) return;
+
+  // Programs keep the SPIR-V they were linked with, so the shader can go
+  // right away.
+  if (!gCtx->shaders.Release(shader)) {
+    SetGLError(GL_INVALID_VALUE);
+  }
 }
 
-void glUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2) {
+void glDeleteProgram(GLuint program) {
   InitializeGLContext();
-  if (location < 0) return;
-  assert(static_cast<size_t>(location) < gCtx->uniforms.size());
 
-  gCtx->uniforms[static_cast<size_t>(location)].fv[0] = v0;
-  gCtx->uniforms[static_cast<size_t>(location)].fv[1] = v1;
-  gCtx->uniforms[static_cast<size_t>(location)].fv[2] = v2;
-  gCtx->uniforms[static_cast<size_t>(location)].type = GL_FLOAT;
-  gCtx->uniforms[static_cast<size_t>(location)].count = 3;
-}
+  if (program == 0) return;
 
-void glUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2,
-                 GLfloat v3) {
-  InitializeGLContext();
-  if (location < 0) return;
-  assert(static_cast<size_t>(location) < gCtx->uniforms.size());
+  if (!gCtx->programs.Get(program)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
 
-  gCtx->uniforms[static_cast<size_t>(location)].fv[0] = v0;
-  gCtx->uniforms[static_cast<size_t>(location)].fv[1] = v1;
-  gCtx->uniforms[static_cast<size_t>(location)].fv[2] = v2;
-  gCtx->uniforms[static_cast<size_t>(location)].fv[3] = v3;
-  gCtx->uniforms[static_cast<size_t>(location)].type = GL_FLOAT;
-  gCtx->uniforms[static_cast<size_t>(location)].count = 4;
+  gCtx->scheduler.Wait();
+
+  // Destructs the shader objects. The compiled module stays in the engine and
+  // is replaced when the slot is reused by a program which gets linked.
+  gCtx->programs.Release(program);
 }
 
-void glUniform1i(GLint location, GLint v0) {
-  InitializeGLContext();
-  if (location < 0) return;
-  assert(static_cast<size_t>(location) < gCtx->uniforms.size());
+// Resolves buffer bindings of the active program into `command`.
+static bool ResolveDispatch(GLuint num_groups_x, GLuint num_groups_y,
+                            GLuint num_groups_z, DispatchCommand *command) {
+  Program *program = gCtx->programs.Get(gCtx->active_program);
+  if (!program) return false;
 
-  gCtx->uniforms[static_cast<size_t>(location)].iv[0] = v0;
-  gCtx->uniforms[static_cast<size_t>(location)].type = GL_INT;
-  gCtx->uniforms[static_cast<size_t>(location)].count = 1;
-}
+  Program &prog = *program;
+  if (!prog.linked) {
+    SetGLError(GL_INVALID_OPERATION);
+    return false;
+  }
 
-void glUniform2i(GLint location, GLint v0, GLint v1) {
-  InitializeGLContext();
-  if (location < 0) return;
-  assert(static_cast<size_t>(location) < gCtx->uniforms.size());
+  command->program = &prog;
+  command->program_name = gCtx->active_program;
+  command->program_link_count = prog.link_count;
+  command->num_groups[0] = num_groups_x;
+  command->num_groups[1] = num_groups_y;
+  command->num_groups[2] = num_groups_z;
+  command->bindings.clear();
+  command->uniforms = prog.GetUniformSnapshot();
+
+  for (size_t i = 0; i < prog.resource_bindings.size(); i++) {
+    const ResourceBinding &resource = prog.resource_bindings[i];
+    const Accessor &accessor =
+        resource.is_storage
+            ? gCtx->shader_storage_buffer_accessor[resource.buffer_binding]
+            : gCtx->uniform_buffer_accessor[resource.buffer_binding];
+
+    if (!accessor.assigned) {
+      // Shader will see nullptr.
+      continue;
+    }
+
+    BufferBinding binding;
+    binding.set = resource.set;
+    binding.binding = resource.binding;
+    binding.buffer = gCtx->buffers.Get(accessor.buffer_index);
+    if (!binding.buffer) {
+      // Deleted after binding.
+      continue;
+    }
+    if (resource.writable && !binding.buffer->storage->IsWritable()) {
+      // Stores would fault on the read-only file mapping.
+      SetGLError(GL_INVALID_OPERATION);
+      return false;
+    }
+    binding.offset = accessor.offset;
+    binding.size = accessor.size;
+    binding.element_stride = resource.element_stride;
+    binding.buffer_name = accessor.buffer_index;
+    binding.readable = resource.readable;
+    binding.writable = resource.writable;
+    binding.elementwise = resource.elementwise;
+    memset(binding.pad, 0, sizeof(binding.pad));
+    command->bindings.push_back(binding);
+  }
 
-  gCtx->uniforms[static_cast<size_t>(location)].iv[0] = v0;
-  gCtx->uniforms[static_cast<size_t>(location)].iv[1] = v1;
-  gCtx->uniforms[static_cast<size_t>(location)].type = GL_INT;
-  gCtx->uniforms[static_cast<size_t>(location)].count = 2;
+  return true;
 }
 
-void glUniform3i(GLint location, GLint v0, GLint v1, GLint v2) {
+void glDispatchCompute(GLuint num_groups_x, GLuint num_groups_y,
+                       GLuint num_groups_z) {
   InitializeGLContext();
-  if (location < 0) return;
-  assert(static_cast<size_t>(location) < gCtx->uniforms.size());
 
-  gCtx->uniforms[static_cast<size_t>(location)].iv[0] = v0;
-  gCtx->uniforms[static_cast<size_t>(location)].iv[1] = v1;
-  gCtx->uniforms[static_cast<size_t>(location)].iv[2] = v2;
-  gCtx->uniforms[static_cast<size_t>(location)].type = GL_INT;
-  gCtx->uniforms[static_cast<size_t>(location)].count = 3;
-}
+  DispatchCommand command;
+  if (!ResolveDispatch(num_groups_x, num_groups_y, num_groups_z, &command)) {
+    return;
+  }
 
-void glUniform4i(GLint location, GLint v0, GLint v1, GLint v2, GLint v3) {
-  InitializeGLContext();
-  if (location < 0) return;
-  assert(static_cast<size_t>(location) < gCtx->uniforms.size());
+  CommandList *list = GetRecordingCommandList();
+  if (list) {
+    // Recorded for CallCommandList(). Not executed.
+    AppendCommand(list, Command::kDispatch, &list->dispatches, command);
+    return;
+  }
 
-  gCtx->uniforms[static_cast<size_t>(location)].iv[0] = v0;
-  gCtx->uniforms[static_cast<size_t>(location)].iv[1] = v1;
-  gCtx->uniforms[static_cast<size_t>(location)].iv[2] = v2;
-  gCtx->uniforms[static_cast<size_t>(location)].iv[3] = v3;
-  gCtx->uniforms[static_cast<size_t>(location)].type = GL_INT;
-  gCtx->uniforms[static_cast<size_t>(location)].count = 4;
+  // Returns immediately. Use glFenceSync/glClientWaitSync or glFinish to
+  // wait for the result.
+  gCtx->scheduler.Submit(&command, 1);
 }
 
-void glGenBuffers(GLsizei n, GLuint *buffers) {
-  InitializeGLContext();
-  assert(n >= 0);
-  assert(n < kMaxBuffers);
-  assert(buffers);
+namespace {
 
-  // Simple linear seach to find available Buffer.
-  // Skip 0th index since its reserved.
-  int count = 0;
-  for (size_t i = 1; i < gCtx->buffers.size(); i++) {
-    if (gCtx->buffers[i].deleted) {
-      buffers[count] = static_cast<GLuint>(i);
-      gCtx->buffers[i].deleted = false;
-      count++;
+// File streamed through one SSBO binding by DispatchComputeStreaming().
+struct Stream {
+  softcompute::ChunkFile file;
+  Buffer buffers[2];  // Chunk being computed, chunk in I/O
+  ResourceBinding resource;
+  bool output;
+  char pad[7];
+};
 
-      if (count >= n) break;
+// Thread running the I/O of DispatchComputeStreaming() one request at a
+// time, so that files are read and written sequentially while chunks
+// compute.
+class StreamIOThread {
+ public:
+  // `io(index, write_chunk, read_chunk)` runs a request, see StreamChunks().
+  explicit StreamIOThread(
+      const std::function<bool(size_t, int64_t, int64_t)> &io)
+      : io_(io),
+        pending_(false),
+        ok_(true),
+        stop_(false),
+        index_(0),
+        write_chunk_(-1),
+        read_chunk_(-1),
+        thread_(&StreamIOThread::Main, this) {}
+
+  ~StreamIOThread() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
     }
+    cv_.notify_all();
+    thread_.join();
   }
-}
-
-GLuint glCreateProgram() {
-  InitializeGLContext();
 
-  // Simple linear seach to find available Program.
-  // Skip 0th index since its reserved.
-  for (size_t i = 1; i < gCtx->programs.size(); i++) {
-    if (gCtx->programs[i].deleted) {
-      gCtx->programs[i].deleted = false;
-      return static_cast<GLuint>(i);
+  // Starts a request. The previous one must have been waited for.
+  void Start(size_t index, int64_t write_chunk, int64_t read_chunk) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      assert(!pending_);
+      index_ = index;
+      write_chunk_ = write_chunk;
+      read_chunk_ = read_chunk;
+      pending_ = true;
     }
+    cv_.notify_all();
   }
 
-  return 0;  // Invalid
-}
+  // Waits for the started request and returns whether it succeeded.
+  bool Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !pending_; });
+    return ok_;
+  }
 
-GLuint glCreateShader(GLenum shader_type) {
-  assert(shader_type == GL_COMPUTE_SHADER);
-  (void)shader_type;
+ private:
+  StreamIOThread(const StreamIOThread &);
+  StreamIOThread &operator=(const StreamIOThread &);
+
+  void Main() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      cv_.wait(lock, [this] { return stop_ || pending_; });
+      if (!pending_) {
+        return;
+      }
+
+      const size_t index = index_;
+      const int64_t write_chunk = write_chunk_;
+      const int64_t read_chunk = read_chunk_;
+      lock.unlock();
+      const bool ok = io_(index, write_chunk, read_chunk);
+      lock.lock();
 
-  // Simple linear seach to find available Shader.
-  // Skip 0th index since its reserved.
-  for (size_t i = 1; i < gCtx->shaders.size(); i++) {
-    if (gCtx->shaders[i].deleted) {
-      gCtx->shaders[i].deleted = false;
-      return static_cast<GLuint>(i);
+      ok_ = ok;
+      pending_ = false;
+      cv_.notify_all();
     }
   }
 
-  return 0;
-}
+  std::function<bool(size_t, int64_t, int64_t)> io_;
 
-void glLinkProgram(GLuint program) {
-  InitializeGLContext();
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool pending_;
+  bool ok_;
+  bool stop_;
+  char pad_[5];
+  size_t index_;
+  int64_t write_chunk_;
+  int64_t read_chunk_;
 
-  assert(program < kMaxPrograms);
+  // Last, so that it starts after the rest is initialized.
+  std::thread thread_;
+};
 
-  if (program == 0) {
-    return;
+}  // namespace
+
+// Writes outputs of chunk `write_chunk` and reads inputs of chunk
+// `read_chunk` (either may be -1 for none) through `buffers[index]`.
+static bool StreamChunks(const std::vector<std::unique_ptr<Stream>> &streams,
+                         size_t index, int64_t write_chunk, int64_t read_chunk,
+                         uint64_t chunk_invocations, uint64_t num_invocations) {
+  for (size_t i = 0; i < streams.size(); i++) {
+    const Stream &stream = *streams[i];
+    const int64_t chunk = stream.output ? write_chunk : read_chunk;
+    if (chunk < 0) continue;
+
+    const uint64_t first = uint64_t(chunk) * chunk_invocations;
+    const uint64_t count = std::min(chunk_invocations, num_invocations - first);
+    const uint64_t stride = stream.resource.element_stride;
+    const Buffer &buffer = stream.buffers[index];
+
+    const bool ok =
+        stream.output
+            ? stream.file.Write(first * stride, size_t(count * stride),
+                                buffer.storage->data())
+            : stream.file.Read(first * stride, size_t(count * stride),
+                               const_cast<uint8_t *>(buffer.storage->data()));
+    if (!ok) {
+      std::cerr << "[SoftGL] Streaming I/O failed." << std::endl;
+      return false;
+    }
   }
 
-  Program &prog = gCtx->programs[program];
+  return true;
+}
 
-  if (prog.deleted) {
-    // LOG_F(ERROR, "[SoftGL] Program %d is not created.", program);
-    return;
-  }
+GLboolean DispatchComputeStreaming(const StreamBinding *bindings,
+                                   GLsizei num_bindings,
+                                   GLuint64 num_invocations,
+                                   GLuint64 chunk_invocations) {
+  InitializeGLContext();
 
-  if (prog.linked) {
-    // LOG_F(ERROR, "[SoftGL] Program %d is already linked.", program);
-    return;
+  if (!bindings || (num_bindings <= 0) || (num_invocations == 0)) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_FALSE;
   }
 
-  // CHECK_F(prog.shaders.size() == 1, "Currently only one shader per program
-  // expected, but got %d", int(prog.shaders.size()));
-
-  GLuint shader_idx = prog.shaders[0];
-
-  if (shader_idx == 0) {
-    // LOG_F(ERROR, "[SoftGL] Invalid shader attached to the program.");
-    return;
+  Program *prog = gCtx->programs.Get(gCtx->active_program);
+  if (GetRecordingCommandList() || !prog || !prog->linked ||
+      (prog->local_size[1] != 1) || (prog->local_size[2] != 1)) {
+    SetGLError(GL_INVALID_OPERATION);
+    return GL_FALSE;
   }
 
-  // CHECK_F(shader_idx < gCtx->shaders.size(), "Invalid shader ID %d",
-  // shader_idx);
+  // Whole workgroups per chunk, so chunk buffers cover every invocation.
+  const uint64_t group_size = prog->local_size[0];
+  const uint64_t max_groups = std::numeric_limits<GLuint>::max();
+  uint64_t num_groups = (std::min(std::max(chunk_invocations, group_size),
+                                  num_invocations) +
+                         group_size - 1) /
+                        group_size;
+  num_groups = std::min(num_groups, max_groups);
+  const uint64_t chunk = num_groups * group_size;
+  const uint64_t num_chunks = (num_invocations + chunk - 1) / chunk;
+
+  // gl_GlobalInvocationID continues over chunks, and is 32-bit.
+  if ((num_invocations + group_size - 1) / group_size * group_size >
+      uint64_t(std::numeric_limits<GLuint>::max()) + 1) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_FALSE;
+  }
 
-  const Shader &shader = gCtx->shaders[shader_idx];
+  std::vector<std::unique_ptr<Stream>> streams;
+  for (GLsizei i = 0; i < num_bindings; i++) {
+    const StreamBinding &binding = bindings[i];
 
-  if (shader.binary.size() == 0) {
-    // LOG_F(ERROR, "[SoftGL] No shader binary assined.");
-    return;
-  }
+    std::unique_ptr<Stream> stream(new Stream());
+    stream->output = (binding.output != GL_FALSE);
 
-  std::string basename = GenerateUniqueFilename();
-  std::string spirv_filename = basename + ".spv";
-  std::string cpp_filename = basename + ".cc";
+    const ResourceBinding *resource = nullptr;
+    for (size_t r = 0; r < prog->num_storage_blocks; r++) {
+      if (prog->resource_bindings[r].buffer_binding == binding.binding) {
+        resource = &prog->resource_bindings[r];
+      }
+    }
 
-#ifdef _WIN32
-  std::string dll_filename = basename + ".dll";
-#else
-  std::string dll_filename = basename + ".so";
-#endif
+    // Chunks are only independent for buffers accessed at the invocation's
+    // own index. Writes to input streams would be lost, and output chunks
+    // are not read in, so output streams must be writeonly.
+    const bool access_ok =
+        resource && (stream->output
+                         ? (resource->writable && !resource->readable)
+                         : !resource->writable);
+    if (!binding.filename || !resource || !resource->elementwise ||
+        !access_ok) {
+      SetGLError(GL_INVALID_OPERATION);
+      return GL_FALSE;
+    }
+    stream->resource = *resource;
+
+    const uint64_t stride = resource->element_stride;
+    const bool opened =
+        stream->output
+            ? stream->file.OpenForWrite(binding.filename,
+                                        num_invocations * stride)
+            : stream->file.OpenForRead(binding.filename);
+    if (!opened) {
+      return GL_FALSE;
+    }
 
-  {
-    // Save CPP compiler context of SPIRV-Cross for later use.
-    prog.cpp = std::make_shared<spirv_cross::CompilerCPP>(shader.binary);
+    stream->buffers[0].storage->Allocate(size_t(chunk * stride));
+    stream->buffers[1].storage->Allocate(size_t(chunk * stride));
+    streams.push_back(std::move(stream));
   }
 
-  {
-    bool ret =
-        compile_spirv_binary(cpp_filename, /* verbose */ true, shader.binary);
-    if (!ret) {
-      // ABORT_F("Failed to translate SPIR-V binary to .cpp");
-      std::cerr << "Failed to translate SPIR-V binary to .cpp" << std::endl;
+  // Other resources stay bound as usual.
+  DispatchCommand base;
+  if (!ResolveDispatch(GLuint(num_groups), 1, 1, &base)) {
+    return GL_FALSE;
+  }
+  for (size_t i = 0; i < streams.size(); i++) {
+    const ResourceBinding &resource = streams[i]->resource;
+    for (size_t b = 0; b < base.bindings.size(); b++) {
+      if ((base.bindings[b].set == resource.set) &&
+          (base.bindings[b].binding == resource.binding)) {
+        base.bindings.erase(base.bindings.begin() + std::ptrdiff_t(b));
+        break;
+      }
     }
   }
 
-#if 0
-  {
-    std::string cpp_compile_options;  // FIXME(syoyo): Supply compiler options
-
-    // c++ -> dll
-    bool ret = compile_cpp(dll_filename, cpp_compile_options,
-                           /* verbose */ true, cpp_filename);
-    if (!ret) {
-      std::cerr << "Failed to compile C++ into dll module." << std::endl;
-      return;
+  softcompute::TraceScope trace("dispatch", "streaming", "chunks", num_chunks);
+
+  bool ok = StreamChunks(streams, 0, -1, 0, chunk, num_invocations);
+
+  StreamIOThread io([&](size_t index, int64_t write_chunk, int64_t read_chunk) {
+    return StreamChunks(streams, index, write_chunk, read_chunk, chunk,
+                        num_invocations);
+  });
+
+  // Computes chunk c from buffers[c % 2] while chunk c - 1 is written from
+  // and chunk c + 1 read into the other ones.
+  for (uint64_t c = 0; ok && (c < num_chunks); c++) {
+    const size_t index = c % 2;
+
+    DispatchCommand command = base;
+    command.num_groups[0] = GLuint(
+        (std::min(chunk, num_invocations - c * chunk) + group_size - 1) /
+        group_size);
+    command.group_offset[0] = GLuint(c * num_groups);
+    for (size_t i = 0; i < streams.size(); i++) {
+      const ResourceBinding &resource = streams[i]->resource;
+
+      BufferBinding binding;
+      binding.set = resource.set;
+      binding.binding = resource.binding;
+      binding.buffer = &streams[i]->buffers[index];
+      binding.offset = 0;
+      binding.size = 0;
+      binding.element_stride = resource.element_stride;
+      binding.buffer_name = 0;
+      binding.readable = resource.readable;
+      binding.writable = resource.writable;
+      binding.elementwise = true;
+      memset(binding.pad, 0, sizeof(binding.pad));
+      command.bindings.push_back(binding);
     }
-  }
+    const std::shared_ptr<DispatchNode> node =
+        gCtx->scheduler.Submit(&command, 1);
 
-  softcompute::ShaderEngine engine;
-  std::vector<std::string> search_paths;
-  std::string compile_options;
+    const int64_t write_chunk = int64_t(c) - 1;
+    const int64_t read_chunk = (c + 1 < num_chunks) ? int64_t(c + 1) : -1;
+    io.Start(1 - index, write_chunk, read_chunk);
 
-  // LOG_F(INFO, "load dll...");
-  prog.instance = std::make_shared<softcompute::ShaderInstance>(*(engine.Compile("comp", /* id */ 0, search_paths,
-                                 compile_options, dll_filename)));
+    // Only this chunk, not unrelated dispatches in flight.
+    gCtx->scheduler.WaitNode(node, GL_TIMEOUT_IGNORED);
+    ok = io.Wait();
+  }
 
-  // LOG_F(INFO, "loaded dll...");
-  spirv_cross_get_interface_fn interface_fn =
-      reinterpret_cast<spirv_cross_get_interface_fn>(
-          prog.instance->GetInterfaceFuncPtr());
+  if (ok) {
+    ok = StreamChunks(streams, (num_chunks - 1) % 2, int64_t(num_chunks) - 1,
+                      -1, chunk, num_invocations);
+  }
 
-  struct spirv_cross_interface *interface = interface_fn();
-  //fprintf(stderr, "construct: %p\n", interface->construct());
-  prog.shader = std::make_shared<spirv_cross_shader_t>(*(interface->construct()));
+  // The chunk buffers go away with `streams`; all their dispatches are done.
+  for (size_t i = 0; i < streams.size(); i++) {
+    gCtx->scheduler.OrphanBuffer(&streams[i]->buffers[0]);
+    gCtx->scheduler.OrphanBuffer(&streams[i]->buffers[1]);
+  }
 
-  // LOG_F(INFO, "linked...");
-  prog.linked = true;
-#else
+  return static_cast<GLboolean>(ok ? GL_TRUE : GL_FALSE);
+}
 
-  softcompute::ShaderEngine engine;
-  std::vector<std::string> search_paths;
-  std::string compile_options;
+void glMemoryBarrier(GLbitfield barriers) {
+  InitializeGLContext();
 
-  {
-    std::stringstream ss;
+  if (barriers == 0) return;
 
-    //ss << "-I./third_party/glm ";  // TODO(syoyo): User-supplied path to glm
-    ss << "-I./third_party/SPIRV-Cross/include ";
+  // All barrier bits order SSBO accesses of dispatches, so they are not
+  // distinguished.
+  CommandList *list = GetRecordingCommandList();
+  if (list) {
+    AppendCommand(list, Command::kBarrier, &list->barriers, barriers);
+    return;
+  }
 
-    ss << gCtx->GetJITCompileOptions() << " ";
+  gCtx->scheduler.Barrier();
+}
 
-    compile_options = ss.str();
-  }
+GLsync glFenceSync(GLenum condition, GLbitfield flags) {
+  InitializeGLContext();
 
-  prog.instance = std::make_shared<softcompute::ShaderInstance>(*(engine.Compile("comp", /* id */ 0, search_paths, compile_options, cpp_filename)));
+  if (condition != GL_SYNC_GPU_COMMANDS_COMPLETE) {
+    SetGLError(GL_INVALID_ENUM);
+    return nullptr;
+  }
 
-  // LOG_F(INFO, "loaded dll...");
-  spirv_cross_get_interface_fn interface_fn =
-      reinterpret_cast<spirv_cross_get_interface_fn>(
-          prog.instance->GetInterfaceFuncPtr());
+  if (flags != 0) {
+    SetGLError(GL_INVALID_VALUE);
+    return nullptr;
+  }
 
-  struct spirv_cross_interface *interface = interface_fn();
-  //fprintf(stderr, "construct: %p\n", interface->construct());
-  prog.shader = std::make_shared<spirv_cross_shader_t>(*(interface->construct()));
+  std::unique_ptr<SyncObject> sync(new SyncObject());
+  sync->fence = gCtx->scheduler.Fence();
 
-  // LOG_F(INFO, "linked...");
-  prog.linked = true;
+  SyncObject *name = sync.get();
+  gCtx->syncs[name] = std::move(sync);
+  return name;
+}
 
-#endif
+// Whether `sync` was returned by glFenceSync() and not deleted yet.
+static bool IsLiveSync(GLsync sync) {
+  return gCtx->syncs.find(sync) != gCtx->syncs.end();
 }
 
-void glBindBuffer(GLenum target, GLuint buffer) {
+GLboolean glIsSync(GLsync sync) {
   InitializeGLContext();
-  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER));
-  (void)target;
 
-  gCtx->active_buffer_index = buffer;
+  return static_cast<GLboolean>(IsLiveSync(sync) ? GL_TRUE : GL_FALSE);
 }
 
-void glBindBufferBase(GLenum target, GLuint index, GLuint buffer) {
-  (void)target;
-  (void)index;
-  (void)buffer;
+void glDeleteSync(GLsync sync) {
+  InitializeGLContext();
 
-  // LOG_F(ERROR, "TODO");
+  if (sync == nullptr) return;
 
-  return;
+  // Deleting a pending sync is allowed. The fence node is owned by the
+  // scheduler until it finishes.
+  if (gCtx->syncs.erase(sync) == 0) {
+    SetGLError(GL_INVALID_VALUE);
+  }
 }
 
-void glBindBufferRange(GLenum target, GLuint index, GLuint buffer,
-                       GLintptr offset, GLsizeiptr size) {
+GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
   InitializeGLContext();
-  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER));
-
-  assert(index <= kMaxBuffers);
-  assert(buffer < gCtx->buffers.size());
-  assert(gCtx->buffers[buffer].deleted == false);
-
-  assert(static_cast<size_t>(offset + size) <=
-         gCtx->buffers[buffer].data.size());
 
-  if (target == GL_SHADER_STORAGE_BUFFER) {
-    gCtx->shader_storage_buffer_accessor[index].assigned = true;
-    gCtx->shader_storage_buffer_accessor[index].buffer_index = buffer;
-    gCtx->shader_storage_buffer_accessor[index].offset =
-        static_cast<size_t>(offset);
-    gCtx->shader_storage_buffer_accessor[index].size =
-        static_cast<size_t>(size);
-  } else if (target == GL_UNIFORM_BUFFER) {
-    gCtx->uniform_buffer_accessor[index].assigned = true;
-    gCtx->uniform_buffer_accessor[index].buffer_index = buffer;
-    gCtx->uniform_buffer_accessor[index].offset = static_cast<size_t>(offset);
-    gCtx->uniform_buffer_accessor[index].size = static_cast<size_t>(size);
+  if (!IsLiveSync(sync)) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_WAIT_FAILED;
   }
-}
 
-void glBufferData(GLenum target, GLsizeiptr size, const GLvoid *data,
-                  GLenum usage) {
-  InitializeGLContext();
-  assert((target == GL_SHADER_STORAGE_BUFFER) || (target == GL_UNIFORM_BUFFER));
-  (void)target;
+  // Commands are always flushed to the workers.
+  (void)flags;
 
-  if (gCtx->active_buffer_index == 0) return;
+  if (gCtx->scheduler.WaitNode(sync->fence, 0)) {
+    return GL_ALREADY_SIGNALED;
+  }
 
-  gCtx->buffers[gCtx->active_buffer_index].data.resize(
-      static_cast<size_t>(size));
-  memcpy(gCtx->buffers[gCtx->active_buffer_index].data.data(), data,
-         static_cast<size_t>(size));
+  if (timeout == 0) {
+    return GL_TIMEOUT_EXPIRED;
+  }
 
-  (void)usage;
+  return gCtx->scheduler.WaitNode(sync->fence, timeout) ? GL_CONDITION_SATISFIED
+                                                       : GL_TIMEOUT_EXPIRED;
 }
 
-void glUseProgram(GLuint program) {
+void glWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
   InitializeGLContext();
-  gCtx->active_program = program;
+  (void)flags;
+  (void)timeout;
+
+  if (!IsLiveSync(sync)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  // Commands issued after this wait for the ones issued before the fence.
+  // Ordering after everything issued so far is a superset of that.
+  gCtx->scheduler.Barrier();
 }
 
-void glShaderBinary(GLsizei n, const GLuint *shaders, GLenum binaryformat,
-                    const void *binary, GLsizei length) {
+void glGetSynciv(GLsync sync, GLenum pname, GLsizei bufSize, GLsizei *length,
+                 GLint *values) {
   InitializeGLContext();
 
-  // TODO(LTE): Support multiple shaders.
-  assert(n == 1);
-  assert(shaders);
-  assert(binary);
-  assert(length > 0);
-  assert(length % 4 ==
-         0);  // Size of SPIR-V binary must be the multiple of 32bit
-  assert(binaryformat == GL_SHADER_BINARY_FORMAT_SPIR_V_ARB);
-  (void)n;
-  (void)binaryformat;
+  if (!IsLiveSync(sync) || (bufSize < 1) || (values == nullptr)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
 
-  size_t idx = shaders[0];
-  if (gCtx->shaders[idx].deleted) {
-    std::cerr << "[SoftGL] shader " << idx << " is not initialized."
-              << std::endl;
+  if (pname == GL_OBJECT_TYPE) {
+    values[0] = GL_SYNC_FENCE;
+  } else if (pname == GL_SYNC_STATUS) {
+    values[0] =
+        gCtx->scheduler.WaitNode(sync->fence, 0) ? GL_SIGNALED : GL_UNSIGNALED;
+  } else if (pname == GL_SYNC_CONDITION) {
+    values[0] = GL_SYNC_GPU_COMMANDS_COMPLETE;
+  } else if (pname == GL_SYNC_FLAGS) {
+    values[0] = 0;
+  } else {
+    SetGLError(GL_INVALID_ENUM);
     return;
   }
 
-  gCtx->shaders[idx].binary.resize(static_cast<size_t>(length / 4));
-  memcpy(gCtx->shaders[idx].binary.data(), binary, static_cast<size_t>(length));
+  if (length) {
+    (*length) = 1;
+  }
 }
 
-void glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string,
-                    const GLint *length) {
-  assert(count > 0);
-  assert(string);
+void glFlush() {
+  // Dispatches are handed to the workers as soon as they are issued.
+}
+
+void glFinish() {
+  InitializeGLContext();
 
-  size_t idx = shader;
-  if (gCtx->shaders[idx].deleted) {
-    std::cerr << "[SoftGL] shader " << idx << " is not initialized."
-              << std::endl;
+  gCtx->scheduler.Wait();
+}
+
+void glGenQueries(GLsizei n, GLuint *ids) {
+  InitializeGLContext();
+
+  if (n < 0) {
+    SetGLError(GL_INVALID_VALUE);
     return;
   }
 
-  gCtx->shaders[idx].source.clear();
-
-  // Concat
-  for (size_t i = 0; i < static_cast<size_t>(count); i++) {
-    if (length) {
-      gCtx->shaders[idx].source +=
-          std::string(string[i], static_cast<size_t>(length[i]));
-    } else {
-      // Assume each input string is null terminated.
-      gCtx->shaders[idx].source += std::string(string[i]);
+  for (GLsizei i = 0; i < n; i++) {
+    ids[i] = gCtx->queries.Allocate();
+    if (ids[i] == 0) {
+      SetGLError(GL_OUT_OF_MEMORY);
     }
   }
 }
 
-GLint glGetUniformLocation(GLuint program, const GLchar *name) {
+void glDeleteQueries(GLsizei n, const GLuint *ids) {
   InitializeGLContext();
-  (void)name;
 
-  if (program == 0) {
-    return -1;
+  if (n < 0) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
   }
 
-  const Program &prog = gCtx->programs[program];
+  for (GLsizei i = 0; i < n; i++) {
+    if (ids[i] == gCtx->active_time_query) {
+      gCtx->active_time_query = 0;
+    }
 
-  if (prog.deleted) {
-    // LOG_F(ERROR, "Program %d is not created.", program);
-    return -1;
+    // Unused and already deleted names are silently ignored. Pending fence
+    // nodes are owned by the scheduler until they finish.
+    gCtx->queries.Release(ids[i]);
   }
-
-  // ABORT_F("TODO");
-  return -1;
 }
 
-void glAttachShader(GLuint program, GLuint shader) {
+GLboolean glIsQuery(GLuint id) {
   InitializeGLContext();
 
-  if (program == 0) return;
-  if (shader == 0) return;
-
-  assert(program < gCtx->programs.size());
-
-  gCtx->programs[program].shaders.push_back(shader);
+  const Query *query = gCtx->queries.Get(id);
+  return static_cast<GLboolean>(((query != nullptr) && (query->target != 0))
+                                    ? GL_TRUE
+                                    : GL_FALSE);
 }
 
-void glGetShaderiv(GLuint shader, GLenum pname, GLint *params) {
-  if (shader == 0) {
+void glBeginQuery(GLenum target, GLuint id) {
+  InitializeGLContext();
+
+  if (target != GL_TIME_ELAPSED) {
+    SetGLError(GL_INVALID_ENUM);
     return;
   }
 
-  InitializeGLContext();
-
-  if (pname == GL_COMPILE_STATUS) {
-    const Shader &s = gCtx->shaders[shader];
-    if (s.binary.size() > 0) {
-      if (params) {
-        (*params) = GL_TRUE;
-      }
-    } else {
-      if (params) {
-        (*params) = GL_FALSE;
-      }
-    }
-  } else {
-    // ABORT_F("TODO");
+  Query *query = gCtx->queries.Get(id);
+  if (!query || (gCtx->active_time_query != 0) || gCtx->recording_list ||
+      ((query->target != 0) && (query->target != target))) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
   }
 
-  return;
+  query->target = target;
+  query->begin = gCtx->scheduler.Fence();
+  query->end.reset();
+  gCtx->active_time_query = id;
 }
 
-void glGetProgramiv(GLuint program, GLenum pname, GLint *params) {
-  if (program == 0) {
+void glEndQuery(GLenum target) {
+  InitializeGLContext();
+
+  if (target != GL_TIME_ELAPSED) {
+    SetGLError(GL_INVALID_ENUM);
     return;
   }
 
-  if (pname == GL_LINK_STATUS) {
-    const Program &prog = gCtx->programs[program];
-
-    if (prog.linked) {
-      if (params) {
-        (*params) = GL_TRUE;
-      }
-    } else {
-      if (params) {
-        (*params) = GL_FALSE;
-      }
-    }
-
-  } else {
-    // ABORT_F("TODO");
+  Query *query = gCtx->queries.Get(gCtx->active_time_query);
+  gCtx->active_time_query = 0;
+  if (!query || gCtx->recording_list) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
   }
 
-  return;
+  // Fences are not ordered among themselves. Finishing after the begin fence
+  // keeps the elapsed time from going negative.
+  query->end = gCtx->scheduler.Fence(query->begin);
 }
 
-void glGetShaderInfoLog(GLuint shader, GLsizei maxLength, GLsizei *length,
-                        GLchar *infoLog) {
-  (void)shader;
-  (void)maxLength;
-  (void)length;
-  (void)infoLog;
+void glQueryCounter(GLuint id, GLenum target) {
+  InitializeGLContext();
 
-  // LOG_F(ERROR, "Implement");
+  if (target != GL_TIMESTAMP) {
+    SetGLError(GL_INVALID_ENUM);
+    return;
+  }
 
-  return;
+  Query *query = gCtx->queries.Get(id);
+  if (!query || (id == gCtx->active_time_query) || gCtx->recording_list ||
+      ((query->target != 0) && (query->target != target))) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  query->target = target;
+  query->begin.reset();
+  query->end = gCtx->scheduler.Fence();
 }
 
-void glDeleteShader(GLuint shader) {
+void glGetQueryiv(GLenum target, GLenum pname, GLint *params) {
   InitializeGLContext();
 
-  if (shader == 0) return;
-
-  assert(shader < gCtx->shaders.size());
-
-  gCtx->shaders[shader].deleted = true;
+  if ((target != GL_TIME_ELAPSED) && (target != GL_TIMESTAMP)) {
+    SetGLError(GL_INVALID_ENUM);
+    return;
+  }
 
-  // TODO(LTE): Free shader resource.
+  if (pname == GL_CURRENT_QUERY) {
+    (*params) = (target == GL_TIME_ELAPSED)
+                    ? static_cast<GLint>(gCtx->active_time_query)
+                    : 0;
+  } else if (pname == GL_QUERY_COUNTER_BITS) {
+    (*params) = 64;
+  } else {
+    SetGLError(GL_INVALID_ENUM);
+  }
 }
 
-void glDeleteProgram(GLuint program) {
-  InitializeGLContext();
+// Reads `pname` of query `id` for glGetQueryObject*. Returns false and sets
+// the GL error on failure. Without a result yet, GL_QUERY_RESULT_NO_WAIT
+// leaves `value` untouched.
+static bool GetQueryObject(GLuint id, GLenum pname, uint64_t *value) {
+  const Query *query = gCtx->queries.Get(id);
+  if (!query || !query->end || (id == gCtx->active_time_query)) {
+    SetGLError(GL_INVALID_OPERATION);
+    return false;
+  }
 
-  if (program == 0) return;
+  // The end fence finishes after the begin fence.
+  const bool available = gCtx->scheduler.WaitNode(query->end, 0);
 
-  assert(program < gCtx->programs.size());
+  if (pname == GL_QUERY_RESULT_AVAILABLE) {
+    (*value) = available ? GL_TRUE : GL_FALSE;
+    return true;
+  }
+
+  if ((pname != GL_QUERY_RESULT) && (pname != GL_QUERY_RESULT_NO_WAIT)) {
+    SetGLError(GL_INVALID_ENUM);
+    return false;
+  }
 
-  gCtx->programs[program].deleted = true;
+  if (!available) {
+    if (pname == GL_QUERY_RESULT_NO_WAIT) {
+      return false;
+    }
+    gCtx->scheduler.WaitNode(query->end, GL_TIMEOUT_IGNORED);
+  }
 
-  softcompute::ShaderInstance *instance = gCtx->programs[program].instance.get();
-  assert(instance);
+  std::chrono::steady_clock::duration time =
+      query->begin ? (query->end->finish_time - query->begin->finish_time)
+                   : query->end->finish_time.time_since_epoch();
+  if (time.count() < 0) {
+    // Not expected with the fences ordered; GL results are unsigned.
+    time = std::chrono::steady_clock::duration::zero();
+  }
+  (*value) = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
 
-  spirv_cross_get_interface_fn interface_fun =
-      reinterpret_cast<spirv_cross_get_interface_fn>(
-          instance->GetInterfaceFuncPtr());
+  return true;
+}
 
-  assert(gCtx->programs[program].shader);
-  interface_fun()->destruct(gCtx->programs[program].shader.get());
+void glGetQueryObjectiv(GLuint id, GLenum pname, GLint *params) {
+  InitializeGLContext();
 
-  gCtx->programs[program].deleted = true;
+  uint64_t value = 0;
+  if (GetQueryObject(id, pname, &value)) {
+    (*params) = static_cast<GLint>(
+        std::min(value, uint64_t(std::numeric_limits<GLint>::max())));
+  }
 }
 
-void glDispatchCompute(GLuint num_groups_x, GLuint num_groups_y,
-                       GLuint num_groups_z) {
+void glGetQueryObjectuiv(GLuint id, GLenum pname, GLuint *params) {
   InitializeGLContext();
-  (void)num_groups_z;
 
-  // CHECK_F(num_groups_z == 1, "num_group_z must be 1 for a while");
+  uint64_t value = 0;
+  if (GetQueryObject(id, pname, &value)) {
+    (*params) = static_cast<GLuint>(
+        std::min(value, uint64_t(std::numeric_limits<GLuint>::max())));
+  }
+}
 
-  glm::uvec3 num_workgroups(num_groups_x, num_groups_y, 1);
-  glm::uvec3 work_group_id(0, 0, 0);
+void glGetQueryObjecti64v(GLuint id, GLenum pname, GLint64 *params) {
+  InitializeGLContext();
 
-  if (gCtx->active_program == 0) return;
+  uint64_t value = 0;
+  if (GetQueryObject(id, pname, &value)) {
+    (*params) = static_cast<GLint64>(value);
+  }
+}
 
-  spirv_cross_shader_t *shader = gCtx->programs[gCtx->active_program].shader.get();
-  spirv_cross_get_interface_fn interface_fun =
-      reinterpret_cast<spirv_cross_get_interface_fn>(
-          gCtx->programs[gCtx->active_program].instance->GetInterfaceFuncPtr());
+void glGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64 *params) {
+  InitializeGLContext();
 
-  spirv_cross_set_builtin(shader, SPIRV_CROSS_BUILTIN_NUM_WORK_GROUPS,
-                          &num_workgroups, sizeof(num_workgroups));
-  spirv_cross_set_builtin(shader, SPIRV_CROSS_BUILTIN_WORK_GROUP_ID,
-                          &work_group_id, sizeof(work_group_id));
+  uint64_t value = 0;
+  if (GetQueryObject(id, pname, &value)) {
+    (*params) = value;
+  }
+}
 
-  {
-    auto t_begin = std::chrono::high_resolution_clock::now();
-    // Execute work groups
-    for (uint32_t y = 0; y < num_groups_y; y++) {
-      for (uint32_t x = 0; x < num_groups_x; x++) {
-        work_group_id.x = x;
-        work_group_id.y = y;
-
-        interface_fun()->invoke(shader);
-      }
-    }
-    auto t_end = std::chrono::high_resolution_clock::now();
+GLsizei GetDispatchStats(DispatchStats *stats, GLsizei max_count) {
+  InitializeGLContext();
 
-    std::chrono::duration<double, std::milli> exec_ms = t_end - t_begin;
-    std::cout << "execute time: " << exec_ms.count() << " ms" << std::endl;
+  if ((max_count < 0) || (!stats && (max_count > 0))) {
+    SetGLError(GL_INVALID_VALUE);
+    return 0;
   }
+
+  return static_cast<GLsizei>(
+      gCtx->scheduler.TakeStats(stats, static_cast<size_t>(max_count)));
 }
 
 void glCompileShader(GLuint shader_id) {
   InitializeGLContext();
 
-  if (shader_id == 0) return;
-
-  // CHECK_F(shader_id < gCtx->shaders.size(), "Invalid shader ID. Must be less
-  // than %d but got %d", int(gCtx->shaders.size()), shader_id);
+  Shader *shader_ptr = gCtx->shaders.Get(shader_id);
+  if (!shader_ptr) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
 
-  Shader &shader = gCtx->shaders[shader_id];
+  Shader &shader = *shader_ptr;
 
   if (shader.binary.size() > 0) {
     // Binary shader attached.
@@ -1245,12 +4267,20 @@ void glCompileShader(GLuint shader_id) {
 #else
   //ShHandle compiler = ShConstructCompiler(/* lang */EShLangCompute, /* debugOpts */0);
 
+  softcompute::ResetCompileStageTimes();
+
   glslang::InitializeProcess(); // Required before calling glslang functions.
 
   bool ret = compile_glsl_string(shader.source, "dummy", &shader.binary);
   if (!ret) {
     shader.binary.clear(); // for sure
   }
+
+  {
+    uint64_t stage_ns[softcompute::kNumCompileStages];
+    softcompute::GetCompileStageTimes(stage_ns);
+    shader.glsl_to_spirv_ns = stage_ns[softcompute::kCompileGlslToSpirv];
+  }
   std::cout << "len = " << shader.binary.size() << std::endl;
 
   glslang::FinalizeProcess();
@@ -1258,65 +4288,344 @@ void glCompileShader(GLuint shader_id) {
 #endif
 }
 
+// Looks up `name` in one of the block tables of `program`. Returns
+// GL_INVALID_INDEX and sets the GL error for an invalid or unlinked program.
+static GLuint FindBlockIndex(GLuint program, bool storage, const char *name) {
+  const Program *prog = gCtx->programs.Get(program);
+  if (!prog) {
+    SetGLError(GL_INVALID_VALUE);
+    return GL_INVALID_INDEX;
+  }
+
+  if (!prog->linked) {
+    SetGLError(GL_INVALID_OPERATION);
+    return GL_INVALID_INDEX;
+  }
+
+  if (!name) {
+    return GL_INVALID_INDEX;
+  }
+
+  const std::unordered_map<std::string, GLuint> &blocks =
+      storage ? prog->reflection.storage_blocks
+              : prog->reflection.uniform_blocks;
+  std::unordered_map<std::string, GLuint>::const_iterator it =
+      blocks.find(name);
+  if (it == blocks.end()) {
+    return GL_INVALID_INDEX;
+  }
+
+  return it->second;
+}
+
 GLuint glGetProgramResourceIndex(GLuint program, GLenum programInterface,
                                  const char *name) {
   InitializeGLContext();
 
-  if (program == 0) return 0;
-
   if (programInterface == GL_SHADER_STORAGE_BLOCK) {
-    // OK
-  } else {
-    SetGLError(GL_INVALID_ENUM);
-    return 0;
+    return FindBlockIndex(program, /* storage */ true, name);
+  } else if (programInterface == GL_UNIFORM_BLOCK) {
+    return FindBlockIndex(program, /* storage */ false, name);
+  } else if (programInterface == GL_UNIFORM) {
+    const GLint location = glGetUniformLocation(program, name);
+    return (location < 0) ? GL_INVALID_INDEX : static_cast<GLuint>(location);
   }
-  assert(program < gCtx->programs.size());
 
-  const Program &prog = gCtx->programs[program];
+  SetGLError(GL_INVALID_ENUM);
+  return GL_INVALID_INDEX;
+}
+
+void GetProgramCompileStats(GLuint program, ProgramCompileStats *stats) {
+  InitializeGLContext();
 
-  GLuint idx = 0;
-  const spirv_cross::ShaderResources resources =
-      prog.cpp->get_shader_resources();
+  if (!stats) return;
 
-  for (size_t i = 0; i < resources.storage_buffers.size(); i++) {
-    if (resources.storage_buffers[i].name.compare(name) == 0) {
-      // Got it
-      idx = static_cast<GLuint>(i);
-    }
+  const Program *prog = gCtx->programs.Get(program);
+  if (!prog) {
+    SetGLError(GL_INVALID_VALUE);
+    *stats = ProgramCompileStats();
+    return;
   }
 
-  return idx;
+  *stats = prog->compile_stats;
 }
 
 void glShaderStorageBlockBinding(GLuint program, GLuint shaderBlockIndex,
                                  GLuint storageBlockBinding) {
-  (void)program;
-  (void)shaderBlockIndex;
-  (void)storageBlockBinding;
-  // LOG_F(ERROR, "TODO");
+  InitializeGLContext();
+
+  Program *prog = gCtx->programs.Get(program);
+  if (!prog) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (!prog->linked) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  if ((shaderBlockIndex >= prog->num_storage_blocks) ||
+      (storageBlockBinding > kMaxBufferBindings)) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  // Takes effect for dispatches issued from now on. Recorded dispatches keep
+  // the buffers they resolved.
+  prog->resource_bindings[shaderBlockIndex].buffer_binding =
+      storageBlockBinding;
 }
 
 GLuint glGetUniformBlockIndex(GLuint program, const GLchar *uniformBlockName) {
   InitializeGLContext();
 
-  if (program == 0) {
-    return GL_INVALID_INDEX;
+  return FindBlockIndex(program, /* storage */ false, uniformBlockName);
+}
+
+// Whether `b` can run right after `a` block by block instead of after all of
+// `a`. Both must be 1D dispatches over the same invocations, and each buffer
+// they share with a write must be accessed only at gl_GlobalInvocationID.x
+// with the same element layout. Invocation i of `b` then only depends on
+// invocation i of `a`.
+static bool CanFuse(const DispatchCommand &a, const DispatchCommand &b) {
+  const Program &pa = *a.program;
+  const Program &pb = *b.program;
+
+  if (pa.synchronizes || pb.synchronizes) return false;
+
+  if ((a.num_groups[0] != b.num_groups[0]) || (a.num_groups[1] != 1) ||
+      (a.num_groups[2] != 1) || (b.num_groups[1] != 1) ||
+      (b.num_groups[2] != 1) || (a.group_offset[0] != b.group_offset[0])) {
+    return false;
+  }
+
+  if ((pa.local_size[0] != pb.local_size[0]) || (pa.local_size[1] != 1) ||
+      (pa.local_size[2] != 1) || (pb.local_size[1] != 1) ||
+      (pb.local_size[2] != 1)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a.bindings.size(); i++) {
+    for (size_t j = 0; j < b.bindings.size(); j++) {
+      const BufferBinding &ba = a.bindings[i];
+      const BufferBinding &bb = b.bindings[j];
+
+      if (ba.buffer != bb.buffer) continue;
+      if (!ba.writable && !bb.writable) continue;
+
+      if (!ba.elementwise || !bb.elementwise ||
+          (ba.element_stride != bb.element_stride) ||
+          (ba.offset != bb.offset)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Merges runs of fusable dispatches into one kDispatch command, e.g. a layer
+// followed by its activation. The intermediate buffers are still written, but
+// each block of elements is consumed by the next stage while in cache
+// instead of after the whole dispatch. Barriers recorded inside a run are
+// moved in front of it. Buffer hazards already order the run's stages, and
+// the barrier still orders earlier dispatches before all of the run.
+static void FuseDispatches(CommandList *list) {
+  std::vector<Command> commands;
+  commands.reserve(list->commands.size());
+
+  bool in_run = false;
+  size_t run = 0;  // Position of the run's kDispatch in `commands`
+
+  for (size_t i = 0; i < list->commands.size(); i++) {
+    const Command &command = list->commands[i];
+
+    if (command.type == Command::kDispatch) {
+      if (in_run) {
+        Command &head = commands[run];
+        bool fusable = (head.index + head.count == command.index);
+        for (uint32_t k = 0; fusable && (k < head.count); k++) {
+          fusable = CanFuse(list->dispatches[head.index + k],
+                            list->dispatches[command.index]);
+        }
+
+        if (fusable) {
+          head.count++;
+
+          std::vector<Command>::iterator it = std::stable_partition(
+              commands.begin() + static_cast<std::ptrdiff_t>(run),
+              commands.end(),
+              [](const Command &c) { return c.type == Command::kBarrier; });
+          run = static_cast<size_t>(it - commands.begin());
+          continue;
+        }
+      }
+
+      in_run = true;
+      run = commands.size();
+    }
+
+    commands.push_back(command);
   }
 
-  Program &prog = gCtx->GetProgram(program);
+  list->commands.swap(commands);
+}
+
+GLuint CreateCommandList() {
+  InitializeGLContext();
+
+  return gCtx->command_lists.Allocate();
+}
+
+void DeleteCommandList(GLuint list) {
+  InitializeGLContext();
+
+  if (list == 0) return;
+
+  if (gCtx->recording_list == list) {
+    gCtx->recording_list = 0;
+  }
+
+  if (!gCtx->command_lists.Release(list)) {
+    SetGLError(GL_INVALID_VALUE);
+  }
+}
+
+void BeginCommandList(GLuint list) {
+  InitializeGLContext();
+
+  CommandList *commands = gCtx->command_lists.Get(list);
+  if (!commands) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (gCtx->recording_list != 0) {
+    // Nested recording is not allowed.
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  commands->Clear();
+  gCtx->recording_list = list;
+}
+
+void EndCommandList() {
+  InitializeGLContext();
+
+  if (gCtx->recording_list == 0) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  FuseDispatches(GetRecordingCommandList());
+
+  gCtx->recording_list = 0;
+}
+
+// Resolves the objects of the recorded `commands` again from their names into
+// `dispatches`, in the order of commands.dispatches. Returns false when any of
+// them was deleted, or a program relinked, since recording.
+static bool ResolveCommandList(const CommandList &commands,
+                               std::vector<DispatchCommand> *dispatches) {
+  for (size_t i = 0; i < commands.programs.size(); i++) {
+    if ((commands.programs[i] != 0) &&
+        !gCtx->programs.Get(commands.programs[i])) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < commands.binds.size(); i++) {
+    const Accessor &accessor = commands.binds[i].accessor;
+    if (accessor.assigned && !gCtx->buffers.Get(accessor.buffer_index)) {
+      return false;
+    }
+  }
 
-  const spirv_cross::ShaderResources resources =
-      prog.cpp->get_shader_resources();
+  *dispatches = commands.dispatches;
+  for (size_t i = 0; i < dispatches->size(); i++) {
+    DispatchCommand &command = (*dispatches)[i];
+    command.program = gCtx->programs.Get(command.program_name);
+    if (!command.program || !command.program->linked ||
+        (command.program->link_count != command.program_link_count)) {
+      return false;
+    }
 
-  GLuint idx = GL_INVALID_INDEX;
-  for (size_t i = 0; i < resources.storage_buffers.size(); i++) {
-    if (resources.storage_buffers[i].name.compare(uniformBlockName) == 0) {
-      // Got it
-      idx = static_cast<GLuint>(i);
+    for (size_t b = 0; b < command.bindings.size(); b++) {
+      BufferBinding &binding = command.bindings[b];
+      binding.buffer = gCtx->buffers.Get(binding.buffer_name);
+      if (!binding.buffer ||
+          (binding.offset > binding.buffer->storage->size())) {
+        return false;
+      }
     }
   }
 
-  return idx;
+  return true;
+}
+
+void CallCommandList(GLuint list) {
+  InitializeGLContext();
+
+  const CommandList *list_ptr = gCtx->command_lists.Get(list);
+  if (!list_ptr) {
+    SetGLError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (gCtx->recording_list != 0) {
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  const CommandList &commands = *list_ptr;
+
+  // Nothing of the list runs when part of it is stale.
+  std::vector<DispatchCommand> dispatches;
+  if (!ResolveCommandList(commands, &dispatches)) {
+    std::cerr << "[SoftGL] Command list " << list
+              << " uses a program or buffer deleted or relinked since "
+                 "recording."
+              << std::endl;
+    SetGLError(GL_INVALID_OPERATION);
+    return;
+  }
+
+  for (size_t i = 0; i < commands.commands.size(); i++) {
+    const Command &command = commands.commands[i];
+
+    switch (command.type) {
+      case Command::kUseProgram:
+        gCtx->active_program = commands.programs[command.index];
+        break;
+      case Command::kBindBuffer: {
+        const BindCommand &bind = commands.binds[command.index];
+        if (bind.target == GL_SHADER_STORAGE_BUFFER) {
+          gCtx->shader_storage_buffer_accessor[bind.index] = bind.accessor;
+        } else {
+          gCtx->uniform_buffer_accessor[bind.index] = bind.accessor;
+        }
+        break;
+      }
+      case Command::kUniform: {
+        // Recorded dispatches already hold their uniform values. This only
+        // restores the program state.
+        const UniformCommand &uniform = commands.uniforms[command.index];
+        Program *prog = gCtx->programs.Get(gCtx->active_program);
+        if (prog) {
+          prog->WriteUniform(uniform.location, uniform.value);
+        }
+        break;
+      }
+      case Command::kDispatch:
+        gCtx->scheduler.Submit(&dispatches[command.index], command.count);
+        break;
+      case Command::kBarrier:
+        gCtx->scheduler.Barrier();
+        break;
+    }
+  }
 }
 
 }  // namespace softgl
@@ -14,6 +14,7 @@ const int GL_TRUE = 1;
 
 typedef uint8_t GLboolean;
 typedef uint32_t GLenum;
+typedef uint32_t GLbitfield;
 typedef int32_t GLint;
 typedef float GLfloat;
 typedef uint32_t GLuint;
@@ -29,6 +30,11 @@ typedef char GLchar;
 
 typedef ptrdiff_t GLintptr;
 typedef ptrdiff_t GLsizeiptr;
+typedef int64_t GLint64;
+typedef uint64_t GLuint64;
+
+struct SyncObject;
+typedef SyncObject *GLsync;
 
 const int GL_COMPUTE_SHADER = 0x91B9;
 const int GL_COMPILE_STATUS = 0x8B81;
@@ -41,10 +47,80 @@ const int GL_UNSIGNED_SHORT = 0x1403;
 const int GL_INT = 0x1404;
 const int GL_UNSIGNED_INT = 0x1405;
 const int GL_FLOAT = 0x1406;
+const int GL_HALF_FLOAT = 0x140B;
+
+const int GL_FLOAT_VEC2 = 0x8B50;
+const int GL_FLOAT_VEC3 = 0x8B51;
+const int GL_FLOAT_VEC4 = 0x8B52;
+const int GL_INT_VEC2 = 0x8B53;
+const int GL_INT_VEC3 = 0x8B54;
+const int GL_INT_VEC4 = 0x8B55;
+const int GL_FLOAT_MAT2 = 0x8B5A;
+const int GL_FLOAT_MAT3 = 0x8B5B;
+const int GL_FLOAT_MAT4 = 0x8B5C;
+const int GL_FLOAT_MAT2x3 = 0x8B65;
+const int GL_FLOAT_MAT2x4 = 0x8B66;
+const int GL_FLOAT_MAT3x2 = 0x8B67;
+const int GL_FLOAT_MAT3x4 = 0x8B68;
+const int GL_FLOAT_MAT4x2 = 0x8B69;
+const int GL_FLOAT_MAT4x3 = 0x8B6A;
+const int GL_UNSIGNED_INT_VEC2 = 0x8DC6;
+const int GL_UNSIGNED_INT_VEC3 = 0x8DC7;
+const int GL_UNSIGNED_INT_VEC4 = 0x8DC8;
+
+const int GL_RED = 0x1903;
+const int GL_RGB = 0x1907;
+const int GL_RGBA = 0x1908;
+const int GL_RG = 0x8227;
+const int GL_RG_INTEGER = 0x8228;
+const int GL_RED_INTEGER = 0x8D94;
+const int GL_RGB_INTEGER = 0x8D98;
+const int GL_RGBA_INTEGER = 0x8D99;
+
+const int GL_RGBA8 = 0x8058;
+const int GL_RGBA16 = 0x805B;
+const int GL_RGBA32F = 0x8814;
+const int GL_RGB32F = 0x8815;
+const int GL_RGBA16F = 0x881A;
+const int GL_R8 = 0x8229;
+const int GL_R16 = 0x822A;
+const int GL_RG8 = 0x822B;
+const int GL_RG16 = 0x822C;
+const int GL_R16F = 0x822D;
+const int GL_R32F = 0x822E;
+const int GL_RG16F = 0x822F;
+const int GL_RG32F = 0x8230;
+const int GL_R8I = 0x8231;
+const int GL_R8UI = 0x8232;
+const int GL_R16I = 0x8233;
+const int GL_R16UI = 0x8234;
+const int GL_R32I = 0x8235;
+const int GL_R32UI = 0x8236;
+const int GL_RG8I = 0x8237;
+const int GL_RG8UI = 0x8238;
+const int GL_RG16I = 0x8239;
+const int GL_RG16UI = 0x823A;
+const int GL_RG32I = 0x823B;
+const int GL_RG32UI = 0x823C;
+const int GL_RGBA32UI = 0x8D70;
+const int GL_RGB32UI = 0x8D71;
+const int GL_RGBA16UI = 0x8D76;
+const int GL_RGBA8UI = 0x8D7C;
+const int GL_RGBA32I = 0x8D82;
+const int GL_RGB32I = 0x8D83;
+const int GL_RGBA16I = 0x8D88;
+const int GL_RGBA8I = 0x8D8E;
+
+const int GL_STREAM_DRAW = 0x88E0;
+const int GL_STATIC_DRAW = 0x88E4;
+const int GL_DYNAMIC_DRAW = 0x88E8;
 
 const int GL_SHADER_BINARY_FORMAT_SPIR_V_ARB = 0x9551;
 
+const int GL_UNIFORM_BARRIER_BIT = 0x00000004;
+const int GL_BUFFER_UPDATE_BARRIER_BIT = 0x00000200;
 const int GL_SHADER_STORAGE_BARRIER_BIT = 0x2000;
+const GLbitfield GL_ALL_BARRIER_BITS = 0xFFFFFFFF;
 const int GL_MAX_COMBINED_SHADER_OUTPUT_RESOURCES = 0x8F39;
 const int GL_SHADER_STORAGE_BUFFER = 0x90D2;
 const int GL_SHADER_STORAGE_BUFFER_BINDING = 0x90D3;
@@ -62,9 +138,40 @@ const int GL_MAX_SHADER_STORAGE_BLOCK_SIZE = 0x90DE;
 const int GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT = 0x90DF;
 
 const int GL_UNIFORM_BUFFER = 0x8A11;
+const int GL_COPY_READ_BUFFER = 0x8F36;
+const int GL_COPY_WRITE_BUFFER = 0x8F37;
+
+const int GL_READ_ONLY = 0x88B8;
+const int GL_WRITE_ONLY = 0x88B9;
+const int GL_READ_WRITE = 0x88BA;
 
+const int GL_UNIFORM = 0x92E1;
+const int GL_UNIFORM_BLOCK = 0x92E2;
 const int GL_SHADER_STORAGE_BLOCK = 0x92E6;
 
+const int GL_OBJECT_TYPE = 0x9112;
+const int GL_SYNC_CONDITION = 0x9113;
+const int GL_SYNC_STATUS = 0x9114;
+const int GL_SYNC_FLAGS = 0x9115;
+const int GL_SYNC_FENCE = 0x9116;
+const int GL_SYNC_GPU_COMMANDS_COMPLETE = 0x9117;
+const int GL_UNSIGNALED = 0x9118;
+const int GL_SIGNALED = 0x9119;
+const int GL_ALREADY_SIGNALED = 0x911A;
+const int GL_TIMEOUT_EXPIRED = 0x911B;
+const int GL_CONDITION_SATISFIED = 0x911C;
+const int GL_WAIT_FAILED = 0x911D;
+const int GL_SYNC_FLUSH_COMMANDS_BIT = 0x00000001;
+const GLuint64 GL_TIMEOUT_IGNORED = 0xFFFFFFFFFFFFFFFFull;
+
+const int GL_QUERY_COUNTER_BITS = 0x8864;
+const int GL_CURRENT_QUERY = 0x8865;
+const int GL_QUERY_RESULT = 0x8866;
+const int GL_QUERY_RESULT_AVAILABLE = 0x8867;
+const int GL_TIME_ELAPSED = 0x88BF;
+const int GL_TIMESTAMP = 0x8E28;
+const int GL_QUERY_RESULT_NO_WAIT = 0x9194;
+
 const int GL_NO_ERROR = 0;
 const int GL_INVALID_ENUM = 0x0500;
 const int GL_INVALID_VALUE = 0x0501;
@@ -75,6 +182,10 @@ const int GL_OUT_OF_MEMORY = 0x0505;
 
 const unsigned int GL_INVALID_INDEX = static_cast<unsigned int>(-1);
 
+// Sets a plain uniform or a push constant member of the active program.
+// A dispatch uses the values set when it was issued. The function must match
+// the uniform's component type and count (e.g. glUniform3i for an ivec3),
+// otherwise GL_INVALID_OPERATION is raised and the value is kept.
 void glUniform1f(GLint location, GLfloat v0);
 
 void glUniform2f(GLint location, GLfloat v0, GLfloat v1);
@@ -91,13 +202,62 @@ void glUniform3i(GLint location, GLint v0, GLint v1, GLint v2);
 
 void glUniform4i(GLint location, GLint v0, GLint v1, GLint v2, GLint v3);
 
+void glUniform1ui(GLint location, GLuint v0);
+
+void glUniform2ui(GLint location, GLuint v0, GLuint v1);
+
+void glUniform3ui(GLint location, GLuint v0, GLuint v1, GLuint v2);
+
+void glUniform4ui(GLint location, GLuint v0, GLuint v1, GLuint v2, GLuint v3);
+
 GLint glGetUniformLocation(GLuint program, const GLchar *name);
 
+// Type (e.g. GL_FLOAT_VEC3), array size and name of a uniform. The index of a
+// uniform is its location; unused locations raise GL_INVALID_VALUE.
+void glGetActiveUniform(GLuint program, GLuint index, GLsizei bufSize,
+                        GLsizei *length, GLint *size, GLenum *type,
+                        GLchar *name);
+
 void glDispatchCompute(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
 
 void glDispatchComputeIndirect(GLintptr indirect);
 
+void glMemoryBarrier(GLbitfield barriers);
+
+// glDispatchCompute returns without waiting for the dispatch. Use a fence or
+// glFinish to wait for the results. glBufferData, BufferDataFromFile and
+// whole-buffer updates give the buffer new storage and leave the old one to
+// in-flight dispatches instead of waiting for them. glMapBuffer waits for
+// in-flight dispatches accessing the buffer, as do partial updates, and
+// glGetBufferSubData only for the ones writing it.
+GLsync glFenceSync(GLenum condition, GLbitfield flags);
+GLboolean glIsSync(GLsync sync);
+void glDeleteSync(GLsync sync);
+GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout);
+void glWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout);
+void glGetSynciv(GLsync sync, GLenum pname, GLsizei bufSize, GLsizei *length, GLint *values);
+
+void glFlush();
+void glFinish();
+
+// GL_TIME_ELAPSED measures the time from the completion of the commands
+// issued before glBeginQuery to the completion of those issued before
+// glEndQuery. GL_TIMESTAMP is in nanoseconds of a monotonic clock. Queries
+// cannot be used while recording a command list.
+void glGenQueries(GLsizei n, GLuint *ids);
+void glDeleteQueries(GLsizei n, const GLuint *ids);
+GLboolean glIsQuery(GLuint id);
+void glBeginQuery(GLenum target, GLuint id);
+void glEndQuery(GLenum target);
+void glQueryCounter(GLuint id, GLenum target);
+void glGetQueryiv(GLenum target, GLenum pname, GLint *params);
+void glGetQueryObjectiv(GLuint id, GLenum pname, GLint *params);
+void glGetQueryObjectuiv(GLuint id, GLenum pname, GLuint *params);
+void glGetQueryObjecti64v(GLuint id, GLenum pname, GLint64 *params);
+void glGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64 *params);
+
 void glGenBuffers(GLsizei n, GLuint *buffers);
+void glDeleteBuffers(GLsizei n, const GLuint *buffers);
 
 void glBindBuffer(GLenum target, GLuint buffer);
 void glBindBufferBase(GLenum target, GLuint index, GLuint buffer);
@@ -105,6 +265,22 @@ void glBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offs
 
 void glBufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage);
 
+// Partial updates, reads, copies and clears of buffer ranges. They wait for
+// in-flight dispatches accessing the buffers, except that updates of a
+// whole buffer still in use give it new storage instead, like glBufferData.
+// Large ranges are copied and filled on several threads with non-temporal
+// stores. glCopyBufferSubData may copy between buffers bound to
+// GL_COPY_READ_BUFFER and GL_COPY_WRITE_BUFFER.
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data);
+void glGetBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, GLvoid *data);
+void glCopyBufferSubData(GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size);
+
+// `data` (zeros when NULL) is stored as it is: format and type must describe
+// internalformat exactly (e.g. GL_RED and GL_FLOAT for GL_R32F), as no
+// conversion is done. GL_INVALID_OPERATION otherwise.
+void glClearBufferData(GLenum target, GLenum internalformat, GLenum format, GLenum type, const void *data);
+void glClearBufferSubData(GLenum target, GLenum internalformat, GLintptr offset, GLsizeiptr size, GLenum format, GLenum type, const void *data);
+
 void *glMapBuffer(GLenum target, GLenum access);
 GLboolean glUnmapBuffer(GLenum target);
 
@@ -126,6 +302,8 @@ void glDeleteShader(GLuint shader);
 void glGetShaderInfoLog(GLuint shader, GLsizei maxLength, GLsizei *length, GLchar *infoLog);
 void glGetShaderiv(GLuint shader, GLenum pname, GLint *params);
 
+// Interface queries are answered from tables built by glLinkProgram.
+// programInterface is GL_UNIFORM, GL_UNIFORM_BLOCK or GL_SHADER_STORAGE_BLOCK.
 GLuint glGetProgramResourceIndex(GLuint program, GLenum programInterface, const char *name);
 void glShaderStorageBlockBinding(GLuint program, GLuint shaderBlockIndex, GLuint shaderBlockBinding);
 
@@ -139,10 +317,208 @@ GLuint glGetUniformBlockIndex(GLuint program, const GLchar *uniformBlockName);
 // SoftGL specific.
 //
 
+// Settings of a SoftGL context.
+// InitSoftGL() overrides num_threads with SOFTCOMPUTE_THREADS and the CPU
+// settings with SOFTCOMPUTE_AFFINITY when they are set (see README).
+struct SoftGLConfig {
+  GLint num_threads;  // Worker threads. <= 0 runs one per CPU in cpu_list.
+
+  // CPUs workers run on, as a list such as "0-7,16-23", or "isolated" for
+  // the CPUs reserved with the isolcpus= kernel parameter (Linux). nullptr
+  // uses the CPUs the process may run on.
+  const char *cpu_list;
+
+  // Uses only the first hardware thread of each core in cpu_list, so that
+  // workers do not share cores.
+  GLboolean avoid_smt;
+
+  // Binding of workers to CPUs:
+  //   kAffinityNode  to the CPUs of their NUMA node. Not bound when there is
+  //                  a single node and cpu_list and avoid_smt are not set.
+  //   kAffinityCore  each to a single CPU, taken in turn
+  //   kAffinityNone  not bound
+  enum ThreadAffinity { kAffinityNone = 0, kAffinityNode, kAffinityCore };
+  ThreadAffinity thread_affinity;
+
+  // Buffers of at least this many bytes are put on 2 MB pages (Linux), to
+  // cut TLB misses of shaders accessing them randomly. 0 turns it off.
+  GLsizeiptr huge_page_threshold;
+
+  // On NUMA systems (Linux), workers are grouped by node and every
+  // dispatch is split into one contiguous workgroup range per node.
+  // Buffers of 1 MB or more are placed to match:
+  //   kNumaPartition   a contiguous slice per node, for shaders indexing
+  //                    buffers by invocation ID
+  //   kNumaInterleave  pages round-robin over the nodes, for scattered access
+  //   kNumaOff         no NUMA awareness; pages go where first written
+  enum NumaPlacement { kNumaOff = 0, kNumaPartition, kNumaInterleave };
+  NumaPlacement numa_placement;
+
+  SoftGLConfig()
+      : num_threads(0),
+        cpu_list(nullptr),
+        avoid_smt(GL_FALSE),
+        thread_affinity(kAffinityNode),
+        huge_page_threshold(4 << 20),
+        numa_placement(kNumaPartition) {}
+};
+
 void InitSoftGL();
+void InitSoftGL(const SoftGLConfig &config);
 void SetJITCompilerOptions(const char *option_string);
 void ReleaseSoftGL();
 
+// Backs the buffer bound to `target` with a memory mapping of `filename`
+// instead of copying data into it. GL_READ_ONLY maps the file read-only,
+// covering the whole file when `size` is 0; dispatches which may write the
+// buffer then fail with GL_INVALID_OPERATION. GL_READ_WRITE shares the
+// mapping with the file, creating it and growing it to `size` bytes as
+// needed, so results are written to the file. Pages are read on first access
+// with readahead hints taken from how dispatches access the buffer.
+// Returns GL_FALSE when the file cannot be mapped. POSIX only.
+GLboolean BufferDataFromFile(GLenum target, const char *filename, GLsizeiptr size, GLenum access);
+
+// Loads a NumPy .npy file, or a raw little-endian file described by a JSON
+// sidecar `<filename>.json` ({"dtype": "<f4", "shape": [1024, 3]}), into the
+// buffer bound to `target`. The data is mapped copy-on-write, so it is paged
+// in on demand and shaders may write the buffer without modifying the file.
+// Returns GL_FALSE for unsupported files, e.g. big-endian or Fortran order.
+// POSIX only.
+GLboolean BufferDataFromTensorFile(GLenum target, const char *filename);
+
+// Saves the contents of `buffer` as .npy, or for other extensions as a raw
+// file with a JSON sidecar. `dtype` is a NumPy type string such as "<f4".
+// With `num_dims` 0 the array is one-dimensional and covers the buffer.
+GLboolean SaveBufferAsTensorFile(GLuint buffer, const char *filename, const char *dtype, const GLuint64 *shape, GLsizei num_dims);
+
+// Saves `buffer` holding width x height linear float pixels with `channels`
+// (1 to 4) channels, bottom row first, choosing the format from the
+// extension of `filename`: .png is gamma corrected and quantized through a
+// lookup table, except alpha (the last of 2 or 4 channels), which is kept
+// linear. .pfm and .exr keep floats and .npy keeps the buffer as is.
+// Other extensions are not written and return GL_FALSE. Conversion runs on
+// the dispatch workers.
+GLboolean SaveBufferAsImage(GLuint buffer, const char *filename, GLsizei width, GLsizei height, GLint channels);
+
+// File streamed through an SSBO binding by DispatchComputeStreaming().
+struct StreamBinding {
+  const char *filename;
+  GLuint binding;    // SSBO binding point of the shader
+  GLboolean output;  // Written to instead of read from
+  GLubyte pad[3];
+};
+
+// Runs the active program over `num_invocations` invocations along x on
+// files which need not fit in memory. Each streamed buffer must be accessed
+// by the shader only at the invocation's own index, as in twice.comp, and
+// element i of it is read from or written to the file at i * array stride.
+// The range runs in chunks of `chunk_invocations` (rounded up to whole
+// workgroups); while one chunk computes, the previous chunk's outputs are
+// written and the next chunk's inputs read on another thread. Memory use is
+// two chunks per streamed buffer whatever the file sizes. Other buffers stay
+// bound as usual. gl_GlobalInvocationID.x counts over the whole range, so
+// it is limited to 2^32 invocations; gl_NumWorkGroups is that of the chunk.
+// Input streams must be readonly in the shader and output streams
+// writeonly, since output chunks are not read in, otherwise
+// GL_INVALID_OPERATION.
+// Blocks until the outputs are written. POSIX only.
+GLboolean DispatchComputeStreaming(const StreamBinding *bindings, GLsizei num_bindings, GLuint64 num_invocations, GLuint64 chunk_invocations);
+
+// Number of worker threads running dispatches.
+GLint GetNumWorkerThreads();
+
+// Number of NUMA nodes workers are spread over. 1 without NUMA.
+GLint GetNumNumaNodes();
+
+// "jit" or "dll", the shader engine this library was built with.
+const char *GetShaderEngineName();
+
+// Records compile and dispatch trace events (one per dispatch, and one per
+// chunk of workgroups run by a worker) until ReleaseSoftGL(), which
+// writes them to `filename` as Chrome trace-event JSON. Setting the
+// SOFTCOMPUTE_TRACE environment variable to a filename does the same from
+// InitSoftGL().
+void EnableTracing(const char *filename);
+
+// Measures the cycles each workgroup of dispatches issued from now on takes,
+// and writes them as `<prefix>-<n>.csv` and a false-color `<prefix>-<n>.png`
+// for the n-th dispatch (see DispatchStats::sequence) from the next
+// glFinish() or ReleaseSoftGL(), so that writing them does not hold up later
+// dispatches. x runs along the image, y and z slices down it. nullptr or "" turns it off.
+// SOFTCOMPUTE_HEATMAP=<prefix> turns it on from InitSoftGL().
+void EnableWorkgroupHeatmap(const char *prefix);
+
+// Counts CPU cycles, instructions, last level cache misses and branch misses
+// of the worker threads for dispatches issued from now on, and reports them
+// in DispatchStats. Uses Linux perf_event_open(), so perf_event_paranoid must
+// allow user space counting. SOFTCOMPUTE_PERF_COUNTERS=1 turns it on from
+// InitSoftGL().
+void EnablePerfCounters(GLboolean enable);
+
+// Time a program took to build, by stage. JIT builds run the C++ through the
+// clang frontend and the LLVM backend; DLL builds run an external compiler,
+// reported as cpp_to_ir_ns, and dlopen() it.
+struct ProgramCompileStats {
+  GLuint64 glsl_to_spirv_ns;  // glslang, in glCompileShader. 0 for SPIR-V
+  GLuint64 spirv_to_cpp_ns;   // SPIRV-Cross
+  GLuint64 cpp_to_ir_ns;
+  GLuint64 codegen_ns;
+  GLuint64 load_ns;           // Finalizing JIT code, dlopen()
+  GLuint64 link_ns;           // All of glLinkProgram
+};
+
+// Stats of the last successful glLinkProgram of `program`, zero before.
+void GetProgramCompileStats(GLuint program, ProgramCompileStats *stats);
+
+// Statistics of a finished dispatch. Dispatches fused in a command list are
+// reported as one entry.
+struct DispatchStats {
+  GLuint64 sequence;        // Order in which dispatches were issued, from 1
+  GLuint64 wall_time_ns;    // From the start of its first workgroup to the end of its last
+  GLuint64 num_workgroups;
+  GLuint64 bytes_bound;     // Sizes of the bound buffer ranges
+  GLuint64 bytes_bound_huge_pages;  // Of bytes_bound, buffers on 2 MB pages
+
+  // Hardware events summed over the worker threads, with EnablePerfCounters().
+  // Bit 0..3 of counter_mask is set when cycles, instructions, last level
+  // cache misses and branch misses respectively could be counted.
+  GLuint64 cycles;
+  GLuint64 instructions;
+  GLuint64 llc_misses;
+  GLuint64 branch_misses;
+  GLuint counter_mask;
+
+  GLuint num_threads;       // Worker threads which ran its workgroups
+  GLuint num_dispatches;    // Number of fused dispatches
+  GLuint pad;
+};
+
+// Moves the statistics of dispatches finished since the last call to
+// `stats`, oldest first, and returns how many were written. Statistics of
+// the last 1024 finished dispatches are kept.
+GLsizei GetDispatchStats(DispatchStats *stats, GLsizei max_count);
+
+// Command list. glUseProgram, glBindBuffer{Base,Range}, glUniform*,
+// glMemoryBarrier and glDispatchCompute issued between BeginCommandList() and
+// EndCommandList() are recorded into the list. State changes take effect
+// immediately, but dispatches are only recorded, with the names of their
+// program and buffers. CallCommandList() looks the names up again, so
+// buffers respecified since recording are used with their current storage.
+// When a program or buffer was deleted, or a program relinked, since
+// recording, CallCommandList() runs nothing and sets GL_INVALID_OPERATION.
+// Replayed dispatches without a barrier or a buffer hazard between them run
+// concurrently.
+//
+// EndCommandList() fuses consecutive 1D dispatches of the same size whose
+// shared buffers are only indexed by gl_GlobalInvocationID.x (e.g. a layer
+// and its activation). Fused dispatches run block by block, each block going
+// through all of them while its data is in cache.
+GLuint CreateCommandList();
+void DeleteCommandList(GLuint list);
+void BeginCommandList(GLuint list);
+void EndCommandList();
+void CallCommandList(GLuint list);
+
 } // softgl
 
 #endif // SOFT_GL_H_
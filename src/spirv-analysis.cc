@@ -0,0 +1,261 @@
+#include "spirv-analysis.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#endif
+
+#include "spirv.hpp"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+namespace softcompute {
+
+namespace {
+
+const size_t kHeaderSize = 5;
+
+struct Instruction {
+  uint32_t opcode;
+  uint32_t num_operands;
+  const uint32_t *operands;
+};
+
+// What an id is known to hold.
+enum ValueKind {
+  kUnknown = 0,
+  kGlobalIdVariable,  // gl_GlobalInvocationID
+  kGlobalIdVector,    // Loaded gl_GlobalInvocationID
+  kGlobalIdXPointer,  // Pointer to gl_GlobalInvocationID.x
+  kGlobalIdX,         // Value of gl_GlobalInvocationID.x
+  kBufferVariable,
+  kLocalVariable,     // Function storage variable
+};
+
+bool IsCopy(uint32_t opcode) {
+  return (opcode == spv::OpCopyObject) || (opcode == spv::OpBitcast) ||
+         (opcode == spv::OpUConvert) || (opcode == spv::OpSConvert);
+}
+
+}  // namespace
+
+bool AnalyzeBufferAccess(const std::vector<uint32_t> &spirv,
+                         const std::vector<uint32_t> &buffer_variables,
+                         BufferAccessInfo *info) {
+  if ((spirv.size() < kHeaderSize) || (spirv[0] != spv::MagicNumber)) {
+    return false;
+  }
+
+  const uint32_t id_bound = spirv[3];
+
+  std::vector<Instruction> instructions;
+  for (size_t pos = kHeaderSize; pos < spirv.size();) {
+    const uint32_t word_count = spirv[pos] >> spv::WordCountShift;
+    if ((word_count == 0) || (pos + word_count > spirv.size())) {
+      return false;
+    }
+
+    Instruction inst;
+    inst.opcode = spirv[pos] & spv::OpCodeMask;
+    inst.num_operands = word_count - 1;
+    inst.operands = &spirv[pos + 1];
+    instructions.push_back(inst);
+
+    pos += word_count;
+  }
+
+  std::vector<uint8_t> kinds(id_bound, kUnknown);
+  std::vector<bool> is_zero(id_bound, false);  // Integer constant 0
+
+  for (size_t i = 0; i < buffer_variables.size(); i++) {
+    if (buffer_variables[i] >= id_bound) return false;
+    kinds[buffer_variables[i]] = kBufferVariable;
+  }
+
+  info->synchronizes = false;
+
+  for (size_t i = 0; i < instructions.size(); i++) {
+    const Instruction &inst = instructions[i];
+    const uint32_t *ops = inst.operands;
+
+    if ((inst.opcode == spv::OpDecorate) && (inst.num_operands >= 3) &&
+        (ops[1] == spv::DecorationBuiltIn) &&
+        (ops[2] == spv::BuiltInGlobalInvocationId) && (ops[0] < id_bound)) {
+      kinds[ops[0]] = kGlobalIdVariable;
+    } else if ((inst.opcode == spv::OpConstant) && (inst.num_operands == 3) &&
+               (ops[1] < id_bound)) {
+      is_zero[ops[1]] = (ops[2] == 0);
+    } else if ((inst.opcode == spv::OpVariable) && (inst.num_operands >= 3) &&
+               (ops[1] < id_bound)) {
+      if (ops[2] == spv::StorageClassWorkgroup) {
+        info->synchronizes = true;
+      } else if (ops[2] == spv::StorageClassFunction) {
+        kinds[ops[1]] = kLocalVariable;
+      }
+    } else if ((inst.opcode == spv::OpControlBarrier) ||
+               (inst.opcode == spv::OpMemoryBarrier)) {
+      info->synchronizes = true;
+    }
+  }
+
+  // Propagate gl_GlobalInvocationID.x through loads, copies and function
+  // variables, e.g. `uint ident = gl_GlobalInvocationID.x;`. A function
+  // variable holds the index if every store to it does. Start with no such
+  // variables and grow both sets until nothing changes.
+  //
+  // Stores are only seen for function variables written directly. Ones whose
+  // pointer is passed to a function (e.g. glslang's temporaries for `inout`
+  // parameters), copied with OpCopyMemory or indexed into may be written
+  // otherwise, so they never hold the index.
+  std::vector<bool> escaped(id_bound, false);
+  for (size_t i = 0; i < instructions.size(); i++) {
+    const Instruction &inst = instructions[i];
+    const uint32_t *ops = inst.operands;
+
+    uint32_t begin = inst.num_operands;
+    uint32_t end = inst.num_operands;
+    if (inst.opcode == spv::OpFunctionCall) {
+      begin = 3;  // (type, result, function, arguments...)
+    } else if ((inst.opcode == spv::OpCopyMemory) ||
+               (inst.opcode == spv::OpCopyMemorySized)) {
+      begin = 0;  // (target, source, ...)
+      end = std::min(inst.num_operands, uint32_t(2));
+    } else if ((inst.opcode == spv::OpAccessChain) ||
+               (inst.opcode == spv::OpInBoundsAccessChain) ||
+               (inst.opcode == spv::OpPtrAccessChain)) {
+      begin = 2;  // (type, result, base, indices...)
+      end = std::min(inst.num_operands, uint32_t(3));
+    }
+
+    for (uint32_t k = begin; k < end; k++) {
+      if ((ops[k] < id_bound) && (kinds[ops[k]] == kLocalVariable)) {
+        escaped[ops[k]] = true;
+      }
+    }
+  }
+
+  std::vector<bool> index_locals(id_bound, false);
+  for (bool changed = true; changed;) {
+    changed = false;
+
+    for (size_t i = 0; i < instructions.size(); i++) {
+      const Instruction &inst = instructions[i];
+      const uint32_t *ops = inst.operands;
+
+      if (inst.num_operands < 3) continue;
+      const uint32_t result = ops[1];
+      const uint32_t source = ops[2];
+      if ((result >= id_bound) || (source >= id_bound)) continue;
+      if (kinds[result] != kUnknown) continue;
+
+      uint8_t kind = kUnknown;
+      if (inst.opcode == spv::OpLoad) {
+        if (kinds[source] == kGlobalIdVariable) {
+          kind = kGlobalIdVector;
+        } else if ((kinds[source] == kGlobalIdXPointer) ||
+                   ((kinds[source] == kLocalVariable) &&
+                    index_locals[source])) {
+          kind = kGlobalIdX;
+        }
+      } else if ((inst.opcode == spv::OpAccessChain) ||
+                 (inst.opcode == spv::OpInBoundsAccessChain)) {
+        if ((kinds[source] == kGlobalIdVariable) && (inst.num_operands == 4) &&
+            (ops[3] < id_bound) && is_zero[ops[3]]) {
+          kind = kGlobalIdXPointer;
+        }
+      } else if (inst.opcode == spv::OpCompositeExtract) {
+        if ((kinds[source] == kGlobalIdVector) && (inst.num_operands == 4) &&
+            (ops[3] == 0)) {
+          kind = kGlobalIdX;
+        }
+      } else if (IsCopy(inst.opcode)) {
+        if (kinds[source] == kGlobalIdX) {
+          kind = kGlobalIdX;
+        }
+      }
+
+      if (kind != kUnknown) {
+        kinds[result] = kind;
+        changed = true;
+      }
+    }
+
+    std::vector<bool> stored(id_bound, false);
+    std::vector<bool> stored_other(id_bound, false);
+    for (size_t i = 0; i < instructions.size(); i++) {
+      const Instruction &inst = instructions[i];
+      if ((inst.opcode != spv::OpStore) || (inst.num_operands < 2)) continue;
+
+      const uint32_t pointer = inst.operands[0];
+      const uint32_t value = inst.operands[1];
+      if ((pointer >= id_bound) || (kinds[pointer] != kLocalVariable)) continue;
+
+      stored[pointer] = true;
+      if ((value >= id_bound) || (kinds[value] != kGlobalIdX)) {
+        stored_other[pointer] = true;
+      }
+    }
+
+    for (uint32_t id = 0; id < id_bound; id++) {
+      if (stored[id] && !stored_other[id] && !escaped[id] &&
+          !index_locals[id]) {
+        index_locals[id] = true;
+        changed = true;
+      }
+    }
+  }
+
+  // Check every use of the buffer variables in function bodies. Declarations
+  // before the first function only name or decorate them.
+  std::vector<bool> elementwise(id_bound, true);
+  bool in_function = false;
+  for (size_t i = 0; i < instructions.size(); i++) {
+    const Instruction &inst = instructions[i];
+    const uint32_t *ops = inst.operands;
+
+    if (inst.opcode == spv::OpFunction) {
+      in_function = true;
+    }
+    if (!in_function) continue;
+
+    if (((inst.opcode == spv::OpAccessChain) ||
+         (inst.opcode == spv::OpInBoundsAccessChain)) &&
+        (inst.num_operands >= 3) && (ops[2] < id_bound) &&
+        (kinds[ops[2]] == kBufferVariable)) {
+      // (type, result, base, member, index, [indices into the element...])
+      // Further indices stay inside the element.
+      const bool ok = (inst.num_operands >= 5) && (ops[4] < id_bound) &&
+                      (kinds[ops[4]] == kGlobalIdX);
+      if (!ok) {
+        elementwise[ops[2]] = false;
+      }
+      continue;
+    }
+
+    if (inst.opcode == spv::OpArrayLength) {
+      continue;
+    }
+
+    for (uint32_t k = 0; k < inst.num_operands; k++) {
+      if ((ops[k] < id_bound) && (kinds[ops[k]] == kBufferVariable)) {
+        elementwise[ops[k]] = false;
+      }
+    }
+  }
+
+  info->elementwise_variables.clear();
+  for (size_t i = 0; i < buffer_variables.size(); i++) {
+    if (elementwise[buffer_variables[i]]) {
+      info->elementwise_variables.push_back(buffer_variables[i]);
+    }
+  }
+
+  return true;
+}
+
+}  // namespace softcompute
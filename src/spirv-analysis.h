@@ -0,0 +1,32 @@
+#ifndef SOFTCOMPUTE_SPIRV_ANALYSIS_H_
+#define SOFTCOMPUTE_SPIRV_ANALYSIS_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace softcompute {
+
+// How a compute shader accesses its storage buffers.
+struct BufferAccessInfo {
+  // Subset of the analyzed buffer variables (SPIR-V ids) which are only
+  // accessed as `buf.member[gl_GlobalInvocationID.x]`, i.e. each invocation
+  // touches only its own element.
+  std::vector<uint32_t> elementwise_variables;
+
+  // true when invocations may communicate through barriers or shared memory.
+  bool synchronizes;
+  char pad[7];
+
+  BufferAccessInfo() : synchronizes(false) {}
+};
+
+// Scans the SPIR-V module for accesses to `buffer_variables`. The analysis is
+// conservative: an access it does not understand makes the variable
+// non-elementwise. Returns false for a malformed module.
+bool AnalyzeBufferAccess(const std::vector<uint32_t> &spirv,
+                         const std::vector<uint32_t> &buffer_variables,
+                         BufferAccessInfo *info);
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_SPIRV_ANALYSIS_H_
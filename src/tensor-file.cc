@@ -0,0 +1,301 @@
+#include "tensor-file.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#endif
+
+#include "nlohmann/json.hpp"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+namespace softcompute {
+
+namespace {
+
+const char kNpyMagic[] = "\x93NUMPY";
+const size_t kNpyMagicSize = 6;
+
+bool EndsWith(const std::string &s, const std::string &suffix) {
+  return (s.size() >= suffix.size()) &&
+         (s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+uint64_t GetFileSize(std::ifstream &ifs) {
+  ifs.seekg(0, ifs.end);
+  const std::streamoff size = ifs.tellg();
+  ifs.seekg(0, ifs.beg);
+  return (size > 0) ? uint64_t(size) : 0;
+}
+
+// Value of `key` in a Python dict literal as written by NumPy, e.g.
+// "{'descr': '<f4', 'fortran_order': False, 'shape': (3, 4), }". Quoted
+// strings are returned without quotes.
+std::string GetDictValue(const std::string &dict, const std::string &key) {
+  size_t pos = dict.find("'" + key + "'");
+  if (pos == std::string::npos) return std::string();
+  pos = dict.find(':', pos);
+  if (pos == std::string::npos) return std::string();
+  pos = dict.find_first_not_of(' ', pos + 1);
+  if (pos == std::string::npos) return std::string();
+
+  if ((dict[pos] == '\'') || (dict[pos] == '"')) {
+    const size_t end = dict.find(dict[pos], pos + 1);
+    return (end == std::string::npos) ? std::string()
+                                      : dict.substr(pos + 1, end - pos - 1);
+  }
+  if (dict[pos] == '(') {
+    const size_t end = dict.find(')', pos);
+    return (end == std::string::npos) ? std::string()
+                                      : dict.substr(pos, end - pos + 1);
+  }
+
+  const size_t end = dict.find_first_of(",}", pos);
+  return dict.substr(pos, end - pos);
+}
+
+bool ReadNpyHeader(std::ifstream &ifs, uint64_t file_size,
+                   TensorHeader *header) {
+  uint8_t prefix[12];
+  if (!ifs.read(reinterpret_cast<char *>(prefix), 10) ||
+      (memcmp(prefix, kNpyMagic, kNpyMagicSize) != 0)) {
+    return false;
+  }
+
+  // Version 1 has a 16-bit header length, versions 2 and 3 a 32-bit one.
+  const uint8_t major = prefix[6];
+  size_t header_len = size_t(prefix[8]) | (size_t(prefix[9]) << 8);
+  size_t prefix_len = 10;
+  if (major >= 2) {
+    if (!ifs.read(reinterpret_cast<char *>(prefix + 10), 2)) return false;
+    header_len |= (size_t(prefix[10]) << 16) | (size_t(prefix[11]) << 24);
+    prefix_len = 12;
+  }
+
+  std::string dict(header_len, '\0');
+  if (!ifs.read(&dict[0], std::streamsize(header_len))) return false;
+
+  if (GetDictValue(dict, "fortran_order").find("True") != std::string::npos) {
+    std::cerr << "[SoftGL] Fortran order .npy is not supported." << std::endl;
+    return false;
+  }
+
+  header->dtype = GetDictValue(dict, "descr");
+
+  // "(3, 4)", "(3,)" or "()"
+  header->shape.clear();
+  std::stringstream ss(GetDictValue(dict, "shape"));
+  char c;
+  ss >> c;
+  uint64_t dim;
+  while (ss >> dim) {
+    header->shape.push_back(dim);
+    ss >> c;
+  }
+
+  header->data_offset = prefix_len + header_len;
+  header->data_size = (file_size > header->data_offset)
+                          ? file_size - header->data_offset
+                          : 0;
+
+  return true;
+}
+
+bool WriteNpy(const std::string &filename, const std::string &dtype,
+              const std::vector<uint64_t> &shape, const void *data,
+              size_t size) {
+  std::stringstream dict;
+  dict << "{'descr': '" << dtype << "', 'fortran_order': False, 'shape': (";
+  for (size_t i = 0; i < shape.size(); i++) {
+    dict << shape[i];
+    // One-element tuples need a trailing comma.
+    if ((shape.size() == 1) || (i + 1 < shape.size())) dict << ",";
+    if (i + 1 < shape.size()) dict << " ";
+  }
+  dict << "), }";
+
+  // Version 1.0. Data starts at a multiple of 64 bytes, the header ends with
+  // '\n'.
+  const std::string dict_str = dict.str();
+  const size_t prefix_len = 10;
+  const size_t total = (prefix_len + dict_str.size() + 1 + 63) / 64 * 64;
+  const size_t header_len = total - prefix_len;
+  if (header_len > 0xFFFF) {
+    return false;
+  }
+
+  // Magic, version, header length and the padded dict, written at once.
+  std::string header(kNpyMagic, kNpyMagicSize);
+  header.push_back(1);
+  header.push_back(0);
+  header.push_back(char(header_len & 0xFF));
+  header.push_back(char(header_len >> 8));
+  header.append(dict_str);
+  header.append(total - header.size() - 1, ' ');
+  header.push_back('\n');
+
+  std::ofstream ofs(filename, std::ios::binary);
+  if (!ofs) {
+    std::cerr << "[SoftGL] Failed to create " << filename << std::endl;
+    return false;
+  }
+
+  // The data is written from the buffer as it is, without a copy.
+  ofs.write(header.data(), std::streamsize(header.size()));
+  ofs.write(static_cast<const char *>(data), std::streamsize(size));
+
+  return bool(ofs);
+}
+
+}  // namespace
+
+size_t GetDTypeSize(const std::string &dtype) {
+  // "=" is native order, little-endian on supported hosts.
+  if ((dtype.size() < 3) ||
+      ((dtype[0] != '<') && (dtype[0] != '|') && (dtype[0] != '='))) {
+    return 0;
+  }
+  if (std::string("fiub").find(dtype[1]) == std::string::npos) {
+    return 0;
+  }
+
+  const int size = atoi(dtype.c_str() + 2);
+  if ((size != 1) && (size != 2) && (size != 4) && (size != 8)) {
+    return 0;
+  }
+  if ((size > 1) && (dtype[0] == '|')) {
+    return 0;
+  }
+
+  return size_t(size);
+}
+
+bool ReadTensorHeader(const std::string &filename, TensorHeader *header) {
+  std::ifstream ifs(filename, std::ios::binary);
+  if (!ifs) {
+    std::cerr << "[SoftGL] Failed to open " << filename << std::endl;
+    return false;
+  }
+  const uint64_t file_size = GetFileSize(ifs);
+
+  if (EndsWith(filename, ".npy")) {
+    if (!ReadNpyHeader(ifs, file_size, header)) {
+      std::cerr << "[SoftGL] Invalid .npy file: " << filename << std::endl;
+      return false;
+    }
+  } else {
+    header->dtype = "|u1";
+    header->shape.assign(1, file_size);
+    header->data_offset = 0;
+    header->data_size = file_size;
+
+    std::ifstream sidecar(filename + ".json");
+    if (sidecar) {
+      nlohmann::json j =
+          nlohmann::json::parse(sidecar, nullptr, /* allow_exceptions */ false);
+      if (j.is_discarded() || !j.contains("dtype") || !j["dtype"].is_string() ||
+          !j.contains("shape") || !j["shape"].is_array()) {
+        std::cerr << "[SoftGL] Invalid sidecar: " << filename << ".json"
+                  << std::endl;
+        return false;
+      }
+
+      header->dtype = j["dtype"].get<std::string>();
+      header->shape.clear();
+      try {
+        for (size_t i = 0; i < j["shape"].size(); i++) {
+          header->shape.push_back(j["shape"][i].get<uint64_t>());
+        }
+      } catch (const nlohmann::json::exception &e) {
+        std::cerr << "[SoftGL] Invalid shape in " << filename
+                  << ".json: " << e.what() << std::endl;
+        return false;
+      }
+    }
+  }
+
+  const size_t element_size = GetDTypeSize(header->dtype);
+  if (element_size == 0) {
+    std::cerr << "[SoftGL] Unsupported dtype " << header->dtype << " in "
+              << filename << std::endl;
+    return false;
+  }
+
+  uint64_t num_elements = 1;
+  for (size_t i = 0; i < header->shape.size(); i++) {
+    if ((header->shape[i] != 0) &&
+        (num_elements > header->data_size / header->shape[i])) {
+      // Also keeps the product from overflowing.
+      num_elements = header->data_size + 1;
+      break;
+    }
+    num_elements *= header->shape[i];
+  }
+  if (num_elements * element_size > header->data_size) {
+    std::cerr << "[SoftGL] " << filename << " is shorter than its shape."
+              << std::endl;
+    return false;
+  }
+  header->data_size = num_elements * element_size;
+
+  return true;
+}
+
+bool WriteTensorFile(const std::string &filename, const std::string &dtype,
+                     const std::vector<uint64_t> &shape, const void *data,
+                     size_t size) {
+  const size_t element_size = GetDTypeSize(dtype);
+  if (element_size == 0) {
+    std::cerr << "[SoftGL] Unsupported dtype " << dtype << std::endl;
+    return false;
+  }
+
+  std::vector<uint64_t> dims = shape;
+  if (dims.empty()) {
+    dims.push_back(size / element_size);
+  }
+
+  uint64_t num_elements = 1;
+  for (size_t i = 0; i < dims.size(); i++) {
+    num_elements *= dims[i];
+  }
+  if (num_elements * element_size > size) {
+    std::cerr << "[SoftGL] Shape is larger than the data for " << filename
+              << std::endl;
+    return false;
+  }
+  size = size_t(num_elements * element_size);
+
+  if (EndsWith(filename, ".npy")) {
+    return WriteNpy(filename, dtype, dims, data, size);
+  }
+
+  {
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) {
+      std::cerr << "[SoftGL] Failed to create " << filename << std::endl;
+      return false;
+    }
+    ofs.write(static_cast<const char *>(data), std::streamsize(size));
+    if (!ofs) return false;
+  }
+
+  nlohmann::json sidecar;
+  sidecar["dtype"] = dtype;
+  sidecar["shape"] = dims;
+
+  std::ofstream ofs(filename + ".json");
+  ofs << sidecar.dump() << std::endl;
+
+  return bool(ofs);
+}
+
+}  // namespace softcompute
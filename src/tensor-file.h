@@ -0,0 +1,41 @@
+#ifndef SOFTCOMPUTE_TENSOR_FILE_H_
+#define SOFTCOMPUTE_TENSOR_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace softcompute {
+
+// Layout of an array stored as NumPy .npy, or as raw little-endian data
+// described by a JSON sidecar `<filename>.json`:
+//
+//   {"dtype": "<f4", "shape": [1024, 3]}
+struct TensorHeader {
+  std::string dtype;  // NumPy type string, e.g. "<f4", "<i4", "|u1"
+  std::vector<uint64_t> shape;
+  size_t data_offset;  // Start of the data in the file
+  uint64_t data_size;  // Bytes of data
+
+  TensorHeader() : data_offset(0), data_size(0) {}
+};
+
+// Bytes per element of a NumPy type string, or 0 when unsupported. Only
+// little-endian and byte-sized types are supported.
+size_t GetDTypeSize(const std::string &dtype);
+
+// Reads the header of a .npy file, or for other extensions the JSON sidecar
+// of a raw file. A raw file without sidecar is read as bytes ("|u1").
+// Returns false for unsupported files, e.g. Fortran order or big-endian.
+bool ReadTensorHeader(const std::string &filename, TensorHeader *header);
+
+// Writes `data` as .npy, or for other extensions as a raw file and JSON
+// sidecar. An empty `shape` means one dimension covering `size` bytes.
+bool WriteTensorFile(const std::string &filename, const std::string &dtype,
+                     const std::vector<uint64_t> &shape, const void *data,
+                     size_t size);
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_TENSOR_FILE_H_
@@ -0,0 +1,187 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#endif
+
+#include "nlohmann/json.hpp"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+namespace softcompute {
+
+std::atomic<bool> g_tracing(false);
+
+namespace {
+
+thread_local uint64_t g_compile_stage_ns[kNumCompileStages];
+
+struct TraceEvent {
+  const char *category;
+  const char *name;
+  const char *arg_name;
+  uint64_t arg;
+  uint64_t start_ns;
+  uint64_t end_ns;
+};
+
+// Events of one thread. Only contended while StopTracing() collects them.
+struct ThreadBuffer {
+  std::mutex mutex;
+  std::vector<TraceEvent> events;
+  uint32_t tid;
+};
+
+struct TraceState {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;  // Never shrinks
+  std::string filename;
+  uint64_t start_ns;
+
+  TraceState() : start_ns(0) {}
+};
+
+// Leaked so that threads exiting after main() can still find it.
+TraceState &GetState() {
+  static TraceState *state = new TraceState();
+  return *state;
+}
+
+ThreadBuffer *GetThreadBuffer() {
+  static thread_local ThreadBuffer *buffer = nullptr;
+  if (!buffer) {
+    TraceState &state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+    buffer = state.buffers.back().get();
+    buffer->tid = static_cast<uint32_t>(state.buffers.size());
+  }
+  return buffer;
+}
+
+}  // namespace
+
+bool StartTracing(const std::string &filename) {
+  TraceState &state = GetState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+
+  if (IsTracing()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < state.buffers.size(); i++) {
+    std::lock_guard<std::mutex> buffer_lock(state.buffers[i]->mutex);
+    state.buffers[i]->events.clear();
+  }
+
+  state.filename = filename;
+  state.start_ns = TraceNow();
+  g_tracing.store(true);
+
+  return true;
+}
+
+void StartTracingFromEnvironment() {
+  const char *filename = getenv("SOFTCOMPUTE_TRACE");
+  if (filename && filename[0]) {
+    StartTracing(filename);
+  }
+}
+
+void AddTraceEvent(const char *category, const char *name, uint64_t start_ns,
+                   uint64_t end_ns, const char *arg_name, uint64_t arg) {
+  ThreadBuffer *buffer = GetThreadBuffer();
+
+  TraceEvent event;
+  event.category = category;
+  event.name = name;
+  event.arg_name = arg_name;
+  event.arg = arg;
+  event.start_ns = start_ns;
+  event.end_ns = end_ns;
+
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  buffer->events.push_back(event);
+}
+
+void ResetCompileStageTimes() {
+  for (int i = 0; i < kNumCompileStages; i++) {
+    g_compile_stage_ns[i] = 0;
+  }
+}
+
+void AddCompileStageTime(CompileStage stage, uint64_t ns) {
+  g_compile_stage_ns[stage] += ns;
+}
+
+void GetCompileStageTimes(uint64_t ns[kNumCompileStages]) {
+  for (int i = 0; i < kNumCompileStages; i++) {
+    ns[i] = g_compile_stage_ns[i];
+  }
+}
+
+bool StopTracing() {
+  TraceState &state = GetState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+
+  if (!IsTracing()) {
+    return false;
+  }
+  g_tracing.store(false);
+
+  nlohmann::json events = nlohmann::json::array();
+  for (size_t i = 0; i < state.buffers.size(); i++) {
+    ThreadBuffer &buffer = *state.buffers[i];
+    std::lock_guard<std::mutex> buffer_lock(buffer.mutex);
+
+    for (size_t e = 0; e < buffer.events.size(); e++) {
+      const TraceEvent &event = buffer.events[e];
+
+      // Events started before StartTracing() are clipped.
+      const uint64_t start = std::max(event.start_ns, state.start_ns);
+      const uint64_t end = std::max(event.end_ns, start);
+
+      nlohmann::json json;
+      json["name"] = event.name;
+      json["cat"] = event.category;
+      json["ph"] = "X";
+      json["pid"] = 1;
+      json["tid"] = buffer.tid;
+      json["ts"] = static_cast<double>(start - state.start_ns) / 1000.0;
+      json["dur"] = static_cast<double>(end - start) / 1000.0;
+      if (event.arg_name) {
+        json["args"][event.arg_name] = event.arg;
+      }
+      events.push_back(json);
+    }
+    buffer.events.clear();
+  }
+
+  nlohmann::json trace;
+  trace["traceEvents"] = events;
+  trace["displayTimeUnit"] = "ms";
+
+  std::ofstream ofs(state.filename);
+  if (!ofs) {
+    std::cerr << "[SoftGL] Failed to open trace file: " << state.filename
+              << std::endl;
+    return false;
+  }
+
+  ofs << trace.dump();
+
+  return true;
+}
+
+}  // namespace softcompute
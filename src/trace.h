@@ -0,0 +1,120 @@
+#ifndef SOFTCOMPUTE_TRACE_H_
+#define SOFTCOMPUTE_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace softcompute {
+
+// Scoped trace events of the compile and dispatch pipeline, written as
+// Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+//
+// Tracing is off unless started with StartTracing() or by setting the
+// SOFTCOMPUTE_TRACE environment variable to the output filename. Events are
+// appended to per-thread buffers without locking other threads, so a
+// disabled TraceScope costs one relaxed load.
+
+// Starts recording events. They are written to `filename` by StopTracing().
+// Returns false when already tracing.
+bool StartTracing(const std::string &filename);
+
+// Starts tracing to $SOFTCOMPUTE_TRACE if set.
+void StartTracingFromEnvironment();
+
+// Stops recording and writes the recorded events. Returns false when not
+// tracing or the file cannot be written.
+bool StopTracing();
+
+extern std::atomic<bool> g_tracing;
+
+inline bool IsTracing() { return g_tracing.load(std::memory_order_relaxed); }
+
+inline uint64_t TraceNow() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// Adds a complete event to the calling thread's buffer. `category`, `name`
+// and `arg_name` must outlive tracing, e.g. string literals. `arg_name` may
+// be nullptr.
+void AddTraceEvent(const char *category, const char *name, uint64_t start_ns,
+                   uint64_t end_ns, const char *arg_name, uint64_t arg);
+
+// Records the time from construction to destruction as one event.
+class TraceScope {
+ public:
+  TraceScope(const char *category, const char *name,
+             const char *arg_name = nullptr, uint64_t arg = 0)
+      : category_(category),
+        name_(name),
+        arg_name_(arg_name),
+        arg_(arg),
+        start_ns_(0),
+        enabled_(IsTracing()) {
+    if (enabled_) {
+      start_ns_ = TraceNow();
+    }
+  }
+
+  ~TraceScope() {
+    if (enabled_) {
+      AddTraceEvent(category_, name_, start_ns_, TraceNow(), arg_name_, arg_);
+    }
+  }
+
+ private:
+  TraceScope(const TraceScope &);
+  TraceScope &operator=(const TraceScope &);
+
+  const char *category_;
+  const char *name_;
+  const char *arg_name_;
+  uint64_t arg_;
+  uint64_t start_ns_;
+  bool enabled_;
+};
+
+// Stages of turning a shader into native code. Time spent in each is summed
+// per thread so that glCompileShader/glLinkProgram can report a breakdown
+// whether or not tracing is on.
+enum CompileStage {
+  kCompileGlslToSpirv = 0,  // glslang
+  kCompileSpirvToCpp,       // SPIRV-Cross
+  kCompileCppToIR,          // clang frontend. The whole C++ compiler for DLLs
+  kCompileCodegen,          // LLVM backend
+  kCompileLoad,             // Finalizing JIT code, dlopen()
+  kNumCompileStages
+};
+
+void ResetCompileStageTimes();
+void AddCompileStageTime(CompileStage stage, uint64_t ns);
+
+// Nanoseconds spent in each stage on the calling thread since
+// ResetCompileStageTimes().
+void GetCompileStageTimes(uint64_t ns[kNumCompileStages]);
+
+// TraceScope in the "compile" category which also adds its duration to
+// `stage`.
+class CompileStageScope {
+ public:
+  CompileStageScope(CompileStage stage, const char *name)
+      : trace_("compile", name), start_ns_(TraceNow()), stage_(stage) {}
+
+  ~CompileStageScope() { AddCompileStageTime(stage_, TraceNow() - start_ns_); }
+
+ private:
+  CompileStageScope(const CompileStageScope &);
+  CompileStageScope &operator=(const CompileStageScope &);
+
+  TraceScope trace_;
+  uint64_t start_ns_;
+  CompileStage stage_;
+};
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_TRACE_H_
@@ -0,0 +1,215 @@
+#include "worker-pool.h"
+
+#include <atomic>
+#include <memory>
+
+namespace softcompute {
+
+WorkerPool::WorkerPool(int num_threads)
+    : queues_(2), num_tasks_(0), stop_(false) {
+  Start(num_threads, kAffinityNone);
+}
+
+WorkerPool::WorkerPool(int num_threads, const NumaTopology &topology,
+                       ThreadAffinity affinity)
+    : topology_(topology),
+      queues_(size_t(topology.GetNumNodes()) + 1),
+      num_tasks_(0),
+      stop_(false) {
+  Start(num_threads, affinity);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+
+  for (size_t i = 0; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+}
+
+void WorkerPool::Start(int num_threads, ThreadAffinity affinity) {
+  const int num_nodes = GetNumNodes();
+  const int num_cpus = static_cast<int>(topology_.GetNumCpus());
+
+  if (num_threads <= 0) {
+    num_threads = (num_cpus > 0)
+                      ? num_cpus
+                      : static_cast<int>(std::thread::hardware_concurrency());
+  }
+
+  if (num_threads <= 0) {
+    num_threads = 1;
+  }
+
+  // Contiguous groups of workers per node, in proportion to their CPUs.
+  int cpus_before = 0;
+  for (int n = 0; n < num_nodes; n++) {
+    first_workers_.push_back(
+        (num_cpus > 0) ? (num_threads * cpus_before / num_cpus)
+                       : (num_threads * n / num_nodes));
+    cpus_before += static_cast<int>(topology_.GetNode(n).cpus.size());
+  }
+  first_workers_.push_back(num_threads);
+
+  for (int n = 0; n < num_nodes; n++) {
+    const std::vector<int> &cpus = topology_.GetNode(n).cpus;
+    for (int i = first_workers_[size_t(n)]; i < first_workers_[size_t(n + 1)];
+         i++) {
+      worker_nodes_.push_back(n);
+
+      if (cpus.empty() || (affinity == kAffinityNone)) {
+        worker_cpus_.push_back(std::vector<int>());
+      } else if (affinity == kAffinityCore) {
+        const size_t index = size_t(i - first_workers_[size_t(n)]);
+        worker_cpus_.push_back(std::vector<int>(1, cpus[index % cpus.size()]));
+      } else {
+        worker_cpus_.push_back(cpus);
+      }
+    }
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    threads_.push_back(std::thread(&WorkerPool::WorkerMain, this, i));
+  }
+}
+
+void WorkerPool::Submit(const Task &task) { Submit(task, GetNumNodes()); }
+
+void WorkerPool::Submit(const Task &task, int node) {
+  if ((node < 0) || (node > GetNumNodes())) {
+    node = GetNumNodes();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queues_[size_t(node)].push_back(task);
+    num_tasks_++;
+  }
+
+  // Wakes all workers for node tasks, since the one woken might be of
+  // another node and only steal it.
+  if (node == GetNumNodes()) {
+    cv_.notify_one();
+  } else {
+    cv_.notify_all();
+  }
+}
+
+bool WorkerPool::PopTask(int node, Task *task) {
+  if (num_tasks_ == 0) {
+    return false;
+  }
+
+  // Own node, any node, then the other nodes in turn.
+  const size_t num_nodes = queues_.size() - 1;
+  for (size_t i = 0; i <= num_nodes; i++) {
+    size_t q = num_nodes;
+    if (i == 0) {
+      q = size_t(node);
+    } else if (i > 1) {
+      q = (size_t(node) + i - 1) % num_nodes;
+    }
+
+    if (!queues_[q].empty()) {
+      *task = queues_[q].front();
+      queues_[q].pop_front();
+      num_tasks_--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void WorkerPool::WorkerMain(int worker_id) {
+  const int node = worker_nodes_[size_t(worker_id)];
+  if (!worker_cpus_[size_t(worker_id)].empty()) {
+    BindThreadToCpus(worker_cpus_[size_t(worker_id)]);
+  }
+
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || (num_tasks_ > 0); });
+
+      // Drain remaining tasks before exiting.
+      if (!PopTask(node, &task)) {
+        return;
+      }
+    }
+
+    task(worker_id);
+  }
+}
+
+namespace {
+
+// Progress of a ParallelFor(), shared with its tasks, which may run after it
+// returned.
+struct ParallelForState {
+  std::unique_ptr<std::atomic<bool>[]> started;
+  std::atomic<size_t> remaining;
+  const std::function<void(size_t)> *fn;  // Valid while calls remain
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  explicit ParallelForState(size_t count)
+      : started(new std::atomic<bool>[count]), remaining(count), fn(nullptr) {
+    for (size_t i = 0; i < count; i++) {
+      started[i] = false;
+    }
+  }
+
+  // Makes call `i` unless it was already started.
+  void Run(size_t i) {
+    if (started[i].exchange(true)) {
+      return;
+    }
+
+    (*fn)(i);
+
+    if (--remaining == 0) {
+      // Under the lock, so the waiter cannot miss it between its check and
+      // its wait.
+      std::lock_guard<std::mutex> lock(mutex);
+      cv.notify_all();
+    }
+  }
+};
+
+}  // namespace
+
+void ParallelFor(WorkerPool *pool, size_t count,
+                 const std::function<void(size_t)> &fn,
+                 const std::function<int(size_t)> &get_node) {
+  if (!pool || (count <= 1)) {
+    for (size_t i = 0; i < count; i++) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::shared_ptr<ParallelForState> state =
+      std::make_shared<ParallelForState>(count);
+  state->fn = &fn;
+
+  for (size_t i = 0; i < count; i++) {
+    pool->Submit([state, i](int) { state->Run(i); },
+                 get_node ? get_node(i) : -1);
+  }
+
+  // Last first, as workers take them in order.
+  for (size_t i = count; i > 0; i--) {
+    state->Run(i - 1);
+  }
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&state] { return state->remaining == 0; });
+}
+
+}  // namespace softcompute
@@ -0,0 +1,96 @@
+#ifndef SOFTCOMPUTE_WORKER_POOL_H_
+#define SOFTCOMPUTE_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpu-affinity.h"
+#include "numa-topology.h"
+
+namespace softcompute {
+
+// Fixed number of threads consuming FIFO task queues.
+//
+// Workers are split into contiguous groups, one per NUMA node, in
+// proportion to the CPUs of the nodes, and bound to CPUs of their node as
+// asked by ThreadAffinity. Each node has its own queue:
+// workers run tasks of their node first, then tasks for any node, and take
+// tasks of other nodes only when they would idle otherwise.
+class WorkerPool {
+ public:
+  // `worker_id` is in [0, GetNumThreads()) and identifies the thread running
+  // the task, e.g. to index per-thread storage.
+  typedef std::function<void(int worker_id)> Task;
+
+  // num_threads <= 0 uses one thread per CPU of `topology`, or
+  // std::thread::hardware_concurrency() when its CPUs are not known. With
+  // kAffinityCore, workers of a node take its CPUs in turn.
+  explicit WorkerPool(int num_threads);
+  WorkerPool(int num_threads, const NumaTopology &topology,
+             ThreadAffinity affinity);
+  ~WorkerPool();
+
+  int GetNumThreads() const { return static_cast<int>(threads_.size()); }
+
+  // Nodes workers are split over, in node index order.
+  const NumaTopology &GetTopology() const { return topology_; }
+
+  // Number of nodes workers are split over. 1 without NUMA.
+  int GetNumNodes() const { return static_cast<int>(queues_.size()) - 1; }
+
+  // Node index (see NumaTopology::GetNode()) of worker `worker_id`.
+  int GetWorkerNode(int worker_id) const {
+    return worker_nodes_[size_t(worker_id)];
+  }
+
+  // Workers of node `node` are [GetFirstWorker(node),
+  // GetFirstWorker(node + 1)). GetFirstWorker(GetNumNodes()) is
+  // GetNumThreads().
+  int GetFirstWorker(int node) const { return first_workers_[size_t(node)]; }
+
+  // Runs `task` on any worker.
+  void Submit(const Task &task);
+
+  // Runs `task` preferably on a worker of node `node`.
+  void Submit(const Task &task, int node);
+
+ private:
+  WorkerPool(const WorkerPool &);
+  WorkerPool &operator=(const WorkerPool &);
+
+  void Start(int num_threads, ThreadAffinity affinity);
+  void WorkerMain(int worker_id);
+
+  // Needs mutex_ held. Returns false when all queues are empty.
+  bool PopTask(int node, Task *task);
+
+  NumaTopology topology_;
+  std::vector<int> first_workers_;  // Per node, then GetNumThreads()
+  std::vector<int> worker_nodes_;
+  std::vector<std::vector<int>> worker_cpus_;  // Empty: not bound
+  std::vector<std::thread> threads_;
+  std::vector<std::deque<Task>> queues_;  // Per node, then for any node
+  size_t num_tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+};
+
+// Calls `fn(i)` for each i in [0, count) and returns once all calls have
+// returned. Calls run on workers of `pool`, call i preferably on node
+// `get_node(i)` when given (< 0: any node), and on the calling thread, which
+// takes the calls no worker has started yet. So this also finishes when
+// called from a worker, or when the workers are busy. Without `pool`, calls
+// run on the calling thread.
+void ParallelFor(WorkerPool *pool, size_t count,
+                 const std::function<void(size_t)> &fn,
+                 const std::function<int(size_t)> &get_node = nullptr);
+
+}  // namespace softcompute
+
+#endif  // SOFTCOMPUTE_WORKER_POOL_H_
@@ -7,7 +7,7 @@ project "Test_SoftCompute"
    end
    
    
-   includedirs { "../src", "../third_party/Catch/include"}
+   includedirs { "../src", "../third_party/Catch/include", "../third_party/json/include", "../third_party/filesystem/include" }
    
    language "C++"
    
@@ -16,6 +16,8 @@ project "Test_SoftCompute"
    files {
    	"test-*.cc",
    	"test-*.h",
+   	"../src/bench-stats.cc",
+   	"../src/job-file.cc",
    }
 
    if _OPTIONS['asan'] then
@@ -1,6 +1,21 @@
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
 
+#include "nlohmann/json.hpp"
+
+#include "bench-stats.h"
+#include "cpu-affinity.h"
+#include "heatmap.h"
+#include "image-file.h"
+#include "job-file.h"
+#include "slot-map.h"
 #include "softgl.h"
 
 #define CATCH_CONFIG_MAIN
@@ -8,6 +23,43 @@
 
 using namespace softgl;
 
+// Contents of a file, removing it. Empty when it cannot be read.
+static std::vector<uint8_t> TakeFile(const char *filename) {
+  std::ifstream ifs(filename, std::ios::binary);
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)),
+                            std::istreambuf_iterator<char>());
+  ifs.close();
+  std::remove(filename);
+  return data;
+}
+
+// Compiles and links a compute shader. 0 on failure.
+static GLuint CreateComputeProgram(const char *source) {
+  GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+
+  GLint status = 0;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (!status) {
+    glDeleteShader(shader);
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, shader);
+  glLinkProgram(program);
+  glDeleteShader(shader);
+
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (!status) {
+    glDeleteProgram(program);
+    return 0;
+  }
+
+  return program;
+}
+
 TEST_CASE("create_program", "[program]") {
   softgl::InitSoftGL(); 
 
@@ -25,3 +77,1270 @@ TEST_CASE("ininitialize", "[init]") {
   softgl::ReleaseSoftGL(); 
 }
 
+TEST_CASE("thread_config", "[init]") {
+  softgl::SoftGLConfig config;
+  config.num_threads = 3;
+  config.cpu_list = "0";
+  config.thread_affinity = softgl::SoftGLConfig::kAffinityCore;
+  softgl::InitSoftGL(config);
+
+  REQUIRE(softgl::GetNumWorkerThreads() == 3);
+  REQUIRE(softgl::GetNumNumaNodes() == 1);
+
+  softgl::ReleaseSoftGL();
+}
+
+
+TEST_CASE("cpu_list", "[init]") {
+  struct {
+    const char *list;
+    bool ok;
+    std::vector<int> cpus;
+  } cases[] = {
+      {"", true, {}},
+      {"3\n", true, {3}},
+      {"0-3,8-9", true, {0, 1, 2, 3, 8, 9}},
+      {"8-9,2,0-1,1", true, {0, 1, 2, 8, 9}},
+      {"007", true, {7}},
+      {"8191", true, {8191}},
+      {"8-2", false, {}},
+      {"8192", false, {}},
+      {"0-4294967297", false, {}},
+      {"99999999999999999999", false, {}},
+      {"1-", false, {}},
+      {"-1", false, {}},
+      {"a", false, {}},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    std::vector<int> cpus;
+    REQUIRE(softcompute::ParseCpuList(cases[i].list, &cpus) == cases[i].ok);
+    if (cases[i].ok) {
+      REQUIRE(cpus == cases[i].cpus);
+    }
+  }
+}
+
+TEST_CASE("smt_siblings", "[init]") {
+  // Cores of 2 threads numbered {0, 4}, {1, 5}, ..., and a core of 1 at 8.
+  const auto get_siblings = [](int cpu) {
+    return (cpu >= 8) ? std::vector<int>{cpu}
+                      : std::vector<int>{cpu % 4, cpu % 4 + 4};
+  };
+
+  struct {
+    std::vector<int> cpus;
+    std::vector<int> first_threads;
+  } cases[] = {
+      {{}, {}},
+      {{0, 1, 2, 3, 4, 5, 6, 7, 8}, {0, 1, 2, 3, 8}},
+      {{4, 5, 6, 7}, {4, 5, 6, 7}},
+      {{1, 3, 5, 7}, {1, 3}},
+      {{2, 5, 6, 8}, {2, 5, 8}},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    REQUIRE(softcompute::RemoveSmtSiblings(cases[i].cpus, get_siblings) ==
+            cases[i].first_threads);
+  }
+
+  // Unknown siblings keep every CPU.
+  const std::vector<int> cpus = {0, 1, 2};
+  REQUIRE(softcompute::RemoveSmtSiblings(
+              cpus, [](int) { return std::vector<int>(); }) == cpus);
+}
+
+TEST_CASE("command_list", "[command_list]") {
+  softgl::InitSoftGL();
+
+  GLuint program = CreateComputeProgram(
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(location = 0) uniform float scale;\n"
+      "layout(std430, binding = 0) buffer Data { float data[]; };\n"
+      "void main() {\n"
+      "  data[gl_GlobalInvocationID.x] += scale;\n"
+      "}\n");
+  REQUIRE(program > 0);
+
+  const size_t n = 64;
+  std::vector<float> values(n, 1.0f);
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(n * sizeof(float)),
+               values.data(), GL_DYNAMIC_DRAW);
+
+  GLuint list = softgl::CreateCommandList();
+  REQUIRE(list > 0);
+
+  softgl::BeginCommandList(list);
+  glUseProgram(program);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+  glUniform1f(0, 2.0f);
+  glDispatchCompute(GLuint(n / 16), 1, 1);
+  softgl::EndCommandList();
+
+  // Recording does not execute.
+  glFinish();
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     GLsizeiptr(n * sizeof(float)), values.data());
+  REQUIRE(values[0] == 1.0f);
+
+  // The recorded uniform value is used, not the current one.
+  glUniform1f(0, 100.0f);
+  softgl::CallCommandList(list);
+  softgl::CallCommandList(list);
+  glFinish();
+
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     GLsizeiptr(n * sizeof(float)), values.data());
+  for (size_t i = 0; i < n; i++) {
+    REQUIRE(values[i] == 5.0f);
+  }
+
+  // Nothing runs once the program is deleted.
+  glDeleteProgram(program);
+  softgl::CallCommandList(list);
+  glFinish();
+
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     GLsizeiptr(n * sizeof(float)), values.data());
+  REQUIRE(values[0] == 5.0f);
+
+  softgl::DeleteCommandList(list);
+  glDeleteBuffers(1, &buffer);
+
+  softgl::ReleaseSoftGL();
+}
+
+// Records `first` and then `second` into a command list, each dispatched over
+// `n` invocations with buffers `a`, `b` and `c` at bindings 0, 1 and 2, runs
+// it, and returns the number of dispatches it ran as, e.g. 1 when fused.
+static GLsizei RunCommandListPair(GLuint first, GLuint second, size_t n,
+                                  GLuint a, GLuint b, GLuint c) {
+  GLuint list = softgl::CreateCommandList();
+
+  softgl::BeginCommandList(list);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, a);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, b);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, c);
+  glUseProgram(first);
+  glDispatchCompute(GLuint(n / 16), 1, 1);
+  glUseProgram(second);
+  glDispatchCompute(GLuint(n / 16), 1, 1);
+  softgl::EndCommandList();
+
+  softgl::DispatchStats stats[4];
+  softgl::GetDispatchStats(stats, 4);
+
+  softgl::CallCommandList(list);
+  glFinish();
+  softgl::DeleteCommandList(list);
+
+  return softgl::GetDispatchStats(stats, 4);
+}
+
+// Buffer of `n` floats counting up from 0.
+static GLuint CreateFloatBuffer(size_t n) {
+  std::vector<float> values(n);
+  for (size_t i = 0; i < n; i++) {
+    values[i] = float(i);
+  }
+
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(n * sizeof(float)),
+               values.data(), GL_DYNAMIC_DRAW);
+  return buffer;
+}
+
+static std::vector<float> ReadFloatBuffer(GLuint buffer, size_t n) {
+  std::vector<float> values(n);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     GLsizeiptr(n * sizeof(float)), values.data());
+  return values;
+}
+
+TEST_CASE("command_list_fusion", "[command_list]") {
+  softgl::InitSoftGL();
+
+  const char *kBuffers =
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(std430, binding = 0) buffer A { float a[]; };\n"
+      "layout(std430, binding = 1) buffer B { float b[]; };\n"
+      "layout(std430, binding = 2) buffer C { float c[]; };\n";
+  const std::string prefix = kBuffers;
+
+  GLuint scale = CreateComputeProgram(
+      (prefix + "void main() {\n"
+                "  uint i = gl_GlobalInvocationID.x;\n"
+                "  b[i] = a[i] * 2.0;\n"
+                "}\n")
+          .c_str());
+  GLuint add = CreateComputeProgram(
+      (prefix + "void main() {\n"
+                "  uint i = gl_GlobalInvocationID.x;\n"
+                "  c[i] = b[i] + 1.0;\n"
+                "}\n")
+          .c_str());
+  // Reads elements other invocations of `scale` write.
+  GLuint reverse = CreateComputeProgram(
+      (prefix + "void main() {\n"
+                "  uint i = gl_GlobalInvocationID.x;\n"
+                "  c[i] = b[gl_NumWorkGroups.x * 16u - 1u - i];\n"
+                "}\n")
+          .c_str());
+  // Uses a barrier, so its workgroups cannot be split into blocks.
+  GLuint shared_add = CreateComputeProgram(
+      (prefix + "shared float s[16];\n"
+                "void main() {\n"
+                "  uint i = gl_GlobalInvocationID.x;\n"
+                "  s[gl_LocalInvocationID.x] = b[i];\n"
+                "  barrier();\n"
+                "  c[i] = s[gl_LocalInvocationID.x] + 1.0;\n"
+                "}\n")
+          .c_str());
+  // Same as `reverse`, with the index changed through an `inout` parameter.
+  GLuint inout_reverse = CreateComputeProgram(
+      (prefix + "void Mirror(inout uint i) {\n"
+                "  i = gl_NumWorkGroups.x * 16u - 1u - i;\n"
+                "}\n"
+                "void main() {\n"
+                "  uint i = gl_GlobalInvocationID.x;\n"
+                "  uint j = i;\n"
+                "  Mirror(j);\n"
+                "  c[i] = b[j];\n"
+                "}\n")
+          .c_str());
+  REQUIRE(scale > 0);
+  REQUIRE(add > 0);
+  REQUIRE(reverse > 0);
+  REQUIRE(shared_add > 0);
+  REQUIRE(inout_reverse > 0);
+
+  const size_t n = 4096;
+  GLuint a = CreateFloatBuffer(n);
+  GLuint b = CreateFloatBuffer(n);
+  GLuint c = CreateFloatBuffer(n);
+
+  // Elementwise stages are fused.
+  {
+    REQUIRE(RunCommandListPair(scale, add, n, a, b, c) == 1);
+
+    const std::vector<float> values = ReadFloatBuffer(c, n);
+    for (size_t i = 0; i < n; i++) {
+      REQUIRE(values[i] == float(i) * 2.0f + 1.0f);
+    }
+  }
+
+  // Stages reading elements other invocations wrote are not.
+  {
+    REQUIRE(RunCommandListPair(scale, reverse, n, a, b, c) == 2);
+
+    const std::vector<float> values = ReadFloatBuffer(c, n);
+    for (size_t i = 0; i < n; i++) {
+      REQUIRE(values[i] == float(n - 1 - i) * 2.0f);
+    }
+  }
+
+  // Also when the index is written through a function's `inout` parameter.
+  {
+    REQUIRE(RunCommandListPair(scale, inout_reverse, n, a, b, c) == 2);
+
+    const std::vector<float> values = ReadFloatBuffer(c, n);
+    for (size_t i = 0; i < n; i++) {
+      REQUIRE(values[i] == float(n - 1 - i) * 2.0f);
+    }
+  }
+
+  // Nor are stages with barriers.
+  {
+    REQUIRE(RunCommandListPair(scale, shared_add, n, a, b, c) == 2);
+
+    const std::vector<float> values = ReadFloatBuffer(c, n);
+    for (size_t i = 0; i < n; i++) {
+      REQUIRE(values[i] == float(i) * 2.0f + 1.0f);
+    }
+  }
+
+  glDeleteBuffers(1, &a);
+  glDeleteBuffers(1, &b);
+  glDeleteBuffers(1, &c);
+  glDeleteProgram(scale);
+  glDeleteProgram(add);
+  glDeleteProgram(reverse);
+  glDeleteProgram(shared_add);
+  glDeleteProgram(inout_reverse);
+
+  softgl::ReleaseSoftGL();
+}
+
+// Dispatches without barriers between them are still ordered when they access
+// the same buffer and one of them writes it.
+TEST_CASE("dispatch_hazards", "[scheduler]") {
+  softgl::InitSoftGL();
+
+  GLuint copy = CreateComputeProgram(
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(std430, binding = 0) buffer A { float a[]; };\n"
+      "layout(std430, binding = 1) buffer B { float b[]; };\n"
+      "void main() {\n"
+      "  uint i = gl_GlobalInvocationID.x;\n"
+      "  b[i] = a[i] + 1.0;\n"
+      "}\n");
+  GLuint fill = CreateComputeProgram(
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(location = 0) uniform float value;\n"
+      "layout(std430, binding = 0) buffer A { float a[]; };\n"
+      "void main() {\n"
+      "  a[gl_GlobalInvocationID.x] = value;\n"
+      "}\n");
+  REQUIRE(copy > 0);
+  REQUIRE(fill > 0);
+
+  const size_t n = 1 << 16;
+  GLuint x = CreateFloatBuffer(n);
+  GLuint y = CreateFloatBuffer(n);
+  GLuint z = CreateFloatBuffer(n);
+
+  // Read after write: y = x + 1, then z = y + 1.
+  {
+    glUseProgram(copy);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, x);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, y);
+    glDispatchCompute(GLuint(n / 16), 1, 1);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, y);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, z);
+    glDispatchCompute(GLuint(n / 16), 1, 1);
+    glFinish();
+
+    const std::vector<float> values = ReadFloatBuffer(z, n);
+    for (size_t i = 0; i < n; i++) {
+      REQUIRE(values[i] == float(i) + 2.0f);
+    }
+  }
+
+  // Write after read: y = x + 1, then x = -1.
+  {
+    glUseProgram(copy);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, x);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, y);
+    glDispatchCompute(GLuint(n / 16), 1, 1);
+    glUseProgram(fill);
+    glUniform1f(0, -1.0f);
+    glDispatchCompute(GLuint(n / 16), 1, 1);
+    glFinish();
+
+    const std::vector<float> values = ReadFloatBuffer(y, n);
+    for (size_t i = 0; i < n; i++) {
+      REQUIRE(values[i] == float(i) + 1.0f);
+    }
+    REQUIRE(ReadFloatBuffer(x, n)[n - 1] == -1.0f);
+  }
+
+  // Write after write: y = x + 1, then y = 7.
+  {
+    glUseProgram(copy);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, x);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, y);
+    glDispatchCompute(GLuint(n / 16), 1, 1);
+    glUseProgram(fill);
+    glUniform1f(0, 7.0f);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, y);
+    glDispatchCompute(GLuint(n / 16), 1, 1);
+    glFinish();
+
+    const std::vector<float> values = ReadFloatBuffer(y, n);
+    for (size_t i = 0; i < n; i++) {
+      REQUIRE(values[i] == 7.0f);
+    }
+  }
+
+  glDeleteBuffers(1, &x);
+  glDeleteBuffers(1, &y);
+  glDeleteBuffers(1, &z);
+  glDeleteProgram(copy);
+  glDeleteProgram(fill);
+
+  softgl::ReleaseSoftGL();
+}
+
+// Deleting a program right after its dispatches finished, and linking a new
+// one into the reused name, must not leave its shader contexts to be
+// destructed later by a worker.
+TEST_CASE("program_relink", "[program]") {
+  softgl::InitSoftGL();
+
+  const char *source =
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(std430, binding = 0) buffer Data { float data[]; };\n"
+      "void main() {\n"
+      "  data[gl_GlobalInvocationID.x] += 1.0;\n"
+      "}\n";
+
+  const size_t n = 1024;
+  GLuint buffer = CreateFloatBuffer(n);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+
+  for (int i = 0; i < 4; i++) {
+    GLuint program = CreateComputeProgram(source);
+    REQUIRE(program > 0);
+
+    glUseProgram(program);
+    glDispatchCompute(GLuint(n / 16), 1, 1);
+    glFinish();
+    glDeleteProgram(program);
+  }
+
+  const std::vector<float> values = ReadFloatBuffer(buffer, n);
+  for (size_t i = 0; i < n; i++) {
+    REQUIRE(values[i] == float(i) + 4.0f);
+  }
+
+  glDeleteBuffers(1, &buffer);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("dispatch_stats", "[scheduler]") {
+  softgl::InitSoftGL();
+
+  GLuint program = CreateComputeProgram(
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(std430, binding = 0) buffer Data { float data[]; };\n"
+      "void main() {\n"
+      "  data[gl_GlobalInvocationID.x] = 1.0;\n"
+      "}\n");
+  REQUIRE(program > 0);
+
+  GLuint buffer = CreateFloatBuffer(1024);
+  glUseProgram(program);
+
+  softgl::DispatchStats stats[4];
+  softgl::GetDispatchStats(stats, 4);
+
+  // Only the bound range counts.
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, buffer, 256, 64);
+  glDispatchCompute(1, 1, 1);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+  glDispatchCompute(1, 1, 1);
+  glFinish();
+
+  REQUIRE(softgl::GetDispatchStats(stats, 4) == 2);
+  REQUIRE(stats[0].bytes_bound == 64);
+  REQUIRE(stats[0].num_workgroups == 1);
+  REQUIRE(stats[1].bytes_bound == 1024 * sizeof(float));
+
+  glDeleteBuffers(1, &buffer);
+  glDeleteProgram(program);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("uniforms", "[program]") {
+  softgl::InitSoftGL();
+
+  GLuint program = CreateComputeProgram(
+      "#version 430\n"
+      "layout(local_size_x = 1) in;\n"
+      "layout(location = 0) uniform float f;\n"
+      "layout(location = 1) uniform vec3 v;\n"
+      "layout(location = 2) uniform int i;\n"
+      "layout(location = 3) uniform uvec2 u;\n"
+      "layout(std430, binding = 0) buffer Data { float data[]; };\n"
+      "void main() {\n"
+      "  data[0] = f;\n"
+      "  data[1] = v.x; data[2] = v.y; data[3] = v.z;\n"
+      "  data[4] = float(i);\n"
+      "  data[5] = float(u.x); data[6] = float(u.y);\n"
+      "}\n");
+  REQUIRE(program > 0);
+
+  GLint size = 0;
+  GLenum type = 0;
+  glGetActiveUniform(program, 1, 0, nullptr, &size, &type, nullptr);
+  REQUIRE(type == GLenum(GL_FLOAT_VEC3));
+  REQUIRE(size == 1);
+  glGetActiveUniform(program, 3, 0, nullptr, &size, &type, nullptr);
+  REQUIRE(type == GLenum(GL_UNSIGNED_INT_VEC2));
+
+  const size_t n = 7;
+  std::vector<float> values(n, 0.0f);
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(n * sizeof(float)),
+               values.data(), GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+
+  glUseProgram(program);
+  glUniform1f(0, 1.5f);
+  glUniform3f(1, 2.0f, 3.0f, 4.0f);
+  glUniform1i(2, -5);
+  glUniform2ui(3, 6, 7);
+
+  // Each is of the wrong type or count and keeps the value.
+  glUniform1i(0, 100);
+  glUniform2f(1, 100.0f, 100.0f);
+  glUniform1f(2, 100.0f);
+  glUniform2i(3, 100, 100);
+
+  glDispatchCompute(1, 1, 1);
+  glFinish();
+
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     GLsizeiptr(n * sizeof(float)), values.data());
+  const float expected[n] = {1.5f, 2.0f, 3.0f, 4.0f, -5.0f, 6.0f, 7.0f};
+  for (size_t k = 0; k < n; k++) {
+    REQUIRE(values[k] == expected[k]);
+  }
+
+  glDeleteBuffers(1, &buffer);
+  glDeleteProgram(program);
+
+  // Two uniforms at one location do not link.
+  REQUIRE(CreateComputeProgram(
+              "#version 430\n"
+              "layout(local_size_x = 1) in;\n"
+              "layout(location = 0) uniform float a;\n"
+              "layout(location = 0) uniform float b;\n"
+              "layout(std430, binding = 0) buffer Data { float data[]; };\n"
+              "void main() { data[0] = a + b; }\n") == 0);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("block_binding", "[program]") {
+  softgl::InitSoftGL();
+
+  GLuint program = CreateComputeProgram(
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(std430, binding = 0) readonly buffer Src { float src[]; };\n"
+      "layout(std430, binding = 1) buffer Dst { float dst[]; };\n"
+      "layout(std140, binding = 2) uniform Params { float offset; };\n"
+      "void main() {\n"
+      "  uint i = gl_GlobalInvocationID.x;\n"
+      "  dst[i] = src[i] + offset;\n"
+      "}\n");
+  REQUIRE(program > 0);
+
+  const GLuint src_index =
+      glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "Src");
+  const GLuint dst_index =
+      glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "Dst");
+  REQUIRE(src_index != GL_INVALID_INDEX);
+  REQUIRE(dst_index != GL_INVALID_INDEX);
+  REQUIRE(src_index != dst_index);
+  REQUIRE(glGetProgramResourceIndex(program, GL_UNIFORM_BLOCK, "Params") !=
+          GL_INVALID_INDEX);
+  REQUIRE(glGetUniformBlockIndex(program, "Params") ==
+          glGetProgramResourceIndex(program, GL_UNIFORM_BLOCK, "Params"));
+
+  // Unknown names, blocks of the other interface, unknown interfaces and
+  // programs.
+  REQUIRE(glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK,
+                                    "Missing") == GL_INVALID_INDEX);
+  REQUIRE(glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK,
+                                    "Params") == GL_INVALID_INDEX);
+  REQUIRE(glGetProgramResourceIndex(program, GL_UNIFORM_BLOCK, "Src") ==
+          GL_INVALID_INDEX);
+  REQUIRE(glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BUFFER,
+                                    "Src") == GL_INVALID_INDEX);
+  REQUIRE(glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK,
+                                    nullptr) == GL_INVALID_INDEX);
+  REQUIRE(glGetProgramResourceIndex(program + 1000, GL_SHADER_STORAGE_BLOCK,
+                                    "Src") == GL_INVALID_INDEX);
+
+  const size_t n = 64;
+  GLuint src = CreateFloatBuffer(n);
+  GLuint old_dst = CreateFloatBuffer(n);
+  GLuint new_dst = CreateFloatBuffer(n);
+
+  const float offset[4] = {10.0f, 0.0f, 0.0f, 0.0f};
+  GLuint params;
+  glGenBuffers(1, &params);
+  glBindBuffer(GL_UNIFORM_BUFFER, params);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(offset), offset, GL_STATIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, 2, params);
+
+  // Dst moves from binding 1 to 3. Out of range indices change nothing.
+  glShaderStorageBlockBinding(program, dst_index, 3);
+  glShaderStorageBlockBinding(program, 2, 1);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, src);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, old_dst);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, new_dst);
+
+  glUseProgram(program);
+  glDispatchCompute(GLuint(n / 16), 1, 1);
+  glFinish();
+
+  const std::vector<float> old_values = ReadFloatBuffer(old_dst, n);
+  const std::vector<float> new_values = ReadFloatBuffer(new_dst, n);
+  for (size_t i = 0; i < n; i++) {
+    REQUIRE(old_values[i] == float(i));
+    REQUIRE(new_values[i] == float(i) + 10.0f);
+  }
+
+  glDeleteBuffers(1, &src);
+  glDeleteBuffers(1, &old_dst);
+  glDeleteBuffers(1, &new_dst);
+  glDeleteBuffers(1, &params);
+  glDeleteProgram(program);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("trace", "[trace]") {
+  softgl::InitSoftGL();
+
+  const char *filename = "softcompute_test_trace.json";
+  softgl::EnableTracing(filename);
+
+  GLuint program = CreateComputeProgram(
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(std430, binding = 0) buffer Data { float data[]; };\n"
+      "void main() {\n"
+      "  data[gl_GlobalInvocationID.x] += 1.0;\n"
+      "}\n");
+  REQUIRE(program > 0);
+
+  const size_t n = 4096;
+  GLuint buffer = CreateFloatBuffer(n);
+  glUseProgram(program);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+  const int num_dispatches = 3;
+  for (int i = 0; i < num_dispatches; i++) {
+    glDispatchCompute(GLuint(n / 16), 1, 1);
+  }
+  glFinish();
+
+  glDeleteBuffers(1, &buffer);
+  glDeleteProgram(program);
+
+  // Writes the trace.
+  softgl::ReleaseSoftGL();
+
+  const std::vector<uint8_t> data = TakeFile(filename);
+  const nlohmann::json trace = nlohmann::json::parse(
+      data.begin(), data.end(), nullptr, /* allow_exceptions */ false);
+  REQUIRE(!trace.is_discarded());
+  REQUIRE(trace.contains("traceEvents"));
+
+  const nlohmann::json &events = trace["traceEvents"];
+  REQUIRE(events.is_array());
+  std::vector<uint64_t> dispatches;
+  size_t num_chunks = 0;
+  bool linked = false;
+  for (size_t i = 0; i < events.size(); i++) {
+    const std::string name = events[i].value("name", "");
+    REQUIRE(events[i].value("ph", "") == "X");
+    if (name == "dispatch") {
+      dispatches.push_back(events[i]["args"]["dispatch"].get<uint64_t>());
+    } else if (name == "workgroups") {
+      num_chunks++;
+    } else if (name == "glLinkProgram") {
+      linked = true;
+    }
+  }
+
+  REQUIRE(linked);
+  REQUIRE(dispatches.size() == size_t(num_dispatches));
+  REQUIRE(num_chunks >= dispatches.size());
+  std::sort(dispatches.begin(), dispatches.end());
+  for (size_t i = 1; i < dispatches.size(); i++) {
+    REQUIRE(dispatches[i] != dispatches[i - 1]);
+  }
+}
+
+TEST_CASE("fence_sync", "[sync]") {
+  softgl::InitSoftGL();
+
+  GLsync sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  REQUIRE(sync != nullptr);
+
+  // No dispatches in flight, so the fence is signaled right away.
+  GLenum ret = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  REQUIRE(ret == GL_ALREADY_SIGNALED);
+
+  REQUIRE(glIsSync(sync) == GL_TRUE);
+  glDeleteSync(sync);
+
+  // Deleted syncs are no longer valid.
+  REQUIRE(glIsSync(sync) == GL_FALSE);
+  REQUIRE(glClientWaitSync(sync, 0, 0) == GL_WAIT_FAILED);
+  REQUIRE(glIsSync(nullptr) == GL_FALSE);
+
+  // A fence issued behind a running dispatch is signaled once it finished.
+  GLuint program = CreateComputeProgram(
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(std430, binding = 0) buffer Data { float data[]; };\n"
+      "void main() {\n"
+      "  float x = data[gl_GlobalInvocationID.x];\n"
+      "  for (int i = 0; i < 1000; i++) {\n"
+      "    x = x * 0.5 + 1.0;\n"
+      "  }\n"
+      "  data[gl_GlobalInvocationID.x] = x;\n"
+      "}\n");
+  REQUIRE(program > 0);
+
+  const size_t n = 1 << 16;
+  GLuint buffer = CreateFloatBuffer(n);
+  glUseProgram(program);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+  glDispatchCompute(GLuint(n / 16), 1, 1);
+
+  sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  REQUIRE(glIsSync(sync) == GL_TRUE);
+  ret = glClientWaitSync(sync, 0, GLuint64(60) * 1000000000);
+  REQUIRE(((ret == GL_CONDITION_SATISFIED) || (ret == GL_ALREADY_SIGNALED)));
+
+  GLint status = 0;
+  glGetSynciv(sync, GL_SYNC_STATUS, 1, nullptr, &status);
+  REQUIRE(status == GL_SIGNALED);
+  glDeleteSync(sync);
+
+  // x converges to 2 for every start value.
+  const std::vector<float> values = ReadFloatBuffer(buffer, n);
+  REQUIRE(values[0] == 2.0f);
+  REQUIRE(values[n - 1] == 2.0f);
+
+  glDeleteBuffers(1, &buffer);
+  glDeleteProgram(program);
+  glFinish();
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("buffer_handles", "[buffer]") {
+  softgl::InitSoftGL();
+
+  GLuint buffers[2];
+  glGenBuffers(2, buffers);
+  REQUIRE(buffers[0] > 0);
+  REQUIRE(buffers[1] > 0);
+  REQUIRE(buffers[0] != buffers[1]);
+
+  glDeleteBuffers(1, &buffers[0]);
+
+  // The name of a deleted buffer is not handed out again as is.
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  REQUIRE(buffer > 0);
+  REQUIRE(buffer != buffers[0]);
+
+  glDeleteBuffers(1, &buffer);
+  glDeleteBuffers(1, &buffers[1]);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("buffer_respecify", "[buffer]") {
+  softgl::InitSoftGL();
+
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+
+  glBufferData(GL_SHADER_STORAGE_BUFFER, 1000, nullptr, GL_DYNAMIC_DRAW);
+  void *p = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_WRITE);
+  REQUIRE(p != nullptr);
+  REQUIRE((reinterpret_cast<uintptr_t>(p) % 64) == 0);
+  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+  // Same size class and no dispatch using it: the block is reused.
+  glBufferData(GL_SHADER_STORAGE_BUFFER, 1000, nullptr, GL_DYNAMIC_DRAW);
+  REQUIRE(glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_WRITE) == p);
+  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+  glDeleteBuffers(1, &buffer);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("buffer_sub_data", "[buffer]") {
+  softgl::InitSoftGL();
+
+  GLuint buffers[2] = {0, 0};
+  glGenBuffers(2, buffers);
+
+  // Large enough to be copied on several threads with streaming stores.
+  const size_t n = size_t(3) << 20;
+  const GLsizeiptr size = static_cast<GLsizeiptr>(n * sizeof(float));
+  std::vector<float> data(64);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<float>(i);
+  }
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+  const float value = 2.5f;
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32F, GL_RED, GL_FLOAT,
+                    &value);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float),
+                  64 * sizeof(float), data.data());
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+  glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32F, 0, size, GL_RED,
+                       GL_FLOAT, nullptr);
+
+  glBindBuffer(GL_COPY_READ_BUFFER, buffers[0]);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                      sizeof(float), size - GLsizeiptr(sizeof(float)));
+
+  std::vector<float> result(n);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, result.data());
+  REQUIRE(result[0] == 0.0f);
+  REQUIRE(result[1] == 2.5f);
+  REQUIRE(result[5] == 0.0f);
+  REQUIRE(result[68] == 63.0f);
+  REQUIRE(result[69] == 2.5f);
+  REQUIRE(result[n - 1] == 2.5f);
+
+  glDeleteBuffers(2, buffers);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("file_backed_buffer", "[buffer]") {
+  softgl::InitSoftGL();
+
+  const char *filename = "softcompute_test_buffer.bin";
+  remove(filename);
+
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+
+  // Writes through to the file.
+  REQUIRE(BufferDataFromFile(GL_SHADER_STORAGE_BUFFER, filename, 16,
+                             GL_READ_WRITE) == GL_TRUE);
+  float *values = static_cast<float *>(
+      glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY));
+  REQUIRE(values != nullptr);
+  values[3] = 4.0f;
+  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+  // Maps the whole file.
+  REQUIRE(BufferDataFromFile(GL_SHADER_STORAGE_BUFFER, filename, 0,
+                             GL_READ_ONLY) == GL_TRUE);
+  REQUIRE(glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_WRITE) == nullptr);
+  values = static_cast<float *>(
+      glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY));
+  REQUIRE(values != nullptr);
+  REQUIRE(values[3] == 4.0f);
+  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+  glDeleteBuffers(1, &buffer);
+  remove(filename);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("tensor_file_buffer", "[buffer]") {
+  softgl::InitSoftGL();
+
+  const char *filename = "softcompute_test_tensor.npy";
+  remove(filename);
+
+  const float data[6] = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f};
+  const GLuint64 shape[2] = {2, 3};
+
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
+  REQUIRE(SaveBufferAsTensorFile(buffer, filename, "<f4", shape, 2) == GL_TRUE);
+
+  // Copy-on-write: writes to the buffer do not reach the file.
+  REQUIRE(BufferDataFromTensorFile(GL_SHADER_STORAGE_BUFFER, filename) ==
+          GL_TRUE);
+  float *values = static_cast<float *>(
+      glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_WRITE));
+  REQUIRE(values != nullptr);
+  REQUIRE(values[5] == 6.0f);
+  values[5] = 0.0f;
+  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+  REQUIRE(BufferDataFromTensorFile(GL_SHADER_STORAGE_BUFFER, filename) ==
+          GL_TRUE);
+  values = static_cast<float *>(
+      glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY));
+  REQUIRE(values != nullptr);
+  REQUIRE(values[5] == 6.0f);
+  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+  // A sidecar with a non-numeric dimension is rejected and the buffer keeps
+  // its storage.
+  const char *raw_filename = "softcompute_test_tensor.raw";
+  {
+    std::ofstream raw(raw_filename, std::ios::binary);
+    raw.write(reinterpret_cast<const char *>(data), sizeof(data));
+    std::ofstream sidecar(std::string(raw_filename) + ".json");
+    sidecar << "{\"dtype\": \"<f4\", \"shape\": [2, \"x\"]}";
+  }
+  REQUIRE(BufferDataFromTensorFile(GL_SHADER_STORAGE_BUFFER, raw_filename) ==
+          GL_FALSE);
+  values = static_cast<float *>(
+      glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY));
+  REQUIRE(values != nullptr);
+  REQUIRE(values[5] == 6.0f);
+  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+  remove(raw_filename);
+  remove((std::string(raw_filename) + ".json").c_str());
+
+  glDeleteBuffers(1, &buffer);
+  remove(filename);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("streaming_dispatch", "[buffer]") {
+  softgl::InitSoftGL();
+
+  const char *kInputs =
+      "#version 430\n"
+      "layout(local_size_x = 16) in;\n"
+      "layout(std430, binding = 0) readonly buffer In { float in_data[]; };\n";
+  const std::string inputs = kInputs;
+
+  GLuint twice = CreateComputeProgram(
+      (inputs +
+       "layout(std430, binding = 1) writeonly buffer Out { float out_data[]; };\n"
+       "void main() {\n"
+       "  uint i = gl_GlobalInvocationID.x;\n"
+       "  out_data[i] = in_data[i] * 2.0;\n"
+       "}\n")
+          .c_str());
+  // Reads its output, which is not read in from the file.
+  GLuint accumulate = CreateComputeProgram(
+      (inputs +
+       "layout(std430, binding = 1) buffer Out { float out_data[]; };\n"
+       "void main() {\n"
+       "  uint i = gl_GlobalInvocationID.x;\n"
+       "  out_data[i] += in_data[i];\n"
+       "}\n")
+          .c_str());
+  // Reads elements of other chunks.
+  GLuint reverse = CreateComputeProgram(
+      (inputs +
+       "layout(std430, binding = 1) writeonly buffer Out { float out_data[]; };\n"
+       "void main() {\n"
+       "  uint i = gl_GlobalInvocationID.x;\n"
+       "  out_data[i] = in_data[gl_NumWorkGroups.x * 16u - 1u - i];\n"
+       "}\n")
+          .c_str());
+  REQUIRE(twice > 0);
+  REQUIRE(accumulate > 0);
+  REQUIRE(reverse > 0);
+
+  // 1000 invocations in chunks of 96: ten full chunks and a partial one,
+  // which is not a whole number of workgroups either.
+  const size_t n = 1000;
+  const char *input = "softcompute_test_stream_in.bin";
+  const char *output = "softcompute_test_stream_out.bin";
+  {
+    std::vector<float> values(n);
+    for (size_t i = 0; i < n; i++) {
+      values[i] = float(i);
+    }
+    std::ofstream ofs(input, std::ios::binary);
+    ofs.write(reinterpret_cast<const char *>(values.data()),
+              std::streamsize(n * sizeof(float)));
+  }
+
+  softgl::StreamBinding bindings[2];
+  memset(bindings, 0, sizeof(bindings));
+  bindings[0].filename = input;
+  bindings[0].binding = 0;
+  bindings[0].output = GL_FALSE;
+  bindings[1].filename = output;
+  bindings[1].binding = 1;
+  bindings[1].output = GL_TRUE;
+
+  glUseProgram(twice);
+  REQUIRE(softgl::DispatchComputeStreaming(bindings, 2, n, 96) == GL_TRUE);
+
+  const std::vector<uint8_t> data = TakeFile(output);
+  REQUIRE(data.size() == n * sizeof(float));
+  std::vector<float> values(n);
+  memcpy(values.data(), data.data(), data.size());
+  for (size_t i = 0; i < n; i++) {
+    REQUIRE(values[i] == float(i) * 2.0f);
+  }
+
+  // An output stream the shader also reads.
+  glUseProgram(accumulate);
+  REQUIRE(softgl::DispatchComputeStreaming(bindings, 2, n, 96) == GL_FALSE);
+
+  // A stream not accessed at the invocation's own index.
+  glUseProgram(reverse);
+  REQUIRE(softgl::DispatchComputeStreaming(bindings, 2, n, 96) == GL_FALSE);
+
+  // An input stream the shader writes.
+  glUseProgram(twice);
+  bindings[0].output = GL_TRUE;
+  bindings[1].output = GL_FALSE;
+  bindings[0].filename = output;
+  bindings[1].filename = input;
+  REQUIRE(softgl::DispatchComputeStreaming(bindings, 2, n, 96) == GL_FALSE);
+
+  // A binding the shader does not have.
+  bindings[0].output = GL_FALSE;
+  bindings[1].output = GL_TRUE;
+  bindings[0].filename = input;
+  bindings[1].filename = output;
+  bindings[1].binding = 5;
+  REQUIRE(softgl::DispatchComputeStreaming(bindings, 2, n, 96) == GL_FALSE);
+
+  std::remove(input);
+  std::remove(output);
+  glDeleteProgram(twice);
+  glDeleteProgram(accumulate);
+  glDeleteProgram(reverse);
+
+  softgl::ReleaseSoftGL();
+}
+
+// Writes `contents` to a file.
+static void WriteTextFile(const char *filename, const std::string &contents) {
+  std::ofstream ofs(filename, std::ios::binary);
+  ofs << contents;
+}
+
+TEST_CASE("job_file", "[job]") {
+  softgl::InitSoftGL();
+
+  const char *jobs = "softcompute_test_jobs.json";
+  const char *output = "softcompute_test_job.bin";
+  WriteTextFile("softcompute_test_job.comp",
+                "#version 430\n"
+                "layout(local_size_x = 4) in;\n"
+                "layout(location = 0) uniform float scale;\n"
+                "layout(std430, binding = 0) buffer Src { float src[]; };\n"
+                "layout(std430, binding = 1) buffer Dst { float dst[]; };\n"
+                "void main() {\n"
+                "  uint i = gl_GlobalInvocationID.x;\n"
+                "  dst[i] = src[i] * scale;\n"
+                "}\n");
+  WriteTextFile("softcompute_test_job_error.comp",
+                "#version 430\nvoid main() { undeclared = 1; }\n");
+
+  // Files without a "jobs" array count as one failure.
+  remove(jobs);
+  REQUIRE(softcompute::RunJobFile(jobs) == 1);
+  WriteTextFile(jobs, "{\"jobs\": [");
+  REQUIRE(softcompute::RunJobFile(jobs) == 1);
+  WriteTextFile(jobs, "{\"job\": []}");
+  REQUIRE(softcompute::RunJobFile(jobs) == 1);
+
+  // Every job but the first fails: a missing or non-string shader, a shader
+  // which does not compile or exist, a non-numeric buffer value, a missing
+  // tensor file and an unknown uniform. The later ones fail after creating
+  // buffers.
+  const std::string buffers =
+      "\"buffers\": [{\"binding\": 0, \"data\": [1, 2, 3, 4]},"
+      "{\"binding\": 1, \"size\": 16, \"output\": \"" +
+      std::string(output) + "\"}]";
+  WriteTextFile(
+      jobs,
+      "{\"jobs\": ["
+      "{\"shader\": \"softcompute_test_job.comp\", " + buffers +
+          ", \"uniforms\": {\"scale\": 2.0}},"
+      "{" + buffers + "},"
+      "{\"shader\": 3, " + buffers + "},"
+      "{\"shader\": \"softcompute_test_job_error.comp\"},"
+      "{\"shader\": \"softcompute_test_job_missing.comp\"},"
+      "{\"shader\": \"softcompute_test_job.comp\","
+      " \"buffers\": [{\"binding\": 0, \"data\": [1, \"x\"]}]},"
+      "{\"shader\": \"softcompute_test_job.comp\","
+      " \"buffers\": [{\"binding\": 0, \"size\": 16},"
+      " {\"binding\": 1, \"tensor\": \"softcompute_test_job_missing.npy\"}]},"
+      "{\"shader\": \"softcompute_test_job.comp\", " + buffers +
+          ", \"uniforms\": {\"missing\": 1.0}}]}");
+  REQUIRE(softcompute::RunJobFile(jobs) == 7);
+
+  const std::vector<uint8_t> data = TakeFile(output);
+  REQUIRE(data.size() == 4 * sizeof(float));
+  float values[4];
+  memcpy(values, data.data(), sizeof(values));
+  REQUIRE(values[0] == 2.0f);
+  REQUIRE(values[3] == 8.0f);
+
+  // Nothing of the jobs is left. They hold at most two buffers, one shader
+  // and one program at a time, so without leaks no further slots were ever
+  // created and new objects reuse the released ones.
+  typedef softcompute::SlotMap<int> Names;
+  GLuint names[2];
+  glGenBuffers(2, names);
+  REQUIRE(Names::Index(names[0]) < 2);
+  REQUIRE(Names::Index(names[1]) < 2);
+  glDeleteBuffers(2, names);
+
+  GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+  REQUIRE(Names::Index(shader) == 0);
+  glDeleteShader(shader);
+
+  GLuint program = glCreateProgram();
+  REQUIRE(Names::Index(program) == 0);
+  glDeleteProgram(program);
+
+  remove(jobs);
+  remove("softcompute_test_job.comp");
+  remove("softcompute_test_job_error.comp");
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("timer_query", "[query]") {
+  softgl::InitSoftGL();
+
+  GLuint queries[2];
+  glGenQueries(2, queries);
+
+  glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+  glEndQuery(GL_TIME_ELAPSED);
+  glQueryCounter(queries[1], GL_TIMESTAMP);
+
+  GLuint64 elapsed = GL_TIMEOUT_IGNORED;
+  glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &elapsed);
+  REQUIRE(elapsed < 1000000000ull);
+  REQUIRE(glIsQuery(queries[0]) == GL_TRUE);
+
+  GLuint64 timestamp = 0;
+  glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &timestamp);
+  REQUIRE(timestamp > 0);
+
+  // No dispatches were issued.
+  DispatchStats stats[4];
+  REQUIRE(softgl::GetDispatchStats(stats, 4) == 0);
+
+  glDeleteQueries(2, queries);
+
+  softgl::ReleaseSoftGL();
+}
+
+TEST_CASE("bench_stats", "[bench]") {
+  REQUIRE(softcompute::Median({3.0, 1.0, 2.0}) == 2.0);
+  REQUIRE(softcompute::Median({4.0, 1.0, 3.0, 2.0}) == 2.5);
+
+  std::vector<double> a;
+  std::vector<double> b;
+  for (int i = 1; i <= 8; i++) {
+    a.push_back(double(i));
+    b.push_back(double(i + 10));
+  }
+
+  // U = 64 against a mean of 32 and a variance of 64 / 12 * 17.
+  const double p = softcompute::MannWhitneyGreater(a, b);
+  REQUIRE(p > 0.00046);
+  REQUIRE(p < 0.00048);
+  REQUIRE(softcompute::MannWhitneyGreater(b, a) > 0.99);
+
+  // Same samples are not larger, and without spread there is no test.
+  REQUIRE(softcompute::MannWhitneyGreater(a, a) > 0.5);
+  REQUIRE(softcompute::MannWhitneyGreater({1.0, 1.0, 1.0}, {1.0, 1.0}) == 1.0);
+  REQUIRE(softcompute::MannWhitneyGreater(a, std::vector<double>()) == 1.0);
+}
+
+TEST_CASE("image_file", "[image]") {
+  // Bottom row first.
+  const float pixels[12] = {0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f,
+                            1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f};
+
+  // PFM keeps the rows and floats as they are.
+  REQUIRE(softcompute::WriteImage("test-image.pfm", pixels, 2, 2, 3, nullptr));
+  std::vector<uint8_t> pfm = TakeFile("test-image.pfm");
+  const char pfm_header[] = "PF\n2 2\n-1.0\n";
+  const size_t pfm_header_size = sizeof(pfm_header) - 1;
+  REQUIRE(pfm.size() == pfm_header_size + sizeof(pixels));
+  REQUIRE(memcmp(pfm.data(), pfm_header, pfm_header_size) == 0);
+  REQUIRE(memcmp(pfm.data() + pfm_header_size, pixels, sizeof(pixels)) == 0);
+
+  // Gray-alpha PFM is grayscale.
+  REQUIRE(softcompute::WriteImage("test-image.pfm", pixels, 3, 2, 2, nullptr));
+  pfm = TakeFile("test-image.pfm");
+  const char pf_header[] = "Pf\n3 2\n-1.0\n";
+  const size_t pf_header_size = sizeof(pf_header) - 1;
+  REQUIRE(pfm.size() == pf_header_size + 6 * sizeof(float));
+  REQUIRE(memcmp(pfm.data(), pf_header, pf_header_size) == 0);
+  float gray_values[6];
+  memcpy(gray_values, pfm.data() + pf_header_size, sizeof(gray_values));
+  for (size_t i = 0; i < 6; i++) {
+    REQUIRE(gray_values[i] == pixels[i * 2]);
+  }
+
+  // EXR has the top row first, with planar B, G, R lines.
+  REQUIRE(softcompute::WriteImage("test-image.exr", pixels, 2, 2, 3, nullptr));
+  std::vector<uint8_t> exr = TakeFile("test-image.exr");
+  const size_t block_size = 8 + 2 * 3 * sizeof(float);
+  REQUIRE(exr.size() > 16 + 2 * block_size);
+  const uint8_t exr_magic[4] = {0x76, 0x2f, 0x31, 0x01};
+  REQUIRE(memcmp(exr.data(), exr_magic, 4) == 0);
+
+  uint64_t first_block = 0;
+  memcpy(&first_block, &exr[exr.size() - 2 * block_size - 16], 8);
+  REQUIRE(first_block == exr.size() - 2 * block_size);
+
+  int32_t line[2];
+  float bgr[6];
+  memcpy(line, &exr[size_t(first_block)], 8);
+  memcpy(bgr, &exr[size_t(first_block) + 8], sizeof(bgr));
+  REQUIRE(line[0] == 0);
+  REQUIRE(line[1] == int32_t(sizeof(bgr)));
+  const float expected_bgr[6] = {3.0f, 6.0f, 2.0f, 5.0f, 1.0f, 4.0f};
+  REQUIRE(memcmp(bgr, expected_bgr, sizeof(bgr)) == 0);
+
+  // PNG is clamped and flipped to top row first.
+  const float gray[2] = {0.0f, 2.0f};
+  uint8_t quantized[2];
+  softcompute::QuantizeImage(gray, 1, 2, 1, 1, nullptr, quantized);
+  REQUIRE(quantized[0] == 255);
+  REQUIRE(quantized[1] == 0);
+
+  // Alpha of gray-alpha and RGBA is linear, colour gamma encoded.
+  const float gray_alpha[2] = {0.5f, 0.5f};
+  uint8_t quantized_gray_alpha[2];
+  softcompute::QuantizeImage(gray_alpha, 1, 1, 2, 2, nullptr,
+                             quantized_gray_alpha);
+  REQUIRE(quantized_gray_alpha[0] > 128);
+  REQUIRE(quantized_gray_alpha[1] == 128);
+
+  const float rgba[4] = {0.5f, 0.5f, 0.5f, 0.5f};
+  uint8_t quantized_rgba[4];
+  softcompute::QuantizeImage(rgba, 1, 1, 4, 4, nullptr, quantized_rgba);
+  REQUIRE(quantized_rgba[2] == quantized_gray_alpha[0]);
+  REQUIRE(quantized_rgba[3] == 128);
+
+  REQUIRE(softcompute::WriteImage("test-image.png", pixels, 2, 2, 3, nullptr));
+  std::vector<uint8_t> png = TakeFile("test-image.png");
+  const uint8_t png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  REQUIRE(png.size() > 8);
+  REQUIRE(memcmp(png.data(), png_signature, 8) == 0);
+
+  REQUIRE(!softcompute::WriteImage("test-image.xyz", pixels, 2, 2, 3, nullptr));
+  REQUIRE(TakeFile("test-image.xyz").empty());
+
+  // Heatmaps go through WriteImage() too.
+  std::vector<uint64_t> costs;
+  costs.push_back(1);
+  costs.push_back(2);
+  REQUIRE(softcompute::WriteHeatmap("test-heatmap", costs, 2, 1));
+  std::vector<uint8_t> csv = TakeFile("test-heatmap.csv");
+  REQUIRE(std::string(csv.begin(), csv.end()) == "1,2\n");
+  png = TakeFile("test-heatmap.png");
+  REQUIRE(png.size() > 8);
+  REQUIRE(memcmp(png.data(), png_signature, 8) == 0);
+}